@@ -63,6 +63,7 @@
 #include "bacon-video-widget.h"
 #include "bacon-video-widget-enums.h"
 #include "bacon-video-widget-resources.h"
+#include "bvw-preview.h"
 
 #include "gst-bt/gst_bt_demux.hpp"
 
@@ -75,11 +76,20 @@
 #define MAX_NETWORK_SPEED 10752
 #define BUFFERING_LEFT_RATIO 1.1
 
+/* Buffering watermarks in milliseconds of media ahead of the playback position,
+ * pause when btdemux is refilling and less than LOW was pushed downstream,
+ * resume once it has refilled and HIGH is available, or after MAX_WAIT anyway */
+#define BUFFERING_LOW_WATERMARK 2000
+#define BUFFERING_HIGH_WATERMARK 8000
+#define BUFFERING_MAX_WAIT 3000
+#define BUFFERING_CHECK_INTERVAL 250
+
 /* Helper constants */
 #define NANOSECS_IN_SEC 1000000000
 #define SEEK_TIMEOUT NANOSECS_IN_SEC / 10
 #define FORWARD_RATE 1.0
 #define REVERSE_RATE -1.0
+#define DEFAULT_HOTSPOT_SHARE 20               /* percent of the downloads */
 #define DIRECTION_STR (forward == FALSE ? "reverse" : "forward")
 
 #define BVW_TRACK_NONE -2
@@ -143,6 +153,9 @@ enum
   PROP_SHOW_CURSOR,
   PROP_CUR_AUDIO_TAGS,
   PROP_CUR_VIDEO_TAGS,
+  PROP_SNAP_TOLERANCE,
+  PROP_HOTSPOT_COUNT,
+  PROP_HOTSPOT_SHARE,
 
 };
 
@@ -199,6 +212,12 @@ struct _BaconVideoWidget
   guint                        update_id;
   guint                        ppi_id;
 
+  /* what the timeouts would run at full telemetry level, the level may
+   * slow them down or hold them off */
+  BvwTelemetryLevel            telemetry_level;
+  gboolean                     tick_wanted;
+  gboolean                     ppi_wanted;
+
 
   gboolean                     media_has_video;
   gboolean                     media_has_unsupported_video;
@@ -234,6 +253,10 @@ struct _BaconVideoWidget
   /* Visual effects */
   GstElement                  *audio_capsfilter;
   GstElement                  *audio_pitchcontrol;
+  /* scaletempo, with an audioconvert in front for the formats it can't take, is only
+   * linked in after the capsfilter while the rate is not 1.0 */
+  GstElement                  *audio_pitch_convert;
+  gint                         pitch_control_wanted;
 
   /* Other stuff */
   gdouble                      volume;
@@ -258,6 +281,26 @@ struct _BaconVideoWidget
   GstClock                     *clock;
   GstClockTime                 seek_req_time;
   gint64                       seek_time;
+  /* applies the queued seek_time SEEK_TIMEOUT after it was queued, without
+   * waiting for the ASYNC_DONE of a seek which may be buffering */
+  guint                        seek_timeout_id;
+  /* non-accurate seeks may move by up to this many milliseconds to land
+   * on a window btdemux already has, 0 = never */
+  gint                         snap_tolerance;
+  /* background prefetch of the likely seek targets, handed to btdemux: how many
+   * evenly spaced positions, its percent of the downloads, and the skips (gint64 ms)
+   * the user does from the playhead */
+  gint                         hotspot_count;
+  gint                         hotspot_share;
+  GArray                      *skip_offsets;
+
+  /* seek bar thumbnails, created on first use */
+  BvwPreview                  *preview;
+
+  /* A-B loop in milliseconds, loop_stop is -1 when there is none: played with
+   * segment seeks, the next one queued on each SEGMENT_DONE */
+  gint64                       loop_start;
+  gint64                       loop_stop;
 
 
   /* state we want to be in, as opposed to actual pipeline state
@@ -265,8 +308,18 @@ struct _BaconVideoWidget
   GstState                     target_state;
   
 
+  /* pipeline held in PAUSED until btdemux has refilled */
   gboolean                     buffering;
 
+  /* latest buffering message from btdemux, percent is 100 when not refilling,
+   * the byte offsets are within the file, 0 when unknown */
+  gint                         buffering_percent;
+  gint64                       buffering_stream_size;
+  gint64                       buffering_pushed_until;
+  gint64                       buffering_available_until;
+  gint64                       buffering_done_time;
+  guint                        buffering_check_id;
+
 
   /* for missing codecs handling */
   GList                       *missing_plugins;   /* GList of GstMessages */
@@ -299,9 +352,13 @@ static void bacon_video_widget_get_property (GObject * object,
 static void bacon_video_widget_finalize (GObject * object);
 
 static void bvw_reconfigure_ppi_timeout (BaconVideoWidget *bvw, guint msecs);
+static guint bvw_ppi_interval (BaconVideoWidget *bvw);
 static void bvw_stop_play_pipeline (BaconVideoWidget * bvw);
 static GError* bvw_error_from_gst_error (BaconVideoWidget *bvw, GstMessage *m);
 static gboolean bvw_set_playback_direction (BaconVideoWidget *bvw, gboolean forward);
+static void bvw_update_pitch_control (BaconVideoWidget *bvw);
+static void bvw_update_hotspots (BaconVideoWidget *bvw);
+static gboolean bvw_loop_seek (BaconVideoWidget *bvw, gboolean flush);
 static gboolean bacon_video_widget_seek_time_no_lock (BaconVideoWidget *bvw,
 						      gint64 _time,
 						      GstSeekFlags flag,
@@ -703,6 +760,45 @@ bacon_video_widget_class_init (BaconVideoWidgetClass * klass)
                                                          G_PARAM_READWRITE |
                                                          G_PARAM_STATIC_STRINGS));
 
+  /**
+   * BaconVideoWidget:snap-tolerance:
+   *
+   * How far, in milliseconds, a non-accurate seek may be moved to a position
+   * whose pieces are already downloaded, 0 to seek exactly where asked.
+   **/
+  g_object_class_install_property (object_class, PROP_SNAP_TOLERANCE,
+                                   g_param_spec_int ("snap-tolerance", "Snap tolerance",
+                                                     "How far in milliseconds a seek may move to an already downloaded position.",
+                                                     0, G_MAXINT, 0,
+                                                     G_PARAM_READWRITE |
+                                                     G_PARAM_STATIC_STRINGS));
+
+  /**
+   * BaconVideoWidget:hotspot-count:
+   *
+   * At how many evenly spaced positions of the stream btdemux downloads the
+   * first pieces in the background, 0 for none.
+   **/
+  g_object_class_install_property (object_class, PROP_HOTSPOT_COUNT,
+                                   g_param_spec_int ("hotspot-count", "Hotspot count",
+                                                     "Evenly spaced positions to prefetch in the background.",
+                                                     0, 1000, 0,
+                                                     G_PARAM_READWRITE |
+                                                     G_PARAM_STATIC_STRINGS));
+
+  /**
+   * BaconVideoWidget:hotspot-share:
+   *
+   * The percent of the downloads the background prefetch may take, the rest
+   * is left to the window at the playhead. 0 disables it.
+   **/
+  g_object_class_install_property (object_class, PROP_HOTSPOT_SHARE,
+                                   g_param_spec_int ("hotspot-share", "Hotspot share",
+                                                     "Percent of the downloads for the background prefetch.",
+                                                     0, 90, DEFAULT_HOTSPOT_SHARE,
+                                                     G_PARAM_READWRITE |
+                                                     G_PARAM_STATIC_STRINGS));
+
 
 
     /**
@@ -896,8 +992,8 @@ bacon_video_widget_class_init (BaconVideoWidgetClass * klass)
                  G_SIGNAL_RUN_LAST,
                  0,
                  NULL, NULL,
-                 g_cclosure_marshal_VOID__POINTER,  // POINTER for the PieceBlockInfoSd*
-                 G_TYPE_NONE, 1, G_TYPE_POINTER);    // G_TYPE_POINTER for the PieceBlockInfoSd*
+                 g_cclosure_marshal_VOID__POINTER,  // POINTER for the GstBtBlockState*
+                 G_TYPE_NONE, 1, G_TYPE_POINTER);    // G_TYPE_POINTER for the GstBtBlockState*
 
 
   bvw_signals[SIGNAL_FINISHED_PIECE_INFO] =
@@ -916,8 +1012,8 @@ bacon_video_widget_class_init (BaconVideoWidgetClass * klass)
               G_SIGNAL_RUN_LAST,
               0,
               NULL, NULL,
-              g_cclosure_marshal_VOID__POINTER,  // POINTER for the guint8*
-              G_TYPE_NONE, 1, G_TYPE_POINTER);    // G_TYPE_POINTER for the guint8*
+              g_cclosure_marshal_VOID__POINTER,  // POINTER for the GstBtBitset*
+              G_TYPE_NONE, 1, G_TYPE_POINTER);    // G_TYPE_POINTER for the GstBtBitset*
 
                               
   /**
@@ -1072,9 +1168,7 @@ bvw_handle_application_message (BaconVideoWidget *bvw, GstMessage *msg)
 
     if (strcmp (type_name, "got-piece-block-info") == 0) 
     {
-        PieceBlockInfoSd *shared_data = g_object_get_data (G_OBJECT(bvw->btdemux), "piece-block-info");
-
-              // printf ("second PieceBlockInfoSd addr %p \n", shared_data->info.finished_pieces);
+        GstBtBlockState *shared_data = g_object_get_data (G_OBJECT(bvw->btdemux), "piece-block-info");
 
         if (shared_data) 
         {
@@ -1099,8 +1193,25 @@ bvw_handle_application_message (BaconVideoWidget *bvw, GstMessage *msg)
 
                   printf ("(bvw_handle_application_message) Initially start-ppi \n");
 
-      bvw_reconfigure_ppi_timeout (bvw, 1000);
+      /* btdemux pushes the downloading blocks progress from now on */
+      bvw->ppi_wanted = TRUE;
+      bvw_reconfigure_ppi_timeout (bvw, bvw_ppi_interval (bvw));
+
+      goto done;
+    }
+
+    // downloading blocks progress changed, pushed while subscribed
+    else if (strcmp (type_name, "ppi-changed") == 0) 
+    {
+      const GValue *val = gst_structure_get_value (structure, "snapshot");
+
+      if (val && G_VALUE_HOLDS_BOXED (val) && g_value_get_boxed (val))
+      {
+        /* the handler takes the reference */
+        DownloadingBlocksSd *ppi = downloading_blocks_sd_ref (g_value_get_boxed (val));
 
+        g_signal_emit (bvw, bvw_signals[SIGNAL_PPI_INFO], 0, ppi);
+      }
       goto done;
     }
     
@@ -1115,7 +1226,9 @@ bvw_handle_application_message (BaconVideoWidget *bvw, GstMessage *msg)
         {
           bvw_downloading_ppi_timeout (bvw);
         }
-        /* torrent finished, so don't run the timeout anymore */
+        /* torrent finished, so don't run the timeout anymore,
+         * nor ask btdemux for the download queue */
+        bvw->ppi_wanted = FALSE;
         bvw_reconfigure_ppi_timeout (bvw, 0);
 
         goto done;
@@ -1324,6 +1437,29 @@ bvw_signal_eos_delayed (gpointer user_data)
 
 
 
+/*tick and ppi timeouts intervals at the current telemetry level, 0 means off*/
+static guint
+bvw_tick_interval (BaconVideoWidget *bvw)
+{
+  switch (bvw->telemetry_level)
+  {
+    case BVW_TELEMETRY_FULL:
+      return 200;
+    case BVW_TELEMETRY_REDUCED:
+      return 1000;
+    case BVW_TELEMETRY_MINIMAL:
+    default:
+      return 0;
+  }
+}
+
+static guint
+bvw_ppi_interval (BaconVideoWidget *bvw)
+{
+  return bvw->telemetry_level == BVW_TELEMETRY_FULL ? 1000 : 0;
+}
+
+
 /*this func is to configure enable/disable updating slider and time label*/
 static void
 bvw_reconfigure_tick_timeout (BaconVideoWidget *bvw, guint msecs)
@@ -1638,61 +1774,245 @@ audio_tags_changed_cb (GstElement *elem, gint stream_id, gpointer user_data)
 
 
 
+/* Keyframe index lookups in btdemux, in milliseconds and bytes within the file,
+ * -1 until it has indexed the file */
+static gint64
+bvw_keyframe_offset (BaconVideoWidget *bvw, gint64 _time)
+{
+  gint64 offset = -1;
+
+  if (bvw->btdemux && _time >= 0)
+    g_signal_emit_by_name (bvw->btdemux, "keyframe-offset", (guint64) _time * GST_MSECOND, &offset);
+
+  return offset;
+}
+
+static gint64
+bvw_keyframe_time (BaconVideoWidget *bvw, gint64 offset)
+{
+  guint64 _time = GST_CLOCK_TIME_NONE;
+
+  if (bvw->btdemux && offset >= 0)
+    g_signal_emit_by_name (bvw->btdemux, "keyframe-time", offset, &_time);
+
+  return GST_CLOCK_TIME_IS_VALID (_time) ? (gint64) (_time / GST_MSECOND) : -1;
+}
+
+/* milliseconds of media between the playback position and the byte offset until,
+ * -1 if the duration or the size is not known yet. until is mapped to the keyframe
+ * at or before it once btdemux has indexed the file, proportionally before that */
+static gint64
+bvw_buffering_ahead (BaconVideoWidget *bvw, gint64 until)
+{
+  gint64 pos = -1;
+  gint64 until_ms;
+
+  if (bvw->buffering_stream_size <= 0 || bvw->stream_length <= 0)
+    return -1;
+
+  if (gst_element_query_position (bvw->pipeline, GST_FORMAT_TIME, &pos) && pos != -1)
+    pos /= GST_MSECOND;
+  else
+    pos = bvw->current_time;
+
+  until_ms = bvw_keyframe_time (bvw, MIN (until, bvw->buffering_stream_size - 1));
+  if (until_ms < 0)
+    until_ms = (gint64) ((gdouble) until / bvw->buffering_stream_size * bvw->stream_length);
+
+  return MAX (until_ms - pos, 0);
+}
+
+static void
+bvw_buffering_hold (BaconVideoWidget *bvw)
+{
+  GstState cur_state;
+
+  bvw->buffering = TRUE;
+  bvw->buffering_done_time = 0;
+
+  if (bvw->target_state != GST_STATE_PLAYING)
+    return;
+
+  gst_element_get_state (bvw->pipeline, &cur_state, NULL, 0);
+  if (cur_state != GST_STATE_PAUSED) 
+  {
+                printf("(bvw_buffering_hold) Buffering... temporarily pausing playback %d%% and SET bvw->pipeline state to PAUSED\n", bvw->buffering_percent);
+
+    gst_element_set_state (bvw->pipeline, GST_STATE_PAUSED);
+  }
+}
+
+static void
+bvw_buffering_release (BaconVideoWidget *bvw)
+{
+  bvw->buffering = FALSE;
+  bvw->buffering_done_time = 0;
+
+  /* if the desired state is playing, go back */
+  if (bvw->target_state == GST_STATE_PLAYING) 
+  {
+                printf("(bvw_buffering_release) Buffering done, call bacon_video_widget_play on it\n");
+    bacon_video_widget_play (bvw, NULL);
+  } 
+  else 
+  {
+                printf("(bvw_buffering_release) Buffering done, keeping pipeline PAUSED\n");
+  }
+}
+
+/* Hysteresis between the two watermarks, so trickling pieces don't make the
+ * pipeline flip between PAUSED and PLAYING. Runs on every buffering message, and
+ * every BUFFERING_CHECK_INTERVAL ms while btdemux refills or we hold the pipeline,
+ * as the playback position moves on (or the wait expires) between two messages.
+ * Without a known duration it falls back to pausing below 100% and resuming at 100%.
+ * Returns FALSE when there is nothing left to watch */
+static gboolean
+bvw_buffering_update (BaconVideoWidget *bvw)
+{
+  gint64 ahead;
+
+  if (!bvw->buffering)
+  {
+    if (bvw->buffering_percent >= 100)
+      return FALSE;
+
+    /* still playing what was pushed downstream, pause only when about to run dry */
+    ahead = bvw_buffering_ahead (bvw, bvw->buffering_pushed_until);
+    if (ahead < BUFFERING_LOW_WATERMARK)
+    {
+                printf("(bvw_buffering_update) %d%%, %" G_GINT64_FORMAT "ms of media left, hold\n",
+                    bvw->buffering_percent, ahead);
+      bvw_buffering_hold (bvw);
+    }
+    return TRUE;
+  }
+
+  if (bvw->buffering_percent < 100)
+    return TRUE;
+
+  ahead = bvw_buffering_ahead (bvw, bvw->buffering_available_until);
+  if (ahead < 0 || ahead >= BUFFERING_HIGH_WATERMARK ||
+      bvw->buffering_available_until >= bvw->buffering_stream_size ||
+      g_get_monotonic_time () - bvw->buffering_done_time >= BUFFERING_MAX_WAIT * G_TIME_SPAN_MILLISECOND)
+  {
+                printf("(bvw_buffering_update) %" G_GINT64_FORMAT "ms of media available, release\n", ahead);
+    bvw_buffering_release (bvw);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Once refilled btdemux stops posting buffering messages, and with the pipeline
+ * held nothing else moves, so the available range of the last message would only
+ * ever grow by waiting out BUFFERING_MAX_WAIT. Scan the piece matrix again from
+ * where that message left off instead */
+static void
+bvw_buffering_refresh_available (BaconVideoWidget *bvw)
+{
+  GstStructure *layout = NULL;
+  GstBtBitset *piece_matrix = NULL;
+  gint64 offset, size;
+  gint piece_length;
+
+  if (!bvw->btdemux || bvw->buffering_stream_size <= 0)
+    return;
+
+  g_object_get (bvw->btdemux, "stream-layout", &layout, "piece-matrix", &piece_matrix, NULL);
+  if (layout && piece_matrix &&
+      gst_structure_get (layout,
+                         "file-offset", G_TYPE_INT64, &offset,
+                         "size", G_TYPE_INT64, &size,
+                         "piece-length", G_TYPE_INT, &piece_length, NULL) &&
+      size == bvw->buffering_stream_size && piece_length > 0)
+  {
+    guint piece = (guint) ((offset + bvw->buffering_available_until) / piece_length);
+    guint end = (guint) ((offset + size - 1) / piece_length) + 1;
+    gint64 available;
+
+    piece = gst_bt_bitset_find_next_clear (piece_matrix, piece, end);
+    available = CLAMP ((gint64) piece * piece_length - offset, (gint64) 0, size);
+    bvw->buffering_available_until = MAX (bvw->buffering_available_until, available);
+  }
+
+  if (layout)
+    gst_structure_free (layout);
+  if (piece_matrix)
+    gst_bt_bitset_unref (piece_matrix);
+}
+
+static gboolean
+bvw_buffering_check_timeout (BaconVideoWidget *bvw)
+{
+  if (bvw->buffering && bvw->buffering_percent >= 100)
+    bvw_buffering_refresh_available (bvw);
+
+  if (bvw_buffering_update (bvw))
+    return G_SOURCE_CONTINUE;
+
+  bvw->buffering_check_id = 0;
+  return G_SOURCE_REMOVE;
+}
+
+static void
+bvw_buffering_reset (BaconVideoWidget *bvw)
+{
+  if (bvw->buffering_check_id != 0)
+  {
+    g_source_remove (bvw->buffering_check_id);
+    bvw->buffering_check_id = 0;
+  }
+  bvw->buffering = FALSE;
+  bvw->buffering_percent = 100;
+  bvw->buffering_stream_size = 0;
+  bvw->buffering_pushed_until = 0;
+  bvw->buffering_available_until = 0;
+  bvw->buffering_done_time = 0;
+}
+
 /*Handling Three-Piece-Area Buffering msg from btdemux*/
 static void
 bvw_handle_buffering_message (GstMessage * message, BaconVideoWidget *bvw)
 {
+  const GstStructure *structure = gst_message_get_structure (message);
+  GstBufferingMode mode;
   gint percent = 0;
+  gint avg_in = 0, avg_out = 0;
+  gint64 buffering_left = -1;
+  gint64 queued_bytes = 0;
 
   gst_message_parse_buffering (message, &percent);
+  gst_message_parse_buffering_stats (message, &mode, &avg_in, &avg_out, &buffering_left);
+  gst_structure_get_int64 (structure, "queued-bytes", &queued_bytes);
 
-  /**********Three-Piece-Area Buffered finished***********/
-  if (percent >= 100) 
-  {
-    /* a 100% message means buffering is done */
-    bvw->buffering = FALSE;
-    /* if the desired state is playing, go back */
-    if (bvw->target_state == GST_STATE_PLAYING) 
-    {
-      // GST_DEBUG ("Buffering done, setting pipeline back to PLAYING");
-                printf("(bvw_handle_buffering_message) Buffering done, call bacon_video_widget_play on it\n");
-      bacon_video_widget_play (bvw, NULL);
-    } 
-    else 
-    {
-      // GST_DEBUG ("Buffering done, keeping pipeline PAUSED");
-                printf("(bvw_handle_buffering_message) Buffering done, keeping pipeline PAUSED\n");
-    }
-  } 
+                printf("(bvw_handle_buffering_message) %d%% (mode %d, in %d B/s, out %d B/s, %" G_GINT64_FORMAT "ms left), %" G_GINT64_FORMAT " bytes queued in btdemux\n",
+                    percent, mode, avg_in, avg_out, buffering_left, queued_bytes);
 
-  /**********Three-Piece-Area Buffered not finished And we are not paused***********/
-  else if (bvw->target_state == GST_STATE_PLAYING) 
+  bvw->buffering_percent = percent;
+  if (!gst_structure_get_int64 (structure, "stream-size", &bvw->buffering_stream_size) ||
+      !gst_structure_get_int64 (structure, "pushed-until", &bvw->buffering_pushed_until) ||
+      !gst_structure_get_int64 (structure, "available-until", &bvw->buffering_available_until))
   {
-    GstState cur_state;
+    bvw->buffering_stream_size = 0;
+  }
 
-    gst_element_get_state (bvw->pipeline, &cur_state, NULL, 0);
-    if (cur_state != GST_STATE_PAUSED) 
-    {
-      // GST_DEBUG ("Buffering ... temporarily pausing playback %d%%", percent);
-      
-                printf("(bvw_handle_buffering_message) Buffering... temporarily pausing playback %d%% and SET bvw->pipeline state to PAUSED\n", percent);
+  /* refilled, the wait for the high watermark starts now */
+  if (percent >= 100 && bvw->buffering && bvw->buffering_done_time == 0)
+    bvw->buffering_done_time = g_get_monotonic_time ();
 
-      gst_element_set_state (bvw->pipeline, GST_STATE_PAUSED);
-    } 
-    else 
+  if (!bvw_buffering_update (bvw))
+  {
+    if (bvw->buffering_check_id != 0)
     {
-                printf("(bvw_handle_buffering_message) Buffering (already paused) ... %d%%\n", percent);
-      // GST_LOG ("Buffering (already paused) ... %d%%", percent);
+      g_source_remove (bvw->buffering_check_id);
+      bvw->buffering_check_id = 0;
     }
-    bvw->buffering = TRUE;
-  } 
-
-  /**********Three-Piece-Area Buffered not finished And we've already let paused , do nothing and just report the progress***********/
-  else 
+  }
+  else if (bvw->buffering_check_id == 0)
   {
-    // GST_LOG ("Buffering ... %d", percent);
-                printf("(bvw_handle_buffering_message)Buffering ... %d\n", percent);
-    bvw->buffering = TRUE;
+    bvw->buffering_check_id =
+      g_timeout_add (BUFFERING_CHECK_INTERVAL, (GSourceFunc) bvw_buffering_check_timeout, bvw);
+    g_source_set_name_by_id (bvw->buffering_check_id, "[totem] bvw_buffering_check_timeout");
   }
 }
 
@@ -1838,6 +2158,7 @@ bvw_bus_message_cb (GstBus * bus, GstMessage * message, BaconVideoWidget *bvw)
         /* update slider one last time */
         bvw_query_timeout (bvw);
         //disable updating slider&time label every period of time
+        bvw->tick_wanted = FALSE;
         bvw_reconfigure_tick_timeout (bvw, 0);
       } else if (new_state > GST_STATE_PAUSED) 
       {
@@ -1845,7 +2166,8 @@ bvw_bus_message_cb (GstBus * bus, GstMessage * message, BaconVideoWidget *bvw)
               printf ("(bvw_bus_message_cb) resume updating slider and time label\n");
 
         /*resume update slider and time label periodically*/
-        bvw_reconfigure_tick_timeout (bvw, 200);
+        bvw->tick_wanted = TRUE;
+        bvw_reconfigure_tick_timeout (bvw, bvw_tick_interval (bvw));
       }
 
       //state changed from READY to PAUSED, maybe it is start playing
@@ -1930,6 +2252,7 @@ bvw_bus_message_cb (GstBus * bus, GstMessage * message, BaconVideoWidget *bvw)
       if (gst_element_query_duration (bvw->pipeline, GST_FORMAT_TIME, &len) && len != -1) {
 
         bvw->stream_length = len / GST_MSECOND;
+        bvw_update_hotspots (bvw);
 
             printf ("(bvw_bus_message) in GST_MESSAGE_DURATION_CHANGED, update bvw->stream_length \n");
 	// GST_DEBUG ("got new stream length (through duration message) %" G_GINT64_FORMAT, bvw->stream_length);
@@ -1985,12 +2308,22 @@ bvw_bus_message_cb (GstBus * bus, GstMessage * message, BaconVideoWidget *bvw)
     case GST_MESSAGE_STREAM_STATUS:
       break;
 
+    case GST_MESSAGE_SEGMENT_DONE: {
+      /* the end of the loop is reached, go round again without flushing:
+       * the next iteration plays right after what is still queued */
+      if (bvw->loop_stop >= 0)
+      {
+            printf ("(bvw_bus_message) SEGMENT_DONE, looping back to %" G_GINT64_FORMAT " ms\n", bvw->loop_start);
+        bvw_loop_seek (bvw, FALSE);
+      }
+      break;
+    }
+
     case GST_MESSAGE_UNKNOWN:
     case GST_MESSAGE_INFO:
     case GST_MESSAGE_STEP_DONE:
     case GST_MESSAGE_STRUCTURE_CHANGE:
     case GST_MESSAGE_SEGMENT_START:
-    case GST_MESSAGE_SEGMENT_DONE:
     case GST_MESSAGE_LATENCY:
     case GST_MESSAGE_ASYNC_START:
     case GST_MESSAGE_REQUEST_STATE:
@@ -2118,9 +2451,16 @@ bvw_query_timeout (BaconVideoWidget *bvw)
 /**********************************************************************************************************/
 
 
+/*the ppi timeout only reads the piece matrix, the downloading blocks progress
+  is pushed by btdemux while subscribed, so subscribe along with the timeout*/
 static void
 bvw_reconfigure_ppi_timeout (BaconVideoWidget *bvw, guint msecs)
 {
+  if (bvw->btdemux)
+  {
+    g_object_set (bvw->btdemux, "ppi-subscribe", msecs > 0, NULL);
+  }
+
   //remove previous
   if (bvw->ppi_id != 0) {
               printf("(bvw_reconfigure_ppi_timeout) removing ppi timeout\n");
@@ -2142,30 +2482,20 @@ bvw_reconfigure_ppi_timeout (BaconVideoWidget *bvw, guint msecs)
 
 
 
-/*query downloading blocks progress of torrent*/
+/*query the piece matrix of torrent*/
 static gboolean
 bvw_downloading_ppi_timeout (BaconVideoWidget *bvw)
 {
                           // printf("(bvw_downaloding_ppi_timeout) \n");
 
-  DownloadingBlocksSd* ppi = NULL;
-
-  g_signal_emit_by_name (G_OBJECT (bvw->btdemux), "get-ppi", &ppi);
-
-  if(ppi)
-  {
-
-    // printf ("(second ppi addr %p) \n", ppi);
-
-      g_signal_emit (bvw, bvw_signals[SIGNAL_PPI_INFO], 0, ppi);
-
-  }
+  //downloading blocks progress is pushed by btdemux as "ppi-changed" messages
 
   //piece matrix gathered from piece_finished_alert
-  guint8* piece_matrix = NULL;  
+  GstBtBitset* piece_matrix = NULL;  
   g_object_get (G_OBJECT (bvw->btdemux), "piece-matrix", &piece_matrix, NULL);
   if (piece_matrix) {
     g_signal_emit (bvw, bvw_signals[SIGNAL_PIECE_MATRIX], 0, piece_matrix);
+    gst_bt_bitset_unref (piece_matrix);
 
 // printf ("second piece-matrix addr %p \n", piece_matrix);
   }
@@ -2294,6 +2624,9 @@ bacon_video_widget_finalize (GObject * object)
   g_type_class_unref (g_type_class_peek (BVW_TYPE_METADATA_TYPE));
   g_type_class_unref (g_type_class_peek (BVW_TYPE_ROTATION));
 
+  g_clear_pointer (&bvw->preview, bvw_preview_free);
+  g_clear_pointer (&bvw->skip_offsets, g_array_unref);
+
   if (bvw->bus) 
   {
     /* make bus drop all messages to make sure none of our callbacks is ever
@@ -2310,6 +2643,18 @@ bacon_video_widget_finalize (GObject * object)
   
   g_clear_object (&bvw->clock);
 
+  if (bvw->buffering_check_id != 0)
+  {
+    g_source_remove (bvw->buffering_check_id);
+    bvw->buffering_check_id = 0;
+  }
+
+  if (bvw->seek_timeout_id != 0)
+  {
+    g_source_remove (bvw->seek_timeout_id);
+    bvw->seek_timeout_id = 0;
+  }
+
   if (bvw->pipeline != NULL)
   {
               printf ("(bacon_video_widget_finalize) SET bvw->pipeline state to NULL\n");
@@ -2419,6 +2764,11 @@ bacon_video_widget_finalize (GObject * object)
    gst_object_unref(bvw->audio_pitchcontrol);
   }
 
+  if(bvw->audio_pitch_convert)
+  {
+   gst_object_unref(bvw->audio_pitch_convert);
+  }
+
 
   g_mutex_clear (&bvw->seek_mutex);
   g_mutex_clear (&bvw->get_audiotags_mutex);
@@ -2474,6 +2824,17 @@ bacon_video_widget_set_property (GObject * object, guint property_id,
     case PROP_SHOW_CURSOR:
       bacon_video_widget_set_show_cursor (bvw, g_value_get_boolean (value));
       break;
+    case PROP_SNAP_TOLERANCE:
+      bacon_video_widget_set_snap_tolerance (bvw, g_value_get_int (value));
+      break;
+    case PROP_HOTSPOT_COUNT:
+      bvw->hotspot_count = g_value_get_int (value);
+      bvw_update_hotspots (bvw);
+      break;
+    case PROP_HOTSPOT_SHARE:
+      bvw->hotspot_share = g_value_get_int (value);
+      bvw_update_hotspots (bvw);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
       break;
@@ -2532,6 +2893,15 @@ bacon_video_widget_get_property (GObject * object, guint property_id,
     case PROP_SHOW_CURSOR:
       g_value_set_boolean (value, bvw->cursor_shown);
       break;
+    case PROP_SNAP_TOLERANCE:
+      g_value_set_int (value, bvw->snap_tolerance);
+      break;
+    case PROP_HOTSPOT_COUNT:
+      g_value_set_int (value, bvw->hotspot_count);
+      break;
+    case PROP_HOTSPOT_SHARE:
+      g_value_set_int (value, bvw->hotspot_share);
+      break;
     case PROP_CUR_AUDIO_TAGS: 
     {
           // printf ("(bacon_video_widget_get_property) PROP_CUR_AUDIO_TAGS Locking\n");
@@ -3053,6 +3423,10 @@ bacon_video_widget_seek_time_no_lock (BaconVideoWidget *bvw,
   //reset seek_time to -1 
   bvw->seek_time = -1;
 
+  //seeking anywhere ends the A-B loop
+  bvw->loop_start = -1;
+  bvw->loop_stop = -1;
+
   
   GstState cur_state;
   gst_element_get_state (bvw->pipeline, &cur_state, NULL, 0);
@@ -3077,6 +3451,187 @@ bacon_video_widget_seek_time_no_lock (BaconVideoWidget *bvw,
 
 
 
+/* whether the pieces a seek into piece has to download are all there: the
+ * window btdemux would buffer from piece, and the piece before it, where the
+ * keyframe the demuxer restarts from most likely is */
+static gboolean
+bvw_snap_window_is_local (GstBtBitset *piece_matrix, gint64 piece,
+                          gint64 first_piece, gint64 last_piece, gint window)
+{
+  gint64 start = MAX (piece - 1, first_piece);
+  gint64 end = MIN (piece + window, last_piece + 1);
+
+  if (start >= end)
+    return TRUE;
+
+  return gst_bt_bitset_find_next_clear (piece_matrix, (guint) start, (guint) end) == (guint) end;
+}
+
+/* Move a non-accurate seek to _time to the nearest position, at most snap_tolerance
+ * ms away, whose window btdemux already has, so the seek does not rebuffer.
+ * Once btdemux has indexed the file, the candidates are keyframes, the last one
+ * starting in each piece, and the window checked is the one from the piece of the
+ * keyframe. Before that media times are mapped to bytes of the file proportionally,
+ * which is close enough to pick a piece */
+static gint64
+bvw_snap_seek_time (BaconVideoWidget *bvw, gint64 _time)
+{
+  GstStructure *layout = NULL;
+  GstBtBitset *piece_matrix = NULL;
+  gint64 offset, size, first_piece, last_piece, target, q, limit;
+  gint64 forward = -1, backward = -1, snapped = _time;
+  gint64 keyframe;
+  gint piece_length, window;
+
+  if (bvw->snap_tolerance <= 0 || bvw->stream_length <= 0 || !bvw->btdemux)
+    return _time;
+
+  g_object_get (bvw->btdemux, "stream-layout", &layout, "piece-matrix", &piece_matrix, NULL);
+  if (!layout || !piece_matrix)
+    goto done;
+
+  if (!gst_structure_get (layout,
+                          "file-offset", G_TYPE_INT64, &offset,
+                          "size", G_TYPE_INT64, &size,
+                          "piece-length", G_TYPE_INT, &piece_length,
+                          "window-pieces", G_TYPE_INT, &window, NULL) ||
+      size <= 0 || piece_length <= 0)
+    goto done;
+
+#define TIME_TO_PIECE(t) ((offset + (gint64) ((gdouble) (t) / bvw->stream_length * (size - 1))) / piece_length)
+#define PIECE_TO_TIME(b) ((gint64) ((gdouble) ((b) - offset) / size * bvw->stream_length))
+#define PIECE_END(p) (MIN (((p) + 1) * piece_length, offset + size) - 1 - offset)
+#define KEYFRAME_PIECE(t) ((offset + bvw_keyframe_offset (bvw, t)) / piece_length)
+
+  first_piece = offset / piece_length;
+  last_piece = (offset + size - 1) / piece_length;
+  window = MAX (window, 1);
+
+  keyframe = bvw_keyframe_offset (bvw, _time);
+  if (keyframe >= 0)
+  {
+    /* the keyframe the demuxer restarts from, read from its own piece on */
+    target = (offset + keyframe) / piece_length;
+    if (bvw_snap_window_is_local (piece_matrix, target + 1, first_piece, last_piece, window))
+      goto done;
+
+    limit = KEYFRAME_PIECE (MIN (_time + bvw->snap_tolerance, bvw->stream_length));
+    for (q = target + 1; q <= MIN (limit, last_piece); q++)
+    {
+      gint64 t = bvw_keyframe_time (bvw, PIECE_END (q));
+
+      /* no keyframe starts in q */
+      if (t <= _time || KEYFRAME_PIECE (t) < q)
+        continue;
+      if (bvw_snap_window_is_local (piece_matrix, q + 1, first_piece, last_piece, window))
+      {
+        forward = t;
+        break;
+      }
+    }
+
+    limit = KEYFRAME_PIECE (MAX (_time - bvw->snap_tolerance, 0));
+    for (q = target - 1; q >= MAX (limit, first_piece); q--)
+    {
+      gint64 t = bvw_keyframe_time (bvw, PIECE_END (q));
+
+      if (t < 0 || t >= _time || KEYFRAME_PIECE (t) < q)
+        continue;
+      if (bvw_snap_window_is_local (piece_matrix, q + 1, first_piece, last_piece, window))
+      {
+        backward = t;
+        break;
+      }
+    }
+  }
+  else
+  {
+    target = TIME_TO_PIECE (_time);
+    if (bvw_snap_window_is_local (piece_matrix, target, first_piece, last_piece, window))
+      goto done;
+
+    /* later, from the start of the first piece whose window is local */
+    limit = TIME_TO_PIECE (MIN (_time + bvw->snap_tolerance, bvw->stream_length));
+    for (q = target + 1; q <= limit; q++)
+    {
+      if (bvw_snap_window_is_local (piece_matrix, q, first_piece, last_piece, window))
+      {
+        forward = PIECE_TO_TIME (q * piece_length);
+        break;
+      }
+    }
+
+    /* earlier, from the end of the last such piece */
+    limit = TIME_TO_PIECE (MAX (_time - bvw->snap_tolerance, 0));
+    for (q = target - 1; q >= MAX (limit, first_piece); q--)
+    {
+      if (bvw_snap_window_is_local (piece_matrix, q, first_piece, last_piece, window))
+      {
+        backward = PIECE_TO_TIME ((q + 1) * piece_length - 1);
+        break;
+      }
+    }
+  }
+
+#undef TIME_TO_PIECE
+#undef PIECE_TO_TIME
+#undef PIECE_END
+#undef KEYFRAME_PIECE
+
+  if (forward >= 0 && forward - _time <= bvw->snap_tolerance)
+    snapped = forward;
+  if (backward >= 0 && _time - backward <= bvw->snap_tolerance &&
+      (snapped == _time || _time - backward < snapped - _time))
+    snapped = backward;
+  snapped = CLAMP (snapped, 0, bvw->stream_length);
+
+  if (snapped != _time)
+  {
+            printf ("(bvw_snap_seek_time) %" GST_TIME_FORMAT " snapped to %" GST_TIME_FORMAT ", already downloaded\n",
+                GST_TIME_ARGS (_time * GST_MSECOND), GST_TIME_ARGS (snapped * GST_MSECOND));
+  }
+
+done:
+  if (layout)
+    gst_structure_free (layout);
+  if (piece_matrix)
+    gst_bt_bitset_unref (piece_matrix);
+
+  return snapped;
+}
+
+
+
+
+/* the latest of the seeks queued during the last SEEK_TIMEOUT, the ones before it
+ * were replaced and never reach btdemux */
+static gboolean
+bvw_queued_seek_timeout (BaconVideoWidget *bvw)
+{
+  gint64 _time;
+
+  bvw->seek_timeout_id = 0;
+
+  g_mutex_lock (&bvw->seek_mutex);/********************************************/
+  _time = bvw->seek_time;
+  bvw->seek_time = -1;
+  if (_time >= 0)
+    bvw->seek_req_time = gst_clock_get_internal_time (bvw->clock);
+  g_mutex_unlock (&bvw->seek_mutex);/******************************************/
+
+  if (_time >= 0)
+  {
+              printf("(bvw_queued_seek_timeout) doing the queued seek (%" GST_TIME_FORMAT ")\n",
+                  GST_TIME_ARGS (_time * GST_MSECOND));
+    bacon_video_widget_seek_time_no_lock (bvw, _time, 0, NULL);
+  }
+
+  return G_SOURCE_REMOVE;
+}
+
+
+
+
 /**
  * bacon_video_widget_seek_time:
  * @bvw: a #BaconVideoWidget
@@ -3105,6 +3660,10 @@ bacon_video_widget_seek_time (BaconVideoWidget *bvw, gint64 _time, gboolean accu
   /* Don't say we'll seek past the end */
   _time = MIN (_time, bvw->stream_length);
 
+  /* Rather land next to what we already have than rebuffer for a casual skip */
+  if (!accurate)
+    _time = bvw_snap_seek_time (bvw, _time);
+
           printf("(bacon_video_widget_seek_time) Seeking to %" GST_TIME_FORMAT " \n", GST_TIME_ARGS (_time * GST_MSECOND));
 
   /* Emit a time tick of where we are going, we are gonna paused */
@@ -3147,7 +3706,7 @@ bacon_video_widget_seek_time (BaconVideoWidget *bvw, gint64 _time, gboolean accu
   //During one seek, we got other seeks,just update bvw->seek_time per newest seek 
   //*if we seeder, GST_MESSAGE_ASYNC_DONE handling run both before/after update newest seek_time code below
   //*if we leecher, we downloading, so GST_MESSAGE_ASYNC_DONE may comes very late, 
-  //so during this period, seeks will be ignored (btdemux stream_seek never be called)
+  //so the newest seek is also applied by a timeout once SEEK_TIMEOUT elapsed, whichever comes first
   else 
   {
     // GST_LOG ("Not long enough since last seek, queuing it");
@@ -3156,6 +3715,13 @@ bacon_video_widget_seek_time (BaconVideoWidget *bvw, gint64 _time, gboolean accu
 
     //set seek_time to _time, which is not -1 , means that there is a seek queued  
     bvw->seek_time = _time;
+    if (bvw->seek_timeout_id == 0)
+    {
+      guint delay = (bvw->seek_req_time + SEEK_TIMEOUT - cur_time) / GST_MSECOND;
+
+      bvw->seek_timeout_id = g_timeout_add (MAX (delay, 1), (GSourceFunc) bvw_queued_seek_timeout, bvw);
+      g_source_set_name_by_id (bvw->seek_timeout_id, "[totem] bvw_queued_seek_timeout");
+    }
     g_mutex_unlock (&bvw->seek_mutex);/******************************************/
     return TRUE;
   }
@@ -3171,8 +3737,104 @@ bacon_video_widget_seek_time (BaconVideoWidget *bvw, gint64 _time, gboolean accu
 
 
 
-/**
- * bacon_video_widget_seek:
+/* one iteration of the A-B loop, the first one flushing */
+static gboolean
+bvw_loop_seek (BaconVideoWidget *bvw, gboolean flush)
+{
+  return gst_element_seek (bvw->pipeline, bvw->rate, GST_FORMAT_TIME,
+                           (flush ? GST_SEEK_FLAG_FLUSH : GST_SEEK_FLAG_NONE) |
+                           GST_SEEK_FLAG_ACCURATE | GST_SEEK_FLAG_SEGMENT,
+                           GST_SEEK_TYPE_SET, bvw->loop_start * GST_MSECOND,
+                           GST_SEEK_TYPE_SET, bvw->loop_stop * GST_MSECOND);
+}
+
+/**
+ * bacon_video_widget_set_loop:
+ * @bvw: a #BaconVideoWidget
+ * @start: where the loop starts, in milliseconds, or -1 to end the loop
+ * @stop: where it ends, in milliseconds
+ *
+ * Plays from @start to @stop over and over, until another seek or the end of
+ * the stream. Every iteration is a segment seek queued when the previous one
+ * is done, so nothing is flushed, and btdemux keeps the pieces of the range in
+ * memory meanwhile instead of reading them from the disk again.
+ *
+ * Return value: %TRUE on success, %FALSE otherwise
+ **/
+gboolean
+bacon_video_widget_set_loop (BaconVideoWidget *bvw, gint64 start, gint64 stop)
+{
+  g_return_val_if_fail (BACON_IS_VIDEO_WIDGET (bvw), FALSE);
+  g_return_val_if_fail (GST_IS_ELEMENT (bvw->pipeline), FALSE);
+
+  /* out of the loop where it is now, with a plain seek btdemux unpins the range */
+  if (start < 0 || stop <= start)
+  {
+    if (bvw->loop_stop < 0)
+      return TRUE;
+
+    /* no more iterations even if the seek gets queued */
+    bvw->loop_start = -1;
+    bvw->loop_stop = -1;
+
+    return bacon_video_widget_seek_time (bvw, bvw->current_time, TRUE, NULL);
+  }
+
+  if (bvw_set_playback_direction (bvw, TRUE) == FALSE)
+    return FALSE;
+
+  bvw->loop_start = start;
+  bvw->loop_stop = bvw->stream_length > 0 ? MIN (stop, bvw->stream_length) : stop;
+
+          printf ("(bacon_video_widget_set_loop) looping [%" G_GINT64_FORMAT ",%" G_GINT64_FORMAT "] ms\n",
+              bvw->loop_start, bvw->loop_stop);
+
+  /* a seek queued earlier would end the loop */
+  g_mutex_lock (&bvw->seek_mutex);
+  bvw->seek_time = -1;
+  bvw->seek_req_time = gst_clock_get_internal_time (bvw->clock);
+  if (bvw->seek_timeout_id != 0)
+  {
+    g_source_remove (bvw->seek_timeout_id);
+    bvw->seek_timeout_id = 0;
+  }
+  g_mutex_unlock (&bvw->seek_mutex);
+
+  got_time_tick (bvw->pipeline, bvw->loop_start * GST_MSECOND, bvw);
+
+  if (!bvw_loop_seek (bvw, TRUE))
+  {
+    bvw->loop_start = -1;
+    bvw->loop_stop = -1;
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/**
+ * bacon_video_widget_get_loop:
+ * @bvw: a #BaconVideoWidget
+ * @start: (out) (optional): where the loop starts, in milliseconds
+ * @stop: (out) (optional): where it ends, in milliseconds
+ *
+ * Return value: %TRUE if an A-B loop is playing
+ **/
+gboolean
+bacon_video_widget_get_loop (BaconVideoWidget *bvw, gint64 *start, gint64 *stop)
+{
+  g_return_val_if_fail (BACON_IS_VIDEO_WIDGET (bvw), FALSE);
+
+  if (start)
+    *start = bvw->loop_start;
+  if (stop)
+    *stop = bvw->loop_stop;
+
+  return bvw->loop_stop >= 0;
+}
+
+/**
+ * bacon_video_widget_seek:
  * @bvw: a #BaconVideoWidget
  * @position: the percentage of the way through the stream to which to seek
  * @error: a #GError, or %NULL
@@ -3294,7 +3956,7 @@ bvw_stop_play_pipeline (BaconVideoWidget * bvw)
     bvw->target_state = GST_STATE_READY;
 
     /* Clear buffering state */
-    bvw->buffering = FALSE;
+    bvw_buffering_reset (bvw);
    
     g_object_set (bvw->video_sink,
                   "rotate-method", GST_VIDEO_ORIENTATION_AUTO,
@@ -3405,12 +4067,23 @@ bacon_video_widget_close (BaconVideoWidget * bvw)
 
 
   bvw->rate = FORWARD_RATE;
+  bvw_update_pitch_control (bvw);
 
   bvw->current_time = 0;
+  g_mutex_lock (&bvw->seek_mutex);
   bvw->seek_req_time = GST_CLOCK_TIME_NONE; //reset to undefined clock time
   bvw->seek_time = -1;
+  g_mutex_unlock (&bvw->seek_mutex);
+  if (bvw->seek_timeout_id != 0)
+  {
+    g_source_remove (bvw->seek_timeout_id);
+    bvw->seek_timeout_id = 0;
+  }
   //reset bvw->stream_length to "zero", which is initial value, means that we do not get the stream_length yet
   bvw->stream_length = 0;
+  bvw_update_hotspots (bvw);
+  bvw->loop_start = -1;
+  bvw->loop_stop = -1;
 
   if (bvw->eos_id != 0)
   {
@@ -3704,6 +4377,356 @@ bacon_video_widget_get_rotation (BaconVideoWidget *bvw)
   return bvw->rotation;
 }
 
+/**
+ * bacon_video_widget_set_telemetry_level:
+ * @bvw: a #BaconVideoWidget
+ * @level: the new #BvwTelemetryLevel
+ *
+ * Tells how much of the playback and torrent progress is being shown, so
+ * the time tick, the piece matrix polling and btdemux's own alerts and
+ * polling can be slowed down or stopped while nobody is watching.
+ * Coming back to a higher level updates the slider and bitfield right away.
+ **/
+void
+bacon_video_widget_set_telemetry_level (BaconVideoWidget *bvw,
+					BvwTelemetryLevel level)
+{
+  g_return_if_fail (BACON_IS_VIDEO_WIDGET (bvw));
+
+  if (bvw->telemetry_level == level)
+    return;
+
+              printf ("(bacon_video_widget_set_telemetry_level) %d -> %d\n", bvw->telemetry_level, level);
+
+  bvw->telemetry_level = level;
+
+  if (bvw->btdemux)
+    g_object_set (bvw->btdemux, "telemetry-level", (gint) level, NULL);
+
+  if (bvw->tick_wanted)
+  {
+    bvw_reconfigure_tick_timeout (bvw, bvw_tick_interval (bvw));
+    if (bvw->update_id != 0)
+      bvw_query_timeout (bvw);
+  }
+
+  if (bvw->ppi_wanted)
+  {
+    bvw_reconfigure_ppi_timeout (bvw, bvw_ppi_interval (bvw));
+    if (bvw->ppi_id != 0)
+      bvw_downloading_ppi_timeout (bvw);
+  }
+}
+
+/**
+ * bacon_video_widget_get_telemetry_level:
+ * @bvw: a #BaconVideoWidget
+ *
+ * Returns the telemetry level set with bacon_video_widget_set_telemetry_level().
+ *
+ * Return value: a #BvwTelemetryLevel.
+ **/
+BvwTelemetryLevel
+bacon_video_widget_get_telemetry_level (BaconVideoWidget *bvw)
+{
+  g_return_val_if_fail (BACON_IS_VIDEO_WIDGET (bvw), BVW_TELEMETRY_FULL);
+
+  return bvw->telemetry_level;
+}
+
+/**
+ * bacon_video_widget_set_snap_tolerance:
+ * @bvw: a #BaconVideoWidget
+ * @tolerance: in milliseconds, 0 to disable
+ *
+ * Lets non-accurate seeks move by up to @tolerance to a position whose
+ * pieces are already downloaded, instead of buffering a new window.
+ **/
+void
+bacon_video_widget_set_snap_tolerance (BaconVideoWidget *bvw, gint tolerance)
+{
+  g_return_if_fail (BACON_IS_VIDEO_WIDGET (bvw));
+
+  tolerance = MAX (tolerance, 0);
+  if (bvw->snap_tolerance == tolerance)
+    return;
+
+  bvw->snap_tolerance = tolerance;
+  g_object_notify (G_OBJECT (bvw), "snap-tolerance");
+}
+
+/**
+ * bacon_video_widget_get_snap_tolerance:
+ * @bvw: a #BaconVideoWidget
+ *
+ * Returns: the seek snap tolerance in milliseconds, 0 when disabled
+ **/
+gint
+bacon_video_widget_get_snap_tolerance (BaconVideoWidget *bvw)
+{
+  g_return_val_if_fail (BACON_IS_VIDEO_WIDGET (bvw), 0);
+
+  return bvw->snap_tolerance;
+}
+
+/**
+ * bacon_video_widget_set_seek_intent:
+ * @bvw: a #BaconVideoWidget
+ * @position: the position the user is about to seek to, between 0 and 1,
+ * or a negative value once the user moved away
+ *
+ * Lets btdemux start downloading the window at @position before the seek
+ * comes, below the priority of what is being played.
+ **/
+void
+bacon_video_widget_set_seek_intent (BaconVideoWidget *bvw, double position)
+{
+  GstStructure *layout = NULL;
+  gint64 size, offset = -1;
+
+  g_return_if_fail (BACON_IS_VIDEO_WIDGET (bvw));
+
+  if (!bvw->btdemux)
+    return;
+
+  if (position >= 0.0)
+  {
+    g_object_get (bvw->btdemux, "stream-layout", &layout, NULL);
+    if (layout == NULL)
+      return;
+
+    /* proportionally, like a seek does with no index at hand */
+    if (gst_structure_get_int64 (layout, "size", &size) && size > 0)
+      offset = (gint64) (CLAMP (position, 0.0, 1.0) * (size - 1));
+    gst_structure_free (layout);
+
+    if (offset < 0)
+      return;
+  }
+
+          printf ("(bacon_video_widget_set_seek_intent) position %.3f, prefetch offset %" G_GINT64_FORMAT "\n",
+              position, offset);
+
+  g_object_set (bvw->btdemux, "prefetch-offset", offset, NULL);
+}
+
+/**
+ * bacon_video_widget_set_prefetch_offset:
+ * @bvw: a #BaconVideoWidget
+ * @offset: a byte offset in the current stream, or -1 for none
+ *
+ * Like bacon_video_widget_set_seek_intent(), for a position already known as
+ * a byte offset, such as where the stream was left last time. It can be set
+ * right after opening, before the stream starts.
+ **/
+void
+bacon_video_widget_set_prefetch_offset (BaconVideoWidget *bvw, gint64 offset)
+{
+  g_return_if_fail (BACON_IS_VIDEO_WIDGET (bvw));
+
+  if (!bvw->btdemux)
+    return;
+
+          printf ("(bacon_video_widget_set_prefetch_offset) prefetch offset %" G_GINT64_FORMAT "\n", offset);
+
+  g_object_set (bvw->btdemux, "prefetch-offset", MAX (offset, -1), NULL);
+}
+
+/* Hand btdemux the hotspot settings. It works in bytes, so the skips become
+ * byte offsets at the average bitrate of the stream, none until its length is known */
+static void
+bvw_update_hotspots (BaconVideoWidget *bvw)
+{
+  GstStructure *layout = NULL;
+  GValue skips = G_VALUE_INIT;
+  gint64 size = 0;
+
+  if (!bvw->btdemux)
+    return;
+
+  if (bvw->stream_length > 0 && bvw->skip_offsets)
+  {
+    g_object_get (bvw->btdemux, "stream-layout", &layout, NULL);
+    if (layout)
+    {
+      gst_structure_get_int64 (layout, "size", &size);
+      gst_structure_free (layout);
+    }
+  }
+
+  g_value_init (&skips, GST_TYPE_ARRAY);
+  for (guint i = 0; size > 0 && i < bvw->skip_offsets->len; i++)
+  {
+    GValue skip = G_VALUE_INIT;
+
+    g_value_init (&skip, G_TYPE_INT64);
+    g_value_set_int64 (&skip, (gint64) ((gdouble) g_array_index (bvw->skip_offsets, gint64, i) /
+                                        bvw->stream_length * size));
+    gst_value_array_append_and_take_value (&skips, &skip);
+  }
+
+  g_object_set_property (G_OBJECT (bvw->btdemux), "hotspot-skips", &skips);
+  g_value_unset (&skips);
+
+  g_object_set (bvw->btdemux,
+                "hotspot-count", (guint) bvw->hotspot_count,
+                "hotspot-share", (guint) bvw->hotspot_share,
+                NULL);
+}
+
+/**
+ * bacon_video_widget_set_skip_offsets:
+ * @bvw: a #BaconVideoWidget
+ * @offsets: (array length=n_offsets): the relative seeks offered to the user,
+ * in milliseconds, negative ones backwards
+ * @n_offsets: the number of @offsets
+ *
+ * Lets btdemux download the start of the windows these seeks would land on
+ * in the background, within the #BaconVideoWidget:hotspot-share.
+ **/
+void
+bacon_video_widget_set_skip_offsets (BaconVideoWidget *bvw,
+                                     const gint64     *offsets,
+                                     guint             n_offsets)
+{
+  g_return_if_fail (BACON_IS_VIDEO_WIDGET (bvw));
+
+  g_clear_pointer (&bvw->skip_offsets, g_array_unref);
+  if (n_offsets > 0)
+  {
+    bvw->skip_offsets = g_array_sized_new (FALSE, FALSE, sizeof (gint64), n_offsets);
+    g_array_append_vals (bvw->skip_offsets, offsets, n_offsets);
+  }
+
+  bvw_update_hotspots (bvw);
+}
+
+/**
+ * bacon_video_widget_get_stream_offset:
+ * @bvw: a #BaconVideoWidget
+ *
+ * Returns: the byte offset btdemux reads the current position from: the
+ * keyframe at or before it once the file is indexed, the last piece pushed
+ * before that, or -1 when unknown
+ **/
+gint64
+bacon_video_widget_get_stream_offset (BaconVideoWidget *bvw)
+{
+  gint64 offset = -1;
+
+  g_return_val_if_fail (BACON_IS_VIDEO_WIDGET (bvw), -1);
+
+  if (bvw->btdemux)
+    g_object_get (bvw->btdemux, "stream-offset", &offset, NULL);
+
+  return offset;
+}
+
+/**
+ * bacon_video_widget_get_info_hash:
+ * @bvw: a #BaconVideoWidget
+ *
+ * Returns: (transfer full): the hex info-hash of the torrent being played,
+ * known once it is added, or %NULL
+ **/
+char *
+bacon_video_widget_get_info_hash (BaconVideoWidget *bvw)
+{
+  char *info_hash = NULL;
+
+  g_return_val_if_fail (BACON_IS_VIDEO_WIDGET (bvw), NULL);
+
+  if (bvw->btdemux)
+    g_object_get (bvw->btdemux, "info-hash", &info_hash, NULL);
+
+  return info_hash;
+}
+
+/**
+ * bacon_video_widget_get_preview_async:
+ * @bvw: a #BaconVideoWidget
+ * @position: the position to preview, between 0 and 1
+ * @cancellable: a #GCancellable, or %NULL
+ * @callback: called with the thumbnail
+ * @user_data: data for @callback
+ *
+ * Looks up a thumbnail of the current stream at @position. Only the downloaded
+ * pieces are decoded, nothing is fetched for it: where they are missing the
+ * nearest thumbnail taken before is used.
+ **/
+void
+bacon_video_widget_get_preview_async (BaconVideoWidget    *bvw,
+                                      double               position,
+                                      GCancellable        *cancellable,
+                                      GAsyncReadyCallback  callback,
+                                      gpointer             user_data)
+{
+  GstStructure *layout = NULL;
+  GstBtBitset *piece_matrix = NULL;
+  const gchar *info_hash, *location;
+  gint64 offset, size, step, piece;
+  gint piece_length, window, file_index;
+  gboolean local = FALSE;
+
+  g_return_if_fail (BACON_IS_VIDEO_WIDGET (bvw));
+
+  if (bvw->btdemux)
+    g_object_get (bvw->btdemux, "stream-layout", &layout, "piece-matrix", &piece_matrix, NULL);
+
+  if (layout == NULL || bvw->stream_length <= 0 ||
+      !gst_structure_get (layout,
+                          "file-offset", G_TYPE_INT64, &offset,
+                          "size", G_TYPE_INT64, &size,
+                          "piece-length", G_TYPE_INT, &piece_length,
+                          "window-pieces", G_TYPE_INT, &window,
+                          "file-index", G_TYPE_INT, &file_index, NULL) ||
+      (info_hash = gst_structure_get_string (layout, "info-hash")) == NULL ||
+      (location = gst_structure_get_string (layout, "location")) == NULL ||
+      size <= 0 || piece_length <= 0)
+  {
+    g_task_report_new_error (NULL, callback, user_data, bacon_video_widget_get_preview_async,
+                             G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "No stream to preview");
+    goto done;
+  }
+
+  if (bvw->preview == NULL)
+    bvw->preview = bvw_preview_new ();
+
+  /* the thumbnail is taken at the start of the step, that is where the pieces must be */
+  step = (gint64) (CLAMP (position, 0.0, 1.0) * bvw->stream_length) / BVW_PREVIEW_STEP * BVW_PREVIEW_STEP;
+  piece = (offset + (gint64) ((gdouble) step / bvw->stream_length * (size - 1))) / piece_length;
+  if (piece_matrix)
+    local = bvw_snap_window_is_local (piece_matrix, piece, offset / piece_length,
+                                      (offset + size - 1) / piece_length, MAX (window, 1));
+
+  bvw_preview_lookup_async (bvw->preview, info_hash, file_index, location, step, local,
+                            cancellable, callback, user_data);
+
+done:
+  if (layout)
+    gst_structure_free (layout);
+  if (piece_matrix)
+    gst_bt_bitset_unref (piece_matrix);
+}
+
+/**
+ * bacon_video_widget_get_preview_finish:
+ * @bvw: a #BaconVideoWidget
+ * @result: the #GAsyncResult
+ * @error: a #GError, or %NULL
+ *
+ * Returns: (transfer full): the thumbnail, or %NULL with @error set
+ **/
+GdkPixbuf *
+bacon_video_widget_get_preview_finish (BaconVideoWidget  *bvw,
+                                       GAsyncResult      *result,
+                                       GError           **error)
+{
+  g_return_val_if_fail (BACON_IS_VIDEO_WIDGET (bvw), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
 /* Search for the color balance channel corresponding to type and return it. */
 static GstColorBalanceChannel *
 bvw_get_color_balance_channel (GstColorBalance * color_balance,
@@ -3892,6 +4915,7 @@ bacon_video_widget_update_and_get_stream_length (BaconVideoWidget * bvw)
     if (gst_element_query_duration (bvw->decodebin, GST_FORMAT_TIME, &len) && len != -1) {
       //in milliseconds
       bvw->stream_length = len / GST_MSECOND;
+      bvw_update_hotspots (bvw);
     }
   }
 
@@ -4601,6 +5625,115 @@ bacon_video_widget_error_quark (void)
 
 
 
+/* Take scaletempo out of the audio chain, once it is drained, or right away when
+ * nothing flows. Called with the capsfilter src pad idle */
+static void
+bvw_pitch_control_unlink (BaconVideoWidget *bvw)
+{
+  if (GST_OBJECT_PARENT (bvw->audio_pitchcontrol) == NULL)
+    return;
+
+  gst_element_unlink_many (bvw->audio_capsfilter, bvw->audio_pitch_convert,
+                           bvw->audio_pitchcontrol, bvw->volume_plugin, NULL);
+  gst_element_set_state (bvw->audio_pitch_convert, GST_STATE_NULL);
+  gst_element_set_state (bvw->audio_pitchcontrol, GST_STATE_NULL);
+  gst_bin_remove_many (GST_BIN (bvw->audio_bin), bvw->audio_pitch_convert,
+                       bvw->audio_pitchcontrol, NULL);
+  gst_element_link (bvw->audio_capsfilter, bvw->volume_plugin);
+
+            printf ("(bvw_pitch_control_unlink) scaletempo bypassed\n");
+}
+
+/* the EOS we sent into scaletempo came out, everything it held went downstream */
+static GstPadProbeReturn
+bvw_pitch_control_drained_cb (GstPad          *pad,
+                              GstPadProbeInfo *info,
+                              gpointer         user_data)
+{
+  BaconVideoWidget *bvw = BACON_VIDEO_WIDGET (user_data);
+
+  if (GST_EVENT_TYPE (GST_PAD_PROBE_INFO_DATA (info)) != GST_EVENT_EOS)
+    return GST_PAD_PROBE_PASS;
+
+  gst_pad_remove_probe (pad, GST_PAD_PROBE_INFO_ID (info));
+  bvw_pitch_control_unlink (bvw);
+
+  /* the sinks must not see it */
+  return GST_PAD_PROBE_DROP;
+}
+
+/* No data flows through the capsfilter src pad, relink the audio chain to what the
+ * rate wants: insert scaletempo, or drain it with an EOS before taking it out so the
+ * samples it buffered are still played */
+static GstPadProbeReturn
+bvw_pitch_control_idle_cb (GstPad          *pad,
+                           GstPadProbeInfo *info,
+                           gpointer         user_data)
+{
+  BaconVideoWidget *bvw = BACON_VIDEO_WIDGET (user_data);
+  gboolean wanted = g_atomic_int_get (&bvw->pitch_control_wanted);
+  gboolean linked = GST_OBJECT_PARENT (bvw->audio_pitchcontrol) != NULL;
+  GstPad *srcpad, *sinkpad;
+  gulong probe_id;
+
+  if (wanted == linked)
+    return GST_PAD_PROBE_REMOVE;
+
+  if (wanted)
+  {
+    gst_element_unlink (bvw->audio_capsfilter, bvw->volume_plugin);
+    gst_bin_add_many (GST_BIN (bvw->audio_bin), bvw->audio_pitch_convert,
+                      bvw->audio_pitchcontrol, NULL);
+    gst_element_link_many (bvw->audio_capsfilter, bvw->audio_pitch_convert,
+                           bvw->audio_pitchcontrol, bvw->volume_plugin, NULL);
+    gst_element_sync_state_with_parent (bvw->audio_pitch_convert);
+    gst_element_sync_state_with_parent (bvw->audio_pitchcontrol);
+
+            printf ("(bvw_pitch_control_idle_cb) scaletempo linked in\n");
+
+    return GST_PAD_PROBE_REMOVE;
+  }
+
+  srcpad = gst_element_get_static_pad (bvw->audio_pitchcontrol, "src");
+  probe_id = gst_pad_add_probe (srcpad,
+                                GST_PAD_PROBE_TYPE_BLOCK | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+                                bvw_pitch_control_drained_cb, bvw, NULL);
+  sinkpad = gst_element_get_static_pad (bvw->audio_pitch_convert, "sink");
+  gst_pad_send_event (sinkpad, gst_event_new_eos ());
+  gst_object_unref (sinkpad);
+
+  /* not playing, there was nothing to drain */
+  if (GST_OBJECT_PARENT (bvw->audio_pitchcontrol) != NULL)
+  {
+    gst_pad_remove_probe (srcpad, probe_id);
+    bvw_pitch_control_unlink (bvw);
+  }
+  gst_object_unref (srcpad);
+
+  return GST_PAD_PROBE_REMOVE;
+}
+
+/* scaletempo only costs CPU and latency at the normal rate, keep it out of the audio
+ * chain unless bvw->rate asks for it. The relink happens once the capsfilter is idle */
+static void
+bvw_update_pitch_control (BaconVideoWidget *bvw)
+{
+  gboolean wanted = bvw->rate != FORWARD_RATE;
+  GstPad *pad;
+
+  if (bvw->audio_capsfilter == NULL || bvw->audio_pitchcontrol == NULL ||
+      wanted == g_atomic_int_get (&bvw->pitch_control_wanted))
+    return;
+
+  g_atomic_int_set (&bvw->pitch_control_wanted, wanted);
+
+  pad = gst_element_get_static_pad (bvw->audio_capsfilter, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_IDLE, bvw_pitch_control_idle_cb, bvw, NULL);
+  gst_object_unref (pad);
+}
+
+
+
 static gboolean
 bvw_set_playback_direction (BaconVideoWidget *bvw, gboolean forward)
 {
@@ -4620,6 +5753,13 @@ bvw_set_playback_direction (BaconVideoWidget *bvw, gboolean forward)
   retval = FALSE;
   target_rate = (forward ? FORWARD_RATE : REVERSE_RATE);
 
+  /* loops only play forwards */
+  if (!forward)
+  {
+    bvw->loop_start = -1;
+    bvw->loop_stop = -1;
+  }
+
   if (gst_element_query_position (bvw->pipeline, GST_FORMAT_TIME, &cur)) 
   {
 
@@ -4628,8 +5768,10 @@ bvw_set_playback_direction (BaconVideoWidget *bvw, gboolean forward)
 
     // GST_DEBUG ("Setting playback direction to %s at %"G_GINT64_FORMAT"", DIRECTION_STR, cur);
 
+    /* btdemux plays backwards from the keyframes alone, ask the decoders for the same */
     event = gst_event_new_seek (target_rate,
-                GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE,
+                GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE |
+                (forward ? 0 : GST_SEEK_FLAG_TRICKMODE | GST_SEEK_FLAG_TRICKMODE_KEY_UNITS),
                 GST_SEEK_TYPE_SET, forward ? cur : G_GINT64_CONSTANT (0),
                 GST_SEEK_TYPE_SET, forward ? G_GINT64_CONSTANT (0) : cur);
     if (gst_element_send_event (bvw->pipeline, event) == FALSE) 
@@ -4640,6 +5782,7 @@ bvw_set_playback_direction (BaconVideoWidget *bvw, gboolean forward)
     {
       gst_element_get_state (bvw->pipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
       bvw->rate = target_rate;
+      bvw_update_pitch_control (bvw);
       retval = TRUE;
     }
   } 
@@ -5327,8 +6470,11 @@ bacon_video_widget_init (BaconVideoWidget *bvw)
   g_type_class_ref (BVW_TYPE_ROTATION);
 
   bvw->cur_video_fileidx_within_tor = -1;
+  bvw->telemetry_level = BVW_TELEMETRY_FULL;
+  bvw->buffering_percent = 100;
   bvw->volume = -1.0;
   bvw->rate = FORWARD_RATE;
+  bvw->hotspot_share = DEFAULT_HOTSPOT_SHARE;
   bvw->tag_update_queue = g_async_queue_new_full ((GDestroyNotify) update_tags_delayed_data_destroy);
 
   g_mutex_init (&bvw->seek_mutex);
@@ -5338,6 +6484,8 @@ bacon_video_widget_init (BaconVideoWidget *bvw)
   bvw->clock = gst_system_clock_obtain ();
   bvw->seek_req_time = GST_CLOCK_TIME_NONE; //set to undefined clock time
   bvw->seek_time = -1;//set to inital undefined value (which -1 here)
+  bvw->loop_start = -1;
+  bvw->loop_stop = -1;
 
 #ifndef GST_DISABLE_GST_DEBUG
   if (_totem_gst_debug_cat == NULL) 
@@ -5393,8 +6541,9 @@ bacon_video_widget_init (BaconVideoWidget *bvw)
               bvw->decodebin = element_make_or_warn ("decodebin", "decodebin");
 
 
-              //adjusts the playback rate of a media stream
+              //adjusts the playback rate of a media stream, only linked in while rate != 1.0
               bvw->audio_pitchcontrol = element_make_or_warn ("scaletempo", "scaletempo");
+              bvw->audio_pitch_convert = element_make_or_warn ("audioconvert", "pitchconvert");
 
 
               // render video using OpenGL within a GTK application, taking advantage of OpenGL for enhanced visual effects
@@ -5415,6 +6564,7 @@ bacon_video_widget_init (BaconVideoWidget *bvw)
       !bvw->btdemux ||
       !bvw->decodebin ||
       !bvw->audio_pitchcontrol ||
+      !bvw->audio_pitch_convert ||
       !bvw->video_sink ||
       !audio_sink ||
       !bvw->volume_plugin ||
@@ -5502,11 +6652,11 @@ bacon_video_widget_init (BaconVideoWidget *bvw)
 
                        -------------------[audiosinkbin] ------------------------------------------------------------------------------
                        |                                                                                                              |
-     (ghost pad)       |        (sink)[audioconvert](src)  (sink)[capsfilter] (src) ---- (sink)[scaletempo](src) ---- (sink)[autoaudiosink](src)          |  (src)
+     (ghost pad)       |        (sink)[audioconvert](src)  (sink)[capsfilter] (src) ---- (sink)[volume](src) ---- (sink)[autoaudiosink](src)          |  (src)
               |        ---------------|--------------------------------------------------------------------------------|------------  |
               |_______________________|                                                                                |______________|
 
-  
+  while rate != 1.0, [audioconvert] ---- [scaletempo] sit between capsfilter and volume (see bvw_update_pitch_control)
 */
               /* Link the audiopitch element */
               // filter the capabilities (caps) of the media data being processed in a pipeline
@@ -5521,17 +6671,20 @@ bacon_video_widget_init (BaconVideoWidget *bvw)
               gst_bin_add_many (GST_BIN (bvw->audio_bin),
                                 bvw->audio_filter_convert,
                                 bvw->audio_capsfilter,
-                                bvw->audio_pitchcontrol,
                                 bvw->volume_plugin,
                                 audio_sink, 
                                 NULL);
 
+              //kept out of the bin at the normal rate, we hold them meanwhile
+              gst_object_ref_sink (bvw->audio_pitchcontrol);
+              gst_object_ref_sink (bvw->audio_pitch_convert);
+              bvw->pitch_control_wanted = FALSE;
+
 
               //link multiple GstElement instances together in sequence
               //connecting the output pad of one element to the input pad of the next
               gst_element_link_many (bvw->audio_filter_convert,
                                      bvw->audio_capsfilter,
-                                     bvw->audio_pitchcontrol,
                                      bvw->volume_plugin,
                                      audio_sink,
                                      NULL);
@@ -5724,14 +6877,39 @@ bacon_video_widget_set_rate (BaconVideoWidget *bvw,
     return retval;
   }
 
+  /* In the same direction the rate can change in place: nothing is flushed, btdemux
+   * keeps its window (only resized for the new rate) and we don't rebuffer.
+   * Flush only when the pipeline refuses it, or when scaletempo goes in or out of the
+   * audio chain: the sticky segment stays at the old rate after an instant rate
+   * change, a scaletempo linked in then would keep the pitch of rate 1.0 */
+  if ((new_rate > 0.0) == (bvw->rate > 0.0) &&
+      (bvw->audio_pitchcontrol == NULL ||
+       (new_rate != FORWARD_RATE) == (bvw->rate != FORWARD_RATE)))
+  {
+    event = gst_event_new_seek (new_rate,
+				GST_FORMAT_TIME, GST_SEEK_FLAG_INSTANT_RATE_CHANGE,
+				GST_SEEK_TYPE_NONE, 0,
+				GST_SEEK_TYPE_NONE, 0);
+    if (gst_element_send_event (bvw->pipeline, event))
+    {
+          printf ("(bacon_video_widget_set_rate) Changed rate to %f in place\n", new_rate);
+      bvw->rate = new_rate;
+      bvw_update_pitch_control (bvw);
+      return TRUE;
+    }
+          printf ("(bacon_video_widget_set_rate) Instant rate change refused, flushing\n");
+  }
+
   if (gst_element_query_position (bvw->pipeline, GST_FORMAT_TIME, &cur)) 
   {
     // GST_DEBUG ("Setting new rate at %"G_GINT64_FORMAT"", cur);
           printf ("(bacon_video_widget_set_rate) Setting new rate at %"G_GINT64_FORMAT" \n", cur);
+    /* an A-B loop goes on at the new rate */
     event = gst_event_new_seek (new_rate,
-				GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE,
+				GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE |
+				(bvw->loop_stop >= 0 ? GST_SEEK_FLAG_SEGMENT : 0),
 				GST_SEEK_TYPE_SET, cur,
-				GST_SEEK_TYPE_SET, GST_CLOCK_TIME_NONE);
+				GST_SEEK_TYPE_SET, bvw->loop_stop >= 0 ? bvw->loop_stop * GST_MSECOND : GST_CLOCK_TIME_NONE);
     if (gst_element_send_event (bvw->pipeline, event) == FALSE) 
     {
           printf ("(bacon_video_widget_set_rate) Failed to change rate\n");
@@ -5742,6 +6920,7 @@ bacon_video_widget_set_rate (BaconVideoWidget *bvw,
     {
       gst_element_get_state (bvw->pipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
       bvw->rate = new_rate;
+      bvw_update_pitch_control (bvw);
       retval = TRUE;
     }
   } 
@@ -89,6 +89,32 @@ gboolean bacon_video_widget_seek_time		 (BaconVideoWidget *bvw,
 // 						  gboolean forward,
 // 						  GError **error);
 gboolean bacon_video_widget_can_direct_seek	 (BaconVideoWidget *bvw);
+gboolean bacon_video_widget_set_loop		 (BaconVideoWidget *bvw,
+						  gint64 start,
+						  gint64 stop);
+gboolean bacon_video_widget_get_loop		 (BaconVideoWidget *bvw,
+						  gint64 *start,
+						  gint64 *stop);
+void bacon_video_widget_set_snap_tolerance	 (BaconVideoWidget *bvw,
+						  gint tolerance);
+gint bacon_video_widget_get_snap_tolerance	 (BaconVideoWidget *bvw);
+void bacon_video_widget_set_seek_intent	 (BaconVideoWidget *bvw,
+						  double position);
+void bacon_video_widget_set_prefetch_offset	 (BaconVideoWidget *bvw,
+						  gint64 offset);
+gint64 bacon_video_widget_get_stream_offset	 (BaconVideoWidget *bvw);
+char *bacon_video_widget_get_info_hash		 (BaconVideoWidget *bvw);
+void bacon_video_widget_set_skip_offsets	 (BaconVideoWidget *bvw,
+						  const gint64 *offsets,
+						  guint n_offsets);
+void bacon_video_widget_get_preview_async	 (BaconVideoWidget *bvw,
+						  double position,
+						  GCancellable *cancellable,
+						  GAsyncReadyCallback callback,
+						  gpointer user_data);
+GdkPixbuf *bacon_video_widget_get_preview_finish (BaconVideoWidget *bvw,
+						  GAsyncResult *result,
+						  GError **error);
 double bacon_video_widget_get_position           (BaconVideoWidget *bvw);
 gint64 bacon_video_widget_get_current_time       (BaconVideoWidget *bvw);
 gint64 bacon_video_widget_update_and_get_stream_length      (BaconVideoWidget *bvw);
@@ -270,6 +296,28 @@ void bacon_video_widget_set_rotation		 (BaconVideoWidget *bvw,
 						  BvwRotation       rotation);
 BvwRotation bacon_video_widget_get_rotation	 (BaconVideoWidget *bvw);
 
+/**
+ * BvwTelemetryLevel:
+ * @BVW_TELEMETRY_FULL: the window and its controls are shown, update everything
+ * @BVW_TELEMETRY_REDUCED: the window is shown but not its controls, no torrent
+ * progress and a slower time tick
+ * @BVW_TELEMETRY_MINIMAL: nobody is watching, no torrent progress nor time tick,
+ * btdemux keeps only the alerts it needs for streaming
+ *
+ * How much of the playback and torrent progress the UI shows, as set by
+ * bacon_video_widget_set_telemetry_level().
+ **/
+typedef enum {
+	BVW_TELEMETRY_FULL    = 0,
+	BVW_TELEMETRY_REDUCED = 1,
+	BVW_TELEMETRY_MINIMAL = 2
+} BvwTelemetryLevel;
+
+void bacon_video_widget_set_telemetry_level	 (BaconVideoWidget *bvw,
+						  BvwTelemetryLevel level);
+BvwTelemetryLevel bacon_video_widget_get_telemetry_level
+						 (BaconVideoWidget *bvw);
+
 int bacon_video_widget_get_video_property        (BaconVideoWidget *bvw,
 						  BvwVideoProperty type);
 void bacon_video_widget_set_video_property       (BaconVideoWidget *bvw,
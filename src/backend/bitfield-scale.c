@@ -3,9 +3,23 @@
  */
 
 
+#include <math.h>
+#include <string.h>
+
 #include "bitfield-scale.h"
 
 
+/* the pointer has to rest this long within INTENT_MOVE_PX pixels
+ * before we guess the user is about to seek there */
+#define INTENT_DWELL_MS 300
+#define INTENT_MOVE_PX 6
+
+enum {
+    SIGNAL_SEEK_INTENT,
+    LAST_SIGNAL
+};
+
+static guint bitfield_scale_signals[LAST_SIGNAL] = { 0 };
 
 
 struct _BitfieldScale
@@ -18,10 +32,31 @@ struct _BitfieldScale
     gint num_pieces;/*total number of pieces in torrent*/
     gint block_per_piece_normal;/*num of blocks per piece for non-last pieces*/
     gint block_in_last_piece;/*num of blocks for the last piece*/
-    guint8 *have_bitfield;/*bitfield represent what pieces we already have*/
-    UnfinishedPieceInfo*  unfinished_block_bitfield;/*bitfield of blocks within the piece for partial-downloaded pieces*/
+    GstBtBitset *have;/*pieces we already have: block_state->have, then whatever finished since*/
+    GstBtBlockState *block_state;/*shared with btdemux, pieces bitmap plus block bitfields of partial-downloaded pieces only*/
+    GstBtBitset *piece_matrix;/*finished pieces bitset of btdemux, and the generation we synced have to*/
+    guint64 piece_matrix_generation;
+    GHashTable *downloading_index;/*piece index -> index+1 of the piece in downloading_blocks*/
+
+    /*rendering cache, one column per pixel, only dirty columns are re-rendered*/
+    cairo_surface_t *surface;
+    gint surface_width;
+    gint surface_height;
+    guint8 *dirty_columns;
+    gboolean any_dirty;
+
     GMutex lock;  // Mutex for synchronizing access to downloading_blocks
 
+    /*hover and drag intent, where the pointer rests and the position announced by
+     *"seek-intent" for it, -1 while none is*/
+    guint intent_timeout_id;
+    gdouble intent_x;
+    gdouble intent_position;
+
+    /*thumbnail of the intent position, above the pointer*/
+    GtkWidget *preview_popover;
+    GtkWidget *preview_image;
+
   
 };
 
@@ -184,6 +219,247 @@ is_block_bitfield_complete_cur_piece (guint8 *bitfield, gint total_bits_normal,
 
 
 
+/***************************rendering******************************/
+/* The bar is rendered into an image surface, one column per pixel.
+ * A column aggregates all the blocks it covers: green when mostly had, orange
+ * when some block is downloading, empty otherwise, and consecutive columns of
+ * the same state are filled with a single rectangle.
+ * Updates only mark the columns covering the changed blocks dirty, draw then
+ * re-renders those columns and blits the surface */
+
+typedef enum {
+    COLUMN_EMPTY,
+    COLUMN_DOWNLOADING,
+    COLUMN_HAVE
+} BitfieldScaleColumn;
+
+
+static gint
+bitfield_scale_blocks_in_piece (BitfieldScale *self, gint piece)
+{
+    return piece == self->num_pieces - 1 ? self->block_in_last_piece : self->block_per_piece_normal;
+}
+
+
+/* mark the columns covering blocks [b_start, b_end) to be re-rendered */
+static void
+bitfield_scale_invalidate_blocks (BitfieldScale *self, gint64 b_start, gint64 b_end)
+{
+    if (self->surface == NULL || self->num_blocks <= 0 || b_start >= b_end)
+    {
+        return;
+    }
+
+    gint x0 = (gint) (b_start * self->surface_width / self->num_blocks);
+    gint x1 = (gint) (((b_end - 1) * self->surface_width) / self->num_blocks);
+
+    x0 = CLAMP (x0, 0, self->surface_width - 1);
+    x1 = CLAMP (x1, 0, self->surface_width - 1);
+    memset (self->dirty_columns + x0, 1, x1 - x0 + 1);
+    self->any_dirty = TRUE;
+}
+
+
+static void
+bitfield_scale_invalidate_piece (BitfieldScale *self, gint piece)
+{
+    gint64 first = (gint64) piece * self->block_per_piece_normal;
+
+    bitfield_scale_invalidate_blocks (self, first, first + bitfield_scale_blocks_in_piece (self, piece));
+}
+
+
+static void
+bitfield_scale_invalidate_all (BitfieldScale *self)
+{
+    if (self->surface == NULL)
+    {
+        return;
+    }
+    memset (self->dirty_columns, 1, self->surface_width);
+    self->any_dirty = TRUE;
+}
+
+
+/* add the part of blocks [b_start, b_end) falling in each column of [x0, x1) to acc */
+static void
+bitfield_scale_accumulate (gdouble *acc, gint x0, gint x1, gdouble col_blocks, gdouble b_start, gdouble b_end)
+{
+    gint first = MAX (x0, (gint) floor (b_start / col_blocks));
+    gint last = MIN (x1 - 1, (gint) ceil (b_end / col_blocks) - 1);
+
+    for (gint x = first; x <= last; x++)
+    {
+        gdouble overlap = MIN (b_end, (x + 1) * col_blocks) - MAX (b_start, x * col_blocks);
+        if (overlap > 0)
+        {
+            acc[x - x0] += overlap;
+        }
+    }
+}
+
+
+/* add the blocks of the piece i we don't have yet to have (the ones of its partial
+ * bitfield) and to busy (the ones downloading) */
+static void
+bitfield_scale_render_missing (BitfieldScale *self, gint i, gdouble *have, gdouble *busy,
+    gint x0, gint x1, gdouble col_blocks)
+{
+    gdouble first = (gdouble) i * self->block_per_piece_normal;
+    gint n_blocks = bitfield_scale_blocks_in_piece (self, i);
+
+    guint8 *partial = gst_bt_block_state_get_partial (self->block_state, i);
+    guint8 *prog = NULL;
+    guint prog_len = 0;
+
+    if (self->downloading_index != NULL)
+    {
+        gint d_idx = GPOINTER_TO_INT (g_hash_table_lookup (self->downloading_index, GINT_TO_POINTER (i))) - 1;
+        if (d_idx >= 0)
+        {
+            prog = self->downloading_blocks->progress + self->downloading_blocks->block_offsets[d_idx];
+            prog_len = self->downloading_blocks->block_offsets[d_idx+1] - self->downloading_blocks->block_offsets[d_idx];
+        }
+    }
+
+    //untouched piece
+    if (partial == NULL && prog == NULL)
+    {
+        return;
+    }
+
+    for (gint j = 0; j < n_blocks; j++)
+    {
+        if (partial != NULL && is_bit_set (partial, (self->block_per_piece_normal+7)/8, j))
+        {
+            bitfield_scale_accumulate (have, x0, x1, col_blocks, first + j, first + j + 1);
+        }
+        else if (j < prog_len && prog[j] > 0)
+        {
+            bitfield_scale_accumulate (busy, x0, x1, col_blocks, first + j, first + j + 1);
+        }
+    }
+}
+
+
+/* re-render the columns [x0, x1) of the surface from the model */
+static void
+bitfield_scale_render_columns (BitfieldScale *self, gint x0, gint x1)
+{
+    gdouble col_blocks = (gdouble) self->num_blocks / self->surface_width;
+    gint n = x1 - x0;
+    gdouble *have = g_new0 (gdouble, n);
+    gdouble *busy = g_new0 (gdouble, n);
+
+    gint64 b0 = (gint64) floor (x0 * col_blocks);
+    gint64 b1 = MIN ((gint64) ceil (x1 * col_blocks), (gint64) self->num_blocks);
+    gint p0 = b0 / self->block_per_piece_normal;
+    gint p1 = MIN ((gint) ((b1 + self->block_per_piece_normal - 1) / self->block_per_piece_normal), self->num_pieces);
+
+    //the pieces we have a run at a time, the ones in between a piece at a time
+    guint run_start, run_end;
+    gint i = p0;
+    while (i < p1)
+    {
+        if (!gst_bt_bitset_next_set_run (self->have, i, p1, &run_start, &run_end))
+        {
+            run_start = run_end = p1;
+        }
+
+        if (i == (gint) run_start)
+        {
+            gdouble last = (gdouble) (run_end - 1) * self->block_per_piece_normal +
+                bitfield_scale_blocks_in_piece (self, run_end - 1);
+
+            bitfield_scale_accumulate (have, x0, x1, col_blocks,
+                (gdouble) run_start * self->block_per_piece_normal, last);
+            i = run_end;
+            continue;
+        }
+
+        for (; i < (gint) run_start; i++)
+        {
+            bitfield_scale_render_missing (self, i, have, busy, x0, x1, col_blocks);
+        }
+    }
+
+    cairo_t *cr = cairo_create (self->surface);
+
+    //clear the columns
+    cairo_set_operator (cr, CAIRO_OPERATOR_CLEAR);
+    cairo_rectangle (cr, x0, 0, n, self->surface_height);
+    cairo_fill (cr);
+    cairo_set_operator (cr, CAIRO_OPERATOR_OVER);
+
+    //one rectangle per run of columns in the same state
+    gint run_start = 0;
+    BitfieldScaleColumn run_state = COLUMN_EMPTY;
+    for (gint x = 0; x <= n; x++)
+    {
+        BitfieldScaleColumn state = COLUMN_EMPTY;
+
+        if (x < n)
+        {
+            gdouble covered = MIN (col_blocks, (gdouble) self->num_blocks - (x0 + x) * col_blocks);
+
+            if (have[x] * 2 >= covered)
+            {
+                state = COLUMN_HAVE;
+            }
+            else if (busy[x] > 0)
+            {
+                state = COLUMN_DOWNLOADING;
+            }
+        }
+
+        if (x == n || state != run_state)
+        {
+            if (x > run_start && run_state != COLUMN_EMPTY)
+            {
+                if (run_state == COLUMN_HAVE)
+                {
+                    cairo_set_source_rgb (cr, 0.0, 1.0, 0.0); // Green color
+                }
+                else
+                {
+                    cairo_set_source_rgb (cr, 1.0, 0.647, 0.0); // Orange color
+                }
+                cairo_rectangle (cr, x0 + run_start, 0, x - run_start, self->surface_height);
+                cairo_fill (cr);
+            }
+            run_start = x;
+            run_state = state;
+        }
+    }
+
+    cairo_destroy (cr);
+    g_free (have);
+    g_free (busy);
+}
+
+
+static void
+bitfield_scale_ensure_surface (BitfieldScale *self, gint width, gint height)
+{
+    if (self->surface != NULL && self->surface_width == width && self->surface_height == height)
+    {
+        return;
+    }
+
+    if (self->surface != NULL)
+    {
+        cairo_surface_destroy (self->surface);
+    }
+    self->surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+    self->surface_width = width;
+    self->surface_height = height;
+
+    g_free (self->dirty_columns);
+    self->dirty_columns = g_malloc (width);
+    bitfield_scale_invalidate_all (self);
+}
+
+
 static gboolean
 bitfield_scale_draw (GtkWidget* widget, cairo_t *cr)
 {
@@ -193,177 +469,153 @@ bitfield_scale_draw (GtkWidget* widget, cairo_t *cr)
     //Draw Bitfield
     BitfieldScale *self = BITFIELD_SCALE (widget);
 
-    
-    if(FALSE) {
-        return FALSE;
-    }
-    
-    
     if (self == NULL || 
         self->num_blocks <= 0 || 
         self->num_pieces <= 0 || 
         self->block_per_piece_normal <=0 || 
         self->block_in_last_piece <= 0 || 
-        self->have_bitfield==NULL || 
-        self->unfinished_block_bitfield==NULL
+        self->have==NULL || 
+        self->block_state==NULL
     )
     {                       
         return FALSE;
     }
-        
-                            // printf ("(bitfield_scale_draw) start to draw\n");
 
     GtkAllocation allocation;
-    gint width, height;
-    double segment_width;
     gtk_widget_get_allocation (widget, &allocation);
-    width = allocation.width;
-    height = allocation.height;
+    if (allocation.width <= 0 || allocation.height <= 0)
+    {
+        return FALSE;
+    }
 
  g_mutex_lock(&self->lock);/****************************************************************************/
 
-    //the little segment represent a block
-    segment_width = (double) width / self->num_blocks;
-
-    //Iterate each piece (Sequentially)
-    for (int i=0; i < self->num_pieces; i++) 
-    {
-        gint block_index;
-        
-        // if this piece is the one we're downloading
-        // if downloading_blocks is NULL, Loop will not entered
-        // from piece_info_alert, but it may not be accurate (aka. even when i keep downloading from zero to whole torrent, 
-        // the bitfield still not complete) , So, we should also use piece_finished_alert as a fallback to mark whole piece completed 
-        // if this piece not colored in bitfield
-        // This may Looks stupid, but just do what you can do at your *level*, don't want to endless improvement, we need a closure
-        // if it still sucks, just f_Uck it
-        if(self->downloading_blocks)
+    bitfield_scale_ensure_surface (self, allocation.width, allocation.height);
+
+    //re-render the dirty columns only, run by run
+    if (self->any_dirty)
+    {
+        gint x = 0;
+        while (x < self->surface_width)
         {
-            for (gint d_idx=0; d_idx<self->downloading_blocks->size; ++d_idx) 
+            if (!self->dirty_columns[x])
             {
-                gdouble block_progress = 0;
+                x++;
+                continue;
+            }
 
-                gint current_piece_index = self->downloading_blocks->array[d_idx].piece_index;
+            gint start = x;
+            while (x < self->surface_width && self->dirty_columns[x])
+            {
+                self->dirty_columns[x++] = 0;
+            }
+            bitfield_scale_render_columns (self, start, x);
+        }
+        self->any_dirty = FALSE;
+    }
 
-                // If this is the piece we're currently downloading, get its block info.
-                if (current_piece_index == i) 
-                {
-                    UnfinishedPieceInfo info = self->unfinished_block_bitfield[i];
-                    
-                    guint8* prog = self->downloading_blocks->array[d_idx].blocks_progress;
+    cairo_set_source_surface (cr, self->surface, 0, 0);
+    cairo_paint (cr);
 
-                    gdouble is_last_piece = (info.piece_index==self->num_pieces-1);
+g_mutex_unlock(&self->lock);/**************************************************************************************/
 
-                    gint blocks_bitfield_len = is_last_piece ? (self->block_in_last_piece+7)/8 : (self->block_per_piece_normal+7)/8;
+    return FALSE;
+}
 
-                    if(!prog)
-                    {
-                        continue;
-                    }
 
-                    //if it is last piece
-                    guint b_idx_end = self->block_per_piece_normal;
-                    if(current_piece_index == self->num_pieces-1)
-                    {
-                        b_idx_end = self->block_in_last_piece;
-                    }
 
-                    //loop through every block within this piece
-                    for (gint b_idx=0; b_idx<b_idx_end; ++b_idx)
-                    {
-                        if(prog[b_idx]) 
-                        {
-                            block_progress = prog[b_idx]/100;
-                        }
-
-                        // Calculate the filled width based on progress.
-                        double filled_width = block_progress * segment_width;
-                        cairo_set_source_rgb (cr, 1.0, 0.647, 0.0); // Orange color
-                        // Draw the block's progress.
-                        cairo_rectangle (cr, i*self->block_per_piece_normal*segment_width+b_idx*segment_width, 0, 
-                        filled_width, height);
-                        cairo_fill (cr);
-
-                        if (block_progress >= 1.0) 
-                        {   
-                            // Update the unfinished_block_bitfield to mark this block as downloaded.
-                            set_bit_in_bitfield (info.blocks_bitfield, blocks_bitfield_len, b_idx);
-                        }
-                    }
 
-                    // Check if the entire piece is downloaded by checking all blocks in the piece.
-                    if (is_block_bitfield_complete_cur_piece (info.blocks_bitfield,  self->block_per_piece_normal, self->block_in_last_piece, is_last_piece))
-                    {
-                        // Mark the entire piece as downloaded in the have_bitfield.
-                        set_bit_in_bitfield (self->have_bitfield, (self->num_pieces+7)/8,  i);
-                    } 
-                }
-            }
-        }
 
 
-        // resume data
-        if (is_bit_set (self->have_bitfield, (self->num_pieces+7)/8, i)) 
-        { 
-            cairo_set_source_rgb (cr, 0.0, 1.0, 0.0); // Green color
-            gint block_width = (i < self->num_pieces - 1) ? self->block_per_piece_normal : self->block_in_last_piece;
+/*position of x within the trough, between 0 and 1*/
+static gdouble
+bitfield_scale_position_at (BitfieldScale *self, gdouble x)
+{
+    GdkRectangle rect;
 
-            cairo_rectangle (cr, i * self->block_per_piece_normal * segment_width, 0, 
-                block_width * segment_width, height);
+    gtk_range_get_range_rect (GTK_RANGE (self), &rect);
+    if (rect.width <= 0)
+    {
+        return 0.0;
+    }
 
-            cairo_fill(cr);
-        }
-        else 
-        { 
-            //non-last piece case
-            if (i < self->num_pieces - 1) 
-            {
-                // For non-last pieces, we know the block count is normal.
-                for (int j=0; j < self->block_per_piece_normal; j++) 
-                {
-                    UnfinishedPieceInfo info = self->unfinished_block_bitfield[i];
-            
-                    if (is_bit_set (info.blocks_bitfield, (self->block_per_piece_normal+7)/8, j))
-                    {
-                        cairo_set_source_rgb (cr, 0.0, 1.0, 0.0); // Green color
-                        cairo_rectangle (cr, i * self->block_per_piece_normal * segment_width + j * segment_width, 0, 
-                        segment_width, height);
-                        cairo_fill (cr);
-                    }
-                }
-            } 
-            //last piece case
-            else 
-            {
-                // For the last piece, use the block_in_last_piece count.
-                for (int j = 0; j < self->block_in_last_piece; j++) 
-                {
-                    UnfinishedPieceInfo info = self->unfinished_block_bitfield[i];
-                    // `j` is whthin [0, block_in_last_piece]
-                    if (is_bit_set (info.blocks_bitfield, (self->block_in_last_piece+7)/8, j)) 
-                    {
-                        cairo_set_source_rgb (cr, 0.0, 1.0, 0.0); // Green color
-                        cairo_rectangle (cr, i*self->block_per_piece_normal*segment_width+j*segment_width, 0, 
-                        segment_width, height);
-                        cairo_fill (cr);
-                    }                    
-                }
-            }
-        }
+    return CLAMP ((x - rect.x) / rect.width, 0.0, 1.0);
+}
+
+static void
+bitfield_scale_cancel_intent (BitfieldScale *self)
+{
+    if (self->intent_timeout_id != 0)
+    {
+        g_source_remove (self->intent_timeout_id);
+        self->intent_timeout_id = 0;
     }
 
-g_mutex_unlock(&self->lock);/**************************************************************************************/
+    if (self->intent_position >= 0.0)
+    {
+        self->intent_position = -1.0;
+        bitfield_scale_set_preview (self, NULL);
+        g_signal_emit (self, bitfield_scale_signals[SIGNAL_SEEK_INTENT], 0, -1.0);
+    }
+}
+
+static gboolean
+bitfield_scale_intent_timeout (BitfieldScale *self)
+{
+    self->intent_timeout_id = 0;
+    self->intent_position = bitfield_scale_position_at (self, self->intent_x);
+
+                        printf ("(bitfield_scale_intent_timeout) pointer rests at %.3f\n", self->intent_position);
+
+    g_signal_emit (self, bitfield_scale_signals[SIGNAL_SEEK_INTENT], 0, self->intent_position);
+
+    return G_SOURCE_REMOVE;
+}
+
+/*hovering or dragging, a move farther than INTENT_MOVE_PX cancels the current intent
+ *and starts waiting for the pointer to rest again*/
+static gboolean
+bitfield_scale_motion_notify (GtkWidget *widget, GdkEventMotion *event, gpointer user_data)
+{
+    BitfieldScale *self = BITFIELD_SCALE (widget);
+
+    if ((self->intent_timeout_id != 0 || self->intent_position >= 0.0) &&
+        fabs (event->x - self->intent_x) <= INTENT_MOVE_PX)
+    {
+        return FALSE;
+    }
+
+    bitfield_scale_cancel_intent (self);
+
+    self->intent_x = event->x;
+    self->intent_timeout_id = g_timeout_add (INTENT_DWELL_MS, (GSourceFunc) bitfield_scale_intent_timeout, self);
+    g_source_set_name_by_id (self->intent_timeout_id, "[totem] bitfield_scale_intent_timeout");
 
     return FALSE;
 }
 
+static gboolean
+bitfield_scale_leave_notify (GtkWidget *widget, GdkEventCrossing *event, gpointer user_data)
+{
+    /*a drag keeps going outside of the widget*/
+    if (event->state & GDK_BUTTON1_MASK)
+    {
+        return FALSE;
+    }
 
+    bitfield_scale_cancel_intent (BITFIELD_SCALE (widget));
+
+    return FALSE;
+}
 
 
 
 
 static gboolean bitfield_scale_draw(GtkWidget *widget, cairo_t *cr);
 
+static void
+bitfield_scale_dispose(GObject *object);
+
 static void
 bitfield_scale_finalize(GObject *object);
 
@@ -378,7 +630,21 @@ bitfield_scale_class_init (BitfieldScaleClass *klass)
     // Set the custom finalize method
     GObjectClass *object_class = G_OBJECT_CLASS(klass);
 
+    object_class->dispose = bitfield_scale_dispose;
     object_class->finalize = bitfield_scale_finalize;
+
+    /**
+     * BitfieldScale::seek-intent:
+     * @position: where the pointer rests, between 0 and 1, or -1 once it moved away
+     *
+     * Emitted when the pointer rests on the scale while hovering or dragging,
+     * and again with -1 when it leaves that position.
+     **/
+    bitfield_scale_signals[SIGNAL_SEEK_INTENT] =
+        g_signal_new ("seek-intent", G_TYPE_FROM_CLASS (klass),
+                      G_SIGNAL_RUN_LAST, 0, NULL, NULL,
+                      g_cclosure_marshal_VOID__DOUBLE,
+                      G_TYPE_NONE, 1, G_TYPE_DOUBLE);
 }
 
 
@@ -396,8 +662,28 @@ bitfield_scale_init (BitfieldScale *self)
     self->block_per_piece_normal = -1;
     self->block_in_last_piece = -1;
     
-    self->have_bitfield = NULL;
-    self->unfinished_block_bitfield = NULL;
+    self->have = NULL;
+    self->block_state = NULL;
+    self->piece_matrix = NULL;
+    self->piece_matrix_generation = 0;
+    self->downloading_index = NULL;
+
+    self->surface = NULL;
+    self->surface_width = 0;
+    self->surface_height = 0;
+    self->dirty_columns = NULL;
+    self->any_dirty = FALSE;
+
+    self->intent_timeout_id = 0;
+    self->intent_x = 0.0;
+    self->intent_position = -1.0;
+
+    self->preview_popover = NULL;
+    self->preview_image = NULL;
+
+    gtk_widget_add_events (GTK_WIDGET (self), GDK_POINTER_MOTION_MASK | GDK_LEAVE_NOTIFY_MASK);
+    g_signal_connect (self, "motion-notify-event", G_CALLBACK (bitfield_scale_motion_notify), NULL);
+    g_signal_connect (self, "leave-notify-event", G_CALLBACK (bitfield_scale_leave_notify), NULL);
 
 
     // Initialize the mutex when the object is created
@@ -406,6 +692,23 @@ bitfield_scale_init (BitfieldScale *self)
 
 
 
+static void
+bitfield_scale_dispose (GObject *object)
+{
+    BitfieldScale *self = BITFIELD_SCALE(object);
+
+    if (self->preview_popover != NULL)
+    {
+        gtk_widget_destroy (self->preview_popover);
+        self->preview_popover = NULL;
+        self->preview_image = NULL;
+    }
+
+    G_OBJECT_CLASS(bitfield_scale_parent_class)->dispose(object);
+}
+
+
+
 static void 
 bitfield_scale_finalize (GObject *object) 
 {
@@ -413,39 +716,49 @@ bitfield_scale_finalize (GObject *object)
 
 printf ("(bitfield_scale_finalize) \n");
 
+    if (self->intent_timeout_id != 0)
+    {
+        g_source_remove (self->intent_timeout_id);
+        self->intent_timeout_id = 0;
+    }
+
     if (self->downloading_blocks != NULL) 
     {
-        if (self->downloading_blocks->array) 
-        {
-            for(gint i=0;i<self->downloading_blocks->size;i++)
-            {
-                g_free (self->downloading_blocks->array[i].blocks_progress);
+        downloading_blocks_sd_unref (self->downloading_blocks);
+        self->downloading_blocks = NULL;
+    }
 
-            }
-            g_free (self->downloading_blocks->array);
-        }
-        g_free (self->downloading_blocks);  
+    if (self->have != NULL)
+    {
+        gst_bt_bitset_unref (self->have);
+        self->have = NULL;
     }
+    if (self->block_state != NULL) 
+    {
+        gst_bt_block_state_unref (self->block_state);
+        self->block_state = NULL;
+    }
+
 
-    // Free the have_bitfield (GByteArray) if it exists
-    if (self->have_bitfield != NULL) 
+    if (self->piece_matrix != NULL)
     {
-        g_free (self->have_bitfield); 
-        self->have_bitfield = NULL;
+        gst_bt_bitset_unref (self->piece_matrix);
+        self->piece_matrix = NULL;
     }
 
-    if (self->unfinished_block_bitfield != NULL) 
+    if (self->downloading_index != NULL)
     {
-        for (guint i = 0; i < self->num_pieces; i++) 
-        {
-            guint8* tmp = self->unfinished_block_bitfield[i].blocks_bitfield;           
-            g_free(tmp);
-        }
-  
-        g_free(self->unfinished_block_bitfield); 
-        self->unfinished_block_bitfield = NULL;
+        g_hash_table_unref (self->downloading_index);
+        self->downloading_index = NULL;
     }
 
+    if (self->surface != NULL)
+    {
+        cairo_surface_destroy (self->surface);
+        self->surface = NULL;
+    }
+    g_free (self->dirty_columns);
+    self->dirty_columns = NULL;
 
     // Free any resources used by downloading_blocks and finalize mutex
     g_mutex_clear(&self->lock);
@@ -482,44 +795,74 @@ g_mutex_lock(&self->lock);/**************************************/
 
 // printf ("(third ppi addr %p) \n", sd);
 
-    /*local test*/
-    for (gint d_idx=0; d_idx<sd->size; ++d_idx) 
+    //same snapshot as the one drawn, nothing to redraw
+    if (self->downloading_blocks != NULL && self->downloading_blocks->version == sd->version) 
     {
-        gint current_piece_index = sd->array[d_idx].piece_index;
-
-        guint8* prog = sd->array[d_idx].blocks_progress;
-
-        guint b_idx_end = self->block_per_piece_normal;
-        if(current_piece_index == self->num_pieces-1)
+        downloading_blocks_sd_unref (sd);
+    }
+    else
+    {
+        //drop our reference on the previous one, its pieces need to be re-rendered
+        if (self->downloading_blocks != NULL) 
         {
-            b_idx_end = self->block_in_last_piece;
+            for (gint d_idx=0; d_idx<self->downloading_blocks->size; ++d_idx)
+            {
+                bitfield_scale_invalidate_piece (self, self->downloading_blocks->pieces[d_idx]);
+            }
+            downloading_blocks_sd_unref (self->downloading_blocks);
         }
 
-        //loop through every block within this piece
-        for (gint b_idx=0; b_idx<b_idx_end; ++b_idx)
+        // Take Ownership of the reference, no copy
+        self->downloading_blocks = sd;
+
+        if (self->downloading_index == NULL)
         {
-            // printf ("%d>>%d\n", current_piece_index, prog[b_idx]);
+            self->downloading_index = g_hash_table_new (g_direct_hash, g_direct_equal);
         }
-    }
+        g_hash_table_remove_all (self->downloading_index);
 
-    if (self->downloading_blocks != sd) 
-    {
-        //free previous
-        if (self->downloading_blocks != NULL) 
+        for (gint d_idx=0; d_idx<sd->size; ++d_idx) 
         {
-            if (self->downloading_blocks->array) 
+            gint piece = sd->pieces[d_idx];
+
+            if (piece < 0 || piece >= self->num_pieces)
+            {
+                continue;
+            }
+
+            g_hash_table_insert (self->downloading_index, GINT_TO_POINTER (piece), GINT_TO_POINTER (d_idx + 1));
+            bitfield_scale_invalidate_piece (self, piece);
+
+            // piece_info_alert may not be accurate, so remember the finished blocks ourself,
+            // and the whole piece once all its blocks are there
+            if (self->block_state == NULL || gst_bt_bitset_get (self->have, piece))
             {
-                for(gint i=0;i<self->downloading_blocks->size;i++)
+                continue;
+            }
+
+            guint8* prog = sd->progress + sd->block_offsets[d_idx];
+            gint n_blocks = MIN ((guint) bitfield_scale_blocks_in_piece (self, piece), sd->block_offsets[d_idx+1] - sd->block_offsets[d_idx]);
+            guint8* blocks_bitfield = NULL;
+
+            for (gint b_idx=0; b_idx<n_blocks; ++b_idx)
+            {
+                if (prog[b_idx] >= 100)
                 {
-                    g_free (self->downloading_blocks->array[i].blocks_progress);
+                    if (blocks_bitfield == NULL)
+                    {
+                        blocks_bitfield = gst_bt_block_state_ensure_partial (self->block_state, piece);
+                    }
+                    set_bit_in_bitfield (blocks_bitfield, (self->block_per_piece_normal+7)/8, b_idx);
                 }
-                g_free (self->downloading_blocks->array);
             }
-            g_free (self->downloading_blocks);  
-        }
 
-        // Take Ownership, no copy
-        self->downloading_blocks = sd;
+            if (blocks_bitfield != NULL && 
+                is_block_bitfield_complete_cur_piece (blocks_bitfield, self->block_per_piece_normal, self->block_in_last_piece, piece == self->num_pieces-1))
+            {
+                gst_bt_block_state_set_have (self->block_state, piece);
+                gst_bt_bitset_set (self->have, piece);
+            }
+        }
 
         // Mark widget to be redrawn
         gtk_widget_queue_draw (GTK_WIDGET (self));
@@ -537,94 +880,46 @@ g_mutex_unlock(&self->lock);/**************************************/
 
 //this function expected to called once, in initial time
 void 
-bitfield_scale_set_piece_block_info (GtkWidget *widget, 
-                                    gint num_blocks, gint num_pieces, 
-                                    gint block_per_piece_normal, 
-                                    gint block_last_piece,
-                                    guint8                 *finished_pieces,
-                                    UnfinishedPieceInfo    *unfinished_pieces)
+bitfield_scale_set_piece_block_info (GtkWidget *widget, GstBtBlockState *block_state)
 {
 
     BitfieldScale *self = BITFIELD_SCALE (widget);
     
     g_return_if_fail (BITFIELD_IS_SCALE (self));
+    g_return_if_fail (block_state != NULL);
     
-    printf ("(bitfield_scale_set_piece_block_info) %d,%d,%d,%d\n", num_blocks, num_pieces, block_per_piece_normal, block_last_piece);
+    printf ("(bitfield_scale_set_piece_block_info) %u,%u,%u,%u, %u partial pieces\n", block_state->num_blocks, block_state->num_pieces,
+        block_state->blocks_per_piece, block_state->blocks_last_piece, g_hash_table_size (block_state->partial));
     
     //Mandatory
     if(self->num_blocks < 0)
     {
-        self->num_blocks = num_blocks;
+        self->num_blocks = block_state->num_blocks;
     }
     if(self->num_pieces < 0)
     {
-        self->num_pieces = num_pieces;      
+        self->num_pieces = block_state->num_pieces;      
     }
     if(self->block_per_piece_normal < 0)
     {
 
-        self->block_per_piece_normal = block_per_piece_normal;
+        self->block_per_piece_normal = block_state->blocks_per_piece;
     }
     if(self->block_in_last_piece < 0)
     {
 
-        self->block_in_last_piece = block_last_piece;
+        self->block_in_last_piece = block_state->blocks_last_piece;
     }
 
-    if(self->have_bitfield == NULL)
+    if(self->block_state == NULL)
     {
-        if( finished_pieces != NULL )
-        {
-            //Duplicate our own copy
-            self->have_bitfield = g_memdup (finished_pieces, (self->num_pieces + 7) / 8);
-// printf ("fourth PieceBlockInfoSd addr %p \n", self->have_bitfield);
-            /* local test */
-            // for (int i=0; i<(self->num_pieces+7)/8; i++)
-            // {
-            //     guint8 line = self->have_bitfield[i];
-            //     printf ("have_bitfield>>%d \n",line);
-            // }
-        }
-        else
-        {
-            printf ("(bitfield_scale_set_piece_block_info) EMPTY have_bitfield\n");
-        }
-    }
-
-    if (self->unfinished_block_bitfield == NULL)
-    {   
-        if (unfinished_pieces != NULL)
-        {
-            //Duplicate our own copy
-            UnfinishedPieceInfo* copy = g_new0 (UnfinishedPieceInfo, self->num_pieces);
-            for (gsize i=0;i<self->num_pieces; i++)
-            {
-                copy[i].piece_index = unfinished_pieces[i].piece_index;
-                if (unfinished_pieces[i].blocks_bitfield != NULL){
-                    copy[i].blocks_bitfield = g_memdup (unfinished_pieces[i].blocks_bitfield, (self->block_per_piece_normal+ 7) / 8);
-                }
-            }
-            
-            self->unfinished_block_bitfield = copy;
-
-            /*local test*/
-            // for (int pidx=0; pidx<self->num_pieces; pidx++)
-            // {
-            //     UnfinishedPieceInfo info = self->unfinished_block_bitfield[pidx];
-            //     if (info.blocks_bitfield)
-            //     {
-            //         for (int i=0; i<(self->block_per_piece_normal+7)/8; i++)
-            //         {
-            //             printf ("unfinished>>%d \n",info.blocks_bitfield[i]); 
-            //         }
-            //     }
-            // }
+        //Share it, no copy, btdemux doesn't touch it anymore
+        self->block_state = gst_bt_block_state_ref (block_state);
+        self->have = gst_bt_bitset_new (self->num_pieces);
+        gst_bt_bitset_import_bytes (self->have, block_state->have, (self->num_pieces+7)/8);
 
-        }
-        else 
-        {
-            printf ("(bitfield_scale_set_piece_block_info) EMPTY unfinished_block_bitfield\n");
-        }
+        bitfield_scale_invalidate_all (self);
+        gtk_widget_queue_draw (widget);
     }
 
 }
@@ -646,17 +941,13 @@ bitfield_scale_set_whole_piece_finished (GtkWidget *widget, guint8 * finished_pi
 
             printf ("(bitfield_scale_set_whole_piece_finished)\n");
 
-    if (self->have_bitfield != NULL)
+    if (self->have != NULL)
     {
-        for (gint i=0; i<self->num_pieces; ++i)
-        {
-            gboolean bit_status = is_bit_set (self->have_bitfield, self->num_pieces, i);
-            gboolean bit_status_new = is_bit_set (finished_pieces, self->num_pieces, i);
-            if (bit_status_new == TRUE && bit_status == FALSE)
-            {
-                set_bit_in_bitfield (self->have_bitfield, (self->num_pieces+7)/8, i);
-            }
-        }
+        //an LSB-first bitfield, merged a word at a time
+        gst_bt_bitset_import_bytes (self->have, finished_pieces, (self->num_pieces+7)/8);
+
+        bitfield_scale_invalidate_all (self);
+        gtk_widget_queue_draw (widget);
     }
 }
 
@@ -667,33 +958,95 @@ bitfield_scale_set_whole_piece_finished (GtkWidget *widget, guint8 * finished_pi
 
 //this func called periodically, collecting from piece_finished_alerts , as a fallback to ppi who may not be accurate represent the piece bitfield,
 //it just show the currently piece that have outstanding requests or writes
+//only the words changed since the last call are redrawn
 void 
-bitfield_scale_update_piece_matrix_fallback (GtkWidget *widget, guint8 * piece_matrix)
+bitfield_scale_update_piece_matrix (GtkWidget *widget, GstBtBitset * piece_matrix)
 {
                 
     BitfieldScale *self = BITFIELD_SCALE (widget);
+    GArray *ranges;
 
     g_return_if_fail(BITFIELD_IS_SCALE (self));
     g_return_if_fail (self->num_pieces != -1);
-    if (piece_matrix == NULL)
+    if (piece_matrix == NULL || self->have == NULL)
     {
         return;
     }
-    
-    if(self->have_bitfield != NULL)
+
+    //a new torrent, sync from scratch
+    if (self->piece_matrix != piece_matrix)
     {
-        for (gint i=0; i<self->num_pieces; ++i)
+        if (self->piece_matrix != NULL)
         {
-            gboolean bit_status = is_bit_set (self->have_bitfield, self->num_pieces, i);
-            gboolean bit_status_new = is_bit_set (piece_matrix, self->num_pieces, i);
+            gst_bt_bitset_unref (self->piece_matrix);
+        }
+        self->piece_matrix = gst_bt_bitset_ref (piece_matrix);
+        self->piece_matrix_generation = 0;
+    }
 
-            //if it not set, then set it or skip
-            if (!bit_status && bit_status_new == TRUE)
-            {
-                set_bit_in_bitfield (self->have_bitfield, (self->num_pieces+7)/8, i);
-            }
+    ranges = g_array_new (FALSE, FALSE, sizeof (GstBtBitsetRange));
+    self->piece_matrix_generation = gst_bt_bitset_diff (piece_matrix, self->piece_matrix_generation, ranges);
+
+    for (guint i=0; i<ranges->len; ++i)
+    {
+        GstBtBitsetRange *range = &g_array_index (ranges, GstBtBitsetRange, i);
+        gint first_piece = range->first_word * 32;
+        gint end_piece = MIN ((gint) ((range->first_word + range->n_words) * 32), self->num_pieces);
+
+        if (first_piece < end_piece)
+        {
+            bitfield_scale_invalidate_blocks (self, (gint64) first_piece * self->block_per_piece_normal,
+                (gint64) (end_piece - 1) * self->block_per_piece_normal + bitfield_scale_blocks_in_piece (self, end_piece - 1));
         }
     }
+
+    if (ranges->len > 0)
+    {
+        gst_bt_bitset_or (self->have, piece_matrix);
+        gtk_widget_queue_draw (widget);
+    }
+
+    g_array_free (ranges, TRUE);
 }
 
 
+
+
+
+//show the thumbnail of the position the pointer rests on, above it, NULL hides it
+void
+bitfield_scale_set_preview (BitfieldScale *self, GdkPixbuf *pixbuf)
+{
+    GdkRectangle rect;
+
+    g_return_if_fail (BITFIELD_IS_SCALE (self));
+
+    if (pixbuf == NULL || self->intent_position < 0.0)
+    {
+        if (self->preview_popover != NULL)
+        {
+            gtk_popover_popdown (GTK_POPOVER (self->preview_popover));
+        }
+        return;
+    }
+
+    if (self->preview_popover == NULL)
+    {
+        self->preview_popover = gtk_popover_new (GTK_WIDGET (self));
+        gtk_popover_set_modal (GTK_POPOVER (self->preview_popover), FALSE);
+        gtk_popover_set_position (GTK_POPOVER (self->preview_popover), GTK_POS_TOP);
+
+        self->preview_image = gtk_image_new ();
+        gtk_container_add (GTK_CONTAINER (self->preview_popover), self->preview_image);
+        gtk_widget_show (self->preview_image);
+    }
+
+    gtk_image_set_from_pixbuf (GTK_IMAGE (self->preview_image), pixbuf);
+
+    rect.x = (gint) self->intent_x;
+    rect.y = 0;
+    rect.width = 1;
+    rect.height = 1;
+    gtk_popover_set_pointing_to (GTK_POPOVER (self->preview_popover), &rect);
+    gtk_popover_popup (GTK_POPOVER (self->preview_popover));
+}
@@ -37,14 +37,15 @@ void
 bitfield_scale_update_downloading_blocks (BitfieldScale *self, DownloadingBlocksSd* sd);
 
 void
-bitfield_scale_set_piece_block_info (GtkWidget *widget, gint num_blocks, gint num_pieces, 
-                                    gint block_per_piece_normal, gint block_last_piece,
-                                    guint8 * finished_pieces, 
-                                    UnfinishedPieceInfo * unfinished_pieces);
+bitfield_scale_set_piece_block_info (GtkWidget *widget, GstBtBlockState *block_state);
 
 void 
 bitfield_scale_set_whole_piece_finished (GtkWidget *widget, guint8 * finished_pieces);
 
 
 void 
-bitfield_scale_update_piece_matrix_fallback (GtkWidget *widget, guint8 * piece_matrix);
\ No newline at end of file
+bitfield_scale_update_piece_matrix (GtkWidget *widget, GstBtBitset * piece_matrix);
+
+
+void
+bitfield_scale_set_preview (BitfieldScale *self, GdkPixbuf *pixbuf);
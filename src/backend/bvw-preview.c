@@ -0,0 +1,484 @@
+/*
+ * Seek bar preview thumbnails, decoded from the already downloaded part of a
+ * torrent file and cached on disk
+ *
+ * SPDX-License-Identifier: GPL-3-or-later
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+
+#include "totem-gst-pixbuf-helpers.h"
+#include "bvw-preview.h"
+
+/* playbin's GstPlayFlags, video only: no audio decoding, no subtitles */
+#define PREVIEW_PLAY_FLAG_VIDEO (1 << 0)
+/* how long the preview pipeline may take to preroll or seek */
+#define PREVIEW_TIMEOUT (3 * GST_SECOND)
+/* the cache is trimmed each time a BvwPreview is created: the thumbnails not used
+ * for PREVIEW_CACHE_MAX_AGE go, then the least recently used ones until the rest
+ * fits in PREVIEW_CACHE_MAX_SIZE. A thumbnail read from the cache is touched, so
+ * its mtime is when it was last used */
+#define PREVIEW_CACHE_MAX_AGE (30 * G_TIME_SPAN_DAY)
+#define PREVIEW_CACHE_MAX_SIZE (64 * 1024 * 1024)
+
+/* The thumbnails live in <user cache dir>/totem/previews/<info-hash>/<file-index>/<time>.png,
+ * <time> being the step in ms the thumbnail was taken at.
+ * One playbin with fake sinks decodes them straight from the file btdemux downloads
+ * into, it is only asked for the steps whose pieces are all local, lookups run in
+ * worker threads and take turns on the pipeline */
+struct _BvwPreview
+{
+  gint ref_count;
+
+  GMutex lock;
+  GstElement *playbin;
+  gchar *uri;
+};
+
+typedef struct
+{
+  BvwPreview *preview;
+  gchar *info_hash;
+  gint file_index;
+  gchar *location;
+  gint64 time;
+  gboolean local;
+} BvwPreviewRequest;
+
+typedef struct
+{
+  gchar *path;
+  gint64 mtime;
+  gint64 size;
+} BvwPreviewCacheEntry;
+
+
+
+static BvwPreview *
+bvw_preview_ref (BvwPreview *preview)
+{
+  g_atomic_int_inc (&preview->ref_count);
+  return preview;
+}
+
+static void bvw_preview_cache_evict_thread (GTask        *task,
+                                            gpointer      source_object,
+                                            gpointer      task_data,
+                                            GCancellable *cancellable);
+
+BvwPreview *
+bvw_preview_new (void)
+{
+  BvwPreview *preview = g_new0 (BvwPreview, 1);
+  GTask *task;
+
+  preview->ref_count = 1;
+  g_mutex_init (&preview->lock);
+
+  /* opening the cache, trim it out of the way of the main thread */
+  task = g_task_new (NULL, NULL, NULL, NULL);
+  g_task_set_source_tag (task, bvw_preview_new);
+  g_task_run_in_thread (task, bvw_preview_cache_evict_thread);
+  g_object_unref (task);
+
+  return preview;
+}
+
+/* the lookups still running keep it alive */
+void
+bvw_preview_free (BvwPreview *preview)
+{
+  if (!g_atomic_int_dec_and_test (&preview->ref_count))
+    return;
+
+  if (preview->playbin)
+  {
+    gst_element_set_state (preview->playbin, GST_STATE_NULL);
+    gst_object_unref (preview->playbin);
+  }
+  g_free (preview->uri);
+  g_mutex_clear (&preview->lock);
+  g_free (preview);
+}
+
+static void
+bvw_preview_request_free (BvwPreviewRequest *request)
+{
+  bvw_preview_free (request->preview);
+  g_free (request->info_hash);
+  g_free (request->location);
+  g_free (request);
+}
+
+
+
+static gchar *
+bvw_preview_cache_root (void)
+{
+  return g_build_filename (g_get_user_cache_dir (), "totem", "previews", NULL);
+}
+
+static gchar *
+bvw_preview_cache_dir (const gchar *info_hash, gint file_index)
+{
+  gchar *index = g_strdup_printf ("%d", file_index);
+  gchar *root = bvw_preview_cache_root ();
+  gchar *dir = g_build_filename (root, info_hash, index, NULL);
+
+  g_free (root);
+  g_free (index);
+  return dir;
+}
+
+static gchar *
+bvw_preview_cache_file (const gchar *dir, gint64 _time)
+{
+  gchar *name = g_strdup_printf ("%" G_GINT64_FORMAT ".png", _time);
+  gchar *file = g_build_filename (dir, name, NULL);
+
+  g_free (name);
+  return file;
+}
+
+/* add the thumbnails under dir, depth levels of directories down, to entries */
+static void
+bvw_preview_cache_collect (const gchar *dir, gint depth, GArray *entries)
+{
+  GDir *d;
+  const gchar *name;
+
+  d = g_dir_open (dir, 0, NULL);
+  if (d == NULL)
+    return;
+
+  while ((name = g_dir_read_name (d)) != NULL)
+  {
+    gchar *path = g_build_filename (dir, name, NULL);
+    GStatBuf st;
+
+    if (depth > 0)
+    {
+      if (g_file_test (path, G_FILE_TEST_IS_DIR))
+        bvw_preview_cache_collect (path, depth - 1, entries);
+      g_free (path);
+      continue;
+    }
+
+    if (g_str_has_suffix (name, ".png") && g_stat (path, &st) == 0)
+    {
+      BvwPreviewCacheEntry entry = { path, (gint64) st.st_mtime, (gint64) st.st_size };
+
+      g_array_append_val (entries, entry);
+      continue;
+    }
+    g_free (path);
+  }
+  g_dir_close (d);
+
+  /* gone empty, only removed if it is */
+  if (depth < 2)
+    g_rmdir (dir);
+}
+
+static gint
+bvw_preview_cache_compare_mtime (gconstpointer a, gconstpointer b)
+{
+  const BvwPreviewCacheEntry *ea = a;
+  const BvwPreviewCacheEntry *eb = b;
+
+  return ea->mtime < eb->mtime ? -1 : (ea->mtime > eb->mtime ? 1 : 0);
+}
+
+/* drop the thumbnails past PREVIEW_CACHE_MAX_AGE, then the least recently used
+ * ones until the cache fits in PREVIEW_CACHE_MAX_SIZE */
+static void
+bvw_preview_cache_evict_thread (GTask        *task,
+                                gpointer      source_object,
+                                gpointer      task_data,
+                                GCancellable *cancellable)
+{
+  GArray *entries = g_array_new (FALSE, FALSE, sizeof (BvwPreviewCacheEntry));
+  gchar *root = bvw_preview_cache_root ();
+  gint64 oldest = g_get_real_time () / G_USEC_PER_SEC - PREVIEW_CACHE_MAX_AGE / G_TIME_SPAN_SECOND;
+  gint64 total = 0;
+  guint i, evicted = 0;
+
+  bvw_preview_cache_collect (root, 2, entries);
+  g_array_sort (entries, bvw_preview_cache_compare_mtime);
+
+  for (i = 0; i < entries->len; i++)
+    total += g_array_index (entries, BvwPreviewCacheEntry, i).size;
+
+  for (i = 0; i < entries->len; i++)
+  {
+    BvwPreviewCacheEntry *entry = &g_array_index (entries, BvwPreviewCacheEntry, i);
+
+    if ((entry->mtime < oldest || total > PREVIEW_CACHE_MAX_SIZE) && g_unlink (entry->path) == 0)
+    {
+      total -= entry->size;
+      evicted++;
+    }
+    g_free (entry->path);
+  }
+
+  if (evicted > 0)
+  {
+                printf ("(bvw_preview_cache_evict_thread) %u thumbnails evicted, %" G_GINT64_FORMAT " bytes left\n",
+                    evicted, total);
+
+    /* and the directories they leave empty */
+    g_array_set_size (entries, 0);
+    bvw_preview_cache_collect (root, 2, entries);
+    for (i = 0; i < entries->len; i++)
+      g_free (g_array_index (entries, BvwPreviewCacheEntry, i).path);
+  }
+
+  g_array_free (entries, TRUE);
+  g_free (root);
+}
+
+/* the cached step closest to _time, -1 if there is none */
+static gint64
+bvw_preview_cache_nearest (const gchar *dir, gint64 _time)
+{
+  GDir *d;
+  const gchar *name;
+  gint64 nearest = -1;
+
+  d = g_dir_open (dir, 0, NULL);
+  if (d == NULL)
+    return -1;
+
+  while ((name = g_dir_read_name (d)) != NULL)
+  {
+    gchar *end = NULL;
+    gint64 t;
+
+    t = g_ascii_strtoll (name, &end, 10);
+    if (end == name || g_strcmp0 (end, ".png") != 0 || t < 0)
+      continue;
+
+    if (nearest < 0 || ABS (t - _time) < ABS (nearest - _time))
+      nearest = t;
+  }
+  g_dir_close (d);
+
+  return nearest;
+}
+
+
+
+/* called with the lock held */
+static GdkPixbuf *
+bvw_preview_decode (BvwPreview *preview, const gchar *location, gint64 _time, GError **error)
+{
+  GdkPixbuf *frame, *scaled;
+  gchar *uri;
+  gint width, height;
+
+  uri = g_filename_to_uri (location, NULL, error);
+  if (uri == NULL)
+    return NULL;
+
+  if (preview->playbin == NULL)
+  {
+    preview->playbin = gst_element_factory_make ("playbin", "bvw-preview");
+    if (preview->playbin == NULL)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                           "Failed to create the preview pipeline");
+      g_free (uri);
+      return NULL;
+    }
+    gst_object_ref_sink (preview->playbin);
+
+    g_object_set (preview->playbin,
+                  "video-sink", gst_element_factory_make ("fakesink", NULL),
+                  "audio-sink", gst_element_factory_make ("fakesink", NULL),
+                  "flags", PREVIEW_PLAY_FLAG_VIDEO,
+                  NULL);
+  }
+
+  if (g_strcmp0 (preview->uri, uri) != 0)
+  {
+    gst_element_set_state (preview->playbin, GST_STATE_NULL);
+    g_object_set (preview->playbin, "uri", uri, NULL);
+    g_free (preview->uri);
+    preview->uri = uri;
+  }
+  else
+  {
+    g_free (uri);
+  }
+
+  if (gst_element_set_state (preview->playbin, GST_STATE_PAUSED) == GST_STATE_CHANGE_FAILURE ||
+      gst_element_get_state (preview->playbin, NULL, NULL, PREVIEW_TIMEOUT) != GST_STATE_CHANGE_SUCCESS ||
+      !gst_element_seek_simple (preview->playbin, GST_FORMAT_TIME,
+                                GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT, _time * GST_MSECOND) ||
+      gst_element_get_state (preview->playbin, NULL, NULL, PREVIEW_TIMEOUT) != GST_STATE_CHANGE_SUCCESS)
+  {
+    /* start over next time, the file may be readable by then */
+    gst_element_set_state (preview->playbin, GST_STATE_NULL);
+    g_clear_pointer (&preview->uri, g_free);
+
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                 "Could not decode %s at %" G_GINT64_FORMAT " ms", location, _time);
+    return NULL;
+  }
+
+  frame = totem_gst_playbin_get_frame (preview->playbin, error);
+  if (frame == NULL)
+    return NULL;
+
+  width = gdk_pixbuf_get_width (frame);
+  height = gdk_pixbuf_get_height (frame);
+  if (width <= BVW_PREVIEW_WIDTH)
+    return frame;
+
+  scaled = gdk_pixbuf_scale_simple (frame, BVW_PREVIEW_WIDTH,
+                                    MAX (height * BVW_PREVIEW_WIDTH / width, 1),
+                                    GDK_INTERP_BILINEAR);
+  g_object_unref (frame);
+
+  return scaled;
+}
+
+static void
+bvw_preview_lookup_thread (GTask        *task,
+                           gpointer      source_object,
+                           gpointer      task_data,
+                           GCancellable *cancellable)
+{
+  BvwPreviewRequest *request = task_data;
+  GdkPixbuf *pixbuf = NULL;
+  GError *error = NULL;
+  gchar *dir, *file;
+  gint64 step, nearest;
+
+  step = request->time / BVW_PREVIEW_STEP * BVW_PREVIEW_STEP;
+  dir = bvw_preview_cache_dir (request->info_hash, request->file_index);
+  file = bvw_preview_cache_file (dir, step);
+
+  /* taken before */
+  if (g_file_test (file, G_FILE_TEST_EXISTS))
+  {
+    pixbuf = gdk_pixbuf_new_from_file (file, NULL);
+    if (pixbuf != NULL)
+      g_utime (file, NULL);
+  }
+
+  /* the step is downloaded, take it now */
+  if (pixbuf == NULL && request->local)
+  {
+    g_mutex_lock (&request->preview->lock);
+    if (!g_cancellable_is_cancelled (cancellable))
+      pixbuf = bvw_preview_decode (request->preview, request->location, step, &error);
+    g_mutex_unlock (&request->preview->lock);
+
+    if (pixbuf != NULL)
+    {
+                printf ("(bvw_preview_lookup_thread) caching the preview at %" G_GINT64_FORMAT " ms to %s\n", step, file);
+
+      if (g_mkdir_with_parents (dir, 0700) == 0)
+        gdk_pixbuf_save (pixbuf, file, "png", NULL, NULL);
+    }
+    else if (error != NULL)
+    {
+                printf ("(bvw_preview_lookup_thread) %s\n", error->message);
+      g_clear_error (&error);
+    }
+  }
+
+  /* not there yet, the closest one we have will do */
+  if (pixbuf == NULL && !g_cancellable_is_cancelled (cancellable))
+  {
+    nearest = bvw_preview_cache_nearest (dir, step);
+    if (nearest >= 0)
+    {
+      g_free (file);
+      file = bvw_preview_cache_file (dir, nearest);
+      pixbuf = gdk_pixbuf_new_from_file (file, NULL);
+      if (pixbuf != NULL)
+        g_utime (file, NULL);
+    }
+  }
+
+  g_free (file);
+  g_free (dir);
+
+  if (g_task_return_error_if_cancelled (task))
+  {
+    g_clear_object (&pixbuf);
+    return;
+  }
+
+  if (pixbuf == NULL)
+  {
+    g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                             "No preview available yet");
+    return;
+  }
+
+  g_task_return_pointer (task, pixbuf, g_object_unref);
+}
+
+/**
+ * bvw_preview_lookup_async:
+ * @preview: a #BvwPreview
+ * @info_hash: hex info-hash of the torrent
+ * @file_index: index of the file within the torrent
+ * @location: where the file is downloaded to
+ * @_time: the position to preview, in milliseconds
+ * @local: whether the pieces at @_time are downloaded, so it can be decoded
+ * @cancellable: a #GCancellable, or %NULL
+ * @callback: called with the thumbnail
+ * @user_data: data for @callback
+ *
+ * Looks up the thumbnail of the step @_time falls in: from the cache, decoded
+ * from @location when @local, otherwise the nearest cached one.
+ **/
+void
+bvw_preview_lookup_async (BvwPreview          *preview,
+                          const gchar         *info_hash,
+                          gint                 file_index,
+                          const gchar         *location,
+                          gint64               _time,
+                          gboolean             local,
+                          GCancellable        *cancellable,
+                          GAsyncReadyCallback  callback,
+                          gpointer             user_data)
+{
+  BvwPreviewRequest *request;
+  GTask *task;
+
+  g_return_if_fail (preview != NULL);
+  g_return_if_fail (info_hash != NULL && location != NULL);
+
+  request = g_new0 (BvwPreviewRequest, 1);
+  request->preview = bvw_preview_ref (preview);
+  request->info_hash = g_strdup (info_hash);
+  request->file_index = file_index;
+  request->location = g_strdup (location);
+  request->time = MAX (_time, 0);
+  request->local = local;
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_source_tag (task, bvw_preview_lookup_async);
+  g_task_set_task_data (task, request, (GDestroyNotify) bvw_preview_request_free);
+  g_task_run_in_thread (task, bvw_preview_lookup_thread);
+  g_object_unref (task);
+}
+
+GdkPixbuf *
+bvw_preview_lookup_finish (BvwPreview    *preview,
+                           GAsyncResult  *result,
+                           GError       **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
@@ -0,0 +1,39 @@
+/*
+ * Seek bar preview thumbnails, decoded from the already downloaded part of a
+ * torrent file and cached on disk
+ *
+ * SPDX-License-Identifier: GPL-3-or-later
+ *
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+G_BEGIN_DECLS
+
+/* thumbnails are taken every PREVIEW_STEP ms of media, a request is
+ * rounded down to the step it falls in */
+#define BVW_PREVIEW_STEP 10000
+#define BVW_PREVIEW_WIDTH 160
+
+typedef struct _BvwPreview BvwPreview;
+
+BvwPreview *bvw_preview_new		(void);
+void bvw_preview_free			(BvwPreview *preview);
+
+void bvw_preview_lookup_async		(BvwPreview          *preview,
+					 const gchar         *info_hash,
+					 gint                 file_index,
+					 const gchar         *location,
+					 gint64               _time,
+					 gboolean             local,
+					 GCancellable        *cancellable,
+					 GAsyncReadyCallback  callback,
+					 gpointer             user_data);
+GdkPixbuf *bvw_preview_lookup_finish	(BvwPreview          *preview,
+					 GAsyncResult        *result,
+					 GError             **error);
+
+G_END_DECLS
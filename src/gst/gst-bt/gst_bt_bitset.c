@@ -0,0 +1,437 @@
+/* Gst-Bt - BitTorrent related GStreamer elements
+ * Copyright (C) 2015 Jorge Luis Zapata
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "gst_bt_bitset.h"
+
+GstBtBitset *
+gst_bt_bitset_new (guint num_bits)
+{
+  GstBtBitset *bitset = g_new0 (GstBtBitset, 1);
+
+  bitset->ref_count = 1;
+  bitset->num_bits = num_bits;
+  bitset->num_words = (num_bits + 31) / 32;
+  bitset->words = g_new0 (guint, MAX (bitset->num_words, 1));
+  g_mutex_init (&bitset->lock);
+
+  return bitset;
+}
+
+GstBtBitset *
+gst_bt_bitset_ref (GstBtBitset * bitset)
+{
+  g_atomic_int_inc (&bitset->ref_count);
+  return bitset;
+}
+
+void
+gst_bt_bitset_unref (GstBtBitset * bitset)
+{
+  if (!g_atomic_int_dec_and_test (&bitset->ref_count))
+    return;
+
+  g_mutex_clear (&bitset->lock);
+  g_free (bitset->words);
+  g_free (bitset);
+}
+
+/* Must be called with the lock held */
+static void
+gst_bt_bitset_log_word (GstBtBitset * bitset, guint w)
+{
+  bitset->generation++;
+  bitset->log_word[bitset->generation % GST_BT_BITSET_LOG_SIZE] = w;
+}
+
+/* Returns TRUE if the bit was not set before */
+gboolean
+gst_bt_bitset_set (GstBtBitset * bitset, guint bit)
+{
+  guint w = bit / 32;
+  guint mask = 1u << (bit % 32);
+  guint old;
+
+  g_return_val_if_fail (bit < bitset->num_bits, FALSE);
+
+  old = g_atomic_int_or (&bitset->words[w], mask);
+  if (old & mask)
+    return FALSE;
+
+  g_mutex_lock (&bitset->lock);
+  gst_bt_bitset_log_word (bitset, w);
+  g_mutex_unlock (&bitset->lock);
+
+  return TRUE;
+}
+
+gboolean
+gst_bt_bitset_get (GstBtBitset * bitset, guint bit)
+{
+  if (bit >= bitset->num_bits)
+    return FALSE;
+
+  return (g_atomic_int_get (&bitset->words[bit / 32]) & (1u << (bit % 32))) != 0;
+}
+
+/* The first clear bit in [from, end), end if they are all set. Bits past num_bits
+ * count as clear. Skips a whole word of set bits at a time, for the scans over
+ * a window of pieces */
+guint
+gst_bt_bitset_find_next_clear (GstBtBitset * bitset, guint from, guint end)
+{
+  guint bit = from;
+
+  while (bit < end)
+  {
+    guint w = bit / 32;
+    guint word;
+
+    if (w >= bitset->num_words)
+      return bit;
+
+    /* the bits below from count as set */
+    word = ~g_atomic_int_get (&bitset->words[w]) & (~0u << (bit % 32));
+    if (word)
+    {
+      bit = w * 32 + g_bit_nth_lsf (word, -1);
+      return MIN (bit, end);
+    }
+    bit = (w + 1) * 32;
+  }
+
+  return end;
+}
+
+/* The first set bit in [from, end), end if there is none */
+guint
+gst_bt_bitset_find_next_set (GstBtBitset * bitset, guint from, guint end)
+{
+  guint bit = from;
+
+  end = MIN (end, bitset->num_bits);
+  while (bit < end)
+  {
+    guint w = bit / 32;
+    guint word;
+
+    word = g_atomic_int_get (&bitset->words[w]) & (~0u << (bit % 32));
+    if (word)
+    {
+      bit = w * 32 + g_bit_nth_lsf (word, -1);
+      return MIN (bit, end);
+    }
+    bit = (w + 1) * 32;
+  }
+
+  return end;
+}
+
+/* The next run of set bits starting at or after from and stopping at end.
+ * Returns FALSE once there are no more, otherwise the run is
+ * [*run_start, *run_end) and the following one is found from *run_end */
+gboolean
+gst_bt_bitset_next_set_run (GstBtBitset * bitset, guint from, guint end,
+    guint * run_start, guint * run_end)
+{
+  end = MIN (end, bitset->num_bits);
+
+  *run_start = gst_bt_bitset_find_next_set (bitset, from, end);
+  if (*run_start >= end)
+    return FALSE;
+
+  *run_end = gst_bt_bitset_find_next_clear (bitset, *run_start, end);
+
+  return TRUE;
+}
+
+/* The number of set bits in [begin, end), the partial words at both ends
+ * masked and the whole ones in between counted a word at a time */
+guint
+gst_bt_bitset_count_range (GstBtBitset * bitset, guint begin, guint end)
+{
+  guint count = 0;
+  guint w, last;
+
+  end = MIN (end, bitset->num_bits);
+  if (begin >= end)
+    return 0;
+
+  last = (end - 1) / 32;
+  for (w = begin / 32; w <= last; w++)
+  {
+    guint word = g_atomic_int_get (&bitset->words[w]);
+
+    if (w == begin / 32)
+      word &= ~0u << (begin % 32);
+    if (w == last && end % 32)
+      word &= ~0u >> (32 - end % 32);
+
+    count += __builtin_popcount (word);
+  }
+
+  return count;
+}
+
+/* Apply op word by word from src into dst, over the words both have. Every
+ * word of dst that changes is logged, so readers of dst pick it up with
+ * gst_bt_bitset_diff () */
+typedef enum
+{
+  GST_BT_BITSET_OP_AND,
+  GST_BT_BITSET_OP_OR,
+  GST_BT_BITSET_OP_ANDNOT,
+} GstBtBitsetOp;
+
+static void
+gst_bt_bitset_apply (GstBtBitset * dst, GstBtBitset * src, GstBtBitsetOp op)
+{
+  guint n_words = MIN (dst->num_words, src->num_words);
+  guint w;
+
+  g_mutex_lock (&dst->lock);
+  for (w = 0; w < n_words; w++)
+  {
+    guint word = g_atomic_int_get (&src->words[w]);
+    guint old;
+
+    /* src may be longer, never set bits past num_bits */
+    if (w == dst->num_words - 1 && dst->num_bits % 32)
+      word &= ~0u >> (32 - dst->num_bits % 32);
+
+    switch (op)
+    {
+      case GST_BT_BITSET_OP_AND:
+        old = g_atomic_int_and (&dst->words[w], word);
+        if (old & ~word)
+          gst_bt_bitset_log_word (dst, w);
+        break;
+
+      case GST_BT_BITSET_OP_OR:
+        old = g_atomic_int_or (&dst->words[w], word);
+        if (~old & word)
+          gst_bt_bitset_log_word (dst, w);
+        break;
+
+      case GST_BT_BITSET_OP_ANDNOT:
+        old = g_atomic_int_and (&dst->words[w], ~word);
+        if (old & word)
+          gst_bt_bitset_log_word (dst, w);
+        break;
+    }
+  }
+
+  /* words past the end of src are all clear there */
+  if (op == GST_BT_BITSET_OP_AND)
+  {
+    for (; w < dst->num_words; w++)
+    {
+      if (g_atomic_int_and (&dst->words[w], 0))
+        gst_bt_bitset_log_word (dst, w);
+    }
+  }
+  g_mutex_unlock (&dst->lock);
+}
+
+/* dst &= src */
+void
+gst_bt_bitset_and (GstBtBitset * dst, GstBtBitset * src)
+{
+  gst_bt_bitset_apply (dst, src, GST_BT_BITSET_OP_AND);
+}
+
+/* dst |= src */
+void
+gst_bt_bitset_or (GstBtBitset * dst, GstBtBitset * src)
+{
+  gst_bt_bitset_apply (dst, src, GST_BT_BITSET_OP_OR);
+}
+
+/* dst &= ~src */
+void
+gst_bt_bitset_andnot (GstBtBitset * dst, GstBtBitset * src)
+{
+  gst_bt_bitset_apply (dst, src, GST_BT_BITSET_OP_ANDNOT);
+}
+
+/* Set the bits set in an LSB-first byte array of n_bytes, the layout of the
+ * other bitfields of the player (the resume data, the block state). Bits
+ * clear there are left as they are, pieces are never lost */
+void
+gst_bt_bitset_import_bytes (GstBtBitset * bitset, const guint8 * bytes,
+    gsize n_bytes)
+{
+  guint w;
+
+  n_bytes = MIN (n_bytes, (gsize) bitset->num_words * 4);
+
+  g_mutex_lock (&bitset->lock);
+  for (w = 0; (gsize) w * 4 < n_bytes; w++)
+  {
+    gsize b = (gsize) w * 4;
+    guint word = 0;
+    guint old;
+    guint i;
+
+    for (i = 0; i < 4 && b + i < n_bytes; i++)
+      word |= (guint) bytes[b + i] << (8 * i);
+
+    /* whatever the bytes carry past num_bits */
+    if (w == bitset->num_words - 1 && bitset->num_bits % 32)
+      word &= ~0u >> (32 - bitset->num_bits % 32);
+
+    if (!word)
+      continue;
+
+    old = g_atomic_int_or (&bitset->words[w], word);
+    if (~old & word)
+      gst_bt_bitset_log_word (bitset, w);
+  }
+  g_mutex_unlock (&bitset->lock);
+}
+
+/* Write the whole bitset into an LSB-first byte array of n_bytes, the bytes
+ * past the bitset are cleared */
+void
+gst_bt_bitset_export_bytes (GstBtBitset * bitset, guint8 * bytes,
+    gsize n_bytes)
+{
+  GstBtBitsetRange range = { 0, bitset->num_words };
+
+  memset (bytes, 0, n_bytes);
+  gst_bt_bitset_or_into_bytes (bitset, &range, bytes, n_bytes);
+}
+
+guint64
+gst_bt_bitset_get_generation (GstBtBitset * bitset)
+{
+  guint64 generation;
+
+  g_mutex_lock (&bitset->lock);
+  generation = bitset->generation;
+  g_mutex_unlock (&bitset->lock);
+
+  return generation;
+}
+
+static gint
+gst_bt_bitset_compare_words (gconstpointer a, gconstpointer b)
+{
+  guint wa = *(const guint *) a;
+  guint wb = *(const guint *) b;
+
+  return wa < wb ? -1 : (wa > wb ? 1 : 0);
+}
+
+/* Append to ranges (of GstBtBitsetRange) the sorted, coalesced word ranges
+ * changed after the generation since, and return the current generation.
+ * A since of 0, or one older than the log remembers, gives the whole bitset */
+guint64
+gst_bt_bitset_diff (GstBtBitset * bitset, guint64 since, GArray * ranges)
+{
+  GstBtBitsetRange range;
+  guint64 generation;
+  guint *dirty;
+  guint n_dirty = 0;
+  guint i;
+
+  g_mutex_lock (&bitset->lock);
+  generation = bitset->generation;
+
+  if (since >= generation)
+  {
+    g_mutex_unlock (&bitset->lock);
+    return generation;
+  }
+
+  if (since == 0 || generation - since > GST_BT_BITSET_LOG_SIZE)
+  {
+    g_mutex_unlock (&bitset->lock);
+
+    range.first_word = 0;
+    range.n_words = bitset->num_words;
+    g_array_append_val (ranges, range);
+    return generation;
+  }
+
+  dirty = g_new (guint, generation - since);
+  for (guint64 g = since + 1; g <= generation; g++)
+  {
+    dirty[n_dirty++] = bitset->log_word[g % GST_BT_BITSET_LOG_SIZE];
+  }
+  g_mutex_unlock (&bitset->lock);
+
+  qsort (dirty, n_dirty, sizeof (guint), gst_bt_bitset_compare_words);
+
+  range.first_word = dirty[0];
+  range.n_words = 1;
+  for (i = 1; i < n_dirty; i++)
+  {
+    if (dirty[i] < range.first_word + range.n_words)
+      continue;
+
+    if (dirty[i] == range.first_word + range.n_words)
+    {
+      range.n_words++;
+      continue;
+    }
+
+    g_array_append_val (ranges, range);
+    range.first_word = dirty[i];
+    range.n_words = 1;
+  }
+  g_array_append_val (ranges, range);
+
+  g_free (dirty);
+
+  return generation;
+}
+
+/* OR the words of range into an LSB-first byte array of n_bytes, the layout
+ * of the other bitfields of the player, a word at a time */
+void
+gst_bt_bitset_or_into_bytes (GstBtBitset * bitset,
+    const GstBtBitsetRange * range, guint8 * bytes, gsize n_bytes)
+{
+  guint end = MIN (range->first_word + range->n_words, bitset->num_words);
+  guint w;
+
+  for (w = range->first_word; w < end; w++)
+  {
+    guint word = g_atomic_int_get (&bitset->words[w]);
+    gsize b = (gsize) w * 4;
+
+    if (!word)
+      continue;
+
+    if (b + 4 <= n_bytes)
+    {
+      bytes[b] |= word & 0xff;
+      bytes[b + 1] |= (word >> 8) & 0xff;
+      bytes[b + 2] |= (word >> 16) & 0xff;
+      bytes[b + 3] |= (word >> 24) & 0xff;
+    }
+    else
+    {
+      for (; b < n_bytes && word; b++, word >>= 8)
+        bytes[b] |= word & 0xff;
+    }
+  }
+}
@@ -0,0 +1,88 @@
+/* Gst-Bt - BitTorrent related GStreamer elements
+ * Copyright (C) 2015 Jorge Luis Zapata
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GST_BT_BITSET_H
+#define GST_BT_BITSET_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Piece availability bitset shared between btdemux (the writer, on the alert
+ * thread) and the UI (readers, on the main thread).
+ * Bits are kept in 32-bit words set with atomic ops, so readers never see a
+ * torn word. Every change bumps the generation and is recorded in a small
+ * log of dirty words, a reader remembers the generation it last synced to and
+ * asks only for the word ranges changed since then */
+
+#define GST_BT_BITSET_LOG_SIZE 1024
+
+typedef struct
+{
+  guint first_word;
+  guint n_words;
+} GstBtBitsetRange;
+
+typedef struct _GstBtBitset
+{
+  gint ref_count;
+
+  guint num_bits;
+  guint num_words;
+  guint *words;
+
+  /* guards generation and the dirty log */
+  GMutex lock;
+  guint64 generation;
+  /* word changed at generation g is at log_word[g % GST_BT_BITSET_LOG_SIZE] */
+  guint log_word[GST_BT_BITSET_LOG_SIZE];
+} GstBtBitset;
+
+GstBtBitset *gst_bt_bitset_new (guint num_bits);
+GstBtBitset *gst_bt_bitset_ref (GstBtBitset * bitset);
+void gst_bt_bitset_unref (GstBtBitset * bitset);
+
+gboolean gst_bt_bitset_set (GstBtBitset * bitset, guint bit);
+gboolean gst_bt_bitset_get (GstBtBitset * bitset, guint bit);
+guint gst_bt_bitset_find_next_clear (GstBtBitset * bitset, guint from,
+    guint end);
+guint gst_bt_bitset_find_next_set (GstBtBitset * bitset, guint from,
+    guint end);
+gboolean gst_bt_bitset_next_set_run (GstBtBitset * bitset, guint from,
+    guint end, guint * run_start, guint * run_end);
+guint gst_bt_bitset_count_range (GstBtBitset * bitset, guint begin,
+    guint end);
+guint64 gst_bt_bitset_get_generation (GstBtBitset * bitset);
+
+void gst_bt_bitset_and (GstBtBitset * dst, GstBtBitset * src);
+void gst_bt_bitset_or (GstBtBitset * dst, GstBtBitset * src);
+void gst_bt_bitset_andnot (GstBtBitset * dst, GstBtBitset * src);
+
+void gst_bt_bitset_import_bytes (GstBtBitset * bitset, const guint8 * bytes,
+    gsize n_bytes);
+void gst_bt_bitset_export_bytes (GstBtBitset * bitset, guint8 * bytes,
+    gsize n_bytes);
+
+guint64 gst_bt_bitset_diff (GstBtBitset * bitset, guint64 since,
+    GArray * ranges);
+void gst_bt_bitset_or_into_bytes (GstBtBitset * bitset,
+    const GstBtBitsetRange * range, guint8 * bytes, gsize n_bytes);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,320 @@
+/* Gst-Bt - BitTorrent related GStreamer elements
+ * Copyright (C) 2015 Jorge Luis Zapata
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The bitset ops, a bit at a time against the word at a time versions, on a
+ * mostly downloaded torrent: the window scans and counts of the buffering and
+ * seek snapping checks, the run iteration of the piece bar and the bitwise ops
+ * and byte conversions between bitsets. Also checks both agree */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "gst_bt_bitset.h"
+
+#define BENCH_PIECES 40000
+#define BENCH_WINDOW 512
+#define BENCH_ROUNDS 200
+
+static guint
+bench_find_next_clear_bitwise (GstBtBitset * bitset, guint from, guint end)
+{
+  guint bit;
+
+  for (bit = from; bit < end; bit++)
+  {
+    if (!gst_bt_bitset_get (bitset, bit))
+      return bit;
+  }
+
+  return end;
+}
+
+static guint
+bench_count_range_bitwise (GstBtBitset * bitset, guint begin, guint end)
+{
+  guint count = 0;
+  guint bit;
+
+  for (bit = begin; bit < end; bit++)
+  {
+    if (gst_bt_bitset_get (bitset, bit))
+      count++;
+  }
+
+  return count;
+}
+
+/* Sum of the run lengths plus their starts, so both agree on the runs */
+static guint64
+bench_runs_bitwise (GstBtBitset * bitset)
+{
+  guint64 sum = 0;
+  guint bit = 0;
+
+  while (bit < bitset->num_bits)
+  {
+    guint start;
+
+    if (!gst_bt_bitset_get (bitset, bit))
+    {
+      bit++;
+      continue;
+    }
+
+    start = bit;
+    while (bit < bitset->num_bits && gst_bt_bitset_get (bitset, bit))
+      bit++;
+    sum += start + (bit - start);
+  }
+
+  return sum;
+}
+
+static guint64
+bench_runs_words (GstBtBitset * bitset)
+{
+  guint64 sum = 0;
+  guint start, end = 0;
+
+  while (gst_bt_bitset_next_set_run (bitset, end, bitset->num_bits, &start,
+          &end))
+    sum += start + (end - start);
+
+  return sum;
+}
+
+static void
+bench_ops_bitwise (GstBtBitset * dst, GstBtBitset * a, GstBtBitset * b)
+{
+  guint bit;
+
+  for (bit = 0; bit < dst->num_bits; bit++)
+  {
+    gboolean x = gst_bt_bitset_get (a, bit);
+    gboolean y = gst_bt_bitset_get (b, bit);
+
+    /* (a | b) & ~(a & b) */
+    if ((x || y) && !(x && y))
+      gst_bt_bitset_set (dst, bit);
+  }
+}
+
+static void
+bench_ops_words (GstBtBitset * dst, GstBtBitset * a, GstBtBitset * b)
+{
+  GstBtBitset *both = gst_bt_bitset_new (dst->num_bits);
+
+  gst_bt_bitset_or (dst, a);
+  gst_bt_bitset_or (dst, b);
+  gst_bt_bitset_or (both, a);
+  gst_bt_bitset_and (both, b);
+  gst_bt_bitset_andnot (dst, both);
+
+  gst_bt_bitset_unref (both);
+}
+
+static void
+bench_bytes_bitwise (GstBtBitset * src, GstBtBitset * dst, guint8 * bytes)
+{
+  guint bit;
+
+  memset (bytes, 0, (src->num_bits + 7) / 8);
+  for (bit = 0; bit < src->num_bits; bit++)
+  {
+    if (gst_bt_bitset_get (src, bit))
+      bytes[bit / 8] |= 1 << (bit % 8);
+  }
+  for (bit = 0; bit < dst->num_bits; bit++)
+  {
+    if (bytes[bit / 8] & (1 << (bit % 8)))
+      gst_bt_bitset_set (dst, bit);
+  }
+}
+
+static void
+bench_bytes_words (GstBtBitset * src, GstBtBitset * dst, guint8 * bytes)
+{
+  gsize n_bytes = (src->num_bits + 7) / 8;
+
+  gst_bt_bitset_export_bytes (src, bytes, n_bytes);
+  gst_bt_bitset_import_bytes (dst, bytes, n_bytes);
+}
+
+static gboolean
+bench_bitsets_equal (GstBtBitset * a, GstBtBitset * b)
+{
+  guint bit;
+
+  for (bit = 0; bit < a->num_bits; bit++)
+  {
+    if (gst_bt_bitset_get (a, bit) != gst_bt_bitset_get (b, bit))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+static void
+bench_report (const gchar * what, gint64 bitwise_us, gint64 words_us)
+{
+  printf ("%-16s bit by bit %8" G_GINT64_FORMAT " us, word at a time %8"
+      G_GINT64_FORMAT " us\n", what, bitwise_us, words_us);
+}
+
+int
+main (int argc, char **argv)
+{
+  GstBtBitset *bitset, *other;
+  GRand *rand;
+  gint64 start, bitwise_us, words_us;
+  guint64 sum_bitwise, sum_words;
+  guint8 *bytes;
+  guint i, round, from;
+  gboolean ok = TRUE;
+
+  /* everything downloaded but a few holes, and another peer's half */
+  bitset = gst_bt_bitset_new (BENCH_PIECES);
+  other = gst_bt_bitset_new (BENCH_PIECES);
+  rand = g_rand_new_with_seed (42);
+  for (i = 0; i < BENCH_PIECES; i++)
+  {
+    if (g_rand_int_range (rand, 0, 1000) != 0)
+      gst_bt_bitset_set (bitset, i);
+    if (g_rand_int_range (rand, 0, 2) != 0)
+      gst_bt_bitset_set (other, i);
+  }
+  bytes = g_new0 (guint8, (BENCH_PIECES + 7) / 8);
+
+  printf ("%u pieces, window %u, %u rounds\n", BENCH_PIECES, BENCH_WINDOW,
+      BENCH_ROUNDS);
+
+  sum_bitwise = sum_words = 0;
+  start = g_get_monotonic_time ();
+  for (round = 0; round < BENCH_ROUNDS; round++)
+  {
+    for (from = 0; from < BENCH_PIECES; from += BENCH_WINDOW / 4)
+      sum_bitwise += bench_find_next_clear_bitwise (bitset, from, from + BENCH_WINDOW);
+  }
+  bitwise_us = g_get_monotonic_time () - start;
+
+  start = g_get_monotonic_time ();
+  for (round = 0; round < BENCH_ROUNDS; round++)
+  {
+    for (from = 0; from < BENCH_PIECES; from += BENCH_WINDOW / 4)
+      sum_words += gst_bt_bitset_find_next_clear (bitset, from, from + BENCH_WINDOW);
+  }
+  words_us = g_get_monotonic_time () - start;
+  bench_report ("find next clear", bitwise_us, words_us);
+  ok &= sum_bitwise == sum_words;
+
+  sum_bitwise = sum_words = 0;
+  start = g_get_monotonic_time ();
+  for (round = 0; round < BENCH_ROUNDS; round++)
+  {
+    for (from = 0; from < BENCH_PIECES; from += BENCH_WINDOW / 4)
+      sum_bitwise += bench_count_range_bitwise (bitset, from + 3, from + BENCH_WINDOW);
+  }
+  bitwise_us = g_get_monotonic_time () - start;
+
+  start = g_get_monotonic_time ();
+  for (round = 0; round < BENCH_ROUNDS; round++)
+  {
+    for (from = 0; from < BENCH_PIECES; from += BENCH_WINDOW / 4)
+      sum_words += gst_bt_bitset_count_range (bitset, from + 3, from + BENCH_WINDOW);
+  }
+  words_us = g_get_monotonic_time () - start;
+  bench_report ("count range", bitwise_us, words_us);
+  ok &= sum_bitwise == sum_words;
+
+  sum_bitwise = sum_words = 0;
+  start = g_get_monotonic_time ();
+  for (round = 0; round < BENCH_ROUNDS; round++)
+    sum_bitwise += bench_runs_bitwise (bitset);
+  bitwise_us = g_get_monotonic_time () - start;
+
+  start = g_get_monotonic_time ();
+  for (round = 0; round < BENCH_ROUNDS; round++)
+    sum_words += bench_runs_words (bitset);
+  words_us = g_get_monotonic_time () - start;
+  bench_report ("set runs", bitwise_us, words_us);
+  ok &= sum_bitwise == sum_words;
+
+  /* the ops allocate their results, fewer rounds */
+  {
+    GstBtBitset *result_bitwise = NULL, *result_words = NULL;
+
+    start = g_get_monotonic_time ();
+    for (round = 0; round < BENCH_ROUNDS / 10; round++)
+    {
+      if (result_bitwise)
+        gst_bt_bitset_unref (result_bitwise);
+      result_bitwise = gst_bt_bitset_new (BENCH_PIECES);
+      bench_ops_bitwise (result_bitwise, bitset, other);
+    }
+    bitwise_us = g_get_monotonic_time () - start;
+
+    start = g_get_monotonic_time ();
+    for (round = 0; round < BENCH_ROUNDS / 10; round++)
+    {
+      if (result_words)
+        gst_bt_bitset_unref (result_words);
+      result_words = gst_bt_bitset_new (BENCH_PIECES);
+      bench_ops_words (result_words, bitset, other);
+    }
+    words_us = g_get_monotonic_time () - start;
+    bench_report ("and/or/andnot", bitwise_us, words_us);
+    ok &= bench_bitsets_equal (result_bitwise, result_words);
+
+    start = g_get_monotonic_time ();
+    for (round = 0; round < BENCH_ROUNDS / 10; round++)
+    {
+      gst_bt_bitset_unref (result_bitwise);
+      result_bitwise = gst_bt_bitset_new (BENCH_PIECES);
+      bench_bytes_bitwise (bitset, result_bitwise, bytes);
+    }
+    bitwise_us = g_get_monotonic_time () - start;
+
+    start = g_get_monotonic_time ();
+    for (round = 0; round < BENCH_ROUNDS / 10; round++)
+    {
+      gst_bt_bitset_unref (result_words);
+      result_words = gst_bt_bitset_new (BENCH_PIECES);
+      bench_bytes_words (bitset, result_words, bytes);
+    }
+    words_us = g_get_monotonic_time () - start;
+    bench_report ("export/import", bitwise_us, words_us);
+    ok &= bench_bitsets_equal (result_bitwise, result_words);
+    ok &= bench_bitsets_equal (bitset, result_words);
+
+    gst_bt_bitset_unref (result_bitwise);
+    gst_bt_bitset_unref (result_words);
+  }
+
+  g_free (bytes);
+  g_rand_free (rand);
+  gst_bt_bitset_unref (other);
+  gst_bt_bitset_unref (bitset);
+
+  if (!ok)
+  {
+    fprintf (stderr, "the bitwise and word versions disagree\n");
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,108 @@
+/* Gst-Bt - BitTorrent related GStreamer elements
+ * Copyright (C) 2015 Jorge Luis Zapata
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gst_bt_block_state.h"
+
+GstBtBlockState *
+gst_bt_block_state_new (guint num_pieces, guint blocks_per_piece,
+    guint blocks_last_piece)
+{
+  GstBtBlockState *state = g_new0 (GstBtBlockState, 1);
+
+  state->ref_count = 1;
+  state->num_pieces = num_pieces;
+  state->blocks_per_piece = blocks_per_piece;
+  state->blocks_last_piece = blocks_last_piece;
+  state->num_blocks = num_pieces ?
+      blocks_per_piece * (num_pieces - 1) + blocks_last_piece : 0;
+
+  state->have = g_new0 (guint8, MAX (gst_bt_block_state_have_bytes (state), 1));
+  state->partial = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+      NULL, g_free);
+
+  return state;
+}
+
+GstBtBlockState *
+gst_bt_block_state_ref (GstBtBlockState * state)
+{
+  g_atomic_int_inc (&state->ref_count);
+  return state;
+}
+
+void
+gst_bt_block_state_unref (GstBtBlockState * state)
+{
+  if (!g_atomic_int_dec_and_test (&state->ref_count))
+    return;
+
+  g_hash_table_unref (state->partial);
+  g_free (state->have);
+  g_free (state);
+}
+
+gsize
+gst_bt_block_state_have_bytes (GstBtBlockState * state)
+{
+  return (state->num_pieces + 7) / 8;
+}
+
+/* even the last piece has a bitmap as large as the others */
+gsize
+gst_bt_block_state_block_bytes (GstBtBlockState * state)
+{
+  return (state->blocks_per_piece + 7) / 8;
+}
+
+guint
+gst_bt_block_state_blocks_in_piece (GstBtBlockState * state, guint piece)
+{
+  return piece == state->num_pieces - 1 ?
+      state->blocks_last_piece : state->blocks_per_piece;
+}
+
+/* NULL if no block of the piece is known */
+guint8 *
+gst_bt_block_state_get_partial (GstBtBlockState * state, guint piece)
+{
+  return g_hash_table_lookup (state->partial, GUINT_TO_POINTER (piece));
+}
+
+guint8 *
+gst_bt_block_state_ensure_partial (GstBtBlockState * state, guint piece)
+{
+  guint8 *blocks = gst_bt_block_state_get_partial (state, piece);
+
+  if (!blocks)
+  {
+    blocks = g_new0 (guint8, MAX (gst_bt_block_state_block_bytes (state), 1));
+    g_hash_table_insert (state->partial, GUINT_TO_POINTER (piece), blocks);
+  }
+
+  return blocks;
+}
+
+/* the whole piece is there, its block bitmap is not needed anymore */
+void
+gst_bt_block_state_set_have (GstBtBlockState * state, guint piece)
+{
+  g_return_if_fail (piece < state->num_pieces);
+
+  state->have[piece / 8] |= 1 << (piece % 8);
+  g_hash_table_remove (state->partial, GUINT_TO_POINTER (piece));
+}
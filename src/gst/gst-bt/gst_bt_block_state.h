@@ -0,0 +1,64 @@
+/* Gst-Bt - BitTorrent related GStreamer elements
+ * Copyright (C) 2015 Jorge Luis Zapata
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GST_BT_BLOCK_STATE_H
+#define GST_BT_BLOCK_STATE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Which pieces and blocks of the torrent we have, as resumed when the torrent
+ * is added: one LSB-first bitmap of the finished pieces, and a block bitmap
+ * only for the partially downloaded pieces, looked up by piece index.
+ * Untouched and finished pieces cost nothing beyond their bit.
+ * btdemux builds it and hands it over by reference, the receiver owns it
+ * from then on and may keep updating it */
+
+typedef struct _GstBtBlockState
+{
+  gint ref_count;
+
+  guint num_pieces;
+  guint num_blocks;
+  guint blocks_per_piece;
+  guint blocks_last_piece;
+
+  /* (num_pieces + 7) / 8 bytes */
+  guint8 *have;
+  /* piece index -> block bitmap of (blocks_per_piece + 7) / 8 bytes */
+  GHashTable *partial;
+} GstBtBlockState;
+
+GstBtBlockState *gst_bt_block_state_new (guint num_pieces,
+    guint blocks_per_piece, guint blocks_last_piece);
+GstBtBlockState *gst_bt_block_state_ref (GstBtBlockState * state);
+void gst_bt_block_state_unref (GstBtBlockState * state);
+
+gsize gst_bt_block_state_have_bytes (GstBtBlockState * state);
+gsize gst_bt_block_state_block_bytes (GstBtBlockState * state);
+guint gst_bt_block_state_blocks_in_piece (GstBtBlockState * state, guint piece);
+
+guint8 *gst_bt_block_state_get_partial (GstBtBlockState * state, guint piece);
+guint8 *gst_bt_block_state_ensure_partial (GstBtBlockState * state,
+    guint piece);
+void gst_bt_block_state_set_have (GstBtBlockState * state, guint piece);
+
+G_END_DECLS
+
+#endif
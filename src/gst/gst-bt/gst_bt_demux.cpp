@@ -30,6 +30,7 @@
 
 #include "gst_bt.h"
 #include "gst_bt_demux.hpp"
+#include "gst_bt_mp4_index.h"
 #include <gst/base/gsttypefindhelper.h>
 #include <glib/gstdio.h>
 
@@ -38,8 +39,15 @@
 #include <string>
 #include <memory>
 #include <cstdio>
+#include <cstring>
 #include <functional>
 #include <string_view>
+#include <list>
+#include <set>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <sstream>
 
 #include "libtorrent/session.hpp"
 #include "libtorrent/torrent_info.hpp"
@@ -55,6 +63,29 @@
 #define DEFAULT_BUFFER_PIECES 3
 #define DEFAULT_DIR "btdemux"
 #define DEFAULT_TEMP_REMOVE FALSE 
+#define DEFAULT_PIECE_CACHE_SIZE (64 * 1024 * 1024)
+#define DEFAULT_MAX_QUEUED_BYTES (32 * 1024 * 1024)
+#define DEFAULT_MAX_QUEUED_PIECES 8
+#define DEFAULT_STATS_INTERVAL 1000
+#define REDUCED_STATS_INTERVAL 5000
+#define MINIMAL_STATS_INTERVAL 30000
+#define DEFAULT_PPI_INTERVAL 500
+#define DEFAULT_BUFFERING_INTERVAL 250
+/* above the default priority of the rest of the stream, below the
+ * top_priority of the playhead window */
+#define PREFETCH_PRIORITY 6
+/* the likely seek targets, below the prefetch of the position the user points at,
+ * each one gets HOTSPOT_PIECES of the stream to start from */
+#define HOTSPOT_PRIORITY 5
+#define HOTSPOT_PIECES 1
+#define DEFAULT_HOTSPOT_SHARE 20
+#define MAX_HOTSPOT_SHARE 90
+/* trick modes show about TRICKMODE_KEYFRAMES_PER_SECOND keyframes per second of playback
+ * and keep the pieces of the next TRICKMODE_AHEAD of them downloading */
+#define TRICKMODE_KEYFRAMES_PER_SECOND 2
+#define TRICKMODE_AHEAD 8
+/* piece of the empty ipc_data a trick seek queues to wake up push_loop */
+#define TRICKMODE_WAKEUP_PIECE -2
 
 GST_DEBUG_CATEGORY_EXTERN (gst_bt_demux_debug);
 #define GST_CAT_DEFAULT gst_bt_demux_debug
@@ -93,6 +124,10 @@ typedef struct _GstBtDemuxBufferData
  *----------------------------------------------------------------------------*/
 static void gst_bt_demux_buffer_data_free (gpointer data)
 {
+  GstBtDemuxBufferData *buf_data = (GstBtDemuxBufferData *) data;
+
+  //allocated with g_new0, so drop our reference on the piece by hand
+  buf_data->buffer.reset ();
   g_free (data);
 }
 
@@ -167,970 +202,3084 @@ GstBuffer * gst_bt_demux_buffer_new (boost::shared_array <char> const buffer,
 
 
 
-/********************************************Partial_Piece_Info *************************************/
-static void 
-gst_free_ppi_data (gpointer data) 
+/*----------------------------------------------------------------------------*
+ *                             The piece cache                                *
+ *----------------------------------------------------------------------------*/
+/* Recently read pieces are kept in memory, so a backward seek, a replay or the
+ * moov-after-mdat restart doesn't go through h.read_piece() (disk read plus a
+ * full piece allocation) for a piece we pushed seconds ago.
+ * Entries are keyed by the piece index within the torrent, so a piece straddling
+ * two files is read once and shared by both streams, the shared_array is
+ * refcounted and never copied.
+ * Eviction is LRU under a byte budget, the window of the requested stream and
+ * the index pieces (first/last piece of each video, where the moov atom lives)
+ * are pinned and never evicted, as is the range a segment seek loops over */
+typedef struct _GstBtDemuxCachedPiece
 {
-    // Cast back to the correct type
-    std::vector<libtorrent::partial_piece_info>* ppi = static_cast<std::vector<libtorrent::partial_piece_info>*>(data);  
-    // Free memory allocated with new
-    delete ppi;  
-}
+  boost::shared_array <char> buffer;
+  int size;
+  std::list<int>::iterator lru_pos;
+} GstBtDemuxCachedPiece;
 
+typedef struct _GstBtDemuxPieceCache
+{
+  GMutex lock;
 
-static DownloadingBlocksSd* downloading_blocks_sd_copy(const DownloadingBlocksSd *src) {
-    DownloadingBlocksSd *copy = (DownloadingBlocksSd *)g_new(DownloadingBlocksSd, 1);
-    copy->size = src->size;
-    copy->array = (DownloadingBlocks*) g_new(DownloadingBlocks, src->size);
+  //most recently used piece index at the front
+  std::list<int> lru;
+  std::unordered_map<int, GstBtDemuxCachedPiece> pieces;
 
-    for (int i = 0; i < src->size; i++) {
-        copy->array[i].piece_index = src->array[i].piece_index;
-        copy->array[i].blocks_progress = (guint8*) g_memdup(src->array[i].blocks_progress, sizeof(guint8));
-    }
+  gint64 bytes;
+  gint64 max_bytes;
 
-    return copy;
-}
+  //pinned pieces: the window of the requested stream, the index pieces and the
+  //range of a loop
+  int window_start;
+  int window_end;
+  std::set<int> index_pieces;
+  int loop_start;
+  int loop_end;
 
-static void downloading_blocks_sd_free(DownloadingBlocksSd *value) {
-    if (value->array != NULL) {
-        for (int i = 0; i < value->size; i++) {
-            g_free(value->array[i].blocks_progress);
-        }
-        g_free(value->array);
-    }
-    g_free(value);
-}
+  guint64 hits;
+  guint64 misses;
+} GstBtDemuxPieceCache;
 
-GType downloading_blocks_sd_get_type(void) {
-    static GType type = 0;
-    if (!type) {
-        type = g_boxed_type_register_static ("DownloadingBlocksSd",
-                (GBoxedCopyFunc)downloading_blocks_sd_copy,
-                (GBoxedFreeFunc)downloading_blocks_sd_free);
-    }
-    return type;
+
+static GstBtDemuxPieceCache *
+gst_bt_demux_piece_cache_new (gint64 max_bytes)
+{
+  GstBtDemuxPieceCache *cache = new GstBtDemuxPieceCache ();
+
+  g_mutex_init (&cache->lock);
+  cache->bytes = 0;
+  cache->max_bytes = max_bytes;
+  cache->window_start = -1;
+  cache->window_end = -1;
+  cache->loop_start = -1;
+  cache->loop_end = -1;
+  cache->hits = 0;
+  cache->misses = 0;
+
+  return cache;
 }
 
+static void
+gst_bt_demux_piece_cache_free (GstBtDemuxPieceCache * cache)
+{
+  g_mutex_clear (&cache->lock);
+  delete cache;
+}
 
+/* must be called with the cache lock held */
+static gboolean
+gst_bt_demux_piece_cache_is_pinned (GstBtDemuxPieceCache * cache, int piece)
+{
+  if (piece >= cache->window_start && piece <= cache->window_end)
+  {
+    return TRUE;
+  }
+  if (piece >= cache->loop_start && piece <= cache->loop_end)
+  {
+    return TRUE;
+  }
 
+  return cache->index_pieces.count (piece) > 0;
+}
 
-//NOT USE
-// /*----------------------------------------------------------------------------*
-//  *                           The selector policy                              *
-//  *----------------------------------------------------------------------------*/
-// static GType
-// gst_bt_demux_selector_policy_get_type (void)
-// {
-//   static GType gst_bt_demux_selector_policy_type = 0;
-//   static const GEnumValue selector_policy_types[] = {
-//     {GST_BT_DEMUX_SELECTOR_POLICY_ALL, "All streams", "all" },
-//     {GST_BT_DEMUX_SELECTOR_POLICY_LARGER, "Larger stream", "larger" },
-//     {0, NULL, NULL}
-//   };
+/* must be called with the cache lock held */
+static void
+gst_bt_demux_piece_cache_evict (GstBtDemuxPieceCache * cache)
+{
+  std::list<int>::iterator it = cache->lru.end ();
 
-//   if (!gst_bt_demux_selector_policy_type) {
-//     gst_bt_demux_selector_policy_type =
-//         g_enum_register_static ("GstBtDemuxSelectorPolicy",
-//         selector_policy_types);
-//   }
-//   return gst_bt_demux_selector_policy_type;
-// }
+  //walk from the least recently used piece, skipping the pinned ones
+  while (cache->bytes > cache->max_bytes && it != cache->lru.begin ())
+  {
+    --it;
+    int piece = *it;
 
+    if (gst_bt_demux_piece_cache_is_pinned (cache, piece))
+    {
+      continue;
+    }
 
+    std::unordered_map<int, GstBtDemuxCachedPiece>::iterator entry = cache->pieces.find (piece);
+    cache->bytes -= entry->second.size;
+    cache->pieces.erase (entry);
+    it = cache->lru.erase (it);
+  }
+}
 
+static void
+gst_bt_demux_piece_cache_insert (GstBtDemuxPieceCache * cache, int piece,
+    boost::shared_array <char> const buffer, int size)
+{
+  g_mutex_lock (&cache->lock);
 
+  //a zero budget disables the cache
+  if (cache->max_bytes <= 0)
+  {
+    g_mutex_unlock (&cache->lock);
+    return;
+  }
 
+  std::unordered_map<int, GstBtDemuxCachedPiece>::iterator entry = cache->pieces.find (piece);
+  if (entry != cache->pieces.end ())
+  {
+    //pieces never change once hash-checked, just refresh its position
+    cache->lru.splice (cache->lru.begin (), cache->lru, entry->second.lru_pos);
+  }
+  else
+  {
+    GstBtDemuxCachedPiece cached;
 
+    cache->lru.push_front (piece);
+    cached.buffer = buffer;
+    cached.size = size;
+    cached.lru_pos = cache->lru.begin ();
+    cache->pieces[piece] = cached;
+    cache->bytes += size;
 
+    gst_bt_demux_piece_cache_evict (cache);
+  }
 
+  g_mutex_unlock (&cache->lock);
+}
 
-/*----------------------------------------------------------------------------*
- *                             The stream class                               *
- *----------------------------------------------------------------------------*/
+static gboolean
+gst_bt_demux_piece_cache_lookup (GstBtDemuxPieceCache * cache, int piece,
+    boost::shared_array <char> * buffer, int * size)
+{
+  gboolean found = FALSE;
 
-G_DEFINE_TYPE (GstBtDemuxStream, gst_bt_demux_stream, GST_TYPE_PAD);
+  g_mutex_lock (&cache->lock);
 
+  std::unordered_map<int, GstBtDemuxCachedPiece>::iterator entry = cache->pieces.find (piece);
+  if (entry != cache->pieces.end ())
+  {
+    cache->lru.splice (cache->lru.begin (), cache->lru, entry->second.lru_pos);
+    *buffer = entry->second.buffer;
+    *size = entry->second.size;
+    cache->hits++;
+    found = TRUE;
+  }
+  else
+  {
+    cache->misses++;
+  }
 
+  g_mutex_unlock (&cache->lock);
 
+  return found;
+}
 
 static void
-gst_bt_demux_stream_push_loop (gpointer user_data)
+gst_bt_demux_piece_cache_pin_window (GstBtDemuxPieceCache * cache, int start, int end)
 {
+  g_mutex_lock (&cache->lock);
+  cache->window_start = start;
+  cache->window_end = end;
+  //the previous window is unpinned now, give its pieces back to the budget
+  gst_bt_demux_piece_cache_evict (cache);
+  g_mutex_unlock (&cache->lock);
+}
 
-  using namespace libtorrent;
-  GstBtDemux *demux;
-  GstBtDemuxStream *thiz;
-  GstBtDemuxBufferData *ipc_data;
-  GstBuffer *buf;
-  GstFlowReturn ret;
-  GstBtDemuxBufferData *buf_data;
-  GSList *walk;
-  guint8 *data;
-  session *s;
-  torrent_handle h;
-  gboolean update_buffering = FALSE;
-  gboolean send_eos = FALSE;
-  gint buf_size;
+/* keep [start,end] while it is looped over, -1 to release it. A range larger than
+ * half the budget is not pinned, it would leave no room for the rest */
+static gboolean
+gst_bt_demux_piece_cache_pin_loop (GstBtDemuxPieceCache * cache, int start, int end,
+    int piece_length)
+{
+  gboolean pinned = FALSE;
 
-  //our current stream, there may be multiple stream within torrent
-  thiz = GST_BT_DEMUX_STREAM (user_data);
+  g_mutex_lock (&cache->lock);
+  cache->loop_start = -1;
+  cache->loop_end = -1;
+  if (start >= 0 && end >= start &&
+      (gint64) (end - start + 1) * piece_length <= cache->max_bytes / 2)
+  {
+    cache->loop_start = start;
+    cache->loop_end = end;
+    pinned = TRUE;
+  }
+  gst_bt_demux_piece_cache_evict (cache);
+  g_mutex_unlock (&cache->lock);
 
-              
-                                // printf("(bt_demux_stream_push_loop) Pad is %d 1-PUSH, 2-PULL, >start_piece= %d,current_piece=(%d)\n", 
-                                //     (int)GST_PAD_MODE (thiz), thiz->start_piece, thiz->current_piece);
+  return pinned;
+}
 
-                    
-  demux = GST_BT_DEMUX (gst_pad_get_parent (GST_PAD (thiz)));
+static void
+gst_bt_demux_piece_cache_pin_index (GstBtDemuxPieceCache * cache, int piece)
+{
+  g_mutex_lock (&cache->lock);
+  cache->index_pieces.insert (piece);
+  g_mutex_unlock (&cache->lock);
+}
 
-                                GstTaskState tstate = gst_pad_get_task_state (GST_PAD_CAST (thiz));  
+static void
+gst_bt_demux_piece_cache_set_max_bytes (GstBtDemuxPieceCache * cache, gint64 max_bytes)
+{
+  g_mutex_lock (&cache->lock);
+  cache->max_bytes = max_bytes;
+  gst_bt_demux_piece_cache_evict (cache);
+  g_mutex_unlock (&cache->lock);
+}
 
-                                printf("(bt_demux_stream_push_loop) FIRE %s [start piece idx:%d, end piece idx:%d],current_piece:%d,pad task state %d \n", 
-                                          GST_PAD_NAME (thiz), thiz->start_piece, thiz->end_piece, thiz->current_piece, (int)tstate);
+static void
+gst_bt_demux_piece_cache_clear (GstBtDemuxPieceCache * cache)
+{
+  g_mutex_lock (&cache->lock);
+
+              printf ("(gst_bt_demux_piece_cache_clear) %ld bytes cached, hits:%lu, misses:%lu\n",
+                  (long) cache->bytes, (unsigned long) cache->hits, (unsigned long) cache->misses);
+
+  cache->pieces.clear ();
+  cache->lru.clear ();
+  cache->index_pieces.clear ();
+  cache->bytes = 0;
+  cache->window_start = -1;
+  cache->window_end = -1;
+  cache->loop_start = -1;
+  cache->loop_end = -1;
+  g_mutex_unlock (&cache->lock);
+}
 
-  //demux->finished field doesn't means that the whole torrent finished, we are seeder
-  //it is set to TRUE when torrent_removed_alert, so push_loop will terminate
-  if (demux->finished) 
+
+
+/*----------------------------------------------------------------------------*
+ *                            The queue accounting                            *
+ *----------------------------------------------------------------------------*/
+/* Every piece sitting in a stream ipc queue is a whole piece in memory (up to
+ * 16MB each), and nothing stops the reads from piling up while downstream is
+ * paused or slow. We account what is queued and defer new reads once over
+ * max-queued-bytes/max-queued-pieces, push_loop issues them again as it drains.
+ * An empty queue never counts as full, so a piece larger than the byte limit
+ * still goes through */
+
+/* must be called with the queue lock held */
+static gboolean
+gst_bt_demux_queue_is_full (GstBtDemux * thiz)
+{
+  if (thiz->queued_pieces == 0)
   {
-                                printf("(bt_demux_stream_push_loop) %s demux->finished, so return\n", GST_PAD_NAME (thiz));
-    gst_pad_pause_task (GST_PAD (thiz));
-    return;
+    return FALSE;
   }
 
-  //check requested, if modified , means we should not keep pushing the current stream
-  if (!thiz->requested)
+  if (thiz->max_queued_pieces > 0 && thiz->queued_pieces >= thiz->max_queued_pieces)
   {
-                                printf("(bt_demux_stream_push_loop) Undesired stream %s checked\n", GST_PAD_NAME (thiz));
-    
-    gst_pad_pause_task (GST_PAD (thiz));
+    return TRUE;
+  }
 
-    return;
+  if (thiz->max_queued_bytes > 0 && thiz->queued_bytes >= thiz->max_queued_bytes)
+  {
+    return TRUE;
   }
 
-          gboolean have_type_emitted = FALSE;
-          gboolean need_re_push = FALSE;
-          // the peer pad of our btdemux src pad is 
-          // gstdecodebin2's static sink pad which is ghost pad to gsttypefindelement
-          GstPad* peerpad = gst_pad_get_peer (GST_PAD (thiz));
-          if (peerpad && GST_IS_GHOST_PAD (peerpad))
-          {
-              GstPad* internal_pad = gst_ghost_pad_get_target (GST_GHOST_PAD (peerpad));
-              if (!internal_pad) {
-                  printf ("(bt_demux_stream_push_loop) decodebin ghost sink pad Has no target yet, return\n");
-                return;
-              } else {
-
-                  printf ("(bt_demux_stream_push_loop) decodebin ghost sink pad is ok to have target\n");
-
-                  GstObject* parent = gst_pad_get_parent (internal_pad);
-                  if (parent) {
-                    g_object_get (G_OBJECT (parent), "have-type-emitted", &have_type_emitted, NULL);
-                    if (FALSE == have_type_emitted) {
-                      printf ("(bt_demux_stream_push_loop) have_type not emitted yet\n");
-                    } else {
-                      printf ("(bt_demux_stream_push_loop) have_type emitted, proceeding \n");
-                    }
-                    gst_object_unref (parent);
-                  } else {
-                    printf ("(bt_demux_stream_push_loop) parent is NULL \n");
-                  } 
-                  gst_object_unref (internal_pad);
-              }
+  return FALSE;
+}
 
-            gst_object_unref (peerpad);
-            
-          } else if (peerpad && !GST_IS_GHOST_PAD (peerpad)) {
-            printf ("(bt_demux_stream_push_loop) peer pad is not Ghost pad\n");
-            gst_object_unref (peerpad);
-          }
+static void
+gst_bt_demux_queue_acquire (GstBtDemux * thiz, int size)
+{
+  g_mutex_lock (&thiz->queue_lock);
+  thiz->queued_bytes += size;
+  thiz->queued_pieces++;
+  g_mutex_unlock (&thiz->queue_lock);
+}
 
+static void
+gst_bt_demux_queue_release (GstBtDemux * thiz, int size)
+{
+  g_mutex_lock (&thiz->queue_lock);
+  thiz->queued_bytes -= size;
+  thiz->queued_pieces--;
+  thiz->pushed_bytes += size;
+  g_mutex_unlock (&thiz->queue_lock);
+}
 
-  //----Pushed in read_piece_alert handling code, pop up here
-  // If thiz->ipc (gasyncqueue) is empty, `g_async_queue_pop` blocks until data becomes available
-  ipc_data = (GstBtDemuxBufferData *) g_async_queue_pop (thiz->ipc);
-  if (!ipc_data) 
-  {
-                          printf("(bt_demux_stream_push_loop) !ipc_data, so return\n");
+/* remember a read we can't issue now, once per piece */
+static gboolean
+gst_bt_demux_queue_defer_read (GstBtDemux * thiz, int piece)
+{
+  gboolean deferred = FALSE;
+  guint i;
 
-    gst_pad_pause_task (GST_PAD (thiz));
-    return;
+  g_mutex_lock (&thiz->queue_lock);
+  if (gst_bt_demux_queue_is_full (thiz))
+  {
+    deferred = TRUE;
+    for (i = 0; i < thiz->deferred_reads->len; i++)
+    {
+      if (g_array_index (thiz->deferred_reads, gint, i) == piece)
+        break;
+    }
+    if (i == thiz->deferred_reads->len)
+    {
+      g_array_append_val (thiz->deferred_reads, piece);
+    }
   }
-  if (!ipc_data->size) 
+  g_mutex_unlock (&thiz->queue_lock);
+
+  return deferred;
+}
+
+/* forget the deferred reads outside [start,end], the window a seek moved to */
+static void
+gst_bt_demux_queue_drop_deferred (GstBtDemux * thiz, int start, int end)
+{
+  guint i, kept = 0;
+
+  g_mutex_lock (&thiz->queue_lock);
+  for (i = 0; i < thiz->deferred_reads->len; i++)
   {
-                          printf("(bt_demux_stream_push_loop) ipc_data->size is zero,means btdemux have cleanup so return\n");
+    int piece = g_array_index (thiz->deferred_reads, gint, i);
 
-    gst_bt_demux_buffer_data_free (ipc_data);
-    g_static_rec_mutex_unlock (thiz->lock);
-    return;
+    if (piece >= start && piece <= end)
+    {
+      g_array_index (thiz->deferred_reads, gint, kept++) = piece;
+    }
   }
+  g_array_set_size (thiz->deferred_reads, kept);
+  g_mutex_unlock (&thiz->queue_lock);
+}
 
+/* drop whatever is left in the ipc queue of a stream whose task is stopped,
+ * otherwise those pieces would be accounted forever */
+static void
+gst_bt_demux_stream_drop_queued (GstBtDemuxStream * thiz, GstBtDemux * demux)
+{
+  GstBtDemuxBufferData *ipc_data;
 
-  s = (session *)demux->session;
-  std::vector<libtorrent::torrent_handle> vec = s->get_torrents ();
-  if(vec.empty())
+  while ((ipc_data = (GstBtDemuxBufferData *) g_async_queue_try_pop (thiz->ipc)) != NULL)
   {
-                          printf("(bt_demux_stream_push_loop) vec.empty(), so return\n");
-
+    if (ipc_data->size)
+    {
+      gst_bt_demux_queue_release (demux, ipc_data->size);
+    }
     gst_bt_demux_buffer_data_free (ipc_data);
-    g_static_rec_mutex_unlock (thiz->lock);
-    return;
-  } 
-  h = vec[0];
-
+  }
+}
 
-printf("(bt_demux_stream_push_loop) waiting lock thiz->current_piece(%d), ipc_data->piece(%d)\n", thiz->current_piece,ipc_data->piece);
-  g_static_rec_mutex_lock (thiz->lock);//***************************************************************************************************
-printf("(bt_demux_stream_push_loop) recovery lock (%d)\n", thiz->current_piece);
+/* Post the buffering level of stream, called with the stream lock held.
+ * Between the first message of a buffering episode and its final 100% at most one
+ * message per DEFAULT_BUFFERING_INTERVAL ms goes out, the rest is dropped.
+ * Besides the stats (input rate from the torrent status, output rate of the ipc
+ * queues, time left for the missing pieces at that rate) the message carries, in
+ * bytes of the file, its "stream-size", where the data pushed downstream ends
+ * ("pushed-until") and where the data we have contiguously ends ("available-until"),
+ * so the application can tell how many seconds of media it has left */
+static void
+gst_bt_demux_post_buffering (GstBtDemux * thiz, GstBtDemuxStream * stream, gint percent)
+{
+  GstMessage *msg;
+  GstBtBitset *piece_matrix = NULL;
+  gint64 queued_bytes;
+  gint queued_pieces;
+  gint64 now = g_get_monotonic_time ();
+  gint avg_in = 0, avg_out;
+  gint64 buffering_left = -1;
+
+  g_mutex_lock (&thiz->queue_lock);
+  if (percent < 100 && thiz->last_buffering_percent < 100 &&
+      (percent == thiz->last_buffering_percent ||
+       now - thiz->last_buffering_post < DEFAULT_BUFFERING_INTERVAL * G_TIME_SPAN_MILLISECOND))
+  {
+    g_mutex_unlock (&thiz->queue_lock);
+    return;
+  }
+  thiz->last_buffering_percent = percent;
+  thiz->last_buffering_post = now;
 
+  queued_bytes = thiz->queued_bytes;
+  queued_pieces = thiz->queued_pieces;
 
-  //----CHECK
-  //judge whether `ipc_data` belongs to this stream(file)
-  if (ipc_data->piece < thiz->start_piece && ipc_data->piece > thiz->end_piece) 
+  /* smoothed rate the streams drain their ipc queues since the last message */
+  if (thiz->out_rate_time && now > thiz->out_rate_time)
   {
-                                    printf("(bt_demux_stream_push_loop) judge whether `ipc_data` belongs to this stream(file), so return\n");
+    gint rate = (gint) ((thiz->pushed_bytes - thiz->out_rate_bytes) * G_USEC_PER_SEC
+        / (now - thiz->out_rate_time));
 
-    gst_bt_demux_buffer_data_free (ipc_data);
-    g_static_rec_mutex_unlock (thiz->lock);
-    return;
+    thiz->avg_out = thiz->avg_out ? (3 * thiz->avg_out + rate) / 4 : rate;
   }
-  //whether it is our desired fileidx, if not dont Pushing buffer
-  if (!thiz->requested) 
+  thiz->out_rate_bytes = thiz->pushed_bytes;
+  thiz->out_rate_time = now;
+  avg_out = thiz->avg_out;
+  g_mutex_unlock (&thiz->queue_lock);
+
+  GST_OBJECT_LOCK (thiz);
+  if (thiz->stats)
   {
-                                    printf("(bt_demux_stream_push_loop) this stream is not requested(aka. not playing currently in playlist), so return\n");
-    
-    gst_bt_demux_buffer_data_free (ipc_data);
-    g_static_rec_mutex_unlock (thiz->lock);
-    return;
+    gst_structure_get_int (thiz->stats, "download-rate", &avg_in);
   }
-  /* in case got a seek event(current_piece has changed) intercept pushing it */
-  //this check to some extent guarantee the piece pushed in order
-  if (ipc_data->piece != thiz->current_piece + 1) 
+  if (thiz->piece_matrix)
   {
-    // GST_DEBUG_OBJECT (thiz, "Dropping piece %d, waiting for %d on "
-    //     "file %d", ipc_data->piece, thiz->current_piece + 1, thiz->file_idx);
+    piece_matrix = gst_bt_bitset_ref (thiz->piece_matrix);
+  }
+  GST_OBJECT_UNLOCK (thiz);
 
-                                      printf("(bt_demux_stream_push_loop) Dropping piece (%d), waiting for (%d) on file %d \n", ipc_data->piece, thiz->current_piece + 1, thiz->file_idx);
+  if (percent >= 100)
+  {
+    buffering_left = 0;
+  }
+  else if (avg_in > 0 && thiz->piece_length > 0)
+  {
+    gint64 missing = (gint64) stream->buffering_count * (100 - percent) / 100 * thiz->piece_length;
 
-    gst_bt_demux_buffer_data_free (ipc_data);
-    g_static_rec_mutex_unlock (thiz->lock);
-    return;
+    buffering_left = missing * 1000 / avg_in;
   }
 
+  msg = gst_message_new_buffering (GST_OBJECT_CAST (thiz), percent);
+  gst_message_set_buffering_stats (msg, GST_BUFFERING_DOWNLOAD, avg_in, avg_out, buffering_left);
+  gst_structure_set (gst_message_writable_structure (msg),
+      "queued-bytes", G_TYPE_INT64, queued_bytes,
+      "queued-pieces", G_TYPE_INT, queued_pieces, NULL);
 
-  buf = gst_bt_demux_buffer_new (ipc_data->buffer, ipc_data->piece,
-    ipc_data->size, thiz);
+  if (thiz->piece_length > 0 && stream->end_byte_global > stream->start_byte_global)
+  {
+    gint64 size = stream->end_byte_global - stream->start_byte_global;
+    gint piece = stream->current_piece + 1;
+    gint64 pushed_until, available_until;
 
-  //get buffer size for debug
-  buf_size = gst_buffer_get_size (buf);
+    pushed_until = (gint64) piece * thiz->piece_length - stream->start_byte_global;
 
-  // GST_DEBUG_OBJECT (thiz, "Received piece %d of size %d on file %d",
-  //     ipc_data->piece, ipc_data->size, thiz->file_idx);
+    if (piece_matrix && piece <= stream->last_piece)
+    {
+      piece = gst_bt_bitset_find_next_clear (piece_matrix, piece, stream->last_piece + 1);
+    }
+    available_until = (gint64) piece * thiz->piece_length - stream->start_byte_global;
 
-                                      printf("(bt_demux_stream_push_loop) Received piece (%d) of size %d and actual size %d on file %d \n", ipc_data->piece, ipc_data->size, buf_size,thiz->file_idx);
+    gst_structure_set (gst_message_writable_structure (msg),
+        "stream-size", G_TYPE_INT64, size,
+        "pushed-until", G_TYPE_INT64, CLAMP (pushed_until, (gint64) 0, size),
+        "available-until", G_TYPE_INT64, CLAMP (available_until, (gint64) 0, size), NULL);
+  }
 
-  //----FOR SEEKING
-  if (thiz->pending_segment) 
+  if (piece_matrix)
   {
-    GstEvent *event;
-#if HAVE_GST_1
-    GstSegment *segment;
-    gboolean update;
-#endif
+    gst_bt_bitset_unref (piece_matrix);
+  }
 
-#if HAVE_GST_1
-    segment = gst_segment_new ();
-    gst_segment_init (segment, GST_FORMAT_BYTES);
-    gst_segment_do_seek (segment, 1.0, GST_FORMAT_BYTES, GST_SEEK_FLAG_NONE, 
-        GST_SEEK_TYPE_SET, thiz->start_byte-thiz->start_byte_global,
-        GST_SEEK_TYPE_SET, thiz->end_byte-thiz->start_byte_global, 
-        &update);
+  gst_element_post_message (GST_ELEMENT_CAST (thiz), msg);
+}
 
-    event = gst_event_new_segment (segment);
-#else
-    event = gst_event_new_segment (FALSE, 1.0, GST_FORMAT_BYTES,
-        thiz->start_byte, thiz->end_byte, thiz->start_byte);
-#endif
+/* Where the requested stream lives in the torrent, for the "stream-layout" property:
+ * its "file-offset" and "size" in bytes of the torrent, the "piece-length", the
+ * "window-pieces" a seek has to download before playing, and to find its data on
+ * disk, the "location" of the file, its "file-index" and the torrent "info-hash".
+ * NULL until the torrent is added */
+static GstStructure *
+gst_bt_demux_stream_layout (GstBtDemux * thiz)
+{
+  GstStructure *layout = NULL;
+  GSList *walk;
 
-                                        printf("(bt_demux_stream_push_loop) Push SEGMENT event, start_byte=%d, end_byte=%d \n", 
-                                            thiz->start_byte-thiz->start_byte_global, 
-                                            thiz->end_byte-thiz->start_byte_global);
+  if (thiz->piece_length <= 0)
+    return NULL;
 
-    if(thiz->flush_start_sent)
-    {
+  g_mutex_lock (thiz->streams_lock);
+  for (walk = thiz->streams; walk; walk = g_slist_next (walk))
+  {
+    GstBtDemuxStream *stream = GST_BT_DEMUX_STREAM (walk->data);
 
-                                        printf("(bt_demux_stream_push_loop) since flush_start sent, send flush_stop then \n");
+    if (!stream->requested || stream->end_byte_global <= stream->start_byte_global)
+      continue;
 
-      GstEvent* flush_stop = gst_event_new_flush_stop (TRUE);
-      gst_pad_push_event (GST_PAD (thiz), flush_stop);
-      thiz->flush_start_sent = FALSE;
+    gchar *location = g_build_path (G_DIR_SEPARATOR_S, thiz->temp_location,
+        stream->path, NULL);
+
+    layout = gst_structure_new ("btdemux-stream-layout",
+        "file-offset", G_TYPE_INT64, stream->start_byte_global,
+        "size", G_TYPE_INT64, stream->end_byte_global - stream->start_byte_global,
+        "piece-length", G_TYPE_INT, thiz->piece_length,
+        "window-pieces", G_TYPE_INT, thiz->buffer_pieces,
+        "location", G_TYPE_STRING, location,
+        "file-index", G_TYPE_INT, stream->file_idx, NULL);
+    g_free (location);
+
+    GST_OBJECT_LOCK (thiz);
+    if (thiz->info_hash)
+    {
+      gst_structure_set (layout, "info-hash", G_TYPE_STRING, thiz->info_hash, NULL);
     }
+    GST_OBJECT_UNLOCK (thiz);
+    break;
+  }
+  g_mutex_unlock (thiz->streams_lock);
 
-    gst_pad_push_event (GST_PAD (thiz), event);
+  return layout;
+}
 
-    //clear the `pending_segment` field
-    thiz->pending_segment = FALSE;
 
+
+/* Every read on a piece goes through here instead of calling h.read_piece() directly.
+ * On a cache hit the piece is handed to the alert thread, which dispatches it to the
+ * streams the same way as a read_piece_alert, so ordering and locking are unchanged */
+static void
+gst_bt_demux_read_piece (GstBtDemux * thiz, libtorrent::torrent_handle h, int piece)
+{
+  GstBtDemuxPieceCache *cache = (GstBtDemuxPieceCache *) thiz->piece_cache;
+  boost::shared_array <char> buffer;
+  int size;
+
+  if (gst_bt_demux_queue_defer_read (thiz, piece))
+  {
+                          printf ("(gst_bt_demux_read_piece) queues full, deferring read of piece %d\n", piece);
+    return;
   }
 
+  if (cache && gst_bt_demux_piece_cache_lookup (cache, piece, &buffer, &size))
+  {
+    GstBtDemuxBufferData *cached;
 
-  // GST_DEBUG_OBJECT (thiz, "Pushing buffer, size: %d, file: %d, piece: %d",
-  //     ipc_data->size, thiz->file_idx, ipc_data->piece);
+                          printf ("(gst_bt_demux_read_piece) piece %d served from cache\n", piece);
 
+    cached = g_new0 (GstBtDemuxBufferData, 1);
+    cached->buffer = buffer;
+    cached->piece = piece;
+    cached->size = size;
+    g_async_queue_push (thiz->cached_reads, cached);
+    return;
+  }
 
-  /***** BtdemuxStream->current_piece is UPDATED here  *****/
-  gint old_current_piece = thiz->current_piece;
-  thiz->current_piece = ipc_data->piece;
+  h.read_piece (piece);
+}
 
-                                          printf("(bt_demux_stream_push_loop) Modifying thiz->current_piece from %d to %d \n",
-                                              old_current_piece, 
-                                              thiz->current_piece);
+/* issue the reads deferred while the queues were full, called as they drain */
+static void
+gst_bt_demux_resume_deferred_reads (GstBtDemux * thiz, libtorrent::torrent_handle h)
+{
+  GArray *pending = NULL;
+  guint i;
 
+  g_mutex_lock (&thiz->queue_lock);
+  if (thiz->deferred_reads->len && !gst_bt_demux_queue_is_full (thiz))
+  {
+    pending = thiz->deferred_reads;
+    thiz->deferred_reads = g_array_new (FALSE, FALSE, sizeof (gint));
+  }
+  g_mutex_unlock (&thiz->queue_lock);
 
-                // before pushing buffer on pad, check whether it is flushing
-                // if (GST_PAD_IS_FLUSHING (GST_PAD (thiz)))
-                // {
-                //   printf ("(bt_demux_stream_push_loop) Before pushing  buffer, it is flushing\n");
-                // }else
-                // {
-                //   printf ("(bt_demux_stream_push_loop) Before pushing  buffer, it is NOT flushing\n");
-                // }
+  if (!pending)
+    return;
 
+  for (i = 0; i < pending->len; i++)
+  {
+    int piece = g_array_index (pending, gint, i);
 
-                                          printf("(bt_demux_stream_push_loop) Pushing buffer, actual size: %d, file: %d, cur piece: (%d) \n", buf_size, thiz->file_idx, thiz->current_piece);
+                          printf ("(gst_bt_demux_resume_deferred_reads) resuming read of piece %d\n", piece);
 
+    gst_bt_demux_read_piece (thiz, h, piece);
+  }
+  g_array_free (pending, TRUE);
+}
 
-  ret = gst_pad_push (GST_PAD (thiz), buf);
 
-  if (ret != GST_FLOW_OK) 
+/* pin the Three-Piece-Area following the current piece of the requested stream */
+static void
+gst_bt_demux_stream_pin_window (GstBtDemuxStream * thiz, GstBtDemux * demux)
+{
+  int start = thiz->current_piece + 1;
+  int end = thiz->current_piece + demux->buffer_pieces;
+
+  if (end > thiz->end_piece)
   {
+    end = thiz->end_piece;
+  }
 
-                                           printf("(bt_demux_stream_push_loop)!!Failed Pushing buffer,actual size: %d, file: %d, piece: (%d) ret=%d\n", 
-                                              buf_size, thiz->file_idx, thiz->current_piece, (int)ret);
+  gst_bt_demux_piece_cache_pin_window ((GstBtDemuxPieceCache *) demux->piece_cache,
+      start, end);
+}
 
-    if (ret == GST_FLOW_NOT_LINKED ) 
-    {
-      printf ("(bt_demux_stream_push_loop) it is Pad-not-linked errors \n");
 
-      send_eos = TRUE;
-      GST_ELEMENT_ERROR (demux, STREAM, FAILED,
-          ("Internal data flow error."),
-          ("streaming task paused, reason %s (%d)", gst_flow_get_name (ret),
-          ret));
-    }
-    // such as seek, flush-start, but flush-stop not sent yet
-    else if (ret == GST_FLOW_FLUSHING)
-    {
-        printf ("(bt_demux_stream_push_loop) it is flushing  \n");
 
-        if (FALSE == have_type_emitted) {
+/*----------------------------------------------------------------------------*
+ *                         The piece to stream index                          *
+ *----------------------------------------------------------------------------*/
+/* The files of a torrent are laid out back to back, so once sorted by start piece
+ * their end pieces are sorted too, and the files covering a piece are a contiguous
+ * run found with two binary searches. Built once in add_torrent_alert, it spares
+ * piece_finished_alert and read_piece_alert a walk over every stream of torrents
+ * with thousands of files. Ranges are those of the whole files, a seek narrowing
+ * stream->start_piece is still checked by the callers.
+ * It is also the metadata table of the playable files, their stream is only
+ * created once requested */
+typedef struct _GstBtDemuxFileRange
+{
+  int start_piece;
+  int end_piece;
+  int file_idx;
+  std::string path;
+  //NULL until the file gets requested
+  GstBtDemuxStream *stream;
+} GstBtDemuxFileRange;
 
-              printf ("(bt_demux_stream_push_loop) have-type not sent yet, repush this piece \n");
-                
-          g_async_queue_push_front (thiz->ipc, ipc_data);
-          //dont update the current_piece here, since we need re-push this piece data again to guarantee it pushed successful
-          thiz->current_piece = old_current_piece;
-          need_re_push = TRUE;
-        }else {
-          printf ("(bt_demux_stream_push_loop) otherwise, send eos downstream to avoid blcking on push_loop \n");
-          send_eos = TRUE;
-        }
-    }
-    // that is GST_FLOW_EOS, 
-    // where is the EOS originated ? who populates it ?
-    // it was found in 'goto eos' eos labeled code in qtdemux_process_adapter which gonna return GST_FLOW_EOS in qtdemux.c , 
-    else if (ret == GST_FLOW_UNEXPECTED)
-    {
-      // if already got eos event when gst_pad_push, why not we don't send the same another eos event, 
-      // send eos or not ,does it matter that much ? yes
-      send_eos = TRUE;
-      printf ("(bt_demux_stream_push_loop) it is End of stream \n");
-    }
-    // maybe GST_FLOW_NOT_NEGOTIATE, GST_FLOW_ERROR etc... but i never meet them returned
-    else if (ret < GST_FLOW_UNEXPECTED)
-    {
-      printf ("(bt_demux_stream_push_loop) it is unexpected errors \n");
+typedef std::vector<GstBtDemuxFileRange> GstBtDemuxPieceIndex;
 
-      send_eos = TRUE;
-      GST_ELEMENT_ERROR (demux, STREAM, FAILED,
-          ("Internal data flow error."),
-          ("streaming task paused, reason %s (%d)", gst_flow_get_name (ret),
-          ret));
-    }
-  }
 
+static void
+gst_bt_demux_piece_index_add (GstBtDemux * thiz, int start_piece, int end_piece,
+    int file_idx, const gchar * path)
+{
+  GstBtDemuxPieceIndex *index = (GstBtDemuxPieceIndex *) thiz->piece_index;
+  GstBtDemuxFileRange range;
+
+  range.start_piece = start_piece;
+  range.end_piece = end_piece;
+  range.file_idx = file_idx;
+  range.path = path;
+  range.stream = NULL;
+  index->push_back (range);
+}
 
-#if 0
-  /* send the end of segment in case we need to */
-  if (ipc_data->piece == thiz->end_piece) {
+/* call once every file is added */
+static void
+gst_bt_demux_piece_index_sort (GstBtDemux * thiz)
+{
+  GstBtDemuxPieceIndex *index = (GstBtDemuxPieceIndex *) thiz->piece_index;
 
-  }
-#endif
+  std::stable_sort (index->begin (), index->end (),
+      [] (const GstBtDemuxFileRange & a, const GstBtDemuxFileRange & b) {
+        return a.start_piece < b.start_piece;
+      });
+}
 
+/* entries [*first, *last) of the index cover @piece */
+static void
+gst_bt_demux_piece_index_find (GstBtDemux * thiz, int piece, gsize * first, gsize * last)
+{
+  GstBtDemuxPieceIndex *index = (GstBtDemuxPieceIndex *) thiz->piece_index;
 
-  /* send the EOS downstream, check that last push didnt trigger a new seek */
-  if (!thiz->moov_after_mdat && ipc_data->piece == thiz->last_piece && !thiz->pending_segment)
-  {
+  GstBtDemuxPieceIndex::iterator lo = std::lower_bound (index->begin (), index->end (), piece,
+      [] (const GstBtDemuxFileRange & r, int p) { return r.end_piece < p; });
+  GstBtDemuxPieceIndex::iterator hi = std::upper_bound (lo, index->end (), piece,
+      [] (int p, const GstBtDemuxFileRange & r) { return p < r.start_piece; });
 
-                                  printf("(bt_demux_stream_push_loop) during last push set send_eos to TRUE %d %d\n",ipc_data->piece, thiz->last_piece);
+  *first = lo - index->begin ();
+  *last = hi - index->begin ();
+}
 
-    send_eos = TRUE;
-  }
+static GstBtDemuxStream *
+gst_bt_demux_piece_index_stream (GstBtDemux * thiz, gsize i)
+{
+  return (*(GstBtDemuxPieceIndex *) thiz->piece_index)[i].stream;
+}
 
-  if (send_eos) 
-  {
-    GstEvent *eos;
-    // send eos means previous stream is end, new seek in stream occur 
-    // Elements that receive the EOS event on a pad can return #GST_FLOW_EOS when data after the EOS event arrives
-    eos = gst_event_new_eos ();
 
-    // GST_DEBUG_OBJECT (thiz, "Sending EOS on file %d", thiz->file_idx);
 
-                                  printf("(bt_demux_stream_push_loop) Sending EOS event on file %d, piece:%d \n", thiz->file_idx, ipc_data->piece );
+/********************************************Partial_Piece_Info *************************************/
+static DownloadingBlocksSd *
+gst_bt_demux_ppi_snapshot_new (void)
+{
+  DownloadingBlocksSd *sd = g_new0 (DownloadingBlocksSd, 1);
 
-    gst_pad_push_event (GST_PAD (thiz), eos);
-    gst_pad_pause_task (GST_PAD (thiz));
+  sd->ref_count = 1;
+  return sd;
+}
 
-  }
+/* Fill the snapshot from the piece_info_alert, its arrays only grow, so once
+ * they fit the usual download queue no allocation happens anymore */
+static void
+gst_bt_demux_ppi_snapshot_fill (DownloadingBlocksSd * sd,
+    std::vector<libtorrent::partial_piece_info> const& ppi)
+{
+  static guint8 const scale_progress[] = {0, 20, 40, 60, 80};
+  gint num_pieces = ppi.size ();
+  gint num_blocks = 0;
+  gint offset = 0;
 
+  for (libtorrent::partial_piece_info const& item : ppi)
+  {
+    num_blocks += item.blocks_in_piece;
+  }
 
-  //-----------HANDLING MOOV AFTER MDAT CASE---------
-  // when moov header after mdat, reset pushing from first piece after push last piece
-  //the gstdeocdebin2 srcpad is not created until moov header piece pushed and reset pushing from start, after that , the stream become seekable
-  // No need to worry about that user will trigger a seek before or during the moov-header-seek posted bt qtdemux and parsing 
-  if (thiz->moov_after_mdat && ipc_data->piece == thiz->end_piece)
+  if (num_pieces > sd->pieces_capacity)
   {
+    sd->pieces_capacity = MAX (num_pieces, sd->pieces_capacity * 2);
+    sd->pieces = g_renew (guint32, sd->pieces, sd->pieces_capacity);
+    sd->block_offsets = g_renew (guint32, sd->block_offsets, sd->pieces_capacity + 1);
+  }
 
-                                      printf("(bt_demux_stream_push_loop) When got moov header after mdat , reset pushing start from first piece \n");
+  if (num_blocks > sd->blocks_capacity)
+  {
+    sd->blocks_capacity = MAX (num_blocks, sd->blocks_capacity * 2);
+    sd->progress = g_renew (guint8, sd->progress, sd->blocks_capacity);
+  }
 
-      gint start_piece, start_offset, end_piece, end_offset;
-      gint64 start_byte, end_byte;
+  sd->size = num_pieces;
 
-      /* get the piece length */
-      torrent_info ti = h.get_torrent_info ();
-      int piece_length = ti.piece_length ();
+  for (gint d_idx = 0; d_idx < num_pieces; d_idx++)
+  {
+    libtorrent::partial_piece_info const& item = ppi[d_idx];
+    guint8 *prog = sd->progress + offset;
 
-      //// gst_bt_demux_stream_info (thiz, h, &start_offset,
-      //// &start_piece, &end_offset, &end_piece, NULL, &start_byte, &end_byte);
+    sd->pieces[d_idx] = static_cast<int> (item.piece_index);
+    sd->block_offsets[d_idx] = offset;
 
-      thiz->start_byte = thiz->start_byte_global;
-      thiz->end_byte = thiz->end_byte_global;
-      thiz->start_piece = thiz->start_byte / piece_length;
-      thiz->start_offset = thiz->start_byte % piece_length;
-      thiz->end_piece = thiz->end_byte / piece_length;
-      thiz->end_offset = thiz->end_byte % piece_length; 
-      
-      gboolean update_buffering = gst_bt_demux_stream_activate (thiz, h, demux->buffer_pieces);
-      if (update_buffering) 
+    for (gint i = 0; i < item.blocks_in_piece; i++)
+    {
+      if (item.blocks[i].state == libtorrent::block_info::finished
+          || item.blocks[i].state == libtorrent::block_info::writing)
       {
-                                      printf ("(bt_demux_stream_push_loop) When got moov header after mdat , call send_buffering\n");
-
-        gst_bt_demux_send_buffering (demux, h);
-      } 
+        prog[i] = 100;
+      }
+      //avoid divided by zero error
+      else if (item.blocks[i].state == libtorrent::block_info::requested
+          && item.blocks[i].bytes_progress > 0 && item.blocks[i].block_size > 0)
+      {
+        prog[i] = scale_progress[item.blocks[i].bytes_progress * 5 / item.blocks[i].block_size];
+      }
       else
       {
-                                      printf ("(bt_demux_stream_push_loop) When got moov header after mdat, call read_piece() on start piece %d\n",
-                                      thiz->start_piece);
-
-        //**fire the read on start_piece, the rest will follow automatically, like a chain reaction, or domino effect
-        h.read_piece (thiz->start_piece);
+        prog[i] = 0;
       }
-      thiz->moov_after_mdat = FALSE;
+    }
+    offset += item.blocks_in_piece;
   }
+  sd->block_offsets[num_pieces] = offset;
+}
 
-  
-
-  //-----------TRY ADD MORE ADJENCENT PIECES---------
-  /* read the next piece, make sure not exceeds `end_piece` */
-  if (!need_re_push && (ipc_data->piece+1<=thiz->end_piece)) 
+static gboolean
+gst_bt_demux_ppi_snapshot_equal (DownloadingBlocksSd * a, DownloadingBlocksSd * b)
+{
+  if (!a || !b || a->size != b->size)
   {
-      int next = ipc_data->piece+1;    
-      //in case we got a seek, current_piece modified
-      if (next<=thiz->current_piece || next>thiz->current_piece+demux->buffer_pieces-1) 
-      {
-                printf ("(bt_demux_stream_push_loop) current_piece modified, give up call read_piece() on next piece %d, current:%d\n", ipc_data->piece+1, thiz->current_piece);
-      } 
-      else 
-      {
+    return FALSE;
+  }
 
-        //here,we dont check Three-Piece-Area availability, just check the only one piece next to us, it is more loose than bt_demux_stream_activate()
-        if (h.have_piece (next)) 
-        {
-          // GST_DEBUG_OBJECT (thiz, "Reading next piece %d, current: %d",
-          //     ipc_data->piece + 1, thiz->current_piece);
+  return memcmp (a->pieces, b->pieces, sizeof (guint32) * a->size) == 0
+      && memcmp (a->block_offsets, b->block_offsets, sizeof (guint32) * (a->size + 1)) == 0
+      && memcmp (a->progress, b->progress, a->block_offsets[a->size]) == 0;
+}
 
-          if (send_eos ==FALSE) {
-                          printf ("(bt_demux_stream_push_loop) Luckily we have next piece %d, call read_piece() on it, current:%d\n", ipc_data->piece+1, thiz->current_piece);
-            //**fire the read on start_piece, the rest will follow automatically, like a chain reaction, or domino effect
-            h.read_piece (next);
-          } else {
-                          //generally, it is reached when EOS occured
-                          printf ("(bt_demux_stream_push_loop) due to EOS or internal Error, suspend call read_piece() on next piece %d, current:%d, end/last:%d \n", ipc_data->piece + 1, thiz->current_piece, thiz->last_piece);
-          }
-        } 
-        // if we do not hold the next piece following the current, we need to buffering the Three-Piece-Area 
-        else 
-        {
-          int i;
+/* Publish a new ppi snapshot. The back buffer is filled and swapped with the
+ * front one, if a consumer still holds the old back buffer (ref_count > 1)
+ * it is left to them and a new one is used instead.
+ * Returns FALSE, and publishes nothing, when nothing changed since the front one */
+static gboolean
+gst_bt_demux_ppi_publish (GstBtDemux * thiz,
+    std::vector<libtorrent::partial_piece_info> const& ppi)
+{
+  DownloadingBlocksSd *back;
+  gboolean changed;
 
-          // GST_DEBUG_OBJECT (thiz, "Start buffering next piece %d",
-          //      ipc_data->piece + 1);
+  g_mutex_lock (&thiz->ppi_lock);
+  back = thiz->ppi_back;
+  thiz->ppi_back = NULL;
+  g_mutex_unlock (&thiz->ppi_lock);
 
-                                            {
-                                                int begin = next;
-                                                int ending = ipc_data->piece+demux->buffer_pieces-1;
-                                                if (ending > thiz->end_piece) {
-                                                  ending = thiz->end_piece;
-                                                }
+  if (back && g_atomic_int_get (&back->ref_count) > 1)
+  {
+    downloading_blocks_sd_unref (back);
+    back = NULL;
+  }
+  if (!back)
+  {
+    back = gst_bt_demux_ppi_snapshot_new ();
+  }
 
-                                                printf ("(bt_demux_stream_push_loop) Unlickily We dont hold the next piece, buffering between [%d,%d] \n", 
-                                                  begin, 
-                                                  ending);
-                                            }
+  gst_bt_demux_ppi_snapshot_fill (back, ppi);
 
-          //Clear previous buffering stats
-          thiz->buffering_level = 0;
-          thiz->buffering_count = 0;
+  g_mutex_lock (&thiz->ppi_lock);
+  changed = !gst_bt_demux_ppi_snapshot_equal (back, thiz->ppi_front);
+  if (changed)
+  {
+    back->version = ++thiz->ppi_version;
+    thiz->ppi_back = thiz->ppi_front;
+    thiz->ppi_front = back;
+  }
+  else
+  {
+    thiz->ppi_back = back;
+  }
+  g_mutex_unlock (&thiz->ppi_lock);
 
-          if (thiz->cur_buffering_flags) {
-              //clear history
-              thiz->cur_buffering_flags = g_array_remove_range (thiz->cur_buffering_flags, 0, thiz->cur_buffering_flags->len);
-  printf ("(bt_demux_stream_push_loop) clearing historical cur_buffering_flags for new push\n");
-              //Three-Piece-Area
-              for (i=1; i<demux->buffer_pieces; i++) 
-              {
-                  libtorrent::download_priority_t priority;
-                  int idx = next;
+  return changed;
+}
 
-                  //border checking -- if hit, bail out
-                  if (idx > thiz->end_piece) 
-                  {
-                    break;
-                  }
-                  
-                  if (h.have_piece (idx))
-                  {
-                    //if we hold this piece, thiz->cur_buffering_flags set to FALSE on that index
-                    gboolean tmp_false = FALSE;
-                    g_array_append_vals (thiz->cur_buffering_flags, &tmp_false, 1);
-                    continue;
-                  }
+/* Push model of the ppi: while someone subscribed (the "ppi-subscribe" property),
+ * the alert thread asks for the download queue every ppi-interval and the snapshot
+ * is posted as a "ppi-changed" application message, only when it changed and at
+ * most once per interval. Nothing is asked nor posted without subscribers.
+ * Called on every new snapshot and on every loop of the alert thread: a snapshot
+ * published within the interval of the last post is posted once the interval is
+ * over, whether or not another one comes */
+static void
+gst_bt_demux_ppi_post (GstBtDemux * thiz)
+{
+  GstStructure *st;
+  DownloadingBlocksSd *sd = NULL;
+  gint64 now = g_get_monotonic_time ();
 
-                  gboolean tmp_true = TRUE;
-                  g_array_append_vals (thiz->cur_buffering_flags, &tmp_true, 1);
+  if (now - thiz->last_ppi_post < thiz->ppi_interval * G_TIME_SPAN_MILLISECOND)
+  {
+    return;
+  }
 
-                  /* if it's already set to `top_priority` just skip */
-                  priority = h.piece_priority (idx);
-                  if (priority == libtorrent::top_priority)
-                  {
-                    continue;
-                  }
+  g_mutex_lock (&thiz->ppi_lock);
+  if (thiz->ppi_front && thiz->ppi_front->version > thiz->ppi_posted_version)
+  {
+    sd = downloading_blocks_sd_ref (thiz->ppi_front);
+  }
+  g_mutex_unlock (&thiz->ppi_lock);
 
-                  /* set to top priority */
-                  priority = libtorrent::top_priority;
+  if (!sd)
+  {
+    return;
+  }
 
-                  h.piece_priority (idx, priority);
+  thiz->last_ppi_post = now;
+  thiz->ppi_posted_version = sd->version;
 
-                  thiz->buffering_count++;
-              }
+  st = gst_structure_new ("ppi-changed",
+      "snapshot", downloading_blocks_sd_get_type (), sd,
+      "version", G_TYPE_UINT64, sd->version, NULL);
+  downloading_blocks_sd_unref (sd);
 
-              if (thiz->buffering_count)
-              {
-                thiz->buffering = TRUE;
-              }
+  gst_element_post_message (GST_ELEMENT_CAST (thiz),
+      gst_message_new_application (GST_OBJECT_CAST (thiz), st));
+}
 
-              update_buffering = TRUE;
-          } 
+/* the piece matrix is shared too, readers hold a reference and ask for its diffs */
+static GType
+gst_bt_bitset_get_type (void)
+{
+    static GType type = 0;
+    if (!type) {
+        type = g_boxed_type_register_static ("GstBtBitset",
+                (GBoxedCopyFunc)gst_bt_bitset_ref,
+                (GBoxedFreeFunc)gst_bt_bitset_unref);
+    }
+    return type;
+}
 
-          else {
-            printf ("(bt_demux_stream_push_loop) failed clear cur_buffering_flags \n");
-          }
+/* the boxed copy just takes a reference, snapshots are never modified once published */
+GType downloading_blocks_sd_get_type(void) {
+    static GType type = 0;
+    if (!type) {
+        type = g_boxed_type_register_static ("DownloadingBlocksSd",
+                (GBoxedCopyFunc)downloading_blocks_sd_ref,
+                (GBoxedFreeFunc)downloading_blocks_sd_unref);
+    }
+    return type;
+}
 
-        }
 
-      }
+
+
+//NOT USE
+// /*----------------------------------------------------------------------------*
+//  *                           The selector policy                              *
+//  *----------------------------------------------------------------------------*/
+// static GType
+// gst_bt_demux_selector_policy_get_type (void)
+// {
+//   static GType gst_bt_demux_selector_policy_type = 0;
+//   static const GEnumValue selector_policy_types[] = {
+//     {GST_BT_DEMUX_SELECTOR_POLICY_ALL, "All streams", "all" },
+//     {GST_BT_DEMUX_SELECTOR_POLICY_LARGER, "Larger stream", "larger" },
+//     {0, NULL, NULL}
+//   };
+
+//   if (!gst_bt_demux_selector_policy_type) {
+//     gst_bt_demux_selector_policy_type =
+//         g_enum_register_static ("GstBtDemuxSelectorPolicy",
+//         selector_policy_types);
+//   }
+//   return gst_bt_demux_selector_policy_type;
+// }
+
+
+
+
+
+
+
+
+
+/*----------------------------------------------------------------------------*
+ *                             The stream class                               *
+ *----------------------------------------------------------------------------*/
+
+G_DEFINE_TYPE (GstBtDemuxStream, gst_bt_demux_stream, GST_TYPE_PAD);
+
+
+/* Downstream readiness.
+ * Our peer is the decodebin2 ghost sink pad whose target is the typefind sink pad.
+ * Instead of resolving peer -> ghost target -> typefind and reading its
+ * "have-type-emitted" for every piece, resolve it once when our pad gets linked,
+ * follow "have-type" from then on, and let push_loop wait on ready_cond */
+static void
+gst_bt_demux_stream_have_type_cb (GstElement * typefind, guint probability,
+    GstCaps * caps, gpointer user_data)
+{
+  GstBtDemuxStream *thiz = GST_BT_DEMUX_STREAM (user_data);
+
+                          printf ("(bt_demux_stream_have_type_cb) %s typefind emitted have-type\n", GST_PAD_NAME (thiz));
+
+  g_mutex_lock (&thiz->ready_lock);
+  thiz->have_type = TRUE;
+  g_cond_broadcast (&thiz->ready_cond);
+  g_mutex_unlock (&thiz->ready_lock);
+}
+
+/* must be called with the ready lock held */
+static void
+gst_bt_demux_stream_forget_downstream (GstBtDemuxStream * thiz)
+{
+  if (thiz->ghost_internal)
+  {
+    g_signal_handler_disconnect (thiz->ghost_internal, thiz->ghost_linked_id);
+    gst_object_unref (thiz->ghost_internal);
   }
+  thiz->ghost_internal = NULL;
+  thiz->ghost_linked_id = 0;
 
-                                  printf("(bt_demux_stream_push_loop) unlock cur:(%d)\n", thiz->current_piece);
+  if (thiz->typefind)
+  {
+    if (thiz->have_type_id)
+    {
+      g_signal_handler_disconnect (thiz->typefind, thiz->have_type_id);
+    }
+    gst_object_unref (thiz->typefind);
+  }
+  thiz->typefind = NULL;
+  thiz->have_type_id = 0;
+  thiz->downstream_linked = FALSE;
+  thiz->have_type = FALSE;
+}
 
-  g_static_rec_mutex_unlock (thiz->lock);
+static void gst_bt_demux_stream_ghost_linked_cb (GstPad * pad, GstPad * peer,
+    gpointer user_data);
 
-  // g_mutex_unlock (demux->streams_lock);
+/* resolve the typefind behind the peer, must be called with the ready lock held */
+static void
+gst_bt_demux_stream_resolve_downstream (GstBtDemuxStream * thiz)
+{
+  GstPad *peerpad;
 
-  if (update_buffering)
+  gst_bt_demux_stream_forget_downstream (thiz);
+
+  peerpad = gst_pad_get_peer (GST_PAD (thiz));
+  if (!peerpad)
   {
-    //this is just for post gst buffering message so application can know
-    gst_bt_demux_send_buffering (demux, h);
+    return;
   }
 
-  // g_mutex_unlock (demux->streams_lock);
-  // still push current piece instead of moving to push next piece
-  if (!need_re_push) {
-    gst_bt_demux_buffer_data_free (ipc_data);
+  if (!GST_IS_GHOST_PAD (peerpad))
+  {
+    //not decodebin, nobody to wait for
+                          printf ("(bt_demux_stream_resolve_downstream) peer pad is not Ghost pad\n");
+    thiz->downstream_linked = TRUE;
+    thiz->have_type = TRUE;
   }
+  else
+  {
+    GstPad *internal_pad = gst_ghost_pad_get_target (GST_GHOST_PAD (peerpad));
 
-                                  printf("bt_demux_stream_push_loop, END \n");
+    if (!internal_pad)
+    {
+                          printf ("(bt_demux_stream_resolve_downstream) decodebin ghost sink pad Has no target yet\n");
+      //setting the target links the ghost pad's internal pad, resolve again then
+      thiz->ghost_internal = GST_PAD (gst_proxy_pad_get_internal (GST_PROXY_PAD (peerpad)));
+      if (thiz->ghost_internal)
+      {
+        thiz->ghost_linked_id = g_signal_connect (thiz->ghost_internal, "linked",
+            G_CALLBACK (gst_bt_demux_stream_ghost_linked_cb), thiz);
+      }
+    }
+    else
+    {
+      GstObject *parent = gst_pad_get_parent (internal_pad);
+
+      if (parent)
+      {
+        thiz->typefind = GST_ELEMENT (parent);
+        thiz->have_type_id = g_signal_connect (parent, "have-type",
+            G_CALLBACK (gst_bt_demux_stream_have_type_cb), thiz);
+        g_object_get (G_OBJECT (parent), "have-type-emitted", &thiz->have_type, NULL);
+      }
+      thiz->downstream_linked = TRUE;
+      gst_object_unref (internal_pad);
+
+                          printf ("(bt_demux_stream_resolve_downstream) %s downstream ready, have_type:%d\n",
+                              GST_PAD_NAME (thiz), thiz->have_type);
+    }
+  }
 
+  gst_object_unref (peerpad);
 }
 
+static void
+gst_bt_demux_stream_linked_cb (GstPad * pad, GstPad * peer, gpointer user_data)
+{
+  GstBtDemuxStream *thiz = GST_BT_DEMUX_STREAM (pad);
 
+  g_mutex_lock (&thiz->ready_lock);
+  gst_bt_demux_stream_resolve_downstream (thiz);
+  g_cond_broadcast (&thiz->ready_cond);
+  g_mutex_unlock (&thiz->ready_lock);
+}
 
+static void
+gst_bt_demux_stream_ghost_linked_cb (GstPad * pad, GstPad * peer, gpointer user_data)
+{
+  GstBtDemuxStream *thiz = GST_BT_DEMUX_STREAM (user_data);
 
+  g_mutex_lock (&thiz->ready_lock);
+  gst_bt_demux_stream_resolve_downstream (thiz);
+  g_cond_broadcast (&thiz->ready_cond);
+  g_mutex_unlock (&thiz->ready_lock);
+}
 
+static void
+gst_bt_demux_stream_unlinked_cb (GstPad * pad, GstPad * peer, gpointer user_data)
+{
+  GstBtDemuxStream *thiz = GST_BT_DEMUX_STREAM (pad);
 
+  g_mutex_lock (&thiz->ready_lock);
+  gst_bt_demux_stream_forget_downstream (thiz);
+  g_mutex_unlock (&thiz->ready_lock);
+}
 
-//Used in piece_finished_alert handling code
-//Updating the buffering progress infomation
+/* the stream is about to be switched away, make typefind run again next time */
 static void
-gst_bt_demux_stream_update_buffering (GstBtDemuxStream * thiz,
-    libtorrent::torrent_handle h, int max_pieces)
+gst_bt_demux_stream_reset_type (GstBtDemuxStream * thiz)
 {
-  using namespace libtorrent;
-  int i;
-  //cuz thiz->current_pieces was assigned as thiz->start_piece minus 1 in gst_bt_demux_stream_activate
-  //3 pieces treat as a unit
-  int start = thiz->current_piece + 1;
-  int end = thiz->current_piece + max_pieces;
-  // num of pieces that already downloaded, it should within sector of [0,3]
-  int buffered_pieces = 0;
+  g_mutex_lock (&thiz->ready_lock);
+  if (thiz->typefind)
+  {
+                          printf ("(bt_demux_stream_reset_type) re-set typefindelement have-type to FALSE\n");
+    g_object_set (G_OBJECT (thiz->typefind), "have-type-emitted", FALSE, NULL);
+  }
+  thiz->have_type = FALSE;
+  g_mutex_unlock (&thiz->ready_lock);
+}
 
-  /* do not exceeds piece boundry */
-  if (start >= thiz->end_piece) {
-    start = thiz->end_piece;
-    end = thiz->end_piece;
+/* The task is about to be flushed or stopped: wake whatever push_loop waits on, it
+ * pauses itself instead of waiting again. Lowered right before the task is started */
+static void
+gst_bt_demux_stream_set_flushing (GstBtDemuxStream * thiz, gboolean flushing)
+{
+  g_mutex_lock (&thiz->ready_lock);
+  thiz->ready_flushing = flushing;
+  g_cond_broadcast (&thiz->ready_cond);
+  g_mutex_unlock (&thiz->ready_lock);
+}
+
+/* a piece was finished or the trick mode moved on, push_keyframe may have waited for it */
+static void
+gst_bt_demux_stream_wake (GstBtDemuxStream * thiz)
+{
+  g_mutex_lock (&thiz->ready_lock);
+  thiz->ready_cookie++;
+  g_cond_broadcast (&thiz->ready_cond);
+  g_mutex_unlock (&thiz->ready_lock);
+}
+
+/* Called with the ready lock held when a wait ended on ready_flushing. Pausing under
+ * the lock means a set_flushing (FALSE) and gst_pad_start_task() right after are not
+ * lost, the task is either still looping or gets resumed by them */
+static void
+gst_bt_demux_stream_pause_flushing (GstBtDemuxStream * thiz)
+{
+                          printf ("(bt_demux_stream_pause_flushing) %s flushing, pause the task\n", GST_PAD_NAME (thiz));
+  gst_pad_pause_task (GST_PAD (thiz));
+}
+
+/* Block until downstream can take buffers: the "linked" handlers and the typefind
+ * resolve it and signal ready_cond, flushing or stopping the task ends the wait too.
+ * Returns whether typefind emitted have-type through @have_type */
+static gboolean
+gst_bt_demux_stream_wait_ready (GstBtDemuxStream * thiz, gboolean * have_type)
+{
+  gboolean ready;
+
+  g_mutex_lock (&thiz->ready_lock);
+  while (!thiz->downstream_linked && !thiz->ready_flushing)
+  {
+    g_cond_wait (&thiz->ready_cond, &thiz->ready_lock);
   }
-  if (end > thiz->end_piece) {
-    end = thiz->end_piece;
+  ready = thiz->downstream_linked;
+  *have_type = thiz->have_type;
+  if (!ready)
+  {
+    gst_bt_demux_stream_pause_flushing (thiz);
   }
-          
-  if (thiz->cur_buffering_flags) {
+  g_mutex_unlock (&thiz->ready_lock);
 
+  return ready;
+}
 
-      int flag_idx = 0;
-      /* count how many pieces have been downloaded */
-      for (i = start; i <= end; i++) {
-        if ( h.have_piece (i) && g_array_index (thiz->cur_buffering_flags, gboolean, flag_idx) == TRUE) {
-          buffered_pieces++;
-        }
-        flag_idx++;
-      }
 
-            printf ("(gst_bt_demux_stream_update_buffering) between [%d,%d] buffered:%d, buffering:%d\n", 
-                start, end,
-                buffered_pieces, 
-                thiz->buffering_count);
 
+/* The on-disk file of a stream, read directly for the keyframe index and the trick
+ * modes. A range is readable once all the pieces under it are in the piece matrix */
+typedef struct
+{
+  GstBtDemuxStream *stream;
+  GstBtBitset *piece_matrix;
+  gchar *location;
+  gint piece_length;
+} GstBtDemuxLocalFile;
 
-      if (buffered_pieces > thiz->buffering_count) {
-        //correction on the buffered_pieces , making sure it not greater than actual buffering_count
-        buffered_pieces = thiz->buffering_count;
-      }
+static gboolean
+gst_bt_demux_local_file_init (GstBtDemuxLocalFile * file, GstBtDemuxStream * stream,
+    GstBtDemux * demux)
+{
+  if (demux->piece_length <= 0)
+  {
+    return FALSE;
+  }
 
-      //Hot Three-Piece-Area progress
-      //******************Compute the average percent progress*************************
-      thiz->buffering_level = (buffered_pieces * 100) / thiz->buffering_count;
+  GST_OBJECT_LOCK (demux);
+  file->piece_matrix = demux->piece_matrix ? gst_bt_bitset_ref (demux->piece_matrix) : NULL;
+  GST_OBJECT_UNLOCK (demux);
+
+  if (!file->piece_matrix)
+  {
+    return FALSE;
+  }
+
+  file->stream = stream;
+  file->piece_length = demux->piece_length;
+  file->location = g_build_path (G_DIR_SEPARATOR_S, demux->temp_location,
+      stream->path, NULL);
+
+  return TRUE;
+}
+
+static void
+gst_bt_demux_local_file_clear (GstBtDemuxLocalFile * file)
+{
+  gst_bt_bitset_unref (file->piece_matrix);
+  g_free (file->location);
+}
+
+static gboolean
+gst_bt_demux_local_file_has (GstBtDemuxLocalFile * file, gint64 offset, gsize size)
+{
+  GstBtDemuxStream *stream = file->stream;
+  gint64 start = stream->start_byte_global + offset;
+  gint64 end = start + (gint64) size - 1;
+
+  if (offset < 0 || size == 0 || end >= stream->end_byte_global)
+  {
+    return FALSE;
+  }
+
+  return gst_bt_bitset_find_next_clear (file->piece_matrix, (guint) (start / file->piece_length),
+      (guint) (end / file->piece_length) + 1) > (guint) (end / file->piece_length);
+}
+
+/* GstBtMp4ReadFunc over the on-disk file */
+static gboolean
+gst_bt_demux_local_file_read (gpointer user_data, gint64 offset, guint8 * data, gsize size)
+{
+  GstBtDemuxLocalFile *file = (GstBtDemuxLocalFile *) user_data;
+  gboolean ret;
+  FILE *f;
+
+  if (!gst_bt_demux_local_file_has (file, offset, size))
+  {
+    return FALSE;
+  }
+
+  f = g_fopen (file->location, "rb");
+  if (!f)
+  {
+    return FALSE;
+  }
+  ret = fseeko (f, offset, SEEK_SET) == 0 && fread (data, 1, size, f) == size;
+  fclose (f);
+
+  return ret;
+}
+
+
+/* Build the keyframe index of the stream if the pieces holding the moov are local,
+ * called with the stream lock held. A failed attempt is only retried once more pieces
+ * finished */
+static gboolean
+gst_bt_demux_stream_ensure_keyframes (GstBtDemuxStream * thiz, GstBtDemux * demux)
+{
+  GstBtDemuxLocalFile file;
+  guint64 generation;
+
+  if (thiz->keyframes)
+  {
+    return TRUE;
+  }
+
+  if (!gst_bt_demux_local_file_init (&file, thiz, demux))
+  {
+    return FALSE;
+  }
+
+  generation = gst_bt_bitset_get_generation (file.piece_matrix);
+  if (generation != thiz->keyframes_generation)
+  {
+    thiz->keyframes_generation = generation;
+    thiz->keyframes = gst_bt_mp4_keyframes_parse (gst_bt_demux_local_file_read, &file,
+        thiz->end_byte_global - thiz->start_byte_global);
+
+                  printf ("(bt_demux_stream_ensure_keyframes) %s: %d keyframes indexed\n",
+                      GST_PAD_NAME (thiz), thiz->keyframes ? (int) thiz->keyframes->len : -1);
+  }
+  gst_bt_demux_local_file_clear (&file);
+
+  return thiz->keyframes != NULL;
+}
+
+
+/* Build the keyframe index of the requested stream on the alert thread, nothing
+ * is parsed until the piece matrix changed since the last attempt */
+static void
+gst_bt_demux_index_requested (GstBtDemux * thiz)
+{
+  GSList *walk;
+
+  g_mutex_lock (thiz->streams_lock);
+  for (walk = thiz->streams; walk; walk = g_slist_next (walk))
+  {
+    GstBtDemuxStream *stream = GST_BT_DEMUX_STREAM (walk->data);
+
+    if (!stream->requested)
+      continue;
+
+    g_static_rec_mutex_lock (stream->lock);
+    gst_bt_demux_stream_ensure_keyframes (stream, thiz);
+    g_static_rec_mutex_unlock (stream->lock);
+  }
+  g_mutex_unlock (thiz->streams_lock);
+}
+
+
+/* The keyframe after index i in the direction of the rate, skipping the ones closer
+ * than |rate| / TRICKMODE_KEYFRAMES_PER_SECOND seconds of media, so about that many
+ * are shown per second whatever the rate. -1 or keyframes->len past the ends */
+static gint
+gst_bt_demux_stream_trick_step (GstBtDemuxStream * thiz, gint i)
+{
+  gint dir = thiz->rate < 0.0 ? -1 : 1;
+  GstClockTime from = g_array_index (thiz->keyframes, GstBtKeyframe, i).time;
+  GstClockTime spacing = (GstClockTime) (ABS (thiz->rate) * GST_SECOND /
+      TRICKMODE_KEYFRAMES_PER_SECOND);
+  gint next;
+
+  for (next = i + dir; next >= 0 && next < (gint) thiz->keyframes->len; next += dir)
+  {
+    GstClockTime t = g_array_index (thiz->keyframes, GstBtKeyframe, next).time;
+
+    if ((t > from ? t - from : from - t) >= spacing)
+    {
+      break;
+    }
+  }
+
+  return next;
+}
+
+
+/* push_loop in trick mode: once the pieces of the next keyframe are local, read it
+ * from the file and push it as a segment of its own starting at its offset, which the
+ * demuxer downstream maps back to the sample, then let the alert thread raise the
+ * keyframes ahead. Piece_finished_alert wakes us up while waiting */
+static void
+gst_bt_demux_stream_push_keyframe (GstBtDemuxStream * thiz, GstBtDemux * demux)
+{
+  GstBtDemuxLocalFile file;
+  GstBtKeyframe kf;
+  GstBuffer *buf = NULL;
+  GstSegment segment;
+  GstFlowReturn ret;
+  GstMapInfo map;
+  guint cookie;
+  gint next;
+
+  //taken before looking at the file, a piece finished meanwhile is not missed
+  g_mutex_lock (&thiz->ready_lock);
+  cookie = thiz->ready_cookie;
+  g_mutex_unlock (&thiz->ready_lock);
+
+  g_static_rec_mutex_lock (thiz->lock);//********************************************************************************
+
+  if (thiz->trick_next < 0 || thiz->trick_next >= (gint) thiz->keyframes->len)
+  {
+                                  printf ("(bt_demux_stream_push_keyframe) no keyframe left, Sending EOS event on file %d\n", thiz->file_idx);
+
+    g_static_rec_mutex_unlock (thiz->lock);
+    gst_pad_push_event (GST_PAD (thiz), gst_event_new_eos ());
+    gst_pad_pause_task (GST_PAD (thiz));
+    return;
+  }
+  kf = g_array_index (thiz->keyframes, GstBtKeyframe, thiz->trick_next);
+
+  if (gst_bt_demux_local_file_init (&file, thiz, demux))
+  {
+    if (gst_bt_demux_local_file_has (&file, kf.offset, kf.size))
+    {
+      buf = gst_buffer_new_allocate (NULL, kf.size, NULL);
+      gst_buffer_map (buf, &map, GST_MAP_WRITE);
+      if (!gst_bt_demux_local_file_read (&file, kf.offset, map.data, kf.size))
+      {
+        gst_buffer_unmap (buf, &map);
+        gst_buffer_unref (buf);
+        buf = NULL;
+      }
+      else
+      {
+        gst_buffer_unmap (buf, &map);
+      }
+    }
+    gst_bt_demux_local_file_clear (&file);
+  }
+
+  if (!buf)
+  {
+    g_static_rec_mutex_unlock (thiz->lock);//********************************************************
+
+    //not downloaded yet, wait for a piece to finish or the trick seek to move on
+    g_mutex_lock (&thiz->ready_lock);
+    while (thiz->ready_cookie == cookie && !thiz->ready_flushing)
+    {
+      g_cond_wait (&thiz->ready_cond, &thiz->ready_lock);
+    }
+    if (thiz->ready_cookie == cookie)
+    {
+      gst_bt_demux_stream_pause_flushing (thiz);
+    }
+    g_mutex_unlock (&thiz->ready_lock);
+    return;
+  }
+
+  if (thiz->flush_start_sent)
+  {
+                                  printf ("(bt_demux_stream_push_keyframe) since flush_start sent, send flush_stop then \n");
+
+    gst_pad_push_event (GST_PAD (thiz), gst_event_new_flush_stop (TRUE));
+    thiz->flush_start_sent = FALSE;
+  }
+
+  //from the keyframe up to the next one shown, which comes with a segment of its own.
+  //qtdemux maps start and stop to the times of the samples at those bytes, so the
+  //segment lasts the media time skipped, |rate| / TRICKMODE_KEYFRAMES_PER_SECOND
+  //seconds, and the running time moves on by 1 / TRICKMODE_KEYFRAMES_PER_SECOND:
+  //the sink holds each keyframe that long. Going backwards the next one shown is
+  //before, playback runs from stop down to start. The last one is bounded by itself
+  next = gst_bt_demux_stream_trick_step (thiz, thiz->trick_next);
+  gst_segment_init (&segment, GST_FORMAT_BYTES);
+  segment.rate = thiz->rate;
+  segment.flags = GST_SEGMENT_FLAG_TRICKMODE_KEY_UNITS;
+  segment.start = kf.offset;
+  segment.stop = kf.offset + kf.size;
+  if (next >= 0 && next < (gint) thiz->keyframes->len)
+  {
+    gint64 next_offset = g_array_index (thiz->keyframes, GstBtKeyframe, next).offset;
+
+    if (thiz->rate < 0)
+    {
+      segment.start = MIN (next_offset, (gint64) segment.start);
+    }
+    else
+    {
+      segment.stop = MAX (next_offset, (gint64) segment.stop);
+    }
+  }
+  segment.time = segment.start;
+  segment.position = thiz->rate < 0 ? segment.stop : kf.offset;
+  gst_pad_push_event (GST_PAD (thiz), gst_event_new_segment (&segment));
+
+  GST_BUFFER_OFFSET (buf) = kf.offset;
+  GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_DISCONT);
+
+                                  printf ("(bt_demux_stream_push_keyframe) Pushing keyframe %d at %" G_GINT64_FORMAT ", size %u, rate %lf\n",
+                                      thiz->trick_next, kf.offset, kf.size, thiz->rate);
+
+  ret = gst_pad_push (GST_PAD (thiz), buf);
+
+  thiz->trick_next = next;
+  thiz->seek_pending = TRUE;
+
+  g_static_rec_mutex_unlock (thiz->lock);//********************************************************
+
+  g_atomic_int_set (&demux->seek_pending, TRUE);
+
+  //flushing means a new seek is on its way, it sets up what comes next
+  if (ret != GST_FLOW_OK && ret != GST_FLOW_FLUSHING)
+  {
+                                  printf ("(bt_demux_stream_push_keyframe) push failed (%s), Sending EOS event on file %d\n",
+                                      gst_flow_get_name (ret), thiz->file_idx);
+
+    gst_pad_push_event (GST_PAD (thiz), gst_event_new_eos ());
+    gst_pad_pause_task (GST_PAD (thiz));
+  }
+}
+
+
+
+
+/* The segment of a segment seek is over, called with the stream lock held: post the
+ * SEGMENT_DONE for the application to queue the next iteration, and keep the pieces
+ * pushed since the seek in the piece cache, the next iteration is served from there
+ * instead of h.read_piece() and the disk. A seek without the flag releases them */
+static void
+gst_bt_demux_stream_segment_done (GstBtDemuxStream * thiz, GstBtDemux * demux)
+{
+  gint64 size = thiz->end_byte_global - thiz->start_byte_global;
+  gint64 position;
+  GstMessage *msg;
+  GstEvent *event;
+  gboolean pinned = FALSE;
+
+  position = (gint64) (thiz->current_piece + 1) * demux->piece_length - thiz->start_byte_global;
+  position = CLAMP (position, 0, size);
+  thiz->segment_done = TRUE;
+
+  if (demux->piece_cache)
+  {
+    pinned = gst_bt_demux_piece_cache_pin_loop ((GstBtDemuxPieceCache *) demux->piece_cache,
+        thiz->segment_start_piece, thiz->current_piece, demux->piece_length);
+  }
+
+                                  printf ("(bt_demux_stream_segment_done) file %d, pieces [%d,%d] %s, position %ld\n",
+                                      thiz->file_idx, thiz->segment_start_piece, thiz->current_piece,
+                                      pinned ? "pinned" : "too large to pin", (long) position);
+
+  msg = gst_message_new_segment_done (GST_OBJECT_CAST (demux), GST_FORMAT_BYTES, position);
+  gst_message_set_seqnum (msg, thiz->segment_seqnum);
+  gst_element_post_message (GST_ELEMENT_CAST (demux), msg);
+
+  event = gst_event_new_segment_done (GST_FORMAT_BYTES, position);
+  gst_event_set_seqnum (event, thiz->segment_seqnum);
+  gst_pad_push_event (GST_PAD (thiz), event);
+}
+
+
+static void
+gst_bt_demux_stream_push_loop (gpointer user_data)
+{
+
+  using namespace libtorrent;
+  GstBtDemux *demux;
+  GstBtDemuxStream *thiz;
+  GstBtDemuxBufferData *ipc_data;
+  GstBuffer *buf;
+  GstFlowReturn ret;
+  GstBtDemuxBufferData *buf_data;
+  GSList *walk;
+  guint8 *data;
+  session *s;
+  torrent_handle h;
+  gboolean update_buffering = FALSE;
+  gboolean send_eos = FALSE;
+  gint buf_size;
+
+  //our current stream, there may be multiple stream within torrent
+  thiz = GST_BT_DEMUX_STREAM (user_data);
+
+              
+                                // printf("(bt_demux_stream_push_loop) Pad is %d 1-PUSH, 2-PULL, >start_piece= %d,current_piece=(%d)\n", 
+                                //     (int)GST_PAD_MODE (thiz), thiz->start_piece, thiz->current_piece);
+
+                    
+  demux = GST_BT_DEMUX (gst_pad_get_parent (GST_PAD (thiz)));
+
+                                GstTaskState tstate = gst_pad_get_task_state (GST_PAD_CAST (thiz));  
+
+                                printf("(bt_demux_stream_push_loop) FIRE %s [start piece idx:%d, end piece idx:%d],current_piece:%d,pad task state %d \n", 
+                                          GST_PAD_NAME (thiz), thiz->start_piece, thiz->end_piece, thiz->current_piece, (int)tstate);
+
+  //demux->finished field doesn't means that the whole torrent finished, we are seeder
+  //it is set to TRUE when torrent_removed_alert, so push_loop will terminate
+  if (demux->finished) 
+  {
+                                printf("(bt_demux_stream_push_loop) %s demux->finished, so return\n", GST_PAD_NAME (thiz));
+    gst_pad_pause_task (GST_PAD (thiz));
+    return;
+  }
+
+  //check requested, if modified , means we should not keep pushing the current stream
+  if (!thiz->requested)
+  {
+                                printf("(bt_demux_stream_push_loop) Undesired stream %s checked\n", GST_PAD_NAME (thiz));
+    
+    gst_pad_pause_task (GST_PAD (thiz));
+
+    return;
+  }
+
+  gboolean have_type_emitted = FALSE;
+  gboolean need_re_push = FALSE;
+
+  //wait for decodebin to be linked, a flush or stop pauses the task instead
+  if (!gst_bt_demux_stream_wait_ready (thiz, &have_type_emitted))
+  {
+    return;
+  }
+
+  //trick modes push the keyframes straight from the file, not the pieces read
+  if (thiz->trickmode)
+  {
+    gst_bt_demux_stream_push_keyframe (thiz, demux);
+    return;
+  }
+
+
+  //----Pushed in read_piece_alert handling code, pop up here
+  // If thiz->ipc (gasyncqueue) is empty, `g_async_queue_pop` blocks until data becomes available
+  ipc_data = (GstBtDemuxBufferData *) g_async_queue_pop (thiz->ipc);
+  if (!ipc_data) 
+  {
+                          printf("(bt_demux_stream_push_loop) !ipc_data, so return\n");
+
+    gst_pad_pause_task (GST_PAD (thiz));
+    return;
+  }
+  //a trick seek woke us up, loop back to push its keyframes
+  if (ipc_data->piece == TRICKMODE_WAKEUP_PIECE)
+  {
+    gst_bt_demux_buffer_data_free (ipc_data);
+    return;
+  }
+  if (!ipc_data->size) 
+  {
+                          printf("(bt_demux_stream_push_loop) ipc_data->size is zero,means btdemux have cleanup so return\n");
+
+    gst_bt_demux_buffer_data_free (ipc_data);
+    g_static_rec_mutex_unlock (thiz->lock);
+    return;
+  }
+  //the piece left the queue, give its room back
+  gst_bt_demux_queue_release (demux, ipc_data->size);
+
+
+  s = (session *)demux->session;
+  std::vector<libtorrent::torrent_handle> vec = s->get_torrents ();
+  if(vec.empty())
+  {
+                          printf("(bt_demux_stream_push_loop) vec.empty(), so return\n");
+
+    gst_bt_demux_buffer_data_free (ipc_data);
+    g_static_rec_mutex_unlock (thiz->lock);
+    return;
+  } 
+  h = vec[0];
+
+  //issue the reads deferred while the queues were full
+  gst_bt_demux_resume_deferred_reads (demux, h);
+
+
+printf("(bt_demux_stream_push_loop) waiting lock thiz->current_piece(%d), ipc_data->piece(%d)\n", thiz->current_piece,ipc_data->piece);
+  g_static_rec_mutex_lock (thiz->lock);//***************************************************************************************************
+printf("(bt_demux_stream_push_loop) recovery lock (%d)\n", thiz->current_piece);
+
+
+  //----CHECK
+  //judge whether `ipc_data` belongs to this stream(file)
+  if (ipc_data->piece < thiz->start_piece && ipc_data->piece > thiz->end_piece) 
+  {
+                                    printf("(bt_demux_stream_push_loop) judge whether `ipc_data` belongs to this stream(file), so return\n");
+
+    gst_bt_demux_buffer_data_free (ipc_data);
+    g_static_rec_mutex_unlock (thiz->lock);
+    return;
+  }
+  //whether it is our desired fileidx, if not dont Pushing buffer
+  if (!thiz->requested) 
+  {
+                                    printf("(bt_demux_stream_push_loop) this stream is not requested(aka. not playing currently in playlist), so return\n");
+    
+    gst_bt_demux_buffer_data_free (ipc_data);
+    g_static_rec_mutex_unlock (thiz->lock);
+    return;
+  }
+  //a trick seek came after this piece was queued
+  if (thiz->trickmode) 
+  {
+    gst_bt_demux_buffer_data_free (ipc_data);
+    g_static_rec_mutex_unlock (thiz->lock);
+    return;
+  }
+  //the segment of a segment seek is done, the reads still chained after it wait for the next seek
+  if (thiz->segment_done) 
+  {
+    gst_bt_demux_buffer_data_free (ipc_data);
+    //paused before a new seek can take the lock and restart the task
+    gst_pad_pause_task (GST_PAD (thiz));
+    g_static_rec_mutex_unlock (thiz->lock);
+    return;
+  }
+  /* in case got a seek event(current_piece has changed) intercept pushing it */
+  //this check to some extent guarantee the piece pushed in order
+  if (ipc_data->piece != thiz->current_piece + 1) 
+  {
+    // GST_DEBUG_OBJECT (thiz, "Dropping piece %d, waiting for %d on "
+    //     "file %d", ipc_data->piece, thiz->current_piece + 1, thiz->file_idx);
+
+                                      printf("(bt_demux_stream_push_loop) Dropping piece (%d), waiting for (%d) on file %d \n", ipc_data->piece, thiz->current_piece + 1, thiz->file_idx);
+
+    gst_bt_demux_buffer_data_free (ipc_data);
+    g_static_rec_mutex_unlock (thiz->lock);
+    return;
+  }
+
+
+  buf = gst_bt_demux_buffer_new (ipc_data->buffer, ipc_data->piece,
+    ipc_data->size, thiz);
+
+  //get buffer size for debug
+  buf_size = gst_buffer_get_size (buf);
+
+  // GST_DEBUG_OBJECT (thiz, "Received piece %d of size %d on file %d",
+  //     ipc_data->piece, ipc_data->size, thiz->file_idx);
+
+                                      printf("(bt_demux_stream_push_loop) Received piece (%d) of size %d and actual size %d on file %d \n", ipc_data->piece, ipc_data->size, buf_size,thiz->file_idx);
+
+  //----FOR SEEKING
+  if (thiz->pending_segment) 
+  {
+    GstEvent *event;
+#if HAVE_GST_1
+    GstSegment *segment;
+    gboolean update;
+#endif
+
+#if HAVE_GST_1
+    segment = gst_segment_new ();
+    gst_segment_init (segment, GST_FORMAT_BYTES);
+    gst_segment_do_seek (segment, 1.0, GST_FORMAT_BYTES,
+        thiz->segment_seek ? GST_SEEK_FLAG_SEGMENT : GST_SEEK_FLAG_NONE, 
+        GST_SEEK_TYPE_SET, thiz->start_byte-thiz->start_byte_global,
+        GST_SEEK_TYPE_SET, thiz->end_byte-thiz->start_byte_global, 
+        &update);
+
+    event = gst_event_new_segment (segment);
+    if (thiz->segment_seek)
+    {
+      gst_event_set_seqnum (event, thiz->segment_seqnum);
+    }
+#else
+    event = gst_event_new_segment (FALSE, 1.0, GST_FORMAT_BYTES,
+        thiz->start_byte, thiz->end_byte, thiz->start_byte);
+#endif
+
+                                        printf("(bt_demux_stream_push_loop) Push SEGMENT event, start_byte=%d, end_byte=%d \n", 
+                                            thiz->start_byte-thiz->start_byte_global, 
+                                            thiz->end_byte-thiz->start_byte_global);
+
+    if(thiz->flush_start_sent)
+    {
+
+                                        printf("(bt_demux_stream_push_loop) since flush_start sent, send flush_stop then \n");
+
+      GstEvent* flush_stop = gst_event_new_flush_stop (TRUE);
+      gst_pad_push_event (GST_PAD (thiz), flush_stop);
+      thiz->flush_start_sent = FALSE;
+    }
+
+    gst_pad_push_event (GST_PAD (thiz), event);
+
+    //clear the `pending_segment` field
+    thiz->pending_segment = FALSE;
+
+  }
+
+
+  // GST_DEBUG_OBJECT (thiz, "Pushing buffer, size: %d, file: %d, piece: %d",
+  //     ipc_data->size, thiz->file_idx, ipc_data->piece);
+
+
+  /***** BtdemuxStream->current_piece is UPDATED here  *****/
+  gint old_current_piece = thiz->current_piece;
+  thiz->current_piece = ipc_data->piece;
+  gst_bt_demux_stream_pin_window (thiz, demux);
+
+                                          printf("(bt_demux_stream_push_loop) Modifying thiz->current_piece from %d to %d \n",
+                                              old_current_piece, 
+                                              thiz->current_piece);
+
+
+                // before pushing buffer on pad, check whether it is flushing
+                // if (GST_PAD_IS_FLUSHING (GST_PAD (thiz)))
+                // {
+                //   printf ("(bt_demux_stream_push_loop) Before pushing  buffer, it is flushing\n");
+                // }else
+                // {
+                //   printf ("(bt_demux_stream_push_loop) Before pushing  buffer, it is NOT flushing\n");
+                // }
+
+
+                                          printf("(bt_demux_stream_push_loop) Pushing buffer, actual size: %d, file: %d, cur piece: (%d) \n", buf_size, thiz->file_idx, thiz->current_piece);
+
+
+  ret = gst_pad_push (GST_PAD (thiz), buf);
+
+  if (ret != GST_FLOW_OK) 
+  {
+
+                                           printf("(bt_demux_stream_push_loop)!!Failed Pushing buffer,actual size: %d, file: %d, piece: (%d) ret=%d\n", 
+                                              buf_size, thiz->file_idx, thiz->current_piece, (int)ret);
+
+    if (ret == GST_FLOW_NOT_LINKED ) 
+    {
+      printf ("(bt_demux_stream_push_loop) it is Pad-not-linked errors \n");
+
+      send_eos = TRUE;
+      GST_ELEMENT_ERROR (demux, STREAM, FAILED,
+          ("Internal data flow error."),
+          ("streaming task paused, reason %s (%d)", gst_flow_get_name (ret),
+          ret));
+    }
+    // such as seek, flush-start, but flush-stop not sent yet
+    else if (ret == GST_FLOW_FLUSHING)
+    {
+        printf ("(bt_demux_stream_push_loop) it is flushing  \n");
+
+        if (FALSE == have_type_emitted) {
+
+              printf ("(bt_demux_stream_push_loop) have-type not sent yet, repush this piece \n");
+                
+          gst_bt_demux_queue_acquire (demux, ipc_data->size);
+          g_async_queue_push_front (thiz->ipc, ipc_data);
+          //dont update the current_piece here, since we need re-push this piece data again to guarantee it pushed successful
+          thiz->current_piece = old_current_piece;
+          need_re_push = TRUE;
+        }else {
+          printf ("(bt_demux_stream_push_loop) otherwise, send eos downstream to avoid blcking on push_loop \n");
+          send_eos = TRUE;
+        }
+    }
+    // that is GST_FLOW_EOS, 
+    // where is the EOS originated ? who populates it ?
+    // it was found in 'goto eos' eos labeled code in qtdemux_process_adapter which gonna return GST_FLOW_EOS in qtdemux.c , 
+    else if (ret == GST_FLOW_UNEXPECTED)
+    {
+      // if already got eos event when gst_pad_push, why not we don't send the same another eos event, 
+      // send eos or not ,does it matter that much ? yes
+      send_eos = TRUE;
+      printf ("(bt_demux_stream_push_loop) it is End of stream \n");
+    }
+    // maybe GST_FLOW_NOT_NEGOTIATE, GST_FLOW_ERROR etc... but i never meet them returned
+    else if (ret < GST_FLOW_UNEXPECTED)
+    {
+      printf ("(bt_demux_stream_push_loop) it is unexpected errors \n");
+
+      send_eos = TRUE;
+      GST_ELEMENT_ERROR (demux, STREAM, FAILED,
+          ("Internal data flow error."),
+          ("streaming task paused, reason %s (%d)", gst_flow_get_name (ret),
+          ret));
+    }
+  }
+
+
+#if 0
+  /* send the end of segment in case we need to */
+  if (ipc_data->piece == thiz->end_piece) {
+
+  }
+#endif
+
+
+  /* send the EOS downstream, check that last push didnt trigger a new seek */
+  if (!thiz->moov_after_mdat && ipc_data->piece == thiz->last_piece && !thiz->pending_segment)
+  {
+
+                                  printf("(bt_demux_stream_push_loop) during last push set send_eos to TRUE %d %d\n",ipc_data->piece, thiz->last_piece);
+
+    send_eos = TRUE;
+  }
+
+  //a segment seek ends with a SEGMENT_DONE instead, the application goes on with the next seek
+  if (send_eos && thiz->segment_seek && (ret == GST_FLOW_OK || ret == GST_FLOW_UNEXPECTED))
+  {
+    gst_bt_demux_stream_segment_done (thiz, demux);
+    send_eos = FALSE;
+    gst_pad_pause_task (GST_PAD (thiz));
+  }
+
+  if (send_eos) 
+  {
+    GstEvent *eos;
+    // send eos means previous stream is end, new seek in stream occur 
+    // Elements that receive the EOS event on a pad can return #GST_FLOW_EOS when data after the EOS event arrives
+    eos = gst_event_new_eos ();
+
+    // GST_DEBUG_OBJECT (thiz, "Sending EOS on file %d", thiz->file_idx);
+
+                                  printf("(bt_demux_stream_push_loop) Sending EOS event on file %d, piece:%d \n", thiz->file_idx, ipc_data->piece );
+
+    gst_pad_push_event (GST_PAD (thiz), eos);
+    gst_pad_pause_task (GST_PAD (thiz));
+
+  }
+
+
+  //-----------HANDLING MOOV AFTER MDAT CASE---------
+  // when moov header after mdat, reset pushing from first piece after push last piece
+  //the gstdeocdebin2 srcpad is not created until moov header piece pushed and reset pushing from start, after that , the stream become seekable
+  // No need to worry about that user will trigger a seek before or during the moov-header-seek posted bt qtdemux and parsing 
+  if (thiz->moov_after_mdat && ipc_data->piece == thiz->end_piece)
+  {
+
+                                      printf("(bt_demux_stream_push_loop) When got moov header after mdat , reset pushing start from first piece \n");
+
+      gint start_piece, start_offset, end_piece, end_offset;
+      gint64 start_byte, end_byte;
+
+      /* get the piece length */
+      torrent_info ti = h.get_torrent_info ();
+      int piece_length = ti.piece_length ();
+
+      //// gst_bt_demux_stream_info (thiz, h, &start_offset,
+      //// &start_piece, &end_offset, &end_piece, NULL, &start_byte, &end_byte);
+
+      thiz->start_byte = thiz->start_byte_global;
+      thiz->end_byte = thiz->end_byte_global;
+      thiz->start_piece = thiz->start_byte / piece_length;
+      thiz->start_offset = thiz->start_byte % piece_length;
+      thiz->end_piece = thiz->end_byte / piece_length;
+      thiz->end_offset = thiz->end_byte % piece_length; 
+      
+      gboolean update_buffering = gst_bt_demux_stream_activate (thiz, h, demux->buffer_pieces);
+      if (update_buffering) 
+      {
+                                      printf ("(bt_demux_stream_push_loop) When got moov header after mdat , call send_buffering\n");
+
+        gst_bt_demux_send_buffering (demux, h);
+      } 
+      else
+      {
+                                      printf ("(bt_demux_stream_push_loop) When got moov header after mdat, call read_piece() on start piece %d\n",
+                                      thiz->start_piece);
+
+        //**fire the read on start_piece, the rest will follow automatically, like a chain reaction, or domino effect
+        gst_bt_demux_read_piece (demux, h, thiz->start_piece);
+      }
+      gst_bt_demux_stream_pin_window (thiz, demux);
+      thiz->moov_after_mdat = FALSE;
+  }
+
+  
+
+  //-----------TRY ADD MORE ADJENCENT PIECES---------
+  /* read the next piece, make sure not exceeds `end_piece` */
+  if (!need_re_push && !thiz->segment_done && (ipc_data->piece+1<=thiz->end_piece)) 
+  {
+      int next = ipc_data->piece+1;    
+      //in case we got a seek, current_piece modified
+      if (next<=thiz->current_piece || next>thiz->current_piece+demux->buffer_pieces-1) 
+      {
+                printf ("(bt_demux_stream_push_loop) current_piece modified, give up call read_piece() on next piece %d, current:%d\n", ipc_data->piece+1, thiz->current_piece);
+      } 
+      else 
+      {
+
+        //here,we dont check Three-Piece-Area availability, just check the only one piece next to us, it is more loose than bt_demux_stream_activate()
+        if (h.have_piece (next)) 
+        {
+          // GST_DEBUG_OBJECT (thiz, "Reading next piece %d, current: %d",
+          //     ipc_data->piece + 1, thiz->current_piece);
+
+          if (send_eos ==FALSE) {
+                          printf ("(bt_demux_stream_push_loop) Luckily we have next piece %d, call read_piece() on it, current:%d\n", ipc_data->piece+1, thiz->current_piece);
+            //**fire the read on start_piece, the rest will follow automatically, like a chain reaction, or domino effect
+            gst_bt_demux_read_piece (demux, h, next);
+          } else {
+                          //generally, it is reached when EOS occured
+                          printf ("(bt_demux_stream_push_loop) due to EOS or internal Error, suspend call read_piece() on next piece %d, current:%d, end/last:%d \n", ipc_data->piece + 1, thiz->current_piece, thiz->last_piece);
+          }
+        } 
+        // if we do not hold the next piece following the current, we need to buffering the Three-Piece-Area 
+        else 
+        {
+          int i;
+
+          // GST_DEBUG_OBJECT (thiz, "Start buffering next piece %d",
+          //      ipc_data->piece + 1);
+
+                                            {
+                                                int begin = next;
+                                                int ending = ipc_data->piece+demux->buffer_pieces-1;
+                                                if (ending > thiz->end_piece) {
+                                                  ending = thiz->end_piece;
+                                                }
+
+                                                printf ("(bt_demux_stream_push_loop) Unlickily We dont hold the next piece, buffering between [%d,%d] \n", 
+                                                  begin, 
+                                                  ending);
+                                            }
+
+          //Clear previous buffering stats
+          thiz->buffering_level = 0;
+          thiz->buffering_count = 0;
+          thiz->buffering_had = 0;
+
+          if (thiz->cur_buffering_flags) {
+              //clear history
+              thiz->cur_buffering_flags = g_array_remove_range (thiz->cur_buffering_flags, 0, thiz->cur_buffering_flags->len);
+  printf ("(bt_demux_stream_push_loop) clearing historical cur_buffering_flags for new push\n");
+              //Three-Piece-Area
+              for (i=1; i<demux->buffer_pieces; i++) 
+              {
+                  libtorrent::download_priority_t priority;
+                  int idx = next;
+
+                  //border checking -- if hit, bail out
+                  if (idx > thiz->end_piece) 
+                  {
+                    break;
+                  }
+                  
+                  if (h.have_piece (idx))
+                  {
+                    //if we hold this piece, thiz->cur_buffering_flags set to FALSE on that index
+                    gboolean tmp_false = FALSE;
+                    g_array_append_vals (thiz->cur_buffering_flags, &tmp_false, 1);
+                    thiz->buffering_had++;
+                    continue;
+                  }
+
+                  gboolean tmp_true = TRUE;
+                  g_array_append_vals (thiz->cur_buffering_flags, &tmp_true, 1);
+
+                  /* if it's already set to `top_priority` just skip */
+                  priority = h.piece_priority (idx);
+                  if (priority == libtorrent::top_priority)
+                  {
+                    continue;
+                  }
+
+                  /* set to top priority */
+                  priority = libtorrent::top_priority;
+
+                  h.piece_priority (idx, priority);
+                  g_array_append_val (thiz->raised_pieces, idx);
+
+                  thiz->buffering_count++;
+              }
+
+              if (thiz->buffering_count)
+              {
+                thiz->buffering = TRUE;
+              }
+
+              update_buffering = TRUE;
+          } 
+
+          else {
+            printf ("(bt_demux_stream_push_loop) failed clear cur_buffering_flags \n");
+          }
+
+        }
+
+      }
+  }
+
+                                  printf("(bt_demux_stream_push_loop) unlock cur:(%d)\n", thiz->current_piece);
+
+  g_static_rec_mutex_unlock (thiz->lock);
+
+  // g_mutex_unlock (demux->streams_lock);
+
+  if (update_buffering)
+  {
+    //this is just for post gst buffering message so application can know
+    gst_bt_demux_send_buffering (demux, h);
+  }
+
+  // g_mutex_unlock (demux->streams_lock);
+  // still push current piece instead of moving to push next piece
+  if (!need_re_push) {
+    gst_bt_demux_buffer_data_free (ipc_data);
+  }
+
+                                  printf("bt_demux_stream_push_loop, END \n");
+
+}
+
+
+
+
+
+
+
+//Used in piece_finished_alert handling code
+//Updating the buffering progress infomation
+static void
+gst_bt_demux_stream_update_buffering (GstBtDemuxStream * thiz,
+    GstBtDemux * demux, int max_pieces)
+{
+  //cuz thiz->current_pieces was assigned as thiz->start_piece minus 1 in gst_bt_demux_stream_activate
+  //3 pieces treat as a unit
+  int start = thiz->current_piece + 1;
+  int end = thiz->current_piece + max_pieces;
+  // num of pieces that already downloaded, it should within sector of [0,3]
+  int buffered_pieces = 0;
+  GstBtBitset *piece_matrix = NULL;
+
+  /* do not exceeds piece boundry */
+  if (start >= thiz->end_piece) {
+    start = thiz->end_piece;
+    end = thiz->end_piece;
+  }
+  if (end > thiz->end_piece) {
+    end = thiz->end_piece;
+  }
+          
+  if (thiz->cur_buffering_flags) {
+
+      //the window may have grown with the rate since the flags were set
+      if (end >= start + (int) thiz->cur_buffering_flags->len) {
+        end = start + (int) thiz->cur_buffering_flags->len - 1;
+      }
+
+      GST_OBJECT_LOCK (demux);
+      if (demux->piece_matrix)
+      {
+        piece_matrix = gst_bt_bitset_ref (demux->piece_matrix);
+      }
+      GST_OBJECT_UNLOCK (demux);
+
+      /* count how many pieces have been downloaded: pieces are never lost, so
+       * the ones flagged are the ones local now but those local when the
+       * flags were set */
+      if (piece_matrix && end >= start) {
+        buffered_pieces = (int) gst_bt_bitset_count_range (piece_matrix, start, end + 1)
+            - thiz->buffering_had;
+        gst_bt_bitset_unref (piece_matrix);
+      }
+
+            printf ("(gst_bt_demux_stream_update_buffering) between [%d,%d] buffered:%d, buffering:%d\n", 
+                start, end,
+                buffered_pieces, 
+                thiz->buffering_count);
+
+
+      if (buffered_pieces > thiz->buffering_count) {
+        //correction on the buffered_pieces , making sure it not greater than actual buffering_count
+        buffered_pieces = thiz->buffering_count;
+      }
+      if (buffered_pieces < 0) {
+        buffered_pieces = 0;
+      }
+
+      //Hot Three-Piece-Area progress
+      //******************Compute the average percent progress*************************
+      thiz->buffering_level = (buffered_pieces * 100) / thiz->buffering_count;
+
+      // GST_DEBUG_OBJECT (thiz, "Buffering level %d (%d/%d)", 
+      //     thiz->buffering_level,
+      //     buffered_pieces, 
+      //     thiz->buffering_count);
+  
+          printf("(gst_bt_demux_stream_update_buffering) Buffering level %d (%d/%d) \n", thiz->buffering_level, buffered_pieces, thiz->buffering_count);
+  
+  } 
+
+  else {
+
+    printf ("(gst_bt_demux_stream_update_buffering) cur_buffering_flags is empty \n"); 
+  }
+}
+
+
+
+
+
+
+static void
+gst_bt_demux_stream_add_one_piece (GstBtDemuxStream * thiz,
+    libtorrent::torrent_handle h, libtorrent::piece_index_t piece)
+{
+  using namespace libtorrent;
+
+  // GST_DEBUG_OBJECT (thiz, "Adding more pieces at %d, current: %d, "
+  //     "max: %d", piece, thiz->current_piece, max_pieces);
+
+                        printf("(bt_demux_stream_add_piece) Adding more pieces at %d, current: %d\n", piece, thiz->current_piece);
+
+  // select (set priorirt to top) ONLY one piece that following the selected (of top_priority) piece and break the loop
+  // if we are seeder, it do nothing
+  for (piece; piece <= static_cast<piece_index_t>(thiz->end_piece); piece++) 
+  {
+    libtorrent::download_priority_t priority;
+
+
+    //we already hold this piece, just continue looping
+    if (h.have_piece (piece))
+    {
+      continue;
+    }
+
+
+    /* if it's already set to `top_priority` just skip */
+    priority = h.piece_priority (piece);
+    if (priority == libtorrent::top_priority)
+    {
+      continue;
+    }
+
+
+
+    /* set to top priority */
+    priority = libtorrent::top_priority;
+
+
+    // this individual piece we dont hold now will be downloaded at top_priority
+    // priority will affect piece_picker
+    // the other pieces still will be downloaded after all pieces in your requested stream downloaded
+    //when we dont have those pieces needed to play it, we set priority of these pieces,
+    //not means the other pieces is forbidden to be downloaded
+    //actually the pieces which is in non-requested streams still will be downlaoded
+    h.piece_priority (piece, priority);
+
+    int raised = static_cast<int> (piece);
+    g_array_append_val (thiz->raised_pieces, raised);
+
+
+    // GST_DEBUG_OBJECT (thiz, "Requesting piece %d, prio: %d, current: %d ",
+    //     piece, priority, thiz->current_piece);
+
+                        printf("(bt_demux_stream_add_piece) Since WE Dont Have, Requesting piece %d at top priority, current: %d\n", piece, thiz->current_piece);
+    
+    // once set priority on one piece, exit the loop
+    break;
+  }
+}
+
+
+
+
+
+
+
+
+
+
+
+
+/*
+    |---Piece 0---|---Piece 1---|---Piece 2---|---Piece 3---|---Piece 4---|---Piece 5---|---Piece 6---| ...... 
+    |_________________________________________| <- window current_piece starts from -1
+                                              |_________________________________________| <- window current_piece starts from 0                          
+*/
+
+/*used in gst_bt_demux_switch_streams 
+gst_bt_demux_stream_seek 
+and moov_after_mdat handling code in push_loop*/
+// should call this function after we set fileidx in totem-playlist
+//for non-seeder torrent, this function set first three pieces to top_priority 
+//and the rest pieces will 
+//set priority ==> let  libtorrent download it ==> add piece the piece_finished_alert handling code
+//=> call read_piece() in bt_demux_send_buffering() => start push_loop in read_piece_alert hanlding code 
+static gboolean
+gst_bt_demux_stream_activate (GstBtDemuxStream * thiz,
+    libtorrent::torrent_handle h, int max_pieces)
+{
+  using namespace libtorrent;
+
+  gboolean ret = FALSE;
+
+printf ("(bt_demux_stream_activate) waiting lock\n");
+  g_static_rec_mutex_lock (thiz->lock);//********************************************************************************
+printf ("(bt_demux_stream_activate) recovery lock\n");
+
+  // we want this stream - A stream is just a video file within same torrent, there may be multiple
+  if( !thiz->requested )
+  {
+    thiz->requested = TRUE;
+  }
+
+  //update current_piece which is equal to start_piece minus one, make it point to the index preceding the start_piece
+  thiz->current_piece = thiz->start_piece - 1;
+  thiz->pending_segment = TRUE;
+
+
+printf("(bt_demux_stream_activate) Modifying thiz->current_piece to %d (start_piece minus one) \n",
+                                              thiz->current_piece);
+
+
+  // GST_DEBUG_OBJECT (thiz, "Activating stream '%s', start: %d, "
+  //     "start_offset: %d, end: %d, end_offset: %d, current: %d",
+  //     GST_PAD_NAME (thiz), thiz->start_piece, thiz->start_offset,
+  //     thiz->end_piece, thiz->end_offset, thiz->current_piece);
+
+
+  //Clear previous buffering fields, avoid unneeded push
+  thiz->buffering_level = 0;
+  thiz->buffering_count = 0;
+  thiz->buffering_had = 0;
+  if (thiz->buffering != FALSE) 
+  {
+    thiz->buffering = FALSE;
+  }
+
+
+  int start = thiz->start_piece;
+  int end = thiz->start_piece + max_pieces - 1;
+  /* do not exceeds piece boundry */
+  if (start >= thiz->end_piece) {
+    start = thiz->end_piece;
+    end = thiz->end_piece;
+  }
+  if (end > thiz->end_piece) {
+    end = thiz->end_piece;
+  }
+
+
+  if (thiz->cur_buffering_flags) {
+
+
+    //clear history
+    thiz->cur_buffering_flags = g_array_remove_range (thiz->cur_buffering_flags, 0, thiz->cur_buffering_flags->len);
+  
+    printf ("(bt_demux_stream_activate) clearing historical cur_buffering_flags for activate stream\n");
+
+    int i;
+    /* count how many pieces need downloading/buffering in 3-Piece-Area */
+    for (i=start; i<=end; i++) 
+    {
+      //have_piece() return TRUE means we have downloaded this piece, passed hash-check, and flushed to disk
+      if (h.have_piece (i)) 
+      {
+        // if we hold this piece, thiz->cur_buffering_flags set to FALSE on that index, 
+        // so it won't be taken into account when calculate buffering level
+        gboolean tmp_false = FALSE;
+        g_array_append_vals (thiz->cur_buffering_flags, &tmp_false, 1);
+        thiz->buffering_had++;
+        continue;
+      }
+
+      //we need to download this piece, it needs take into account when calculate buffering level
+      gboolean tmp_true = TRUE;
+      g_array_append_vals (thiz->cur_buffering_flags, &tmp_true, 1);
+
+      libtorrent::download_priority_t priority;
+
+      /* if it's already set to `top_priority` just skip */
+      priority = h.piece_priority (i);
+      if (priority == libtorrent::top_priority)
+      {
+        continue;
+      }
+
+      /* set to top priority */
+      priority = libtorrent::top_priority;
+
+      h.piece_priority (i, priority);
+      g_array_append_val (thiz->raised_pieces, i);
+
+      thiz->buffering_count++;
+    }
+
+    if (thiz->buffering_count)
+    {
+      thiz->buffering = TRUE;
+      // set to TRUE means we need to buffering (download the torrent)
+      ret = TRUE;
+    }
+
+
+
+              printf("(bt_demux_stream_activate) Activating stream '%s', start: (%d), start_offset: %d, end: %d, end_offset: %d, current: (%d) buffering(%s)\n", 
+                                GST_PAD_NAME (thiz), thiz->start_piece, thiz->start_offset, thiz->end_piece, thiz->end_offset, thiz->current_piece,
+                                thiz->buffering_count>0 ? "Yes" : "No");
+
+
+  } else {
+    printf ("(bt_demux_stream_activate) failed clear cur_buffering_flags \n");
+  }
+
+printf("(bt_demux_stream_activate) unlock\n");
+  g_static_rec_mutex_unlock (thiz->lock);//********************************************************************************
+
+
+  // GstTaskState tstate = gst_pad_get_task_state (GST_PAD_CAST (thiz));  
+  //   printf ("(bt_demux_stream_activate) pad task state is %d \n", (int)tstate);
+
+  return ret;
+}
+
+
+
+
+
+
+
+/*init the BtDemuxStream */
+static void
+gst_bt_demux_stream_info (GstBtDemuxStream * thiz,
+    libtorrent::torrent_handle h, gint * start_offset,
+    gint * start_piece, gint * end_offset, gint * end_piece,
+    gint64 * size, gint64 * start_byte, gint64 * end_byte)
+{
+  using namespace libtorrent;
+  file_entry fe;
+  int piece_length;
+  torrent_info ti = h.get_torrent_info ();
+
+  piece_length = ti.piece_length ();
+  fe = ti.file_at (thiz->file_idx);
+
+
+  // fe.offset -- the offset of this file inside the torrent 
+  // fe.size -- the size of the file (in bytes) 
+
+
+  // this file starts in `start_piece`th piece within the torrent
+  // conversely, fe.offest = start_piece * piece_length + start_offset, start_piece value is >= 0, 
+  // must not increment one on start_piece before multiply it piece_length
+  if (start_piece)
+  {
+    *start_piece = fe.offset / piece_length;
+  }
+
+
+  // the number of bytes  whom this file starts after in its `start piece` 
+  if (start_offset)
+  {
+    *start_offset = fe.offset % piece_length;
+  }
+
+
+  // this file ends at `end_piece`th piece within the torrent
+  if (end_piece)
+  {
+    *end_piece = (fe.offset + fe.size) / piece_length;
+  }
+
+
+  // the number of bytes past the  `end_piece`
+  if (end_offset)
+  {
+    *end_offset = (fe.offset + fe.size) % piece_length;
+  }
+
+
+  if (size)
+  {
+    *size = fe.size;
+  }
+
+
+  if (start_byte)
+  {
+    *start_byte = fe.offset; 
+  }
+
+
+  if (end_byte)
+  {
+    *end_byte = fe.offset + fe.size;
+  }
+
+}
 
-      // GST_DEBUG_OBJECT (thiz, "Buffering level %d (%d/%d)", 
-      //     thiz->buffering_level,
-      //     buffered_pieces, 
-      //     thiz->buffering_count);
-  
-          printf("(gst_bt_demux_stream_update_buffering) Buffering level %d (%d/%d) \n", thiz->buffering_level, buffered_pieces, thiz->buffering_count);
-  
-  } 
 
-  else {
 
-    printf ("(gst_bt_demux_stream_update_buffering) cur_buffering_flags is empty \n"); 
+
+static gboolean
+gst_bt_demux_array_has_piece (GArray * pieces, int piece)
+{
+  for (guint i = 0; pieces && i < pieces->len; i++)
+  {
+    if (g_array_index (pieces, gint, i) == piece)
+      return TRUE;
   }
+
+  return FALSE;
 }
 
 
+/* The priority a piece goes back to once what raised it is done with it: the
+ * low_priority every video piece idles at (see initial_priorities and switch_streams),
+ * or the one of the prefetch or hotspot target it still is. Anything higher would keep
+ * it ahead of the rest of the file for good */
+static libtorrent::download_priority_t
+gst_bt_demux_idle_priority (GstBtDemux * thiz, int piece)
+{
+  libtorrent::download_priority_t priority = libtorrent::low_priority;
 
+  GST_OBJECT_LOCK (thiz);
+  if (gst_bt_demux_array_has_piece (thiz->prefetch_pieces, piece))
+  {
+    priority = libtorrent::download_priority_t (PREFETCH_PRIORITY);
+  }
+  else if (gst_bt_demux_array_has_piece (thiz->hotspot_pieces, piece))
+  {
+    priority = libtorrent::download_priority_t (HOTSPOT_PRIORITY);
+  }
+  GST_OBJECT_UNLOCK (thiz);
 
+  return priority;
+}
 
 
+/* put back to their idle priority the pieces this stream raised to top_priority which
+ * are outside [start,end] and still missing, in one call, so the targets a scrub went
+ * through don't keep competing with the real one nor with the rest of the file */
 static void
-gst_bt_demux_stream_add_one_piece (GstBtDemuxStream * thiz,
-    libtorrent::torrent_handle h, libtorrent::piece_index_t piece)
+gst_bt_demux_stream_reset_raised (GstBtDemuxStream * thiz, GstBtDemux * demux,
+    libtorrent::torrent_handle h, int start, int end)
 {
-  using namespace libtorrent;
+  std::vector<std::pair<libtorrent::piece_index_t, libtorrent::download_priority_t> > reset;
+  GstBtBitset *piece_matrix = NULL;
+  guint i, kept = 0;
 
-  // GST_DEBUG_OBJECT (thiz, "Adding more pieces at %d, current: %d, "
-  //     "max: %d", piece, thiz->current_piece, max_pieces);
-
-                        printf("(bt_demux_stream_add_piece) Adding more pieces at %d, current: %d\n", piece, thiz->current_piece);
-
-  // select (set priorirt to top) ONLY one piece that following the selected (of top_priority) piece and break the loop
-  // if we are seeder, it do nothing
-  for (piece; piece <= static_cast<piece_index_t>(thiz->end_piece); piece++) 
+  GST_OBJECT_LOCK (demux);
+  if (demux->piece_matrix)
   {
-    libtorrent::download_priority_t priority;
+    piece_matrix = gst_bt_bitset_ref (demux->piece_matrix);
+  }
+  GST_OBJECT_UNLOCK (demux);
 
+  for (i = 0; i < thiz->raised_pieces->len; i++)
+  {
+    int piece = g_array_index (thiz->raised_pieces, gint, i);
 
-    //we already hold this piece, just continue looping
-    if (h.have_piece (piece))
+    if (piece >= start && piece <= end)
+    {
+      g_array_index (thiz->raised_pieces, gint, kept++) = piece;
+      continue;
+    }
+    if (piece_matrix && gst_bt_bitset_get (piece_matrix, piece))
     {
       continue;
     }
+    reset.push_back (std::make_pair (libtorrent::piece_index_t (piece),
+        gst_bt_demux_idle_priority (demux, piece)));
+  }
+  g_array_set_size (thiz->raised_pieces, kept);
 
+  if (piece_matrix)
+  {
+    gst_bt_bitset_unref (piece_matrix);
+  }
 
-    /* if it's already set to `top_priority` just skip */
-    priority = h.piece_priority (piece);
-    if (priority == libtorrent::top_priority)
+  if (!reset.empty ())
+  {
+                  printf ("(bt_demux_stream_reset_raised) %d pieces outside [%d,%d] back to idle prio\n",
+                      (int) reset.size (), start, end);
+    h.prioritize_pieces (reset);
+  }
+}
+
+
+/* whether a stream raised piece to top_priority, called with the streams lock held */
+static gboolean
+gst_bt_demux_piece_is_raised (GstBtDemux * thiz, int piece)
+{
+  GSList *walk;
+  gboolean raised = FALSE;
+
+  for (walk = thiz->streams; walk && !raised; walk = g_slist_next (walk))
+  {
+    GstBtDemuxStream *stream = GST_BT_DEMUX_STREAM (walk->data);
+
+    g_static_rec_mutex_lock (stream->lock);
+    for (guint i = 0; i < stream->raised_pieces->len && !raised; i++)
     {
-      continue;
+      raised = g_array_index (stream->raised_pieces, gint, i) == piece;
     }
+    g_static_rec_mutex_unlock (stream->lock);
+  }
 
+  return raised;
+}
 
 
-    /* set to top priority */
-    priority = libtorrent::top_priority;
+/* Move the speculative prefetch to the latest "prefetch-offset", on the alert thread.
+ * The first window of the target not downloaded yet goes to PREFETCH_PRIORITY, with
+ * the index pieces of the file (its first and last, where the moov is), which a seek
+ * there, or a resume from there, needs first. The pieces raised for the previous
+ * target go back to their idle priority, unless a stream has raised them to
+ * top_priority meanwhile (the user did seek there) */
+static void
+gst_bt_demux_apply_prefetch (GstBtDemux * thiz, libtorrent::torrent_handle h)
+{
+  std::vector<std::pair<libtorrent::piece_index_t, libtorrent::download_priority_t> > prios;
+  GstBtBitset *piece_matrix = NULL;
+  GArray *old_pieces, *new_pieces;
+  gint64 offset;
+  int first = -1, last = -2;
+  int index_pieces[2] = { -1, -1 };
+  GSList *walk;
 
+  new_pieces = g_array_new (FALSE, FALSE, sizeof (gint));
 
-    // this individual piece we dont hold now will be downloaded at top_priority
-    // priority will affect piece_picker
-    // the other pieces still will be downloaded after all pieces in your requested stream downloaded
-    //when we dont have those pieces needed to play it, we set priority of these pieces,
-    //not means the other pieces is forbidden to be downloaded
-    //actually the pieces which is in non-requested streams still will be downlaoded
-    h.piece_priority (piece, priority);
+  GST_OBJECT_LOCK (thiz);
+  offset = thiz->prefetch_offset;
+  old_pieces = thiz->prefetch_pieces;
+  thiz->prefetch_pieces = NULL;
+  if (thiz->piece_matrix)
+  {
+    piece_matrix = gst_bt_bitset_ref (thiz->piece_matrix);
+  }
+  GST_OBJECT_UNLOCK (thiz);
 
+  g_mutex_lock (thiz->streams_lock);
 
-    // GST_DEBUG_OBJECT (thiz, "Requesting piece %d, prio: %d, current: %d ",
-    //     piece, priority, thiz->current_piece);
+  for (walk = thiz->streams; walk && offset >= 0 && thiz->piece_length > 0; walk = g_slist_next (walk))
+  {
+    GstBtDemuxStream *stream = GST_BT_DEMUX_STREAM (walk->data);
+    gint64 size = stream->end_byte_global - stream->start_byte_global;
 
-                        printf("(bt_demux_stream_add_piece) Since WE Dont Have, Requesting piece %d at top priority, current: %d\n", piece, thiz->current_piece);
-    
-    // once set priority on one piece, exit the loop
+    if (!stream->requested || stream->finished || size <= 0)
+      continue;
+
+    first = (int) ((stream->start_byte_global + MIN (offset, size - 1)) / thiz->piece_length);
+    last = MIN (first + thiz->buffer_pieces - 1, stream->last_piece);
+    index_pieces[0] = (int) (stream->start_byte_global / thiz->piece_length);
+    index_pieces[1] = stream->last_piece;
     break;
   }
-}
 
+  for (guint i = 0; old_pieces && i < old_pieces->len; i++)
+  {
+    int piece = g_array_index (old_pieces, gint, i);
 
+    if ((piece >= first && piece <= last) ||
+        piece == index_pieces[0] || piece == index_pieces[1])
+      continue;
+    if ((piece_matrix && gst_bt_bitset_get (piece_matrix, piece)) ||
+        gst_bt_demux_piece_is_raised (thiz, piece))
+      continue;
 
+    //prefetch_pieces is cleared meanwhile, a hotspot target keeps its priority
+    prios.push_back (std::make_pair (libtorrent::piece_index_t (piece),
+        gst_bt_demux_idle_priority (thiz, piece)));
+  }
 
+  for (int piece = first; piece >= 0 && piece <= last; piece++)
+  {
+    if ((piece_matrix && gst_bt_bitset_get (piece_matrix, piece)) ||
+        gst_bt_demux_piece_is_raised (thiz, piece))
+      continue;
 
+    g_array_append_val (new_pieces, piece);
+    prios.push_back (std::make_pair (libtorrent::piece_index_t (piece),
+        libtorrent::download_priority_t (PREFETCH_PRIORITY)));
+  }
 
+  for (int i = 0; i < 2; i++)
+  {
+    int piece = index_pieces[i];
 
+    if (piece < 0 || (piece >= first && piece <= last) ||
+        (i == 1 && piece == index_pieces[0]))
+      continue;
+    if ((piece_matrix && gst_bt_bitset_get (piece_matrix, piece)) ||
+        gst_bt_demux_piece_is_raised (thiz, piece))
+      continue;
 
+    g_array_append_val (new_pieces, piece);
+    prios.push_back (std::make_pair (libtorrent::piece_index_t (piece),
+        libtorrent::download_priority_t (PREFETCH_PRIORITY)));
+  }
 
+  g_mutex_unlock (thiz->streams_lock);
 
+  if (!prios.empty ())
+  {
+                  printf ("(gst_bt_demux_apply_prefetch) target [%d,%d], %d pieces raised, %d put back\n",
+                      first, last, (int) new_pieces->len, (int) prios.size () - (int) new_pieces->len);
+    h.prioritize_pieces (prios);
+  }
 
+  GST_OBJECT_LOCK (thiz);
+  if (thiz->prefetch_pieces)
+  {
+    g_array_free (thiz->prefetch_pieces, TRUE);
+  }
+  thiz->prefetch_pieces = new_pieces;
+  GST_OBJECT_UNLOCK (thiz);
 
-/*
-    |---Piece 0---|---Piece 1---|---Piece 2---|---Piece 3---|---Piece 4---|---Piece 5---|---Piece 6---| ...... 
-    |_________________________________________| <- window current_piece starts from -1
-                                              |_________________________________________| <- window current_piece starts from 0                          
-*/
+  if (old_pieces)
+  {
+    g_array_free (old_pieces, TRUE);
+  }
+  if (piece_matrix)
+  {
+    gst_bt_bitset_unref (piece_matrix);
+  }
+}
 
-/*used in gst_bt_demux_switch_streams 
-gst_bt_demux_stream_seek 
-and moov_after_mdat handling code in push_loop*/
-// should call this function after we set fileidx in totem-playlist
-//for non-seeder torrent, this function set first three pieces to top_priority 
-//and the rest pieces will 
-//set priority ==> let  libtorrent download it ==> add piece the piece_finished_alert handling code
-//=> call read_piece() in bt_demux_send_buffering() => start push_loop in read_piece_alert hanlding code 
+
+/* whether the seek intent prefetch raised piece */
 static gboolean
-gst_bt_demux_stream_activate (GstBtDemuxStream * thiz,
-    libtorrent::torrent_handle h, int max_pieces)
+gst_bt_demux_piece_is_prefetched (GstBtDemux * thiz, int piece)
 {
-  using namespace libtorrent;
+  gboolean prefetched;
 
-  gboolean ret = FALSE;
+  GST_OBJECT_LOCK (thiz);
+  prefetched = gst_bt_demux_array_has_piece (thiz->prefetch_pieces, piece);
+  GST_OBJECT_UNLOCK (thiz);
 
-printf ("(bt_demux_stream_activate) waiting lock\n");
-  g_static_rec_mutex_lock (thiz->lock);//********************************************************************************
-printf ("(bt_demux_stream_activate) recovery lock\n");
+  return prefetched;
+}
 
-  // we want this stream - A stream is just a video file within same torrent, there may be multiple
-  if( !thiz->requested )
+
+/* Background prefetch of where seeks usually land, on the alert thread. The targets
+ * are the "hotspot-skips" offsets from the playhead first, then "hotspot-count"
+ * evenly spaced positions starting with the ones after the playhead. Each gets its
+ * first HOTSPOT_PIECES at HOTSPOT_PRIORITY, but only a few at a time: libtorrent has
+ * no bandwidth split by priority, so the share is the number of hotspot pieces
+ * downloading next to the playhead window, hotspot_share percent of the total.
+ * As they finish the next targets take their place. The pieces not targeted anymore
+ * go back to their idle priority, like the prefetch ones, or they would stay ahead of
+ * the rest of the file outside the share */
+static void
+gst_bt_demux_apply_hotspots (GstBtDemux * thiz, libtorrent::torrent_handle h)
+{
+  std::vector<std::pair<libtorrent::piece_index_t, libtorrent::download_priority_t> > prios;
+  GstBtBitset *piece_matrix = NULL;
+  GArray *old_pieces, *new_pieces, *skips = NULL, *targets;
+  guint count, share, budget = 0;
+  int first = -1, last = -1, current = -1;
+  GSList *walk;
+
+  new_pieces = g_array_new (FALSE, FALSE, sizeof (gint));
+  targets = g_array_new (FALSE, FALSE, sizeof (gint));
+
+  GST_OBJECT_LOCK (thiz);
+  count = thiz->hotspot_count;
+  share = MIN (thiz->hotspot_share, MAX_HOTSPOT_SHARE);
+  if (thiz->hotspot_skips)
   {
-    thiz->requested = TRUE;
+    skips = g_array_ref (thiz->hotspot_skips);
+  }
+  old_pieces = thiz->hotspot_pieces;
+  thiz->hotspot_pieces = NULL;
+  if (thiz->piece_matrix)
+  {
+    piece_matrix = gst_bt_bitset_ref (thiz->piece_matrix);
   }
+  GST_OBJECT_UNLOCK (thiz);
 
-  //update current_piece which is equal to start_piece minus one, make it point to the index preceding the start_piece
-  thiz->current_piece = thiz->start_piece - 1;
-  thiz->pending_segment = TRUE;
+  if (share > 0)
+  {
+    budget = MAX ((thiz->buffer_pieces * share + 99 - share) / (100 - share), 1);
+  }
 
+  g_mutex_lock (thiz->streams_lock);
 
-printf("(bt_demux_stream_activate) Modifying thiz->current_piece to %d (start_piece minus one) \n",
-                                              thiz->current_piece);
+  for (walk = thiz->streams; walk && budget > 0 && thiz->piece_length > 0; walk = g_slist_next (walk))
+  {
+    GstBtDemuxStream *stream = GST_BT_DEMUX_STREAM (walk->data);
+
+    if (!stream->requested || stream->finished ||
+        stream->end_byte_global <= stream->start_byte_global)
+      continue;
 
+    first = (int) (stream->start_byte_global / thiz->piece_length);
+    last = stream->last_piece;
+    g_static_rec_mutex_lock (stream->lock);
+    current = CLAMP (stream->current_piece, first, last);
+    g_static_rec_mutex_unlock (stream->lock);
+    break;
+  }
 
-  // GST_DEBUG_OBJECT (thiz, "Activating stream '%s', start: %d, "
-  //     "start_offset: %d, end: %d, end_offset: %d, current: %d",
-  //     GST_PAD_NAME (thiz), thiz->start_piece, thiz->start_offset,
-  //     thiz->end_piece, thiz->end_offset, thiz->current_piece);
+  if (current >= 0)
+  {
+    guint k, start = 0;
 
+    for (guint i = 0; skips && i < skips->len; i++)
+    {
+      gint64 target = (gint64) current * thiz->piece_length + g_array_index (skips, gint64, i);
+      int piece = (int) CLAMP (target / thiz->piece_length, (gint64) first, (gint64) last);
 
-  //Clear previous buffering fields, avoid unneeded push
-  thiz->buffering_level = 0;
-  thiz->buffering_count = 0;
-  if (thiz->buffering != FALSE) 
+      g_array_append_val (targets, piece);
+    }
+
+    while (start < count && first + (gint64) (last - first + 1) * start / count <= current)
+    {
+      start++;
+    }
+    for (k = 0; k < count; k++)
+    {
+      int piece = first + (int) ((gint64) (last - first + 1) * ((start + k) % count) / count);
+
+      g_array_append_val (targets, piece);
+    }
+  }
+
+  for (guint i = 0; i < targets->len && new_pieces->len < budget; i++)
   {
-    thiz->buffering = FALSE;
+    int target = g_array_index (targets, gint, i);
+
+    for (int piece = target; piece <= MIN (target + HOTSPOT_PIECES - 1, last) &&
+        new_pieces->len < budget; piece++)
+    {
+      /* the playhead window is on its way already */
+      if (piece >= current && piece < current + thiz->buffer_pieces)
+        continue;
+      if ((piece_matrix && gst_bt_bitset_get (piece_matrix, piece)) ||
+          gst_bt_demux_array_has_piece (new_pieces, piece) ||
+          gst_bt_demux_piece_is_raised (thiz, piece) ||
+          gst_bt_demux_piece_is_prefetched (thiz, piece))
+        continue;
+
+      g_array_append_val (new_pieces, piece);
+      if (!gst_bt_demux_array_has_piece (old_pieces, piece))
+      {
+        prios.push_back (std::make_pair (libtorrent::piece_index_t (piece),
+            libtorrent::download_priority_t (HOTSPOT_PRIORITY)));
+      }
+    }
   }
 
+  for (guint i = 0; old_pieces && i < old_pieces->len; i++)
+  {
+    int piece = g_array_index (old_pieces, gint, i);
 
-  int start = thiz->start_piece;
-  int end = thiz->start_piece + max_pieces - 1;
-  /* do not exceeds piece boundry */
-  if (start >= thiz->end_piece) {
-    start = thiz->end_piece;
-    end = thiz->end_piece;
+    if (gst_bt_demux_array_has_piece (new_pieces, piece))
+      continue;
+    if ((piece_matrix && gst_bt_bitset_get (piece_matrix, piece)) ||
+        gst_bt_demux_piece_is_raised (thiz, piece) ||
+        gst_bt_demux_piece_is_prefetched (thiz, piece))
+      continue;
+
+    prios.push_back (std::make_pair (libtorrent::piece_index_t (piece),
+        gst_bt_demux_idle_priority (thiz, piece)));
   }
-  if (end > thiz->end_piece) {
-    end = thiz->end_piece;
+
+  g_mutex_unlock (thiz->streams_lock);
+
+  if (!prios.empty ())
+  {
+                  printf ("(gst_bt_demux_apply_hotspots) playhead %d, %d of %d targets downloading, %d priorities changed\n",
+                      current, (int) new_pieces->len, (int) targets->len, (int) prios.size ());
+    h.prioritize_pieces (prios);
   }
 
+  GST_OBJECT_LOCK (thiz);
+  if (thiz->hotspot_pieces)
+  {
+    g_array_free (thiz->hotspot_pieces, TRUE);
+  }
+  thiz->hotspot_pieces = new_pieces;
+  GST_OBJECT_UNLOCK (thiz);
 
-  if (thiz->cur_buffering_flags) {
+  g_array_free (targets, TRUE);
+  if (old_pieces)
+  {
+    g_array_free (old_pieces, TRUE);
+  }
+  if (skips)
+  {
+    g_array_unref (skips);
+  }
+  if (piece_matrix)
+  {
+    gst_bt_bitset_unref (piece_matrix);
+  }
+}
 
 
-    //clear history
-    thiz->cur_buffering_flags = g_array_remove_range (thiz->cur_buffering_flags, 0, thiz->cur_buffering_flags->len);
-  
-    printf ("(bt_demux_stream_activate) clearing historical cur_buffering_flags for activate stream\n");
+/* The read-ahead window of the streams at a playback rate: DEFAULT_BUFFER_PIECES last
+ * 1/|rate| as long when played faster, so the window grows with the rate, it never
+ * goes below the default */
+static void
+gst_bt_demux_scale_window (GstBtDemux * thiz, gdouble rate)
+{
+  gint pieces = DEFAULT_BUFFER_PIECES * MAX ((gint) std::ceil (ABS (rate)), 1);
 
-    int i;
-    /* count how many pieces need downloading/buffering in 3-Piece-Area */
-    for (i=start; i<=end; i++) 
-    {
-      //have_piece() return TRUE means we have downloaded this piece, passed hash-check, and flushed to disk
-      if (h.have_piece (i)) 
-      {
-        // if we hold this piece, thiz->cur_buffering_flags set to FALSE on that index, 
-        // so it won't be taken into account when calculate buffering level
-        gboolean tmp_false = FALSE;
-        g_array_append_vals (thiz->cur_buffering_flags, &tmp_false, 1);
-        continue;
-      }
+  if (pieces == thiz->buffer_pieces)
+  {
+    return;
+  }
 
-      //we need to download this piece, it needs take into account when calculate buffering level
-      gboolean tmp_true = TRUE;
-      g_array_append_vals (thiz->cur_buffering_flags, &tmp_true, 1);
+                  printf ("(gst_bt_demux_scale_window) rate %lf, window from %d to %d pieces\n",
+                      rate, thiz->buffer_pieces, pieces);
 
-      libtorrent::download_priority_t priority;
+  thiz->buffer_pieces = pieces;
+  g_atomic_int_set (&thiz->window_dirty, TRUE);
+}
 
-      /* if it's already set to `top_priority` just skip */
-      priority = h.piece_priority (i);
-      if (priority == libtorrent::top_priority)
-      {
-        continue;
-      }
 
-      /* set to top priority */
-      priority = libtorrent::top_priority;
+/* After the window grew, on the alert thread: raise the missing pieces it now covers
+ * ahead of the playhead to top_priority, so they come before we are there */
+static void
+gst_bt_demux_stream_raise_window (GstBtDemuxStream * thiz, GstBtDemux * demux,
+    libtorrent::torrent_handle h)
+{
+  std::vector<std::pair<libtorrent::piece_index_t, libtorrent::download_priority_t> > prios;
+  GstBtBitset *piece_matrix = NULL;
+  int start, end;
 
-      h.piece_priority (i, priority);
+  g_static_rec_mutex_lock (thiz->lock);//********************************************************************************
 
-      thiz->buffering_count++;
+  //a pending seek activates its own window
+  if (!thiz->requested || thiz->finished || thiz->trickmode || thiz->seek_pending)
+  {
+    g_static_rec_mutex_unlock (thiz->lock);
+    return;
+  }
+
+  GST_OBJECT_LOCK (demux);
+  if (demux->piece_matrix)
+  {
+    piece_matrix = gst_bt_bitset_ref (demux->piece_matrix);
+  }
+  GST_OBJECT_UNLOCK (demux);
+
+  start = thiz->current_piece + 1;
+  end = MIN (thiz->current_piece + demux->buffer_pieces - 1, thiz->end_piece);
+
+  for (int piece = start; piece <= end; piece++)
+  {
+    gboolean raised = FALSE;
+
+    if (piece_matrix && gst_bt_bitset_get (piece_matrix, piece))
+    {
+      continue;
+    }
+    for (guint i = 0; i < thiz->raised_pieces->len && !raised; i++)
+    {
+      raised = g_array_index (thiz->raised_pieces, gint, i) == piece;
     }
-
-    if (thiz->buffering_count)
+    if (raised)
     {
-      thiz->buffering = TRUE;
-      // set to TRUE means we need to buffering (download the torrent)
-      ret = TRUE;
+      continue;
     }
 
+    prios.push_back (std::make_pair (libtorrent::piece_index_t (piece),
+        libtorrent::top_priority));
+    g_array_append_val (thiz->raised_pieces, piece);
+  }
+  gst_bt_demux_stream_pin_window (thiz, demux);
 
+  g_static_rec_mutex_unlock (thiz->lock);//********************************************************
 
-              printf("(bt_demux_stream_activate) Activating stream '%s', start: (%d), start_offset: %d, end: %d, end_offset: %d, current: (%d) buffering(%s)\n", 
-                                GST_PAD_NAME (thiz), thiz->start_piece, thiz->start_offset, thiz->end_piece, thiz->end_offset, thiz->current_piece,
-                                thiz->buffering_count>0 ? "Yes" : "No");
-
+  if (piece_matrix)
+  {
+    gst_bt_bitset_unref (piece_matrix);
+  }
 
-  } else {
-    printf ("(bt_demux_stream_activate) failed clear cur_buffering_flags \n");
+  if (!prios.empty ())
+  {
+                  printf ("(bt_demux_stream_raise_window) %s: %d pieces raised in [%d,%d]\n",
+                      GST_PAD_NAME (thiz), (int) prios.size (), start, end);
+    h.prioritize_pieces (prios);
   }
+}
 
-printf("(bt_demux_stream_activate) unlock\n");
-  g_static_rec_mutex_unlock (thiz->lock);//********************************************************************************
 
+/* Trick mode half of apply_seek, called with the stream lock held: the pieces of the
+ * next TRICKMODE_AHEAD keyframes go to top_priority, the other pieces this stream
+ * raised back to their idle priority, nothing else of the file is asked for meanwhile */
+static void
+gst_bt_demux_stream_raise_keyframes (GstBtDemuxStream * thiz, GstBtDemux * demux,
+    libtorrent::torrent_handle h)
+{
+  std::vector<std::pair<libtorrent::piece_index_t, libtorrent::download_priority_t> > prios;
+  std::set<int> wanted;
+  GstBtBitset *piece_matrix = NULL;
+  gint next = thiz->trick_next;
+  guint i, kept = 0;
+
+  GST_OBJECT_LOCK (demux);
+  if (demux->piece_matrix)
+  {
+    piece_matrix = gst_bt_bitset_ref (demux->piece_matrix);
+  }
+  GST_OBJECT_UNLOCK (demux);
 
-  // GstTaskState tstate = gst_pad_get_task_state (GST_PAD_CAST (thiz));  
-  //   printf ("(bt_demux_stream_activate) pad task state is %d \n", (int)tstate);
+  for (int n = 0; n < TRICKMODE_AHEAD && next >= 0 && next < (gint) thiz->keyframes->len; n++)
+  {
+    GstBtKeyframe *kf = &g_array_index (thiz->keyframes, GstBtKeyframe, next);
+    gint64 start = thiz->start_byte_global + kf->offset;
+    gint64 end = start + kf->size - 1;
 
-  return ret;
-}
+    for (gint64 piece = start / demux->piece_length; piece <= end / demux->piece_length; piece++)
+    {
+      wanted.insert ((int) piece);
+    }
+    next = gst_bt_demux_stream_trick_step (thiz, next);
+  }
 
+  for (i = 0; i < thiz->raised_pieces->len; i++)
+  {
+    int piece = g_array_index (thiz->raised_pieces, gint, i);
 
+    //still wanted and already raised
+    if (wanted.erase (piece))
+    {
+      g_array_index (thiz->raised_pieces, gint, kept++) = piece;
+      continue;
+    }
+    if (piece_matrix && gst_bt_bitset_get (piece_matrix, piece))
+    {
+      continue;
+    }
+    prios.push_back (std::make_pair (libtorrent::piece_index_t (piece),
+        gst_bt_demux_idle_priority (demux, piece)));
+  }
+  g_array_set_size (thiz->raised_pieces, kept);
 
+  for (int piece : wanted)
+  {
+    if (piece_matrix && gst_bt_bitset_get (piece_matrix, piece))
+    {
+      continue;
+    }
+    prios.push_back (std::make_pair (libtorrent::piece_index_t (piece),
+        libtorrent::top_priority));
+    g_array_append_val (thiz->raised_pieces, piece);
+  }
 
+  if (piece_matrix)
+  {
+    gst_bt_bitset_unref (piece_matrix);
+  }
 
+  if (!prios.empty ())
+  {
+                  printf ("(bt_demux_stream_raise_keyframes) from keyframe %d, %d priorities changed\n",
+                      thiz->trick_next, (int) prios.size ());
+    h.prioritize_pieces (prios);
+  }
+}
 
 
-/*init the BtDemuxStream */
+/* Second half of a seek, on the alert thread: the seek event only moved the segment,
+ * here the stale priorities go away and the new window is activated and read, or
+ * buffered. However many seeks came meanwhile, only the latest one is applied */
 static void
-gst_bt_demux_stream_info (GstBtDemuxStream * thiz,
-    libtorrent::torrent_handle h, gint * start_offset,
-    gint * start_piece, gint * end_offset, gint * end_piece,
-    gint64 * size, gint64 * start_byte, gint64 * end_byte)
+gst_bt_demux_stream_apply_seek (GstBtDemuxStream * thiz, GstBtDemux * demux,
+    libtorrent::torrent_handle h)
 {
-  using namespace libtorrent;
-  file_entry fe;
-  int piece_length;
-  torrent_info ti = h.get_torrent_info ();
-
-  piece_length = ti.piece_length ();
-  fe = ti.file_at (thiz->file_idx);
-
-
-  // fe.offset -- the offset of this file inside the torrent 
-  // fe.size -- the size of the file (in bytes) 
+  gboolean update_buffering;
 
+  g_static_rec_mutex_lock (thiz->lock);//********************************************************************************
 
-  // this file starts in `start_piece`th piece within the torrent
-  // conversely, fe.offest = start_piece * piece_length + start_offset, start_piece value is >= 0, 
-  // must not increment one on start_piece before multiply it piece_length
-  if (start_piece)
+  if (!thiz->seek_pending)
   {
-    *start_piece = fe.offset / piece_length;
+    g_static_rec_mutex_unlock (thiz->lock);
+    return;
   }
+  thiz->seek_pending = FALSE;
 
-
-  // the number of bytes  whom this file starts after in its `start piece` 
-  if (start_offset)
+  //only the keyframes ahead are wanted, push_loop reads them itself
+  if (thiz->trickmode)
   {
-    *start_offset = fe.offset % piece_length;
+    if (thiz->seek_was_buffering)
+    {
+      gst_bt_demux_post_buffering (demux, thiz, 100);
+    }
+    thiz->seek_was_buffering = FALSE;
+
+    gst_bt_demux_stream_raise_keyframes (thiz, demux, h);
+    g_static_rec_mutex_unlock (thiz->lock);
+    return;
   }
 
+  gst_bt_demux_stream_reset_raised (thiz, demux, h, thiz->start_piece,
+      thiz->start_piece + demux->buffer_pieces - 1);
 
-  // this file ends at `end_piece`th piece within the torrent
-  if (end_piece)
-  {
-    *end_piece = (fe.offset + fe.size) / piece_length;
-  }
+  /* activate stream */
+  update_buffering = gst_bt_demux_stream_activate (thiz, h,
+      demux->buffer_pieces);
+  gst_bt_demux_stream_pin_window (thiz, demux);
 
 
-  // the number of bytes past the  `end_piece`
-  if (end_offset)
+  //area we seeking to do no need to buffer
+  if (!update_buffering) 
   {
-    *end_offset = (fe.offset + fe.size) % piece_length;
-  }
+                              printf("(bt_demux_stream_apply_seek) Starting SEEK stream '%s', reading piece %d, current: %d buffering(No) \n", 
+                              GST_PAD_NAME (thiz), thiz->start_piece, thiz->current_piece);
+
+    // When seek from area needing buffering to already-downloaded area
+    // We should tell bvw via posting buffering level 100% to show buffering finished,
+    // So it will not blocked on paused state even if we truly hold those piece
+    if (thiz->seek_was_buffering)
+    {
+                              printf ("(bt_demux_stream_apply_seek) transition from buffering to non-buffering area, send buffering level 100 to bvw \n");
 
+      gst_bt_demux_post_buffering (demux, thiz, 100);
+    }
 
-  if (size)
+    thiz->buffering = FALSE;
+
+    //we must already have this piece before we call `read_piece`
+    //**fire the read on start_piece, the rest will follow automatically, like a chain reaction, or domino effect
+    gst_bt_demux_read_piece (demux, h, thiz->start_piece);
+  } 
+  //area we seeking to do need to buffer
+  else 
   {
-    *size = fe.size;
+                              printf("(bt_demux_stream_apply_seek) Starting SEEK stream '%s' go update buffering, start:%d, current:%d, buffering(Yes) \n", 
+                                                            GST_PAD_NAME (thiz), 
+                                                            thiz->start_piece, 
+                                                            thiz->current_piece);
+
+            gst_bt_demux_stream_update_buffering (thiz, demux, demux->buffer_pieces);
+
+            //If buffering is cleared, we need to set it,to avoid that when piece_finished_alerts received, we cannot updating buffering level
+            if(thiz->buffering == FALSE)
+            {
+              thiz->buffering = TRUE;
+            }
   }
+  thiz->seek_was_buffering = FALSE;
+
+  g_static_rec_mutex_unlock (thiz->lock);//********************************************************
 
 
-  if (start_byte)
+  /* send the buffering if we need to */
+  if (update_buffering)
   {
-    *start_byte = fe.offset; 
+    gst_bt_demux_send_buffering (demux, h);
   }
+}
 
 
-  if (end_byte)
+/* Seek with GST_SEEK_FLAG_TRICKMODE_KEY_UNITS or a negative rate, called with the stream
+ * lock held once the keyframe index is there. TIME and BYTES positions both work, the
+ * keyframes are pushed from the one at or before start, or stop when going backwards
+ * (the end of the file if unset) */
+static void
+gst_bt_demux_stream_trick_seek (GstBtDemuxStream * thiz, GstBtDemux * demux,
+    gdouble rate, GstFormat format, gint64 start, gint64 stop)
+{
+  gint64 position = rate < 0.0 ? stop : start;
+  gint i;
+
+  if (position < 0)
   {
-    *end_byte = fe.offset + fe.size;
+    i = rate < 0.0 ? (gint) thiz->keyframes->len - 1 : 0;
+  }
+  else if (format == GST_FORMAT_TIME)
+  {
+    i = gst_bt_mp4_keyframes_find_time (thiz->keyframes, position);
+  }
+  else
+  {
+    i = gst_bt_mp4_keyframes_find_offset (thiz->keyframes, position);
   }
 
-}
+                                        printf ("(bt_demux_stream_trick_seek) rate:%lf, from keyframe %d of %d\n",
+                                            rate, i, (int) thiz->keyframes->len);
 
+  thiz->trickmode = TRUE;
+  thiz->rate = rate;
+  thiz->trick_next = i;
 
+  //any piece of the file may hold a keyframe, let their alerts through
+  thiz->start_byte = thiz->start_byte_global;
+  thiz->end_byte = thiz->end_byte_global;
+  thiz->start_piece = thiz->start_byte / demux->piece_length;
+  thiz->start_offset = thiz->start_byte % demux->piece_length;
+  thiz->end_piece = thiz->end_byte / demux->piece_length;
+  thiz->end_offset = thiz->end_byte % demux->piece_length;
+
+  thiz->seek_was_buffering |= thiz->buffering;
+  thiz->buffering = FALSE;
+  thiz->buffering_level = 0;
+  thiz->buffering_count = 0;
+  thiz->seek_pending = TRUE;
+}
 
 
 static gboolean
@@ -1147,7 +3296,6 @@ gst_bt_demux_stream_seek (GstBtDemuxStream * thiz, GstEvent * event)
   torrent_handle h;
   session *s;
   int piece_length;
-  gboolean update_buffering;
   gboolean ret = FALSE;
 
 
@@ -1179,6 +3327,104 @@ gst_bt_demux_stream_seek (GstBtDemuxStream * thiz, GstEvent * event)
       &start, &stop_type, &stop);
 
 
+  //the rate changes in place, nothing is flushed nor read again: the elements downstream
+  //apply it relative to the rate of the current segment, we only resize the read-ahead
+  if (flags & GST_SEEK_FLAG_INSTANT_RATE_CHANGE)
+  {
+    GstEvent *rate_change;
+
+    thiz->is_user_seek = FALSE;
+
+    //the direction can't change in place, neither can the keyframe pacing of a trick mode
+    if (thiz->trickmode || rate == 0.0 || (rate < 0.0) != (thiz->rate < 0.0))
+    {
+                      printf("(bt_demux_stream_seek) instant rate change to %lf refused \n", rate);
+      return ret;
+    }
+
+                      printf("(bt_demux_stream_seek) instant rate change to %lf, segment rate %lf \n", rate, thiz->rate);
+
+    rate_change = gst_event_new_instant_rate_change (rate / thiz->rate, GST_SEGMENT_FLAG_NONE);
+    gst_event_set_seqnum (rate_change, gst_event_get_seqnum (event));
+    gst_pad_push_event (GST_PAD (thiz), rate_change);
+
+    gst_bt_demux_scale_window (demux, rate);
+    return TRUE;
+  }
+
+
+  //key units only or backwards, fetch and push nothing but the keyframes
+  if ((flags & GST_SEEK_FLAG_TRICKMODE_KEY_UNITS) || rate < 0.0)
+  {
+    gboolean have_index;
+
+    g_static_rec_mutex_lock (thiz->lock);
+    have_index = (format == GST_FORMAT_TIME || format == GST_FORMAT_BYTES) &&
+        gst_bt_demux_stream_ensure_keyframes (thiz, demux);
+    g_static_rec_mutex_unlock (thiz->lock);
+
+    if (have_index)
+    {
+      GstBtDemuxBufferData *wakeup;
+
+      if (flags & GST_SEEK_FLAG_FLUSH) 
+      {
+                                        printf("(bt_demux_stream_seek) trick mode, push flush_start \n");
+        gst_bt_demux_stream_set_flushing (thiz, TRUE);
+        gst_pad_push_event (GST_PAD (thiz), gst_event_new_flush_start ());
+        thiz->flush_start_sent = TRUE;
+      }
+
+      g_static_rec_mutex_lock (thiz->lock);
+      //out of a segment seek loop too, no SEGMENT_DONE and the reads go on
+      thiz->segment_seek = FALSE;
+      thiz->segment_done = FALSE;
+      gst_bt_demux_stream_trick_seek (thiz, demux, rate, format, start, stop);
+      g_static_rec_mutex_unlock (thiz->lock);
+
+      if (demux->piece_cache)
+      {
+        //out of the loop, its pieces go back to the LRU
+        gst_bt_demux_piece_cache_pin_loop ((GstBtDemuxPieceCache *) demux->piece_cache,
+            -1, -1, demux->piece_length);
+      }
+
+      //the pieces queued for the normal playback are of no use now, and push_loop may
+      //be waiting for more of them
+      gst_bt_demux_stream_drop_queued (thiz, demux);
+      wakeup = g_new0 (GstBtDemuxBufferData, 1);
+      wakeup->piece = TRICKMODE_WAKEUP_PIECE;
+      g_async_queue_push (thiz->ipc, wakeup);
+      gst_bt_demux_stream_wake (thiz);
+
+      if (gst_pad_is_active (GST_PAD (thiz)))
+      {
+        gst_bt_demux_stream_set_flushing (thiz, FALSE);
+#if HAVE_GST_1
+        gst_pad_start_task (GST_PAD (thiz), gst_bt_demux_stream_push_loop,
+            thiz, NULL);
+#else
+        gst_pad_start_task (GST_PAD (thiz), gst_bt_demux_stream_push_loop,
+            thiz);
+#endif
+      }
+
+      g_atomic_int_set (&demux->seek_pending, TRUE);
+      thiz->is_user_seek = FALSE;
+      return TRUE;
+    }
+
+                      printf("(bt_demux_stream_seek) no keyframe index (yet) for a trick mode seek \n");
+
+    //without the index going backwards is not possible, key units forward is a normal seek
+    if (rate < 0.0)
+    {
+      thiz->is_user_seek = FALSE;
+      return ret;
+    }
+  }
+
+
   /* sanitize stuff */
   if (format != GST_FORMAT_BYTES)
   {
@@ -1242,19 +3488,14 @@ return ret;
   if (flags & GST_SEEK_FLAG_FLUSH) 
   {
                                         printf("(bt_demux_stream_seek) push flush_start \n");
+    gst_bt_demux_stream_set_flushing (thiz, TRUE);
     gst_pad_push_event (GST_PAD (thiz), gst_event_new_flush_start ());
         
     thiz->flush_start_sent = TRUE;
   } 
-  else 
-  {
-    /* TODO we need to close the segment */
-  }
-
-  if (flags & GST_SEEK_FLAG_SEGMENT) 
-  {
-    GST_ERROR ("Segment seek");
-  }
+  //non-flushing: there is no closing segment since 1.0, the new one simply follows the data
+  //pushed so far, push_loop drops what is still queued for the old position (current_piece
+  //moves below) and sends the new segment first, restarted by the read of its first piece
 
     
 
@@ -1268,137 +3509,55 @@ printf("(bt_demux_stream_seek) recovery lock (%d)\n", start_piece);
 
       thiz->end_piece = (thiz->start_byte_global + stop) / piece_length;
       thiz->end_offset =  (thiz->start_byte_global + stop) % piece_length; 
-   
-
-      //update thiz->strat_piece, so push_loop can know 
-      thiz->start_piece = (thiz->start_byte_global + start) / piece_length;
-      thiz->start_offset = (thiz->start_byte_global + start) % piece_length;
-    
-
-printf ("(bt_demux_stream_seek) fileidx(%d) start_byte_global = %d\n", 
-        thiz->file_idx, 
-        thiz->start_byte_global);
-
-      
-      //byte position within the torrent
-      thiz->end_byte = thiz->start_byte_global + stop;
-      thiz->start_byte = thiz->start_byte_global + start;
-
-
-      // GST_DEBUG_OBJECT (thiz, "Seeking to, start: %d, start_offset: %d, end: %d, "
-      //     "end_offset: %d", thiz->start_piece, thiz->start_offset,
-      //     thiz->end_piece, thiz->end_offset);
-
-
-
-                                        printf("(bt_demux_stream_seek) Seeking to, start:%d, start_offset:%d, end:%d, end_offset:%d, start_byte%ld,end_byte%ld \n", 
-                                            thiz->start_piece, thiz->start_offset, thiz->end_piece, thiz->end_offset, thiz->start_byte, thiz->end_byte);
-
-
-  //before activate, set previous already activated three-piece-area as default_priority 
-  int old_start = thiz->current_piece + 1;
-  int old_end = thiz->current_piece + demux->buffer_pieces;
-  
-  /* do not exceeds piece boundry */
-  if (old_start >= thiz->end_piece) {
-    old_start = thiz->end_piece;
-    old_end = thiz->end_piece;
-  }
-  if (old_end > thiz->end_piece) {
-    old_end = thiz->end_piece;
-  }
-  
-  //only when the 3-Piece-Area not identical, we do the priority replacement
-  if (thiz->start_piece != old_start) 
-  {
-                  printf ("(bt_demux_stream_seek) before activate, clear previous Three-Piece-Area [%d,%d]\n",
-                  old_start,
-                  old_end);
-
-    int i;
-    for (i = old_start; i <= old_end; i++) 
-    {
-      libtorrent::download_priority_t priority;
-      priority = h.piece_priority (i);
-
-      if (h.have_piece (i))
-      {
-        continue;
-      }
-      if (priority == libtorrent::default_priority)
-      {
-        continue;
-      }
-      if (!h.have_piece (i) && priority == libtorrent::low_priority)
-      {
-        continue;
-      }
-      if ( !h.have_piece (i) && priority==libtorrent::top_priority ) {
-              printf ("(bt_demux_stream_seek) piece %d previously set at top prio,we got a seek ,so set it to default prio\n", i);
-        h.piece_priority (i, libtorrent::default_priority);
-      }
-    }
-  }
-
-
-
-  /* activate stream */
-  update_buffering = gst_bt_demux_stream_activate (thiz, h,
-      demux->buffer_pieces);
-
-
-  //area we seeking to do no need to buffer
-  if (!update_buffering) 
-  {
-    /* start directly */
-    // GST_DEBUG_OBJECT (thiz, "SEEK:Starting stream '%s', reading piece %d, "
-    //     "current: %d", GST_PAD_NAME (thiz), thiz->start_piece,
-    //     thiz->current_piece);
+   
 
-                              printf("(bt_demux_stream_seek) Starting SEEK stream '%s', reading piece %d, current: %d buffering(No) \n", 
-                              GST_PAD_NAME (thiz), thiz->start_piece, thiz->current_piece);
+      //update thiz->strat_piece, so push_loop can know 
+      thiz->start_piece = (thiz->start_byte_global + start) / piece_length;
+      thiz->start_offset = (thiz->start_byte_global + start) % piece_length;
+    
 
-    gboolean old_buffering = thiz->buffering;
+printf ("(bt_demux_stream_seek) fileidx(%d) start_byte_global = %d\n", 
+        thiz->file_idx, 
+        thiz->start_byte_global);
 
-    // When seek from area needing buffering to already-downloaded area
-    // We should tell bvw via posting buffering level 100% to show buffering finished,
-    // So it will not blocked on paused state even if we truly hold those piece
-    if (old_buffering == TRUE)
-    {
+      
+      //byte position within the torrent
+      thiz->end_byte = thiz->start_byte_global + stop;
+      thiz->start_byte = thiz->start_byte_global + start;
 
-                              printf ("(bt_demux_stream_seek) transition from buffering to non-buffering area, send buffering level 100 to bvw \n");
 
-      gst_element_post_message (GST_ELEMENT_CAST (demux),
-      gst_message_new_buffering (GST_OBJECT_CAST (demux), 100));
-    }
+      // GST_DEBUG_OBJECT (thiz, "Seeking to, start: %d, start_offset: %d, end: %d, "
+      //     "end_offset: %d", thiz->start_piece, thiz->start_offset,
+      //     thiz->end_piece, thiz->end_offset);
 
-    thiz->buffering = FALSE;
 
-                              printf("(bt_demux_stream_seek) call read_piece() on piece %d\n",
-                                                                  thiz->start_piece);
-    //we must already have this piece before we call `read_piece`
-    //**fire the read on start_piece, the rest will follow automatically, like a chain reaction, or domino effect
-    h.read_piece (thiz->start_piece);
-  } 
-  //area we seeking to do need to buffer
-  else 
-  {
 
-                              printf("(bt_demux_stream_seek) Starting SEEK stream '%s' go update buffering, start:%d, current:%d, buffering(Yes) \n", 
-                                                            GST_PAD_NAME (thiz), 
-                                                            thiz->start_piece, 
-                                                            thiz->current_piece);
+                                        printf("(bt_demux_stream_seek) Seeking to, start:%d, start_offset:%d, end:%d, end_offset:%d, start_byte%ld,end_byte%ld \n", 
+                                            thiz->start_piece, thiz->start_offset, thiz->end_piece, thiz->end_offset, thiz->start_byte, thiz->end_byte);
 
-            gst_bt_demux_stream_update_buffering (thiz, h, demux->buffer_pieces);
 
-            //If buffering is cleared, we need to set it,to avoid that when piece_finished_alerts received, we cannot updating buffering level
-            if(thiz->buffering == FALSE)
-            {
-              thiz->buffering = TRUE;
-            }
+  //newer seek replacing one the alert thread has not applied yet, only the latest target counts
+  if (thiz->seek_pending)
+  {
+                                        printf ("(bt_demux_stream_seek) replacing a pending seek target\n");
+  }
 
+  //move the window right away, so the reads still in flight for the abandoned target
+  //and its finished pieces are ignored, the alert thread does the rest
+  thiz->seek_was_buffering |= thiz->buffering;
+  thiz->trickmode = FALSE;
+  thiz->rate = rate;
+  thiz->current_piece = thiz->start_piece - 1;
+  thiz->buffering = FALSE;
+  thiz->buffering_level = 0;
+  thiz->buffering_count = 0;
+  thiz->seek_pending = TRUE;
 
-  }
+  //a segment seek ends with a SEGMENT_DONE, see gst_bt_demux_stream_segment_done ()
+  thiz->segment_seek = (flags & GST_SEEK_FLAG_SEGMENT) != 0;
+  thiz->segment_done = FALSE;
+  thiz->segment_seqnum = gst_event_get_seqnum (event);
+  thiz->segment_start_piece = thiz->start_piece;
 
   if(thiz->moov_after_mdat)
   {
@@ -1411,17 +3570,30 @@ printf ("(bt_demux_stream_seek) fileidx(%d) start_byte_global = %d\n",
     ret = TRUE;
   }
 
+  start_piece = thiz->start_piece;
 
 printf("(bt_demux_stream_seek) unlock lock (%d)\n", start_piece);
   g_static_rec_mutex_unlock (thiz->lock);//********************************************************
 
+  if (flags & GST_SEEK_FLAG_SEGMENT)
+  {
+    GstMessage *segment_start = gst_message_new_segment_start (GST_OBJECT_CAST (demux),
+        GST_FORMAT_BYTES, start);
 
-  /* send the buffering if we need to */
-  if (update_buffering)
+    gst_message_set_seqnum (segment_start, gst_event_get_seqnum (event));
+    gst_element_post_message (GST_ELEMENT_CAST (demux), segment_start);
+  }
+  else if (demux->piece_cache)
   {
-    gst_bt_demux_send_buffering (demux, h);
+    //out of the loop, its pieces go back to the LRU
+    gst_bt_demux_piece_cache_pin_loop ((GstBtDemuxPieceCache *) demux->piece_cache,
+        -1, -1, piece_length);
   }
 
+  gst_bt_demux_scale_window (demux, rate);
+  gst_bt_demux_queue_drop_deferred (demux, start_piece, start_piece + demux->buffer_pieces - 1);
+  g_atomic_int_set (&demux->seek_pending, TRUE);
+
   //reset
   thiz->is_user_seek = FALSE;
 
@@ -1595,6 +3767,24 @@ gst_bt_demux_stream_dispose (GObject * object)
     g_array_free (thiz->cur_buffering_flags, TRUE);
   }
 
+  if (thiz->raised_pieces)
+  {
+    g_array_free (thiz->raised_pieces, TRUE);
+    thiz->raised_pieces = NULL;
+  }
+
+  if (thiz->keyframes)
+  {
+    g_array_free (thiz->keyframes, TRUE);
+    thiz->keyframes = NULL;
+  }
+
+  g_mutex_lock (&thiz->ready_lock);
+  gst_bt_demux_stream_forget_downstream (thiz);
+  g_mutex_unlock (&thiz->ready_lock);
+  g_cond_clear (&thiz->ready_cond);
+  g_mutex_clear (&thiz->ready_lock);
+
 
   g_static_rec_mutex_free (thiz->lock);
   g_free (thiz->lock);
@@ -1653,6 +3843,21 @@ gst_bt_demux_stream_init (GstBtDemuxStream * thiz)
 
   thiz->cur_buffering_flags = NULL;
 
+  g_mutex_init (&thiz->ready_lock);
+  g_cond_init (&thiz->ready_cond);
+  thiz->downstream_linked = FALSE;
+  thiz->have_type = FALSE;
+  thiz->ready_flushing = FALSE;
+  thiz->ready_cookie = 0;
+  thiz->typefind = NULL;
+  thiz->have_type_id = 0;
+  thiz->ghost_internal = NULL;
+  thiz->ghost_linked_id = 0;
+  g_signal_connect (thiz, "linked",
+      G_CALLBACK (gst_bt_demux_stream_linked_cb), NULL);
+  g_signal_connect (thiz, "unlinked",
+      G_CALLBACK (gst_bt_demux_stream_unlinked_cb), NULL);
+
   /* our ipc */
   thiz->ipc = g_async_queue_new_full (
       (GDestroyNotify) gst_bt_demux_buffer_data_free);
@@ -1676,6 +3881,21 @@ enum {
   PROP_TEMP_LOCATION,
   PROP_PIECE_MATRIX,
   PROP_TEMP_REMOVE,
+  PROP_PIECE_CACHE_SIZE,
+  PROP_MAX_QUEUED_BYTES,
+  PROP_MAX_QUEUED_PIECES,
+  PROP_QUEUED_BYTES,
+  PROP_STATS,
+  PROP_PPI_SUBSCRIBE,
+  PROP_PPI_INTERVAL,
+  PROP_TELEMETRY_LEVEL,
+  PROP_STREAM_LAYOUT,
+  PROP_PREFETCH_OFFSET,
+  PROP_INFO_HASH,
+  PROP_STREAM_OFFSET,
+  PROP_HOTSPOT_COUNT,
+  PROP_HOTSPOT_SKIPS,
+  PROP_HOTSPOT_SHARE,
 };
 
 enum
@@ -1683,6 +3903,8 @@ enum
   // SIGNAL_GET_STREAM_TAGS,
   SIGNAL_STREAMS_CHANGED,
   SIGNAL_GET_PPI,
+  SIGNAL_KEYFRAME_OFFSET,
+  SIGNAL_KEYFRAME_TIME,
   LAST_SIGNAL
 };
 
@@ -1730,6 +3952,82 @@ gst_bt_demux_sink_chain (GstPad * pad, GstObject * object,
 
 
 
+/* Compute the initial priorities before the torrent is added, instead of one
+ * synchronous h.piece_priority() call per piece once add_torrent_alert comes:
+ * the pieces of the videos start at low_priority, everything else at dont_download,
+ * and the Three-Piece-Area of the video most likely to be played first (the one
+ * requested already, or the first video) is at top_priority right away.
+ * Its last piece goes to PREFETCH_PRIORITY: files not written for streaming keep
+ * their index (moov) at the end, and qtdemux asks for it before anything plays,
+ * a resume position included */
+static void
+gst_bt_demux_initial_priorities (GstBtDemux * thiz, libtorrent::add_torrent_params & atp)
+{
+  using namespace libtorrent;
+  file_storage const & fs = atp.ti->files ();
+  int piece_length = atp.ti->piece_length ();
+  int num_pieces = atp.ti->num_pieces ();
+  int first_video = -1;
+  int i;
+
+  atp.file_priorities.assign (fs.num_files (), dont_download);
+  atp.piece_priorities.assign (num_pieces, dont_download);
+
+  for (i = 0; i < fs.num_files (); i++)
+  {
+    std::string path = fs.file_path (file_index_t (i));
+    std::int64_t offset = fs.file_offset (file_index_t (i));
+    std::int64_t size = fs.file_size (file_index_t (i));
+    int p;
+
+    if (!g_str_has_suffix (path.c_str (), ".mp4") || size <= 0)
+    {
+      continue;
+    }
+
+    atp.file_priorities[file_index_t (i)] = low_priority;
+    for (p = offset / piece_length; p <= (offset + size - 1) / piece_length; p++)
+    {
+      atp.piece_priorities[piece_index_t (p)] = low_priority;
+    }
+
+    if (first_video == -1 || i == thiz->cur_streaming_fileidx)
+    {
+      first_video = i;
+    }
+  }
+
+  if (first_video != -1)
+  {
+    std::int64_t offset = fs.file_offset (file_index_t (first_video));
+    std::int64_t size = fs.file_size (file_index_t (first_video));
+    int start = offset / piece_length;
+    int end = start + thiz->buffer_pieces - 1;
+    int last = (offset + size - 1) / piece_length;
+    int p;
+
+    if (end > last)
+    {
+      end = last;
+    }
+
+                  printf ("(gst_bt_demux_initial_priorities) fileidx %d window [%d,%d] at top_priority\n",
+                      first_video, start, end);
+
+    for (p = start; p <= end; p++)
+    {
+      atp.piece_priorities[piece_index_t (p)] = top_priority;
+    }
+
+    if (last > end)
+    {
+      atp.piece_priorities[piece_index_t (last)] =
+          download_priority_t (PREFETCH_PRIORITY);
+    }
+  }
+}
+
+
 //this function called once btdemux change state READY to PAUSED
 //it seems way too redundant that every time you switch to another item in playlist within torrent
 //this function called again to read the .torrent file and async_add_torrent on session
@@ -1830,6 +4128,7 @@ gst_bt_demux_sink_event (GstPad * pad, GstObject * object,
     atp.ti = std::make_shared<libtorrent::torrent_info>(reinterpret_cast<char const*>(data), len);
     atp.save_path = thiz->temp_location;
           printf("(gst_bt_demux_sink_event) atp.save_path = %s \n", thiz->temp_location);
+    gst_bt_demux_initial_priorities (thiz, atp);
     session->async_add_torrent (std::move(atp));
 
             printf("(gst_bt_demux_sink_event) libtorrent async_add_torrent called \n");
@@ -1922,12 +4221,13 @@ gst_bt_demux_sink_event_simple (GstPad * pad, GstEvent * event)
 static DownloadingBlocksSd*
 gst_bt_demux_get_ppi (GstBtDemux * thiz)
 {
-  if (!thiz->ppi_queue)
+  DownloadingBlocksSd *sd = NULL;
+
+  if (!thiz->session)
   {
     return NULL;
   }
 
-
   /* get torernt_handle */
   using namespace libtorrent;
   session* s;
@@ -1943,74 +4243,90 @@ gst_bt_demux_get_ppi (GstBtDemux * thiz)
   if (!h.is_valid()) 
   {
     printf ("(gst_bt_demux_get_ppi) torrent handle is invalid \n");
+    return NULL;
   }
 
-
-  gint sz = g_async_queue_length (thiz->ppi_queue);
-  if (!sz)
+  //hand out the latest published snapshot by reference, no copy
+  g_mutex_lock (&thiz->ppi_lock);
+  if (thiz->ppi_front)
   {
-    printf ("(gst_bt_demux_get_ppi) empty, post one\n");
-    h.post_download_queue ();
-    return NULL;
+    sd = downloading_blocks_sd_ref (thiz->ppi_front);
   }
-  
+  g_mutex_unlock (&thiz->ppi_lock);
 
-  // printf ("(gst_bt_demux_get_ppi) %d\n", sz);
-  
-  /*************************************************Populating Data**********************************************************/
-            gpointer opaque = g_async_queue_pop (thiz->ppi_queue);
+  //ask for the next one, published when piece_info_alert comes
+  h.post_download_queue ();
 
-            //`partial_piece_info` holds information about pieces that have outstanding requests or outstanding writes
-            std::vector<libtorrent::partial_piece_info>* ppi = static_cast<std::vector<libtorrent::partial_piece_info>*>(opaque);
+  return sd;
+}
 
-            DownloadingBlocksSd *downloading_blocks_sd = (DownloadingBlocksSd*) g_malloc0 (sizeof (DownloadingBlocksSd));
 
-            downloading_blocks_sd->array = (DownloadingBlocks*) g_malloc0 (sizeof (DownloadingBlocks) * ppi->size ());
-            downloading_blocks_sd->size = ppi->size ();
-            gint item_idx = 0;
+/* The keyframe of the requested stream at or before time, or with no time at or
+ * before offset. Only from an index built already, these are looked up from the
+ * main thread. FALSE without one */
+static gboolean
+gst_bt_demux_find_keyframe (GstBtDemux * thiz, GstClockTime time, gint64 offset,
+    GstBtKeyframe * keyframe)
+{
+  gboolean found = FALSE;
+  GSList *walk;
 
-            for (libtorrent::partial_piece_info const& item : *ppi)
-            {
-                // piece_index
-                gint p_idx = static_cast<int> (item.piece_index);
-                downloading_blocks_sd->array[item_idx].piece_index = p_idx;
+  g_mutex_lock (thiz->streams_lock);
+  for (walk = thiz->streams; walk; walk = g_slist_next (walk))
+  {
+    GstBtDemuxStream *stream = GST_BT_DEMUX_STREAM (walk->data);
 
-                downloading_blocks_sd->array[item_idx].blocks_progress = (guint8*) g_malloc0 (sizeof (guint8) * item.blocks_in_piece);
-                for ( gint i=0;i <item.blocks_in_piece;i++ )
-                {
-                    if(item.blocks[i].bytes_progress > 0 && item.blocks[i].block_size > 0
-                      && item.blocks[i].state == libtorrent::block_info::requested)
-                    {
-                      static guint8 const scale_progress[] = {0, 20, 40, 60, 80};
-                      //avoid divided by zero error
-                      gint scale = scale_progress[item.blocks[i].bytes_progress * 5 /item.blocks[i].block_size ];
-                      downloading_blocks_sd->array[item_idx].blocks_progress[i] = static_cast<guint8>(scale); 
-                    }
-                    else if(item.blocks[i].state == libtorrent::block_info::finished 
-                    || item.blocks[i].state == libtorrent::block_info::writing)
-                    {
-                      downloading_blocks_sd->array[item_idx].blocks_progress[i] = 100; 
-                    }
-                    else if (item.blocks[i].block_size==0 )
-                    {
-                      // printf ("(diide by zero) %d %d %d \n", i, item.blocks[i].bytes_progress, item.blocks[i].block_size);
-                    }
-                }   
-                item_idx++;
-            }
+    if (!stream->requested)
+      continue;
+
+    g_static_rec_mutex_lock (stream->lock);
+    if (stream->keyframes && stream->keyframes->len > 0)
+    {
+      gint i = GST_CLOCK_TIME_IS_VALID (time) ?
+          gst_bt_mp4_keyframes_find_time (stream->keyframes, time) :
+          gst_bt_mp4_keyframes_find_offset (stream->keyframes, offset);
+
+      *keyframe = g_array_index (stream->keyframes, GstBtKeyframe, i);
+      found = TRUE;
+    }
+    g_static_rec_mutex_unlock (stream->lock);
+    break;
+  }
+  g_mutex_unlock (thiz->streams_lock);
 
-            if (ppi != NULL)
-              delete ppi;
+  return found;
+}
 
+/* "keyframe-offset": byte offset within the requested stream of the keyframe at or
+ * before time, -1 if the stream is not indexed (yet) */
+static gint64
+gst_bt_demux_keyframe_offset (GstBtDemux * thiz, GstClockTime time)
+{
+  GstBtKeyframe keyframe;
 
-            h.post_download_queue ();
+  if (!GST_CLOCK_TIME_IS_VALID (time) ||
+      !gst_bt_demux_find_keyframe (thiz, time, -1, &keyframe))
+  {
+    return -1;
+  }
 
-printf ("(first ppi addr %p) \n", downloading_blocks_sd);
+  return keyframe.offset;
+}
 
-            return downloading_blocks_sd;
+/* "keyframe-time": time of the keyframe at or before the byte offset within the
+ * requested stream, GST_CLOCK_TIME_NONE if the stream is not indexed (yet) */
+static GstClockTime
+gst_bt_demux_keyframe_time (GstBtDemux * thiz, gint64 offset)
+{
+  GstBtKeyframe keyframe;
 
-  /*************************************************************************************************************************/
+  if (offset < 0 ||
+      !gst_bt_demux_find_keyframe (thiz, GST_CLOCK_TIME_NONE, offset, &keyframe))
+  {
+    return GST_CLOCK_TIME_NONE;
+  }
 
+  return keyframe.time;
 }
 
 
@@ -2211,8 +4527,7 @@ printf("(gst_bt_demux_send_buffering) recovery lock (%d)\n", stream->current_pie
 
 
     //post buffering message , so bvw can know: when to pause and waiting?  when to resume playing after buffered enough?
-    gst_element_post_message (GST_ELEMENT_CAST (thiz),
-            gst_message_new_buffering (GST_OBJECT_CAST (thiz), stream->buffering_level));
+    gst_bt_demux_post_buffering (thiz, stream, stream->buffering_level);
 
 
     // For the only video we requested
@@ -2242,7 +4557,7 @@ printf("(gst_bt_demux_send_buffering) recovery lock (%d)\n", stream->current_pie
       
       // every time current_piece plus one, which guarantee the piece be pushed in order, 
       // aka. read_piece_alert retrieved in order, so push_loop can push in piece order
-      h.read_piece (stream->current_piece+1);
+      gst_bt_demux_read_piece (thiz, h, stream->current_piece+1);
     } 
     else
     {
@@ -2444,6 +4759,98 @@ gst_bt_demux_feed_videos_info (GstBtDemux * thiz)
 
 
 
+/* Streams are created lazily, the first time their file is requested, so startup
+ * and memory scale with the videos actually watched rather than the number of
+ * files in the torrent. Must be called with the streams lock held */
+static GstBtDemuxStream *
+gst_bt_demux_ensure_stream (GstBtDemux * thiz, libtorrent::torrent_handle h,
+    gint file_idx)
+{
+  GstBtDemuxPieceIndex *index = (GstBtDemuxPieceIndex *) thiz->piece_index;
+  GstBtDemuxFileRange *range = NULL;
+  GstBtDemuxStream *stream;
+  gchar *name;
+
+  for (GstBtDemuxFileRange & r : *index)
+  {
+    if (r.file_idx == file_idx)
+    {
+      range = &r;
+      break;
+    }
+  }
+
+  //not a playable file
+  if (!range)
+  {
+    return NULL;
+  }
+
+  if (range->stream)
+  {
+    return range->stream;
+  }
+
+  /* create the pads */
+  name = g_strdup_printf ("src_%02d", file_idx);
+
+  /* ..............initialize the streams -- source pad*/
+  stream = (GstBtDemuxStream *) g_object_new (
+      GST_TYPE_BT_DEMUX_STREAM, "name", name, "direction",
+      GST_PAD_SRC, "template", gst_static_pad_template_get (&src_factory), NULL);
+            printf ("(gst_bt_demux_ensure_stream) create src pad %s (aka.BtDemuxStream) \n",
+            name);
+  //Free after use
+  g_free (name);
+
+  /* set the file idx within torrent*/
+  stream->file_idx = file_idx;
+  stream->requested = FALSE;
+  stream->finished = FALSE;
+  stream->cur_buffering_flags = g_array_new (FALSE, FALSE, sizeof(gboolean));
+  stream->raised_pieces = g_array_new (FALSE, FALSE, sizeof (gint));
+  stream->seek_pending = FALSE;
+  stream->seek_was_buffering = FALSE;
+  stream->keyframes = NULL;
+  stream->keyframes_generation = G_MAXUINT64;
+  stream->trickmode = FALSE;
+  stream->rate = 1.0;
+  stream->trick_next = -1;
+  stream->segment_seek = FALSE;
+  stream->segment_done = FALSE;
+  stream->segment_seqnum = GST_SEQNUM_INVALID;
+  stream->segment_start_piece = -1;
+
+  /* set the path */
+  stream->path = g_strdup (range->path.c_str ());
+
+  gst_bt_demux_stream_info (stream, h, &stream->start_offset,
+      &stream->start_piece, &stream->end_offset, &stream->end_piece,
+      &stream->end_byte, &stream->start_byte, &stream->end_byte);
+
+  if (stream->start_byte)
+  {
+    stream->start_byte_global = stream->start_byte;
+  }
+  if (stream->end_byte)
+  {
+    stream->end_byte_global = stream->end_byte;
+  }
+
+  stream->last_piece = stream->end_piece;
+
+                          printf("(gst_bt_demux_ensure_stream) Adding stream %s for file %s at fileidx %d, start_piece:%d, start_ofset:%d,end_piece:%d,end_ofset:%d (%ld,%ld]\n",
+                              GST_PAD_NAME (stream), stream->path, stream->file_idx, stream->start_piece,
+                              stream->start_offset, stream->end_piece,stream->end_offset, stream->start_byte, stream->end_byte);
+
+  /* Append it to our list of streams */
+  thiz->streams = g_slist_append (thiz->streams, stream);
+  range->stream = stream;
+
+  return stream;
+}
+
+
 static void
 gst_bt_demux_switch_streams (GstBtDemux * thiz, gint desired_file_idx)
 {
@@ -2488,8 +4895,13 @@ gst_bt_demux_switch_streams (GstBtDemux * thiz, gint desired_file_idx)
         &stream->end_offset, &stream->end_piece,
         NULL, &stream->start_byte, &stream->end_byte);
   
+        //a loop left running on it ended with the switch
+        stream->segment_seek = FALSE;
+        stream->segment_done = FALSE;
+
         update_buffering = gst_bt_demux_stream_activate (stream, h,
           thiz->buffer_pieces);
+        gst_bt_demux_stream_pin_window (stream, thiz);
 
         printf("(gst_bt_demux_switch_streams) Switching to stream '%s', reading piece %d, current: %d, buffering(%s)\n", 
                     GST_PAD_NAME (stream), stream->start_piece, stream->current_piece, update_buffering?"Yes":"No");
@@ -2505,7 +4917,7 @@ gst_bt_demux_switch_streams (GstBtDemux * thiz, gint desired_file_idx)
           printf("(gst_bt_demux_switch_streams) call read_piece() on piece %d\n",
             stream->start_piece);
           //**fire the read on start_piece, the rest will follow automatically, like a chain reaction, or domino effect
-          h.read_piece (stream->start_piece);
+          gst_bt_demux_read_piece (thiz, h, stream->start_piece);
 
         }
     }
@@ -2567,61 +4979,410 @@ gst_bt_demux_switch_streams (GstBtDemux * thiz, gint desired_file_idx)
     
     }
 
-// printf("(gst_bt_demux_switch_streams) unlock lock \n");
-//     g_static_rec_mutex_unlock (stream->lock);
+// printf("(gst_bt_demux_switch_streams) unlock lock \n");
+//     g_static_rec_mutex_unlock (stream->lock);
+
+  }//End of for loop
+
+  // g_mutex_unlock (thiz->streams_lock);
+
+}
+
+
+
+
+
+
+
+
+
+
+/* libtorrent keeps its bitfields as MSB-first bytes, ours are LSB-first:
+ * copy them reversing the bits within every byte, a 32-bit word at a time */
+static void
+gst_bt_demux_bitfield_to_bytes (libtorrent::bitfield const& bf, guint8 * dst,
+    gsize n_bytes)
+{
+  guint8 const *src = reinterpret_cast<guint8 const *> (bf.data ());
+  gsize n = MIN (n_bytes, (gsize) bf.num_bytes ());
+  gsize i = 0;
+
+  for (; i + 4 <= n; i += 4)
+  {
+    guint32 w;
+
+    memcpy (&w, src + i, 4);
+    w = ((w >> 1) & 0x55555555) | ((w & 0x55555555) << 1);
+    w = ((w >> 2) & 0x33333333) | ((w & 0x33333333) << 2);
+    w = ((w >> 4) & 0x0f0f0f0f) | ((w & 0x0f0f0f0f) << 4);
+    memcpy (dst + i, &w, 4);
+  }
+  for (; i < n; i++)
+  {
+    guint8 b = src[i];
+
+    b = ((b >> 1) & 0x55) | ((b & 0x55) << 1);
+    b = ((b >> 2) & 0x33) | ((b & 0x33) << 2);
+    dst[i] = (b >> 4) | (b << 4);
+  }
+}
+
+
+/* hand a read piece to the stream(s) it belongs to, called on the alert thread
+ * for every read_piece_alert and for every piece served from the piece cache */
+static void
+gst_bt_demux_dispatch_piece (GstBtDemux * thiz, int piece,
+    boost::shared_array <char> const buffer, int size)
+{
+  gsize first, last, i;
+  //topology_changed means stream switched, that is :old stream unload, loading new stream selected
+  gboolean topology_changed = FALSE;
+
+  g_mutex_lock (thiz->streams_lock);
+
+  //only the streams whose file covers this piece
+  gst_bt_demux_piece_index_find (thiz, piece, &first, &last);
+  gint foo = (gint) first;
+
+  /*************read the piece once it is finished and send downstream in order */
+  for (i = first; i < last; i++) 
+  {
+    GstBtDemuxBufferData *ipc_data;
+    GstBtDemuxStream *stream = gst_bt_demux_piece_index_stream (thiz, i);
+
+    //never requested, nothing to feed
+    if (!stream)
+    {
+      foo++;
+      continue;
+    }
+
+// printf("(gst_bt_demux_dispatch_piece) waiting lock 2; alert piece idx(%d), stream->current_piece(%d)\n", piece, stream->current_piece);
+    g_static_rec_mutex_lock (stream->lock);//***************************************************************************************************************
+// printf("(gst_bt_demux_dispatch_piece) recovery lock 2; alert piece idx(%d), stream->current_piece(%d)\n", piece, stream->current_piece);
+
+    //Judge which piece belongs to which video file (`GstBtDemuxStream`) within torrent
+    if (piece < stream->start_piece ||
+        piece > stream->end_piece) 
+    {
+
+                  printf("(gst_bt_demux_dispatch_piece) judge whether this read piece belongs to this stream\n");
+
+      g_static_rec_mutex_unlock (stream->lock);foo++;
+      continue;
+    }
+
+
+    /* in case the pad is active but not/no more requested, disable it */
+    if (gst_pad_is_active (GST_PAD (stream)) && !stream->requested) {
+                                printf("(gst_bt_demux_dispatch_piece) stream-idx(%d) the pad is active but not requested, disable it (%d)\n", 
+                                foo, piece);
+
+      topology_changed = TRUE;
+
+      //deactivating waits for the streaming thread, wake it first
+      gst_bt_demux_stream_set_flushing (stream, TRUE);
+      if(!gst_pad_set_active (GST_PAD (stream), FALSE)){
+                printf("(gst_bt_demux_dispatch_piece) stream-idx(%d) Disable gst_pad_set_active failed\n", foo);
+      }else{
+                printf("(gst_bt_demux_dispatch_piece) stream-idx(%d) Disable gst_pad_set_active ok\n", foo);
+      }
+     
+      if (stream->added) {
+        gst_object_unref(stream);
+        gst_element_remove_pad (GST_ELEMENT (thiz), GST_PAD (stream));
+        stream->added = FALSE;
+      }
+      gst_pad_stop_task (GST_PAD (stream));
+      gst_bt_demux_stream_drop_queued (stream, thiz);
+      g_static_rec_mutex_unlock (stream->lock);foo++;
+      continue;
+    }
+
+
+    if (!stream->requested) {
+      g_static_rec_mutex_unlock (stream->lock);foo++;
+      continue;
+    }
+
+    //trick modes push the keyframes straight from the file
+    if (stream->trickmode) {
+      g_static_rec_mutex_unlock (stream->lock);foo++;
+      continue;
+    }
+
+    //in case got a seek, current_piece will be modified in gst_bt_demux_stream_activate(), piece not within in Three-Piece-Area
+    if (piece <= stream->current_piece ||
+    piece > stream->current_piece+thiz->buffer_pieces-1) 
+    {
+
+                  printf("(gst_bt_demux_dispatch_piece) in read_piece_alert, current_piece modified, give up\n");
+
+      g_static_rec_mutex_unlock (stream->lock);foo++;
+      continue;
+    }
+
+
+    /* create the pad if has been requested */
+    if (!gst_pad_is_active (GST_PAD (stream))) {
+
+      // whether to run typefind before negotiating
+      //since we run typefind to get caps  the btdemux srcpad can produce, so typefindelement in gstdecodebin2 become useless
+      // if (thiz->typefind) 
+      // {
+      //   GstTypeFindProbability prob;
+      //   GstCaps *caps;
+      //   GstBuffer *buf;
+
+      //   buf = gst_bt_demux_buffer_new (buffer, piece, size,
+      //       stream);
+
+      //   caps = gst_type_find_helper_for_buffer (GST_OBJECT (thiz), buf, &prob);
+      //   gst_buffer_unref (buf);
+
+      //   if (caps) 
+      //   {
+
+      //     gchar* capstr = gst_caps_to_string(caps);
+
+      //                           printf("(gst_bt_demux_dispatch_piece) Manually call typefind helper, caps is %s \n", capstr);
+      //     // if(!g_str_has_prefix(capstr, "video/quicktime"))
+      //     // {
+      //     //                       printf("(gst_bt_demux_dispatch_piece) this stream is not a video/quicktime which we only supoort, remove this stream \n");
+      //     //                 thiz->stream      
+      //     // }
+
+      //     gst_pad_set_caps (GST_PAD (stream), caps);
+      //     gst_caps_unref (caps);
+      //     g_free (capstr);
+      //   }else{
+      //                           printf("(gst_bt_demux_dispatch_piece) Manually call typefind helper, get caps Failed\n");
+      //   }
+      // }
+  
+
+                                printf("(gst_bt_demux_dispatch_piece) stream-idx(%d) Create the pad if needed and add the pad to element (%d)\n", foo, piece);
+
+      // then activate it 
+      if(!gst_pad_set_active (GST_PAD (stream), TRUE)) {
+          printf ("(gst_bt_demux_dispatch_piece) stream-idx(%d) ENABLE gst_pad_set_active failed\n", foo);
+      } else {  
+          printf ("(gst_bt_demux_dispatch_piece) stream-idx(%d) ENABLE gst_pad_set_active ok\n", foo);
+      }
+      
+      //avoid add an already-added one to btdemux 
+      if (stream->added == FALSE)
+      {
+        // `gst_element_add_pad` will emit the #GstElement::pad-added signal on the element btdemux
+        gst_element_add_pad (GST_ELEMENT (thiz), GST_PAD (
+            gst_object_ref (stream)));
+      }
+
+      stream->added = TRUE;
+      topology_changed = TRUE;
+  
+    }
+
+
+    //NOTE: split the whole piece in case there may be data of two video in one piece,if you push the whole piece, 
+/*
+  eg.      Piece 904            Piece 905            Piece 906
+...|---------------------|---------------------|---------------------|...
+                                            |
+ ...__________________________________________|__________________________________...                            
+
+Video 1 territory (maybe moov header in the tail)        Video 2 territory  
+*/
+    //you will push the wrong data libav will show ERROR, which is a endless headache !
+    //push ipc_data in read_piece_alert handling code <====> retrieve ipc_data in bt_demux_stream_push_loop
+    /***** fill the `ipc_data` with read piece post by read_piece_alert, send the data to the stream thread */
+    ipc_data = g_new0 (GstBtDemuxBufferData /*the type of the elements to allocate*/, 1 /* the number of elements to allocate */);
+    ipc_data->buffer = buffer; // a buffer containing all the data of the piece
+    ipc_data->piece = piece; // the piece index that was read
+    ipc_data->size = size; // number of bytes that was read, this doesn't split the case when two video share/interlacing in one piece
+    gst_bt_demux_queue_acquire (thiz, size);
+    g_async_queue_push (stream->ipc, ipc_data);
+
+                                    printf("(gst_bt_demux_dispatch_piece) in read_piece_alert, piece_idx on alert(aka ipc_data->piece)=(%d), size=%d \n", 
+                                        ipc_data->piece, ipc_data->size);
+
+
+    /* start the task */
+    if (stream->requested) {
+            printf("(gst_bt_demux_dispatch_piece) stream-idx(%d) in read_piece_alert, Start the pad task(bt_demux_stream_push_loop) %d \n", foo,piece);
+            gst_bt_demux_stream_set_flushing (stream, FALSE);
+            #if HAVE_GST_1
+                gst_pad_start_task (GST_PAD (stream), gst_bt_demux_stream_push_loop,
+                stream, NULL);
+            #else
+                gst_pad_start_task (GST_PAD (stream), gst_bt_demux_stream_push_loop,
+                stream);
+            #endif
+    }
+
 
-  }//End of for loop
+    ++foo;
 
-  // g_mutex_unlock (thiz->streams_lock);
+// printf("(gst_bt_demux_dispatch_piece) unlock lock 2 ; stream-idx(%d) alert piece idx(%d), stream->current_piece(%d)\n", 
+// foo, 
+// piece, 
+// stream->current_piece);
 
-}
+    g_static_rec_mutex_unlock (stream->lock);
+  }
 
+  //notify no-more-pads, meaning that we won't create more pads any more
+  if (topology_changed)
+  {
+    gst_bt_demux_check_no_more_pads (thiz);
+  }
 
+  g_mutex_unlock (thiz->streams_lock);
+}
 
 
 
+/* thread reading messages from libtorrent */
+/* cache the torrent status as a structure, for the stats property, and tell the
+ * application through a "btdemux-stats" element message */
+static void
+gst_bt_demux_update_stats (GstBtDemux * thiz, libtorrent::torrent_status const & st)
+{
+  GstStructure *stats;
+  GstStructure *old;
+
+  stats = gst_structure_new ("btdemux-stats",
+      "download-rate", G_TYPE_INT, st.download_rate,
+      "upload-rate", G_TYPE_INT, st.upload_rate,
+      "num-peers", G_TYPE_INT, st.num_peers,
+      "num-seeds", G_TYPE_INT, st.num_seeds,
+      "progress", G_TYPE_DOUBLE, (gdouble) st.progress,
+      "total-done", G_TYPE_INT64, (gint64) st.total_done,
+      "total-wanted", G_TYPE_INT64, (gint64) st.total_wanted,
+      "state", G_TYPE_INT, (gint) st.state,
+      NULL);
 
+  GST_OBJECT_LOCK (thiz);
+  old = thiz->stats;
+  thiz->stats = gst_structure_copy (stats);
+  GST_OBJECT_UNLOCK (thiz);
 
+  if (old)
+  {
+    gst_structure_free (old);
+  }
 
+  gst_element_post_message (GST_ELEMENT_CAST (thiz),
+      gst_message_new_element (GST_OBJECT_CAST (thiz), stats));
+}
 
 
-void free_downloading_block_sd(gpointer data)
+/* the alert categories for the current telemetry level, piece_progress only
+ * goes away when nobody is watching and no requested stream is still waiting
+ * for pieces, once checking is over */
+static lt::alert_category_t
+gst_bt_demux_alert_mask (GstBtDemux * thiz)
 {
-    DownloadingBlocksSd *sd = (DownloadingBlocksSd *) data;
-    if (sd->array) 
+  lt::alert_category_t mask = lt::alert_category::error | lt::alert_category::storage |
+      lt::alert_category::status | lt::alert_category::file_progress;
+  gboolean needs_pieces = TRUE;
+
+  if (g_atomic_int_get (&thiz->telemetry_level) == GST_BT_DEMUX_TELEMETRY_MINIMAL
+      && thiz->completes_checking)
+  {
+    GSList *walk;
+
+    needs_pieces = FALSE;
+    g_mutex_lock (thiz->streams_lock);
+    for (walk = thiz->streams; walk; walk = g_slist_next (walk))
     {
-      for(gint i=0;i<sd->size;i++)
-      {
-        g_free (sd->array[i].blocks_progress);
+      GstBtDemuxStream *stream = GST_BT_DEMUX_STREAM (walk->data);
 
+      if (stream->requested && !stream->finished)
+      {
+        needs_pieces = TRUE;
+        break;
       }
-      g_free (sd->array);
     }
-    g_free (sd);  
+    g_mutex_unlock (thiz->streams_lock);
+  }
+
+  if (needs_pieces)
+  {
+    mask |= lt::alert_category::piece_progress;
+  }
+
+  return mask;
 }
 
 
-static void free_piece_block_info_sd(gpointer data)
+/* piece_finished_alerts were off, set the bits of the pieces finished meanwhile */
+static void
+gst_bt_demux_resync_piece_matrix (GstBtDemux * thiz, lt::torrent_handle h)
 {
+  lt::torrent_status st = h.status (lt::torrent_handle::query_pieces);
+  GstBtBitset *piece_matrix = NULL;
+  guint changed = 0;
 
-                printf("(free_piece_block_info_sd) called \n");
+  GST_OBJECT_LOCK (thiz);
+  if (thiz->piece_matrix)
+  {
+    piece_matrix = gst_bt_bitset_ref (thiz->piece_matrix);
+  }
+  GST_OBJECT_UNLOCK (thiz);
+
+  if (!piece_matrix)
+  {
+    return;
+  }
 
-    PieceBlockInfoSd *info_sd = (PieceBlockInfoSd *)data;
-    if (info_sd->info.finished_pieces) {
-        g_free(info_sd->info.finished_pieces);  // Free finished_pieces memory
+  for (gint i = 0; i < st.pieces.size () && i < (gint) piece_matrix->num_bits; i++)
+  {
+    if (st.pieces.get_bit (lt::piece_index_t (i)) && gst_bt_bitset_set (piece_matrix, i))
+    {
+      changed++;
     }
+  }
+  gst_bt_bitset_unref (piece_matrix);
 
-    if (info_sd->info.unfinished_pieces) {
-        for (guint i = 0; i < info_sd->info.total_num_pieces; ++i) {
-            g_free(info_sd->info.unfinished_pieces[i].blocks_bitfield);  // Free each blocks_bitfield memory
-        }
-        g_free(info_sd->info.unfinished_pieces);  // Free unfinished_pieces memory
+                printf ("(bt_demux_resync_piece_matrix) %u pieces finished while not watched\n", changed);
+}
+
+
+/* called on the alert thread when the alert mask may have to change */
+static void
+gst_bt_demux_apply_alert_mask (GstBtDemux * thiz)
+{
+  lt::session *s = (lt::session *) thiz->session;
+  lt::alert_category_t mask = gst_bt_demux_alert_mask (thiz);
+  guint bits = static_cast<std::uint32_t> (mask);
+  guint piece_progress = static_cast<std::uint32_t> (lt::alert_category::piece_progress);
+  lt::settings_pack p;
+
+  if (bits == thiz->alert_mask)
+  {
+    return;
+  }
+
+                printf ("(bt_demux_apply_alert_mask) alert mask 0x%x -> 0x%x\n", thiz->alert_mask, bits);
+
+  p.set_int (lt::settings_pack::alert_mask, mask);
+  s->apply_settings (p);
+
+  if (!(thiz->alert_mask & piece_progress) && (bits & piece_progress))
+  {
+    std::vector<lt::torrent_handle> torrents = s->get_torrents ();
+
+    if (!torrents.empty ())
+    {
+      gst_bt_demux_resync_piece_matrix (thiz, torrents[0]);
     }
+  }
 
-    g_free(info_sd);  // Free PieceBlockInfoSd structure
+  thiz->alert_mask = bits;
 }
 
-/* thread reading messages from libtorrent */
+
 static gboolean
 gst_bt_demux_handle_alert (GstBtDemux * thiz, libtorrent::alert * a)
 {
@@ -2656,7 +5417,6 @@ gst_bt_demux_handle_alert (GstBtDemux * thiz, libtorrent::alert * a)
         {
           GSList *walk;
           torrent_handle h = p->handle;
-          libtorrent::piece_index_t i;
 
           std::shared_ptr<torrent_info> ti =p->params.ti;
 
@@ -2677,108 +5437,67 @@ gst_bt_demux_handle_alert (GstBtDemux * thiz, libtorrent::alert * a)
 
 
 //**********************************************  Populating Data ***********************************************************************
-          PieceBlockInfoSd *piece_block_info_sd = (PieceBlockInfoSd *) g_malloc0(sizeof(PieceBlockInfoSd));
+          GstBtBlockState *block_state = NULL;
 
           if(ti)
           {
               file_storage fs = ti->files();
               thiz->blocks_per_piece_normal = fs.blocks_per_piece();
+              thiz->piece_length = fs.piece_length();
               thiz->num_blocks_last_piece = (fs.piece_size(fs.last_piece())+16384-1) / 16384;
               thiz->total_num_pieces = fs.num_pieces();
 
+              //keys the on-disk data derived from this torrent (thumbnails)
+              std::stringstream info_hash;
+              info_hash << ti->info_hashes ().get_best ();
+
               //also create the fallback piece matrix maintained ourself
-              if (thiz->piece_matrix_fallback == NULL)
+              GST_OBJECT_LOCK (thiz);
+              g_free (thiz->info_hash);
+              thiz->info_hash = g_strdup (info_hash.str ().c_str ());
+              if (thiz->piece_matrix == NULL)
               {
-                  thiz->piece_matrix_fallback = (guint8*) g_malloc0 (sizeof(guint8) * (thiz->total_num_pieces + 7)/8);
-
-    // printf ("first piece-matrix addr %p \n", thiz->piece_matrix_fallback);
-                  
+                  thiz->piece_matrix = gst_bt_bitset_new (thiz->total_num_pieces);
               }
+              GST_OBJECT_UNLOCK (thiz);
 
               //calc total number of blocks for this torrent, may be fewer in the last piece)
               thiz->total_num_blocks = thiz->blocks_per_piece_normal * (thiz->total_num_pieces - 1) + thiz->num_blocks_last_piece;
 
-              piece_block_info_sd->info.total_num_blocks = thiz->total_num_blocks;
-              piece_block_info_sd->info.total_num_pieces = thiz->total_num_pieces;
-              piece_block_info_sd->info.blocks_per_piece_normal = thiz->blocks_per_piece_normal;
-              piece_block_info_sd->info.num_blocks_last_piece = thiz->num_blocks_last_piece;
+              block_state = gst_bt_block_state_new (thiz->total_num_pieces,
+                  thiz->blocks_per_piece_normal, thiz->num_blocks_last_piece);
           }
-
-
-          add_torrent_params atp = p->params;
-          gint piece_byte_count = (thiz->total_num_pieces + 7) / 8;
-          piece_block_info_sd->info.finished_pieces = NULL;
-          // Allocate memory for finished_pieces
-          piece_block_info_sd->info.finished_pieces = (guint8*) g_malloc0 (piece_byte_count); 
-          // atp.have_pieces may be empty if no resume data when add torrent to session
-          // if it empty, We still allocate them, and the size is thiz->total_num_pieces
-
-          for (gint i=0; i<piece_byte_count; ++i) 
+          else
           {
-              guint8 byte = 0;
-              for (gint j=0; j<8; ++j) 
-              {
-                  if (i*8+j >= thiz->total_num_pieces)
-                  {
-                    continue;
-                  }
-                  else if (atp.have_pieces.size() <= 0)
-                  {
-                    continue;
-                  }
-                  else if (atp.have_pieces.get_bit(i*8+j)) 
-                  {
-                    byte |= (1 << j);
-                  }
-              }
-              piece_block_info_sd->info.finished_pieces[i] = byte; 
-          }   
+              block_state = gst_bt_block_state_new (0, 0, 0);
+          }
 
 
-          // atp.unfinished_piece also may be empty 
-          // if it empty, We also allocate them, and the size is thiz->total_num_pieces
-          piece_block_info_sd->info.unfinished_pieces = NULL;
-          piece_block_info_sd->info.unfinished_pieces = 
-                  (UnfinishedPieceInfo*) g_malloc0 (sizeof(UnfinishedPieceInfo) * thiz->total_num_pieces); 
+          add_torrent_params atp = p->params;
 
+          // atp.have_pieces may be empty if no resume data when add torrent to session
+          // the pieces bitmap is still allocated, all unset
+          gst_bt_demux_bitfield_to_bytes (atp.have_pieces, block_state->have,
+              gst_bt_block_state_have_bytes (block_state));
 
-          for (gint k=0; k < thiz->total_num_pieces; ++k) 
-          {
-              piece_block_info_sd->info.unfinished_pieces[k].piece_index = k;
-              gsize byte_count = (thiz->blocks_per_piece_normal+ 7) / 8;
-              //even for last piece, we still allocate thiz->blocks_per_piece_normal, it doesn't matter
-              piece_block_info_sd->info.unfinished_pieces[k].blocks_bitfield = (guint8*) g_malloc0 (sizeof(guint8) * byte_count);
-          }  
-          // if there are any unfinished_pieces, update it 
+          // atp.unfinished_pieces also may be empty, only the pieces listed there get a block bitmap
           for (auto& entry : atp.unfinished_pieces) 
           {
-              gint piece_idx = entry.first;
-              const libtorrent::bitfield& bf = entry.second;
+              gint piece_idx = static_cast<int> (entry.first);
 
-              //block bitfield of that piece
-              gsize byte_count = (thiz->blocks_per_piece_normal+ 7) / 8;
-              for (gint i = 0; i < byte_count; ++i) 
+              if (piece_idx < 0 || piece_idx >= thiz->total_num_pieces)
               {
-                  guint8 byte = 0;
-                  for (gint j = 0; j < 8; ++j) 
-                  {
-                      if (i*8+j >= thiz->blocks_per_piece_normal)
-                      {
-                          continue;
-                      }
-                      else if (bf.get_bit(i*8+j)) 
-                      {
-                          byte |= (1 << j);
-                      }
-                  }
-                  piece_block_info_sd->info.unfinished_pieces[piece_idx].blocks_bitfield[i] = byte;
-              }   
+                  continue;
+              }
+
+              gst_bt_demux_bitfield_to_bytes (entry.second,
+                  gst_bt_block_state_ensure_partial (block_state, piece_idx),
+                  gst_bt_block_state_block_bytes (block_state));
           }
       
-// printf ("first PieceBlockInfoSd addr %p \n", piece_block_info_sd->info.finished_pieces);
-    
-          g_object_set_data_full (G_OBJECT(thiz), "piece-block-info", piece_block_info_sd, (GDestroyNotify)free_piece_block_info_sd);
-          piece_block_info_sd = NULL; //Important, set to NULL to avoid double free.
+          //shared by reference, the receiver takes its own one
+          g_object_set_data_full (G_OBJECT(thiz), "piece-block-info", block_state, (GDestroyNotify)gst_bt_block_state_unref);
+          block_state = NULL; //Important, set to NULL to avoid double free.
 
           GstStructure *msg_struct = gst_structure_new_empty ("got-piece-block-info");
 
@@ -2794,89 +5513,39 @@ gst_bt_demux_handle_alert (GstBtDemux * thiz, libtorrent::alert * a)
 
 
 
-          /*---------------------- create the streams -------------------*/
+          /*------------------ the per-file metadata table ---------------*/
           /*-------------------------------------------------------------*/
-          //there may be multiple videos within the torrent ,then create `GstBtDemuxStream` for each video
-          for (i = 0; i <ti->num_files (); i++) 
+          //there may be multiple videos within the torrent, only their piece ranges are recorded here,
+          //the `GstBtDemuxStream` of a video is created when it gets requested (see gst_bt_demux_ensure_stream)
+          for (gint fi = 0; fi < ti->num_files (); fi++)
           {
-            GstBtDemuxStream *stream;
-            gchar *name;
-            file_entry fe;
-
-            /* create the pads */
-            name = g_strdup_printf ("src_%02d", i);
-
-            /* ..............initialize the streams -- source pad*/
-            stream = (GstBtDemuxStream *) g_object_new (
-                GST_TYPE_BT_DEMUX_STREAM, "name", name, "direction",
-                GST_PAD_SRC, "template", gst_static_pad_template_get (&src_factory), NULL);
-                      printf ("(gst_bt_demux_handle_alert) create src pad %s (aka.BtDemuxStream) \n",
-                      name);
-            //Free after use
-            g_free (name);
-
-            /* set the file idx within torrent*/
-            stream->file_idx = i;
-
-            stream->requested = FALSE;
-
-            stream->finished = FALSE;
-
-            if (stream->cur_buffering_flags == NULL){
-              stream->cur_buffering_flags = g_array_new (FALSE, FALSE, sizeof(gboolean));
-            }
-
-            /* set the path */
-            fe = ti->file_at (i);
-            stream->path = g_strdup (fe.path.c_str ());
+            file_entry fe = ti->file_at (fi);
+            int piece_length = ti->piece_length ();
+            gint start_piece, end_piece;
 
            //if not .mp4 file, skip, only support mp4/quicktime for now and is enough cuz video torrent mostly are .mp4
-            if(!g_str_has_suffix (stream->path, ".mp4"))
+            if(!g_str_has_suffix (fe.path.c_str (), ".mp4"))
             {
               continue;
             }
             thiz->num_video_file++;
 
-            //reset           
-            gst_bt_demux_stream_info (stream, h, &stream->start_offset,
-                &stream->start_piece, &stream->end_offset, &stream->end_piece,
-                &stream->end_byte, &stream->start_byte, &stream->end_byte);
-            
-            if (stream->start_byte)
-            {
-              stream->start_byte_global = stream->start_byte;
-            }
-            if (stream->end_byte)
-            {
-              stream->end_byte_global = stream->end_byte;
-            }
-
-            stream->last_piece = stream->end_piece;
+            start_piece = fe.offset / piece_length;
+            end_piece = (fe.offset + fe.size) / piece_length;
 
-            // GST_INFO_OBJECT (thiz, "Adding stream %s for file '%s', "
-            //     " start_piece: %d, start_offset: %d, end_piece: %d, "
-            //     "end_offset: %d", GST_PAD_NAME (stream), stream->path,
-            //     stream->start_piece, stream->start_offset, stream->end_piece,
-            //     stream->end_offset);
+            //the moov atom lives either in the first or in the last piece of the video
+            gst_bt_demux_piece_cache_pin_index ((GstBtDemuxPieceCache *) thiz->piece_cache,
+                start_piece);
+            gst_bt_demux_piece_cache_pin_index ((GstBtDemuxPieceCache *) thiz->piece_cache,
+                end_piece);
 
-                                    printf("(bt_demux_handle_alert) Adding stream %s for file %s at fileidx %d, start_piece:%d, start_ofset:%d,end_piece:%d,end_ofset:%d (%ld,%ld]\n", 
-                                        GST_PAD_NAME (stream), stream->path, stream->file_idx, stream->start_piece, 
-                                        stream->start_offset, stream->end_piece,stream->end_offset, stream->start_byte, stream->end_byte);
-
-            /* Append it to our list of streams */
-            thiz->streams = g_slist_append (thiz->streams, stream);
-          }
-          /* mark all pieces (across all files within torrent) to `low_priority` */
-          for (i = 0; i <ti->end_piece (); i++) 
-          {
-            
-            h.piece_priority (i, libtorrent::low_priority);
-            
-            // libtorrent::download_priority_t ret = h.piece_priority (i);
-
-            // printf ("(bt_demux_handle_alert) mark piece %d to low_priority, ret is %d\n", i, ret);
+                                    printf("(bt_demux_handle_alert) Recording file %s at fileidx %d, start_piece:%d, end_piece:%d\n",
+                                        fe.path.c_str (), fi, start_piece, end_piece);
 
+            gst_bt_demux_piece_index_add (thiz, start_piece, end_piece, fi, fe.path.c_str ());
           }
+          gst_bt_demux_piece_index_sort (thiz);
+          /* initial piece/file priorities came with add_torrent_params, see gst_bt_demux_initial_priorities */
 
           /* inform that we do know the available streams now */
           g_signal_emit (thiz, gst_bt_demux_signals[SIGNAL_STREAMS_CHANGED], 0);
@@ -2918,10 +5587,23 @@ gst_bt_demux_handle_alert (GstBtDemux * thiz, libtorrent::alert * a)
     // Also, received every time a piece completes downloading and passes the hash check
     case piece_finished_alert::alert_type:
     {
-        GSList *walk;
+        gsize first, last, i;
         piece_finished_alert *p = alert_cast<piece_finished_alert>(a);
         torrent_handle h = p->handle;
-        torrent_status s = h.status();
+        gint download_rate = 0, upload_rate = 0, num_peers = 0;
+
+        g_atomic_int_set (&thiz->hotspot_dirty, TRUE);
+
+        //from the last state_update_alert, no synchronous h.status() per piece
+        GST_OBJECT_LOCK (thiz);
+        if (thiz->stats)
+        {
+          gst_structure_get (thiz->stats,
+              "download-rate", G_TYPE_INT, &download_rate,
+              "upload-rate", G_TYPE_INT, &upload_rate,
+              "num-peers", G_TYPE_INT, &num_peers, NULL);
+        }
+        GST_OBJECT_UNLOCK (thiz);
 
         gboolean update_buffering = FALSE;
 
@@ -2937,7 +5619,7 @@ gst_bt_demux_handle_alert (GstBtDemux * thiz, libtorrent::alert * a)
 
 
                 printf("Piece %d completed (down: %d kb/s, up: %d kb/s, peers: %d, prio:%d) \n", 
-                  p->piece_index, s.download_rate / 1000,  s.upload_rate  / 1000, s.num_peers, (int)pr);
+                  p->piece_index, download_rate / 1000,  upload_rate  / 1000, num_peers, (int)pr);
 
 
 
@@ -2985,40 +5667,33 @@ gst_bt_demux_handle_alert (GstBtDemux * thiz, libtorrent::alert * a)
                 else 
                 {
                     //set corresponding bit ,use bit-OR logic
-                    if (thiz->piece_matrix_fallback)
+                    if (thiz->piece_matrix)
                     {
-                        // Calculate which byte this bit belongs to
-                        gint matrix_index = p->piece_index / 8;
-
-                        // Calculate the position of the bit within the byte (0-7)
-                        gint bit_position = p->piece_index % 8;
-
-                        // Check if the byte_index is within the valid range
-                        if (matrix_index >= (thiz->total_num_pieces+7)/8) 
+                        if (static_cast<int> (p->piece_index) >= thiz->total_num_pieces) 
                         {
-                            g_warning ("Bit index out of bounds! bitfield length: %d, requested matrix index: %d", (thiz->total_num_pieces+7)/8, matrix_index);
+                            g_warning ("Bit index out of bounds! num pieces: %d, requested piece: %d", thiz->total_num_pieces, static_cast<int> (p->piece_index));
                         }
-                        else
+                        else if (gst_bt_bitset_set (thiz->piece_matrix, static_cast<int> (p->piece_index)))
                         {
-                            // Get the byte at the byte_index
-                            guint8 *byte = &thiz->piece_matrix_fallback[matrix_index];
-                            // Set the bit using bitwise OR with a mask
-                            *byte |= (1 << bit_position);  // This sets the bit at `bit_position` to 1
+                            printf (" Piece %d set in matrix\n", static_cast<int> (p->piece_index));
                         }
-
-                        printf (" Piece %d set bit at (%d,%d)\n", p->piece_index, matrix_index, bit_position);
-                    
                     }
                 }
 //*********************************************************************************************************************
 
 
 
-        // although loop all streams here, only one stream is requested (see it is as playlist)
+        // only one stream is requested (see it is as playlist), look up the ones covering this piece
         /* read the piece once it is finished and send downstream in order (only for the stream we requested)*/
-        for (walk = thiz->streams; walk; walk = g_slist_next (walk)) 
+        gst_bt_demux_piece_index_find (thiz, p->piece_index, &first, &last);
+        for (i = first; i < last; i++) 
         {
-          GstBtDemuxStream *stream = GST_BT_DEMUX_STREAM (walk->data);
+          GstBtDemuxStream *stream = gst_bt_demux_piece_index_stream (thiz, i);
+
+          if (!stream)
+          {
+            continue;
+          }
 
 /* why lock? why not lock? extra lock ? lacking lock ? */
 
@@ -3054,6 +5729,12 @@ gst_bt_demux_handle_alert (GstBtDemux * thiz, libtorrent::alert * a)
           ,It is of no interests to us now*/
           h.piece_priority (p->piece_index, libtorrent::dont_download);
 
+          //push_loop may be waiting for this piece of a keyframe
+          if (stream->trickmode)
+          {
+            gst_bt_demux_stream_wake (stream);
+          }
+
 
           /* everytime piece_finished_alert retrieved, never forget to update the buffering progress */
           // check if this stream is in buffering state
@@ -3062,7 +5743,7 @@ gst_bt_demux_handle_alert (GstBtDemux * thiz, libtorrent::alert * a)
 
                             printf("(gst_bt_demux_handle_alert) in piece_finished_alert, updating buffering progress information \n");
 
-              gst_bt_demux_stream_update_buffering (stream, h, thiz->buffer_pieces);
+              gst_bt_demux_stream_update_buffering (stream, thiz, thiz->buffer_pieces);
               update_buffering |= TRUE;
           }
 
@@ -3082,11 +5763,7 @@ gst_bt_demux_handle_alert (GstBtDemux * thiz, libtorrent::alert * a)
     //posted every time a call to torrent_handle::read_piece() is completed
     case read_piece_alert::alert_type:
     {
-
-      GSList *walk;
       read_piece_alert *p = alert_cast<read_piece_alert>(a);
-      //topology_changed means stream switched, that is :old stream unload, loading new stream selected
-      gboolean topology_changed = FALSE;
 
                                 printf("(bt_demux_handle_alert) BEGIN in read_piece_alert, piece idx:(%d)\n", 
                                 static_cast<int>(p->piece));
@@ -3097,187 +5774,25 @@ gst_bt_demux_handle_alert (GstBtDemux * thiz, libtorrent::alert * a)
         break;
       }
 
-      g_mutex_lock (thiz->streams_lock);
-      gint foo = 0;
-
-      /*************read the piece once it is finished and send downstream in order */
-      for (walk = thiz->streams; walk; walk = g_slist_next (walk)) 
-      {
-        GstBtDemuxBufferData *ipc_data;
-        GstBtDemuxStream *stream = GST_BT_DEMUX_STREAM (walk->data);
-
-// printf("(bt_demux_handle_alert) waiting lock 2; alert piece idx(%d), stream->current_piece(%d)\n", p->piece, stream->current_piece);
-        g_static_rec_mutex_lock (stream->lock);//***************************************************************************************************************
-// printf("(bt_demux_handle_alert) recovery lock 2; alert piece idx(%d), stream->current_piece(%d)\n", p->piece, stream->current_piece);
-
-        //Judge which piece belongs to which video file (`GstBtDemuxStream`) within torrent
-        if (p->piece < stream->start_piece ||
-            p->piece > stream->end_piece) 
-        {
-
-                      printf("(gst_bt_demux_handle_alert) judge whether this read piece belongs to this stream\n");
-
-          g_static_rec_mutex_unlock (stream->lock);foo++;
-          continue;
-        }
-
+      gst_bt_demux_piece_cache_insert ((GstBtDemuxPieceCache *) thiz->piece_cache,
+          static_cast<int>(p->piece), p->buffer, p->size);
 
-        /* in case the pad is active but not/no more requested, disable it */
-        if (gst_pad_is_active (GST_PAD (stream)) && !stream->requested) {
-                                    printf("(bt_demux_handle_alert) stream-idx(%d) the pad is active but not requested, disable it (%d)\n", 
-                                    foo, static_cast<int>(p->piece));
+      gst_bt_demux_dispatch_piece (thiz, static_cast<int>(p->piece), p->buffer, p->size);
 
-          topology_changed = TRUE;
-
-          if(!gst_pad_set_active (GST_PAD (stream), FALSE)){
-                    printf("(bt_demux_handle_alert) stream-idx(%d) Disable gst_pad_set_active failed\n", foo);
-          }else{
-                    printf("(bt_demux_handle_alert) stream-idx(%d) Disable gst_pad_set_active ok\n", foo);
-          }
-         
-          if (stream->added) {
-            gst_object_unref(stream);
-            gst_element_remove_pad (GST_ELEMENT (thiz), GST_PAD (stream));
-            stream->added = FALSE;
-          }
-          gst_pad_stop_task (GST_PAD (stream));
-          g_static_rec_mutex_unlock (stream->lock);foo++;
-          continue;
-        }
+printf ("(bt_demux_handle_alert) EXIT in read_piece_alert, piece idx:(%d)\n", static_cast<int>(p->piece));
+    }
+    break;
 
 
-        if (!stream->requested) {
-          g_static_rec_mutex_unlock (stream->lock);foo++;
-          continue;
-        }
+    //answer to post_torrent_updates(), only the torrents whose status changed
+    case state_update_alert::alert_type:
+    {
+        state_update_alert *p = alert_cast<state_update_alert>(a);
 
-        //in case got a seek, current_piece will be modified in gst_bt_demux_stream_activate(), p->piece not within in Three-Piece-Area
-        if (p->piece <= stream->current_piece ||
-        p->piece > stream->current_piece+thiz->buffer_pieces-1) 
+        for (torrent_status const & st : p->status)
         {
-
-                      printf("(gst_bt_demux_handle_alert) in read_piece_alert, current_piece modified, give up\n");
-
-          g_static_rec_mutex_unlock (stream->lock);foo++;
-          continue;
-        }
-
-
-        /* create the pad if has been requested */
-        if (!gst_pad_is_active (GST_PAD (stream))) {
-
-          // whether to run typefind before negotiating
-          //since we run typefind to get caps  the btdemux srcpad can produce, so typefindelement in gstdecodebin2 become useless
-          // if (thiz->typefind) 
-          // {
-          //   GstTypeFindProbability prob;
-          //   GstCaps *caps;
-          //   GstBuffer *buf;
-
-          //   buf = gst_bt_demux_buffer_new (p->buffer, p->piece, p->size,
-          //       stream);
-
-          //   caps = gst_type_find_helper_for_buffer (GST_OBJECT (thiz), buf, &prob);
-          //   gst_buffer_unref (buf);
-
-          //   if (caps) 
-          //   {
-
-          //     gchar* capstr = gst_caps_to_string(caps);
-
-          //                           printf("(bt_demux_handle_alert) Manually call typefind helper, caps is %s \n", capstr);
-          //     // if(!g_str_has_prefix(capstr, "video/quicktime"))
-          //     // {
-          //     //                       printf("(bt_demux_handle_alert) this stream is not a video/quicktime which we only supoort, remove this stream \n");
-          //     //                 thiz->stream      
-          //     // }
-
-          //     gst_pad_set_caps (GST_PAD (stream), caps);
-          //     gst_caps_unref (caps);
-          //     g_free (capstr);
-          //   }else{
-          //                           printf("(bt_demux_handle_alert) Manually call typefind helper, get caps Failed\n");
-          //   }
-          // }
-      
-
-                                    printf("(bt_demux_handle_alert) stream-idx(%d) Create the pad if needed and add the pad to element (%d)\n", foo, static_cast<int>(p->piece));
-
-          // then activate it 
-          if(!gst_pad_set_active (GST_PAD (stream), TRUE)) {
-              printf ("(bt_demux_handle_alert) stream-idx(%d) ENABLE gst_pad_set_active failed\n", foo);
-          } else {  
-              printf ("(bt_demux_handle_alert) stream-idx(%d) ENABLE gst_pad_set_active ok\n", foo);
-          }
-          
-          //avoid add an already-added one to btdemux 
-          if (stream->added == FALSE)
-          {
-            // `gst_element_add_pad` will emit the #GstElement::pad-added signal on the element btdemux
-            gst_element_add_pad (GST_ELEMENT (thiz), GST_PAD (
-                gst_object_ref (stream)));
-          }
-    
-          stream->added = TRUE;
-          topology_changed = TRUE;
-      
-        }
-
-
-        //NOTE: split the whole piece in case there may be data of two video in one piece,if you push the whole piece, 
-/*
-      eg.      Piece 904            Piece 905            Piece 906
-    ...|---------------------|---------------------|---------------------|...
-                                                |
-   ...__________________________________________|__________________________________...                            
-
-Video 1 territory (maybe moov header in the tail)        Video 2 territory  
-*/
-        //you will push the wrong data libav will show ERROR, which is a endless headache !
-        //push ipc_data in read_piece_alert handling code <====> retrieve ipc_data in bt_demux_stream_push_loop
-        /***** fill the `ipc_data` with read piece post by read_piece_alert, send the data to the stream thread */
-        ipc_data = g_new0 (GstBtDemuxBufferData /*the type of the elements to allocate*/, 1 /* the number of elements to allocate */);
-        ipc_data->buffer = p->buffer; // a buffer containing all the data of the piece
-        ipc_data->piece = p->piece; // the piece index that was read
-        ipc_data->size = p->size; // number of bytes that was read, this doesn't split the case when two video share/interlacing in one piece
-        g_async_queue_push (stream->ipc, ipc_data);
-
-                                        printf("(bt_demux_handle_alert) in read_piece_alert, piece_idx on alert(aka ipc_data->piece)=(%d), size=%d \n", 
-                                            ipc_data->piece, ipc_data->size);
-
-
-        /* start the task */
-        if (stream->requested) {
-                printf("(bt_demux_handle_alert) stream-idx(%d) in read_piece_alert, Start the pad task(bt_demux_stream_push_loop) %d \n", foo,static_cast<int>(p->piece));
-                #if HAVE_GST_1
-                    gst_pad_start_task (GST_PAD (stream), gst_bt_demux_stream_push_loop,
-                    stream, NULL);
-                #else
-                    gst_pad_start_task (GST_PAD (stream), gst_bt_demux_stream_push_loop,
-                    stream);
-                #endif
+          gst_bt_demux_update_stats (thiz, st);
         }
-
-
-        ++foo;
-
-// printf("(bt_demux_handle_alert) unlock lock 2 ; stream-idx(%d) alert piece idx(%d), stream->current_piece(%d)\n", 
-// foo, 
-// p->piece, 
-// stream->current_piece);
-
-        g_static_rec_mutex_unlock (stream->lock);
-      }
-
-      //notify no-more-pads, meaning that we won't create more pads any more
-      if (topology_changed)
-      {
-        gst_bt_demux_check_no_more_pads (thiz);
-      }
-
-      g_mutex_unlock (thiz->streams_lock);
-
-printf ("(bt_demux_handle_alert) EXIT in read_piece_alert, piece idx:(%d)\n", static_cast<int>(p->piece));
     }
     break;
 
@@ -3287,20 +5802,15 @@ printf ("(bt_demux_handle_alert) EXIT in read_piece_alert, piece idx:(%d)\n", st
     {     
         piece_info_alert *p = alert_cast<piece_info_alert>(a);
         
-        std::vector<libtorrent::partial_piece_info> *tmp_ptr = new std::vector<libtorrent::partial_piece_info> (std::move(p->piece_info));
-        
         //maybe empty such as when are not downloading
-        if (tmp_ptr->size() <= 0)
+        if (p->piece_info.empty ())
         {
           printf ("(bt_demux_handle_alert) got piece_info_alert, but ppi is empty \n");
-          delete tmp_ptr;
         }
-        else 
+        else if (gst_bt_demux_ppi_publish (thiz, p->piece_info)
+            && g_atomic_int_get (&thiz->ppi_subscribed))
         {
-          printf ("(bt_demux_handle_alert) got piece_info_alert, push ppi queue\n");
-
-          gpointer ppi = static_cast<gpointer>(tmp_ptr);
-          g_async_queue_push ( thiz->ppi_queue, ppi);
+          gst_bt_demux_ppi_post (thiz);
         }
     
     }
@@ -3312,6 +5822,7 @@ printf ("(bt_demux_handle_alert) EXIT in read_piece_alert, piece idx:(%d)\n", st
     {
         //set btdemux plugin as finished torrent downloading
         thiz->buffering = FALSE;
+        g_atomic_int_set (&thiz->alert_mask_dirty, TRUE);
 
         GstStructure *msg_struct = gst_structure_new_empty ("stop-ppi");
         GstMessage *msg = gst_message_new_application (GST_OBJECT_CAST (thiz), msg_struct);
@@ -3353,6 +5864,7 @@ printf ("(bt_demux_handle_alert) EXIT in read_piece_alert, piece idx:(%d)\n", st
           g_static_rec_mutex_unlock (stream->lock);//***********************************************************************************************
 
         }
+        g_atomic_int_set (&thiz->alert_mask_dirty, TRUE);
     }
     break;
 
@@ -3390,42 +5902,149 @@ gst_bt_demux_loop (gpointer user_data)
   std::vector<torrent_handle> torrents;
   thiz = GST_BT_DEMUX (user_data);
 
-  g_return_if_fail (GST_IS_BT_DEMUX (thiz));
+  g_return_if_fail (GST_IS_BT_DEMUX (thiz));
+
+                        // printf("In gst_bt_demux_loop %d\n", static_cast<int>(thiz->finished));
+
+  while (!thiz->finished) {
+    session *s;
+    s = (session *)thiz->session;
+
+    // if (s->wait_for_alert (libtorrent::seconds(5)) != NULL) {
+
+                                // printf("wait for alert success \n");
+
+
+      //call post_download_queue() to get each pieces' download progress, dont do this, will got loads of empty piece_info_alert
+      // torrents = s->get_torrents ();
+      // if(torrents.size() >= 1){
+      //     torrent_handle h;
+      //     h = torrents[0];
+      //     h.post_download_queue();
+      // }
+
+      std::vector<alert*> alerts;
+      s->pop_alerts(&alerts);
+      /* handle every alert */
+      for (auto a : alerts) 
+      {
+        if (!thiz->finished)
+        {
+
+          //finished will be set to TRUE only if got error in add_torrent_alert or received torrent_removed_alert 
+          thiz->finished = gst_bt_demux_handle_alert (thiz, a);
+        }
+                                //  printf("asd is lt::session valid %d\n", (int)s->is_valid());
+      }
+
+      alerts.clear();
+
+      /* apply the latest seek of each stream */
+      if (g_atomic_int_compare_and_exchange (&thiz->seek_pending, TRUE, FALSE))
+      {
+        std::vector<torrent_handle> torrents = s->get_torrents ();
+
+        if (!torrents.empty ())
+        {
+          g_mutex_lock (thiz->streams_lock);
+          for (GSList *walk = thiz->streams; walk; walk = g_slist_next (walk))
+          {
+            gst_bt_demux_stream_apply_seek (GST_BT_DEMUX_STREAM (walk->data), thiz, torrents[0]);
+          }
+          g_mutex_unlock (thiz->streams_lock);
+        }
+      }
+
+      /* the rate resized the read-ahead window */
+      if (g_atomic_int_compare_and_exchange (&thiz->window_dirty, TRUE, FALSE))
+      {
+        std::vector<torrent_handle> torrents = s->get_torrents ();
+
+        if (!torrents.empty ())
+        {
+          g_mutex_lock (thiz->streams_lock);
+          for (GSList *walk = thiz->streams; walk; walk = g_slist_next (walk))
+          {
+            gst_bt_demux_stream_raise_window (GST_BT_DEMUX_STREAM (walk->data), thiz, torrents[0]);
+          }
+          g_mutex_unlock (thiz->streams_lock);
+        }
+      }
+
+      /* the user points somewhere else on the seek bar */
+      if (g_atomic_int_compare_and_exchange (&thiz->prefetch_dirty, TRUE, FALSE))
+      {
+        std::vector<torrent_handle> torrents = s->get_torrents ();
 
-                        // printf("In gst_bt_demux_loop %d\n", static_cast<int>(thiz->finished));
+        if (!torrents.empty ())
+        {
+          gst_bt_demux_apply_prefetch (thiz, torrents[0]);
+        }
+      }
 
-  while (!thiz->finished) {
-    session *s;
-    s = (session *)thiz->session;
+      /* the playhead moved, or a hotspot piece came in and frees its slot */
+      if (g_atomic_int_compare_and_exchange (&thiz->hotspot_dirty, TRUE, FALSE))
+      {
+        std::vector<torrent_handle> torrents = s->get_torrents ();
 
-    // if (s->wait_for_alert (libtorrent::seconds(5)) != NULL) {
+        if (!torrents.empty ())
+        {
+          gst_bt_demux_apply_hotspots (thiz, torrents[0]);
+        }
+      }
 
-                                // printf("wait for alert success \n");
+      /* index the requested stream once its moov is local, here rather than under
+       * the locks "stream-offset" takes on the main thread */
+      gst_bt_demux_index_requested (thiz);
 
+      /* telemetry level or streams changed */
+      if (g_atomic_int_compare_and_exchange (&thiz->alert_mask_dirty, TRUE, FALSE))
+      {
+        gst_bt_demux_apply_alert_mask (thiz);
+      }
 
-      //call post_download_queue() to get each pieces' download progress, dont do this, will got loads of empty piece_info_alert
-      // torrents = s->get_torrents ();
-      // if(torrents.size() >= 1){
-      //     torrent_handle h;
-      //     h = torrents[0];
-      //     h.post_download_queue();
-      // }
+      gint level = g_atomic_int_get (&thiz->telemetry_level);
+      gint64 stats_interval = level == GST_BT_DEMUX_TELEMETRY_FULL ? DEFAULT_STATS_INTERVAL :
+          (level == GST_BT_DEMUX_TELEMETRY_REDUCED ? REDUCED_STATS_INTERVAL : MINIMAL_STATS_INTERVAL);
 
-      std::vector<alert*> alerts;
-      s->pop_alerts(&alerts);
-      /* handle every alert */
-      for (auto a : alerts) 
+      /* ask for a fresh torrent_status now and then, it comes back as a state_update_alert */
+      gint64 now = g_get_monotonic_time ();
+      if (now - thiz->last_stats_request >= stats_interval * G_TIME_SPAN_MILLISECOND)
       {
-        if (!thiz->finished)
-        {
+        thiz->last_stats_request = now;
+        s->post_torrent_updates ();
+        g_atomic_int_set (&thiz->hotspot_dirty, TRUE);
+      }
 
-          //finished will be set to TRUE only if got error in add_torrent_alert or received torrent_removed_alert 
-          thiz->finished = gst_bt_demux_handle_alert (thiz, a);
+      /* subscribed to the ppi, ask for the download queue, it comes back as a piece_info_alert,
+       * only while the bitfield bar is shown */
+      if (level == GST_BT_DEMUX_TELEMETRY_FULL &&
+          g_atomic_int_get (&thiz->ppi_subscribed) &&
+          now - thiz->last_ppi_request >= thiz->ppi_interval * G_TIME_SPAN_MILLISECOND)
+      {
+        std::vector<torrent_handle> torrents = s->get_torrents ();
+
+        thiz->last_ppi_request = now;
+        if (!torrents.empty ())
+        {
+          torrents[0].post_download_queue ();
         }
-                                //  printf("asd is lt::session valid %d\n", (int)s->is_valid());
       }
 
-      alerts.clear();
+      /* a snapshot held back by the interval of the last post */
+      if (g_atomic_int_get (&thiz->ppi_subscribed))
+      {
+        gst_bt_demux_ppi_post (thiz);
+      }
+
+      /* dispatch the pieces served from the piece cache */
+      GstBtDemuxBufferData *cached;
+      while (!thiz->finished &&
+          (cached = (GstBtDemuxBufferData *) g_async_queue_try_pop (thiz->cached_reads)) != NULL)
+      {
+        gst_bt_demux_dispatch_piece (thiz, cached->piece, cached->buffer, cached->size);
+        gst_bt_demux_buffer_data_free (cached);
+      }
 
     // }
 
@@ -3497,10 +6116,34 @@ gst_bt_demux_task_cleanup (GstBtDemux * thiz)
     /* send a cleanup buffer */
     ipc_data = g_new0 (GstBtDemuxBufferData, 1);
     g_async_queue_push (stream->ipc, ipc_data);
+    gst_bt_demux_stream_set_flushing (stream, TRUE);
     gst_pad_stop_task (GST_PAD (stream));
+    gst_bt_demux_stream_drop_queued (stream, thiz);
   }
   g_mutex_unlock (thiz->streams_lock);
 
+  g_mutex_lock (&thiz->queue_lock);
+  g_array_set_size (thiz->deferred_reads, 0);
+  g_mutex_unlock (&thiz->queue_lock);
+
+  /* the next torrent starts at the normal rate */
+  thiz->buffer_pieces = DEFAULT_BUFFER_PIECES;
+  thiz->window_dirty = FALSE;
+
+  /* the prefetched pieces belong to the torrent going away */
+  GST_OBJECT_LOCK (thiz);
+  thiz->prefetch_offset = -1;
+  if (thiz->prefetch_pieces)
+  {
+    g_array_set_size (thiz->prefetch_pieces, 0);
+  }
+  if (thiz->hotspot_pieces)
+  {
+    g_array_set_size (thiz->hotspot_pieces, 0);
+  }
+  GST_OBJECT_UNLOCK (thiz);
+  thiz->hotspot_dirty = FALSE;
+
   s = (session *)thiz->session;
   torrents = s->get_torrents ();
 
@@ -3518,6 +6161,11 @@ gst_bt_demux_task_cleanup (GstBtDemux * thiz)
 
     s->remove_torrent (h);
   }
+
+  if (thiz->piece_cache)
+  {
+    gst_bt_demux_piece_cache_clear ((GstBtDemuxPieceCache *) thiz->piece_cache);
+  }
   
   /* given that the pads are removed on the parent class at the paused
    * to ready state, we need to exit the task and wait for it
@@ -3537,24 +6185,24 @@ static void
 gst_bt_demux_cleanup (GstBtDemux * thiz)
 {
   /* remove every pad reference */
-  if (thiz->streams) 
+  /* finally remove the files if we need to, every video has an entry in the index
+   * whether its stream got created or not */
+  if (thiz->temp_remove) 
   {
-    /* finally remove the files if we need to */
-    if (thiz->temp_remove) 
+    for (GstBtDemuxFileRange & r : *(GstBtDemuxPieceIndex *) thiz->piece_index)
     {
-      GSList *walk;
+      gchar *to_remove;
 
-      for (walk = thiz->streams; walk; walk = g_slist_next (walk)) 
-      {
-        GstBtDemuxStream *stream = GST_BT_DEMUX_STREAM (walk->data);
-        gchar *to_remove;
-        //free the stream->path, cuz it added using g_strdup()
-        to_remove = g_build_path (G_DIR_SEPARATOR_S, thiz->temp_location,
-            stream->path, NULL);
-        g_remove (to_remove);
-        g_free (to_remove);
-      }
+      to_remove = g_build_path (G_DIR_SEPARATOR_S, thiz->temp_location,
+          r.path.c_str (), NULL);
+      g_remove (to_remove);
+      g_free (to_remove);
     }
+  }
+  ((GstBtDemuxPieceIndex *) thiz->piece_index)->clear ();
+
+  if (thiz->streams) 
+  {
   //cleaup up list of stream(src pad)
     g_slist_free_full (thiz->streams, gst_object_unref);
     thiz->streams = NULL;
@@ -3667,20 +6315,77 @@ gst_bt_demux_dispose (GObject * object)
     thiz->adapter = NULL;
   }
 
-  if (thiz->ppi_queue) 
+  if (thiz->ppi_front)
+  {
+    downloading_blocks_sd_unref (thiz->ppi_front);
+    thiz->ppi_front = NULL;
+  }
+  if (thiz->ppi_back)
+  {
+    downloading_blocks_sd_unref (thiz->ppi_back);
+    thiz->ppi_back = NULL;
+  }
+
+  if (thiz->piece_matrix)
+  {
+    gst_bt_bitset_unref (thiz->piece_matrix);
+    thiz->piece_matrix = NULL;
+  }
+
+  if (thiz->cached_reads)
+  {
+    g_async_queue_unref (thiz->cached_reads);
+    thiz->cached_reads = NULL;
+  }
+
+  if (thiz->piece_cache)
+  {
+    gst_bt_demux_piece_cache_free ((GstBtDemuxPieceCache *) thiz->piece_cache);
+    thiz->piece_cache = NULL;
+  }
+
+  if (thiz->stats)
   {
-    g_async_queue_unref (thiz->ppi_queue);
-    thiz->ppi_queue = NULL;
+    gst_structure_free (thiz->stats);
+    thiz->stats = NULL;
   }
 
-  if (thiz->piece_matrix_fallback)
+  if (thiz->piece_index)
   {
-    g_free (thiz->piece_matrix_fallback);
+    delete (GstBtDemuxPieceIndex *) thiz->piece_index;
+    thiz->piece_index = NULL;
+  }
+
+  if (thiz->deferred_reads)
+  {
+    g_array_free (thiz->deferred_reads, TRUE);
+    thiz->deferred_reads = NULL;
+    g_mutex_clear (&thiz->queue_lock);
+  }
+
+  if (thiz->prefetch_pieces)
+  {
+    g_array_free (thiz->prefetch_pieces, TRUE);
+    thiz->prefetch_pieces = NULL;
+  }
+
+  if (thiz->hotspot_pieces)
+  {
+    g_array_free (thiz->hotspot_pieces, TRUE);
+    thiz->hotspot_pieces = NULL;
+  }
+
+  if (thiz->hotspot_skips)
+  {
+    g_array_unref (thiz->hotspot_skips);
+    thiz->hotspot_skips = NULL;
   }
 
   g_mutex_free (thiz->streams_lock);
 
   g_free (thiz->temp_location);
+  g_free (thiz->info_hash);
+  thiz->info_hash = NULL;
 
   G_OBJECT_CLASS (gst_bt_demux_parent_class)->dispose (object);
 }
@@ -3702,6 +6407,20 @@ update_requested_stream (GstBtDemux* thiz)
                           {
                               printf ("(btdemux/update_requested_stream) desired fileidx %d \n", desired_file_index);
                           }
+
+  //first time this video is requested, create its stream
+  if (desired_file_index != -1 && thiz->session)
+  {
+    libtorrent::session *s = (libtorrent::session *) thiz->session;
+    std::vector<libtorrent::torrent_handle> vec = s->get_torrents ();
+
+    if (!vec.empty ())
+    {
+      g_mutex_lock (thiz->streams_lock);
+      gst_bt_demux_ensure_stream (thiz, vec[0], desired_file_index);
+      g_mutex_unlock (thiz->streams_lock);
+    }
+  }
                          
   if(thiz->streams)
   {
@@ -3725,6 +6444,7 @@ update_requested_stream (GstBtDemux* thiz)
             // {
                   printf("(btdemux/update_requested_stream) stream-idx(%d) disable undesired streams(src pads)\n", foo);
         
+                gst_bt_demux_stream_set_flushing (stream, TRUE);
                 if(!gst_pad_set_active (GST_PAD (stream), FALSE)){
                     printf ("(btdemux/update_requested_stream) stream-idx(%d) DISABLE gst_pad_set_active failed\n",foo);
                 } else {
@@ -3737,43 +6457,7 @@ update_requested_stream (GstBtDemux* thiz)
               if (stream->added)
               {
 
-                GstPad* peerpad = gst_pad_get_peer (GST_PAD (stream));
-                if (peerpad && GST_IS_GHOST_PAD (peerpad))
-                {
-                  GstPad* internal_pad = gst_ghost_pad_get_target (GST_GHOST_PAD (peerpad));
-                  if (!internal_pad) 
-                  {
-                      printf ("(btdemux/update_requested_stream) decodebin ghost sink pad Has no target yet, return\n");
-                    return;
-                  } 
-                  else 
-                  {
-                    GstObject* parent = gst_pad_get_parent (internal_pad);
-                    if (parent) 
-                    {
-                      printf ("(btdemux/update_requested_stream) re-set typefindelement have-type to FALSE\n");
-                      g_object_set (G_OBJECT (parent), "have-type-emitted", FALSE, NULL);
-                      gst_object_unref (parent);
-                    } 
-                    else 
-                    {
-                      printf ("(btdemux/update_requested_stream) parent is NULL \n");
-                    } 
-                    gst_object_unref (internal_pad);
-                  }
-                  gst_object_unref (peerpad);
-                
-                }
-                else if (peerpad && !GST_IS_GHOST_PAD (peerpad)) 
-                {
-                  printf ("(btdemux/update_requested_stream) peer pad is not Ghost pad\n");
-                  gst_object_unref (peerpad);
-                }
-                else if (!peerpad)
-                {
-                  printf ("(btdemux/update_requested_stream) peer pad is NULL\n");
-
-                }
+                gst_bt_demux_stream_reset_type (stream);
 
                 
                 //// GstEvent *eos = gst_event_new_eos ();
@@ -3787,6 +6471,7 @@ update_requested_stream (GstBtDemux* thiz)
                 stream->added = FALSE;
               }
               gst_pad_stop_task (GST_PAD (stream));
+              gst_bt_demux_stream_drop_queued (stream, thiz);
 
             // }
 
@@ -3804,6 +6489,13 @@ update_requested_stream (GstBtDemux* thiz)
         foo += 1;
           g_static_rec_mutex_unlock (stream->lock);//********************************************
       }
+
+      /* the new stream may need the piece_progress alerts back */
+      g_atomic_int_set (&thiz->alert_mask_dirty, TRUE);
+      /* a "prefetch-offset" set while no stream was requested (a resume
+       * point given right after opening) has a stream to map to now */
+      g_atomic_int_set (&thiz->prefetch_dirty, TRUE);
+      g_atomic_int_set (&thiz->hotspot_dirty, TRUE);
   } 
 
 }
@@ -3843,6 +6535,80 @@ gst_bt_demux_set_property (GObject * object, guint prop_id,
       thiz->temp_remove = g_value_get_boolean (value);
       break;
 
+    case PROP_PIECE_CACHE_SIZE:
+      thiz->piece_cache_size = g_value_get_int64 (value);
+      gst_bt_demux_piece_cache_set_max_bytes ((GstBtDemuxPieceCache *) thiz->piece_cache,
+          thiz->piece_cache_size);
+      break;
+
+    case PROP_MAX_QUEUED_BYTES:
+      g_mutex_lock (&thiz->queue_lock);
+      thiz->max_queued_bytes = g_value_get_int64 (value);
+      g_mutex_unlock (&thiz->queue_lock);
+      break;
+
+    case PROP_MAX_QUEUED_PIECES:
+      g_mutex_lock (&thiz->queue_lock);
+      thiz->max_queued_pieces = g_value_get_int (value);
+      g_mutex_unlock (&thiz->queue_lock);
+      break;
+
+    case PROP_PPI_SUBSCRIBE:
+      g_atomic_int_set (&thiz->ppi_subscribed, g_value_get_boolean (value));
+      break;
+
+    case PROP_PPI_INTERVAL:
+      thiz->ppi_interval = g_value_get_uint (value);
+      break;
+
+    case PROP_TELEMETRY_LEVEL:
+      g_atomic_int_set (&thiz->telemetry_level, g_value_get_int (value));
+      g_atomic_int_set (&thiz->alert_mask_dirty, TRUE);
+      break;
+
+    case PROP_PREFETCH_OFFSET:
+      GST_OBJECT_LOCK (thiz);
+      thiz->prefetch_offset = g_value_get_int64 (value);
+      GST_OBJECT_UNLOCK (thiz);
+      g_atomic_int_set (&thiz->prefetch_dirty, TRUE);
+      break;
+
+    case PROP_HOTSPOT_COUNT:
+      GST_OBJECT_LOCK (thiz);
+      thiz->hotspot_count = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (thiz);
+      g_atomic_int_set (&thiz->hotspot_dirty, TRUE);
+      break;
+
+    case PROP_HOTSPOT_SKIPS:
+    {
+      GArray *skips = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+      for (guint i = 0; i < gst_value_array_get_size (value); i++)
+      {
+        gint64 skip = g_value_get_int64 (gst_value_array_get_value (value, i));
+
+        g_array_append_val (skips, skip);
+      }
+
+      GST_OBJECT_LOCK (thiz);
+      if (thiz->hotspot_skips)
+      {
+        g_array_unref (thiz->hotspot_skips);
+      }
+      thiz->hotspot_skips = skips;
+      GST_OBJECT_UNLOCK (thiz);
+      g_atomic_int_set (&thiz->hotspot_dirty, TRUE);
+      break;
+    }
+
+    case PROP_HOTSPOT_SHARE:
+      GST_OBJECT_LOCK (thiz);
+      thiz->hotspot_share = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (thiz);
+      g_atomic_int_set (&thiz->hotspot_dirty, TRUE);
+      break;
+
     case PROP_TEMP_LOCATION:
       g_free (thiz->temp_location);
       thiz->temp_location = g_strdup (g_value_get_string (value));
@@ -3855,6 +6621,61 @@ gst_bt_demux_set_property (GObject * object, guint prop_id,
   }
 }
 
+/* Byte offset within the requested stream of what is playing, for "stream-offset".
+ * With a keyframe index it is the keyframe at or before the pipeline position, where
+ * a seek back to that position restarts reading. Without one, the start of the last
+ * piece pushed, which leads playback by what is queued downstream. -1 if unknown.
+ * Read from the main thread, so only an index the alert thread built already is used */
+static gint64
+gst_bt_demux_get_stream_offset (GstBtDemux * thiz)
+{
+  GstObject *top, *parent;
+  gint64 position = -1, offset = -1;
+  GSList *walk;
+
+  //the position is known to the sinks, ask the whole pipeline
+  top = GST_OBJECT (gst_object_ref (thiz));
+  while ((parent = gst_object_get_parent (top)) != NULL)
+  {
+    gst_object_unref (top);
+    top = parent;
+  }
+  if (top != GST_OBJECT (thiz) &&
+      !gst_element_query_position (GST_ELEMENT (top), GST_FORMAT_TIME, &position))
+  {
+    position = -1;
+  }
+  gst_object_unref (top);
+
+  g_mutex_lock (thiz->streams_lock);
+  for (walk = thiz->streams; walk; walk = g_slist_next (walk))
+  {
+    GstBtDemuxStream *stream = GST_BT_DEMUX_STREAM (walk->data);
+    gint64 size = stream->end_byte_global - stream->start_byte_global;
+
+    if (!stream->requested || size <= 0)
+      continue;
+
+    g_static_rec_mutex_lock (stream->lock);
+    if (position >= 0 && stream->keyframes && stream->keyframes->len > 0)
+    {
+      offset = g_array_index (stream->keyframes, GstBtKeyframe,
+          gst_bt_mp4_keyframes_find_time (stream->keyframes, position)).offset;
+    }
+    else if (stream->current_piece >= 0 && thiz->piece_length > 0)
+    {
+      //the first piece may start in the file before
+      offset = (gint64) stream->current_piece * thiz->piece_length - stream->start_byte_global;
+      offset = CLAMP (offset, (gint64) 0, size - 1);
+    }
+    g_static_rec_mutex_unlock (stream->lock);
+    break;
+  }
+  g_mutex_unlock (thiz->streams_lock);
+
+  return offset;
+}
+
 static void
 gst_bt_demux_get_property (GObject * object, guint prop_id, GValue * value,
     GParamSpec * pspec)
@@ -3870,7 +6691,7 @@ gst_bt_demux_get_property (GObject * object, guint prop_id, GValue * value,
 
       break;
     case PROP_N_STREAMS:
-      g_value_set_int (value, g_slist_length (thiz->streams));
+      g_value_set_int (value, thiz->num_video_file);
       break;
 
    case PROP_CURRENT_STREAM:
@@ -3890,13 +6711,96 @@ gst_bt_demux_get_property (GObject * object, guint prop_id, GValue * value,
       break;
 
     case PROP_PIECE_MATRIX:
-      g_value_set_pointer (value, thiz->piece_matrix_fallback);  // Return current guint8* which is thiz->piece_matrix_fallback
+      GST_OBJECT_LOCK (thiz);
+      g_value_set_boxed (value, thiz->piece_matrix);
+      GST_OBJECT_UNLOCK (thiz);
       break;
 
     case PROP_TEMP_LOCATION:
       g_value_set_string (value, thiz->temp_location);
       break;
 
+    case PROP_PIECE_CACHE_SIZE:
+      g_value_set_int64 (value, thiz->piece_cache_size);
+      break;
+
+    case PROP_MAX_QUEUED_BYTES:
+      g_value_set_int64 (value, thiz->max_queued_bytes);
+      break;
+
+    case PROP_MAX_QUEUED_PIECES:
+      g_value_set_int (value, thiz->max_queued_pieces);
+      break;
+
+    case PROP_QUEUED_BYTES:
+      g_mutex_lock (&thiz->queue_lock);
+      g_value_set_int64 (value, thiz->queued_bytes);
+      g_mutex_unlock (&thiz->queue_lock);
+      break;
+
+    case PROP_STATS:
+      GST_OBJECT_LOCK (thiz);
+      g_value_set_boxed (value, thiz->stats);
+      GST_OBJECT_UNLOCK (thiz);
+      break;
+
+    case PROP_PPI_SUBSCRIBE:
+      g_value_set_boolean (value, g_atomic_int_get (&thiz->ppi_subscribed));
+      break;
+
+    case PROP_PPI_INTERVAL:
+      g_value_set_uint (value, thiz->ppi_interval);
+      break;
+
+    case PROP_TELEMETRY_LEVEL:
+      g_value_set_int (value, g_atomic_int_get (&thiz->telemetry_level));
+      break;
+
+    case PROP_STREAM_LAYOUT:
+      g_value_take_boxed (value, gst_bt_demux_stream_layout (thiz));
+      break;
+
+    case PROP_PREFETCH_OFFSET:
+      GST_OBJECT_LOCK (thiz);
+      g_value_set_int64 (value, thiz->prefetch_offset);
+      GST_OBJECT_UNLOCK (thiz);
+      break;
+
+    case PROP_INFO_HASH:
+      GST_OBJECT_LOCK (thiz);
+      g_value_set_string (value, thiz->info_hash);
+      GST_OBJECT_UNLOCK (thiz);
+      break;
+
+    case PROP_STREAM_OFFSET:
+      g_value_set_int64 (value, gst_bt_demux_get_stream_offset (thiz));
+      break;
+
+    case PROP_HOTSPOT_COUNT:
+      GST_OBJECT_LOCK (thiz);
+      g_value_set_uint (value, thiz->hotspot_count);
+      GST_OBJECT_UNLOCK (thiz);
+      break;
+
+    case PROP_HOTSPOT_SKIPS:
+      GST_OBJECT_LOCK (thiz);
+      for (guint i = 0; thiz->hotspot_skips && i < thiz->hotspot_skips->len; i++)
+      {
+        GValue skip = G_VALUE_INIT;
+
+        g_value_init (&skip, G_TYPE_INT64);
+        g_value_set_int64 (&skip, g_array_index (thiz->hotspot_skips, gint64, i));
+        gst_value_array_append_and_take_value (value, &skip);
+      }
+      GST_OBJECT_UNLOCK (thiz);
+      break;
+
+    case PROP_HOTSPOT_SHARE:
+      GST_OBJECT_LOCK (thiz);
+      g_value_set_uint (value, thiz->hotspot_share);
+      GST_OBJECT_UNLOCK (thiz);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -3964,10 +6868,126 @@ gst_bt_demux_class_init (GstBtDemuxClass * klass)
           (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
 
 
+  g_object_class_install_property (gobject_class, PROP_PIECE_CACHE_SIZE,
+      g_param_spec_int64 ("piece-cache-size", "Piece cache size",
+          "Max bytes of recently read pieces kept in memory (0 = disabled)",
+          0, G_MAXINT64, DEFAULT_PIECE_CACHE_SIZE,
+          (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+
+
+  g_object_class_install_property (gobject_class, PROP_MAX_QUEUED_BYTES,
+      g_param_spec_int64 ("max-queued-bytes", "Max queued bytes",
+          "Stop reading pieces when this many bytes wait to be pushed (0 = unlimited)",
+          0, G_MAXINT64, DEFAULT_MAX_QUEUED_BYTES,
+          (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+
+
+  g_object_class_install_property (gobject_class, PROP_MAX_QUEUED_PIECES,
+      g_param_spec_int ("max-queued-pieces", "Max queued pieces",
+          "Stop reading pieces when this many pieces wait to be pushed (0 = unlimited)",
+          0, G_MAXINT, DEFAULT_MAX_QUEUED_PIECES,
+          (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+
+
+  g_object_class_install_property (gobject_class, PROP_QUEUED_BYTES,
+      g_param_spec_int64 ("queued-bytes", "Queued bytes",
+          "Bytes of read pieces currently waiting to be pushed",
+          0, G_MAXINT64, 0,
+          (GParamFlags)(G_PARAM_READABLE | G_PARAM_STATIC_STRINGS)));
+
+
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Torrent statistics",
+          "Latest torrent status (rates, peers, progress), refreshed every second at full telemetry level",
+          GST_TYPE_STRUCTURE,
+          (GParamFlags)(G_PARAM_READABLE | G_PARAM_STATIC_STRINGS)));
+
+
+  g_object_class_install_property (gobject_class, PROP_PPI_SUBSCRIBE,
+      g_param_spec_boolean ("ppi-subscribe", "Subscribe to ppi",
+          "Post \"ppi-changed\" messages with the downloading blocks progress",
+          FALSE,
+          (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+
+
+  g_object_class_install_property (gobject_class, PROP_PPI_INTERVAL,
+      g_param_spec_uint ("ppi-interval", "Ppi interval",
+          "Milliseconds between two download queue requests, and at least between two \"ppi-changed\" messages",
+          50, G_MAXUINT, DEFAULT_PPI_INTERVAL,
+          (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+
+
+  g_object_class_install_property (gobject_class, PROP_TELEMETRY_LEVEL,
+      g_param_spec_int ("telemetry-level", "Telemetry level",
+          "How much the UI is watching (0 = full, 1 = reduced, 2 = minimal), "
+          "lower levels poll less and narrow the alert categories",
+          GST_BT_DEMUX_TELEMETRY_FULL, GST_BT_DEMUX_TELEMETRY_MINIMAL,
+          GST_BT_DEMUX_TELEMETRY_FULL,
+          (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+
+
+  g_object_class_install_property (gobject_class, PROP_STREAM_LAYOUT,
+      g_param_spec_boxed ("stream-layout", "Stream layout",
+          "Byte range of the requested stream in the torrent, piece length and seek window",
+          GST_TYPE_STRUCTURE,
+          (GParamFlags)(G_PARAM_READABLE | G_PARAM_STATIC_STRINGS)));
+
+
+  g_object_class_install_property (gobject_class, PROP_PREFETCH_OFFSET,
+      g_param_spec_int64 ("prefetch-offset", "Prefetch offset",
+          "Byte offset in the requested stream to download the first window of "
+          "ahead of a likely seek, below the playhead priority (-1 = none)",
+          -1, G_MAXINT64, -1,
+          (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+
+
+  g_object_class_install_property (gobject_class, PROP_INFO_HASH,
+      g_param_spec_string ("info-hash", "Info hash",
+          "Hex info-hash of the last torrent added, kept until the next one "
+          "is, so a file can be keyed before its stream is requested",
+          NULL,
+          (GParamFlags)(G_PARAM_READABLE | G_PARAM_STATIC_STRINGS)));
+
+  g_object_class_install_property (gobject_class, PROP_STREAM_OFFSET,
+      g_param_spec_int64 ("stream-offset", "Stream offset",
+          "Byte offset within the requested stream of the position playing: "
+          "the keyframe at or before it once the file is indexed, the last "
+          "piece pushed before that, -1 if unknown",
+          -1, G_MAXINT64, -1,
+          (GParamFlags)(G_PARAM_READABLE | G_PARAM_STATIC_STRINGS)));
+
+
+  g_object_class_install_property (gobject_class, PROP_HOTSPOT_COUNT,
+      g_param_spec_uint ("hotspot-count", "Hotspot count",
+          "Number of evenly spaced positions of the requested stream to download "
+          "the first pieces of in the background (0 = none)",
+          0, 1000, 0,
+          (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+
+
+  g_object_class_install_property (gobject_class, PROP_HOTSPOT_SKIPS,
+      gst_param_spec_array ("hotspot-skips", "Hotspot skips",
+          "Byte offsets from the playhead to download the first pieces of "
+          "in the background, negative ones behind it",
+          g_param_spec_int64 ("skip", "Skip", "Byte offset from the playhead",
+              G_MININT64, G_MAXINT64, 0,
+              (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)),
+          (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+
+
+  g_object_class_install_property (gobject_class, PROP_HOTSPOT_SHARE,
+      g_param_spec_uint ("hotspot-share", "Hotspot share",
+          "Percent of the pieces downloading that may be hotspot ones, the rest "
+          "going to the playhead window (0 = no hotspot prefetch)",
+          0, MAX_HOTSPOT_SHARE, DEFAULT_HOTSPOT_SHARE,
+          (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+
+
   g_object_class_install_property (gobject_class, PROP_PIECE_MATRIX,
-    g_param_spec_pointer ("piece-matrix", "Piece Matrix",
-      "Matrix of piece bitfield",
-      (GParamFlags)(G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)) );
+    g_param_spec_boxed ("piece-matrix", "Piece Matrix",
+      "Bitset of the finished pieces (GstBtBitset)",
+      gst_bt_bitset_get_type (),
+      (GParamFlags)(G_PARAM_READABLE | G_PARAM_STATIC_STRINGS)) );
 
 
 
@@ -3992,6 +7012,20 @@ gst_bt_demux_class_init (GstBtDemuxClass * klass)
       downloading_blocks_sd_get_type(), 0);
 
 
+  gst_bt_demux_signals[SIGNAL_KEYFRAME_OFFSET] =
+      g_signal_new ("keyframe-offset", G_TYPE_FROM_CLASS (klass),
+      (GSignalFlags) (G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION),
+      G_STRUCT_OFFSET (GstBtDemuxClass, keyframe_offset), NULL, NULL, NULL,
+      G_TYPE_INT64, 1, G_TYPE_UINT64);
+
+
+  gst_bt_demux_signals[SIGNAL_KEYFRAME_TIME] =
+      g_signal_new ("keyframe-time", G_TYPE_FROM_CLASS (klass),
+      (GSignalFlags) (G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION),
+      G_STRUCT_OFFSET (GstBtDemuxClass, keyframe_time), NULL, NULL, NULL,
+      G_TYPE_UINT64, 1, G_TYPE_INT64);
+
+
   /* initialize the element class and pad template */
   gst_element_class_add_pad_template (element_class,
       gst_static_pad_template_get (&sink_factory));
@@ -4013,6 +7047,9 @@ gst_bt_demux_class_init (GstBtDemuxClass * klass)
 
   klass->get_ppi = gst_bt_demux_get_ppi;
 
+  klass->keyframe_offset = gst_bt_demux_keyframe_offset;
+  klass->keyframe_time = gst_bt_demux_keyframe_time;
+
 
 }
  
@@ -4054,15 +7091,65 @@ gst_bt_demux_init (GstBtDemux * thiz)
   thiz->total_num_pieces = -1;
   thiz->num_blocks_last_piece = -1;
   thiz->blocks_per_piece_normal = -1;
+  thiz->piece_length = -1;
+
+  g_mutex_init (&thiz->ppi_lock);
+  thiz->ppi_front = NULL;
+  thiz->ppi_back = NULL;
+  thiz->ppi_version = 0;
+  thiz->ppi_posted_version = 0;
+  thiz->ppi_subscribed = FALSE;
+  thiz->ppi_interval = DEFAULT_PPI_INTERVAL;
+  thiz->last_ppi_request = 0;
+  thiz->last_ppi_post = 0;
+
+  thiz->piece_matrix = NULL;
+
+  thiz->piece_cache_size = DEFAULT_PIECE_CACHE_SIZE;
+  thiz->piece_cache = gst_bt_demux_piece_cache_new (thiz->piece_cache_size);
+  thiz->cached_reads = g_async_queue_new_full (
+      (GDestroyNotify) gst_bt_demux_buffer_data_free);
+
+  g_mutex_init (&thiz->queue_lock);
+  thiz->queued_bytes = 0;
+  thiz->queued_pieces = 0;
+  thiz->max_queued_bytes = DEFAULT_MAX_QUEUED_BYTES;
+  thiz->max_queued_pieces = DEFAULT_MAX_QUEUED_PIECES;
+  thiz->deferred_reads = g_array_new (FALSE, FALSE, sizeof (gint));
+
+  thiz->last_buffering_percent = 100;
+  thiz->last_buffering_post = 0;
+  thiz->pushed_bytes = 0;
+  thiz->out_rate_bytes = 0;
+  thiz->out_rate_time = 0;
+  thiz->avg_out = 0;
+
+  thiz->piece_index = new GstBtDemuxPieceIndex ();
+
+  thiz->stats = NULL;
+  thiz->last_stats_request = 0;
+
+  lt::alert_category_t mask = alert_category::error | alert_category::storage |
+      alert_category::status | alert_category::piece_progress | alert_category::file_progress;
+
+  thiz->telemetry_level = GST_BT_DEMUX_TELEMETRY_FULL;
+  thiz->alert_mask_dirty = FALSE;
+  thiz->seek_pending = FALSE;
+  thiz->window_dirty = FALSE;
+  thiz->alert_mask = static_cast<std::uint32_t> (mask);
 
-  thiz->ppi_queue = g_async_queue_new_full (gst_free_ppi_data);
+  thiz->prefetch_offset = -1;
+  thiz->prefetch_dirty = FALSE;
+  thiz->prefetch_pieces = g_array_new (FALSE, FALSE, sizeof (gint));
 
-  thiz->piece_matrix_fallback = NULL;
+  thiz->hotspot_count = 0;
+  thiz->hotspot_share = DEFAULT_HOTSPOT_SHARE;
+  thiz->hotspot_skips = NULL;
+  thiz->hotspot_dirty = FALSE;
+  thiz->hotspot_pieces = g_array_new (FALSE, FALSE, sizeof (gint));
 
   lt::settings_pack p;
-	p.set_int(lt::settings_pack::alert_mask, alert_category::error | alert_category::storage | 
-      alert_category::status | alert_category::piece_progress | alert_category::file_progress
-  );
+	p.set_int(lt::settings_pack::alert_mask, mask);
 
 
   /* create a new session */
@@ -23,6 +23,9 @@
 #include <gst/gst.h>
 #include <gst/base/gstadapter.h>
 
+#include "gst_bt_bitset.h"
+#include "gst_bt_block_state.h"
+
 
 
 G_BEGIN_DECLS
@@ -60,45 +63,64 @@ G_BEGIN_DECLS
 
 
 /***************some defs *********************/
-typedef struct 
-{
-    guint32 piece_index;
-    guint8  *blocks_bitfield; // Bitfield for blocks of this piece
-} UnfinishedPieceInfo;
-
-typedef struct 
-{
-    guint32 total_num_blocks;
-    guint32 total_num_pieces;
-    guint32 blocks_per_piece_normal;
-    guint32 num_blocks_last_piece;
 
-    guint8 *finished_pieces;  // Pointer to dynamically allocated array
 
-    UnfinishedPieceInfo *unfinished_pieces;  // Pointer to dynamically allocated array
-
-} PieceBlockInfo;
+/* How much the UI is watching, set through the "telemetry-level" property.
+ * FULL: stats every second, ppi pushed while subscribed.
+ * REDUCED: the bitfield bar is not shown, no ppi, stats less often.
+ * MINIMAL: nobody is watching, no ppi, stats rarely, and the piece_progress
+ * alerts are disabled while no stream needs them (seeding, or every stream
+ * already complete) */
+typedef enum
+{
+  GST_BT_DEMUX_TELEMETRY_FULL = 0,
+  GST_BT_DEMUX_TELEMETRY_REDUCED,
+  GST_BT_DEMUX_TELEMETRY_MINIMAL
+} GstBtDemuxTelemetryLevel;
 
 
-typedef struct {
-    PieceBlockInfo info;
-} PieceBlockInfoSd;
 
 
+/* Snapshot of the now-downloading pieces (from piece_info_alert), one flat
+ * structure-of-arrays instead of one allocation per piece:
+ * the i-th piece is pieces[i], its blocks progress (0..100, one byte per block)
+ * are progress[block_offsets[i]] .. progress[block_offsets[i+1]-1].
+ * btdemux double-buffers two of them and hands them out by reference, the
+ * buffers only grow, so steady-state snapshots don't allocate.
+ * version increases with every published snapshot, consumers holding the
+ * same version can skip it */
+typedef struct 
+{
+    gint ref_count;
+    guint64 version;
 
+    gint size;              /* number of pieces */
+    guint32 *pieces;
+    guint32 *block_offsets; /* size + 1 entries */
+    guint8 *progress;
 
+    gint pieces_capacity;
+    gint blocks_capacity;
+} DownloadingBlocksSd;
 
-typedef struct 
+static inline DownloadingBlocksSd *
+downloading_blocks_sd_ref (DownloadingBlocksSd *sd)
 {
-    guint32  piece_index;
-    guint8*  blocks_progress;
-} DownloadingBlocks;
+    g_atomic_int_inc (&sd->ref_count);
+    return sd;
+}
 
-typedef struct 
+static inline void
+downloading_blocks_sd_unref (DownloadingBlocksSd *sd)
 {
-    gint size;
-    DownloadingBlocks *array;
-} DownloadingBlocksSd;
+    if (g_atomic_int_dec_and_test (&sd->ref_count))
+    {
+        g_free (sd->pieces);
+        g_free (sd->block_offsets);
+        g_free (sd->progress);
+        g_free (sd);
+    }
+}
 
 
 
@@ -145,6 +167,8 @@ typedef struct _GstBtDemuxStream
   gboolean buffering;
   gint buffering_level;
   gint buffering_count;
+  //pieces of the window already local when cur_buffering_flags were set
+  gint buffering_had;
 
   GStaticRecMutex *lock;
 
@@ -154,6 +178,51 @@ typedef struct _GstBtDemuxStream
   //gboolean array, signaling whether piece needs to downloading/buffering in Three-Piece-Area
   GArray* cur_buffering_flags;
 
+  //pieces this stream raised to top_priority, put back to default when a seek moves away
+  GArray *raised_pieces;
+
+  //a seek updated the segment, the alert thread still has to re-prioritize and read
+  //the new window, newer seeks just replace the target (see gst_bt_demux_stream_apply_seek)
+  gboolean seek_pending;
+  gboolean seek_was_buffering;
+
+  //keyframe index of the file (GstBtKeyframe, see gst_bt_mp4_index.h), parsed from the
+  //moov once the pieces holding it are local, keyframes_generation is the piece matrix
+  //generation of the last failed attempt, so it is not retried until more pieces came
+  GArray *keyframes;
+  guint64 keyframes_generation;
+
+  //trick mode (key units only, or reverse): the keyframes alone are fetched and pushed,
+  //each as its own segment, trick_next is the next one, -1 or keyframes->len when done
+  gboolean trickmode;
+  gdouble rate;
+  gint trick_next;
+
+  //segment seek (an A-B loop): downstream stopping at the end of the segment gets a
+  //SEGMENT_DONE instead of an EOS, and what comes after waits for the next seek.
+  //segment_start_piece is where it began, so the range can be kept in the piece cache
+  //while the application loops over it
+  gboolean segment_seek;
+  gboolean segment_done;
+  guint32 segment_seqnum;
+  gint segment_start_piece;
+
+  //downstream readiness, updated from the pad "linked"/"unlinked" signals and the
+  //typefind "have-type" signal, push_loop waits on ready_cond instead of polling.
+  //ready_cookie counts the pieces finished in trick mode, ready_flushing is raised
+  //when the task is about to be flushed or stopped and wakes every waiter
+  GMutex ready_lock;
+  GCond ready_cond;
+  gboolean downstream_linked;
+  gboolean have_type;
+  gboolean ready_flushing;
+  guint ready_cookie;
+  GstElement *typefind;
+  gulong have_type_id;
+  //the internal pad of a decodebin ghost pad linked before it got its target
+  GstPad *ghost_internal;
+  gulong ghost_linked_id;
+
 } GstBtDemuxStream;
 
 
@@ -178,6 +247,9 @@ typedef struct _GstBtDemux
   /*path of .torrent file*/
   gchar *tor_path;
 
+  /*hex info-hash of the added torrent, guarded by the object lock*/
+  gchar *info_hash;
+
   //current playing/streaming file_index of video within that torrent
   gint cur_streaming_fileidx;
 
@@ -197,6 +269,7 @@ typedef struct _GstBtDemux
   gint total_num_pieces;
   gint num_blocks_last_piece;
   gint blocks_per_piece_normal;
+  gint piece_length;
   gpointer session;
 
   GstTask *task;
@@ -212,13 +285,90 @@ typedef struct _GstBtDemux
 
   guint8 *piece_finished_barray;
 
-  GAsyncQueue *ppi_queue;
-  //// std::vector<libtorrent::partial_piece_info> ppi;
-
-  //since ppi may not accurate enough, use this array to keep track of each piece 
-  //when piece_finished_alert comes, we set corresponding bit 
-  guint8* piece_matrix_fallback;
-
+  //double-buffered ppi snapshots, the alert thread fills ppi_back from piece_info_alert
+  //and swaps it with ppi_front, which get-ppi hands out by reference
+  GMutex ppi_lock;
+  DownloadingBlocksSd *ppi_front;
+  DownloadingBlocksSd *ppi_back;
+  guint64 ppi_version;
+
+  //push model, while subscribed the alert thread asks for the download queue
+  //every ppi_interval ms and posts "ppi-changed" when the snapshot changed,
+  //ppi_posted_version is the version of the last snapshot posted
+  gint ppi_subscribed;
+  guint ppi_interval;
+  gint64 last_ppi_request;
+  gint64 last_ppi_post;
+  guint64 ppi_posted_version;
+
+  //since ppi may not accurate enough, use this bitset to keep track of each piece 
+  //when piece_finished_alert comes, we set corresponding bit, readers fetch only the changed words
+  GstBtBitset *piece_matrix;
+
+  //LRU cache of recently read pieces (GstBtDemuxPieceCache), and the pieces
+  //served from it waiting to be dispatched on the alert thread
+  gpointer piece_cache;
+  gint64 piece_cache_size;
+  GAsyncQueue *cached_reads;
+
+  //pieces waiting in the streams' ipc queues, reads are deferred while over
+  //the limits and issued again when push_loop drains them, 0 means unlimited
+  GMutex queue_lock;
+  gint64 queued_bytes;
+  gint queued_pieces;
+  gint64 max_queued_bytes;
+  gint max_queued_pieces;
+  GArray *deferred_reads;
+
+  //buffering messages are coalesced to one per DEFAULT_BUFFERING_INTERVAL ms
+  //between the first and the final 100%, pushed_bytes (all bytes released from
+  //the ipc queues) gives the output rate of the buffering stats, also under queue_lock
+  gint last_buffering_percent;
+  gint64 last_buffering_post;
+  gint64 pushed_bytes;
+  gint64 out_rate_bytes;
+  gint64 out_rate_time;
+  gint avg_out;
+
+  //sorted piece range -> file/stream index (GstBtDemuxPieceIndex), built in add_torrent_alert
+  gpointer piece_index;
+
+  //latest torrent_status, asked with post_torrent_updates() every second from the
+  //alert thread and cached from state_update_alert, guarded by the object lock
+  GstStructure *stats;
+  gint64 last_stats_request;
+
+  //GstBtDemuxTelemetryLevel, the alert thread applies the alert mask it implies
+  //when alert_mask_dirty is raised, and resyncs the piece matrix once piece_progress
+  //alerts are back
+  gint telemetry_level;
+  gint alert_mask_dirty;
+  guint alert_mask;
+
+  //raised by a stream seek, the alert thread applies the latest target of each stream
+  gint seek_pending;
+
+  //raised when the playback rate changed buffer_pieces, the alert thread raises what
+  //the larger read-ahead window of each stream now covers
+  gint window_dirty;
+
+  //speculative prefetch, byte offset within the requested stream the user is pointing
+  //at (-1 = none) and the pieces the alert thread raised for it, guarded by the object
+  //lock, prefetch_dirty is raised when the offset changed
+  gint64 prefetch_offset;
+  gint prefetch_dirty;
+  GArray *prefetch_pieces;
+
+  //background prefetch of the likely seek targets: the first pieces at hotspot_count
+  //evenly spaced positions and at the hotspot_skips byte offsets (gint64) around the
+  //playhead, at most hotspot_share percent of the playhead window downloading at once.
+  //Settings and the pieces the alert thread raised are guarded by the object lock,
+  //hotspot_dirty is raised when they or the playhead changed
+  guint hotspot_count;
+  guint hotspot_share;
+  GArray *hotspot_skips;
+  gint hotspot_dirty;
+  GArray *hotspot_pieces;
 
   
 } GstBtDemux;
@@ -238,6 +388,11 @@ typedef struct _GstBtDemuxClass
 
   DownloadingBlocksSd *(*get_ppi) (GstBtDemux * demux);
 
+  /* keyframe index lookups for the player, between media time and the byte
+   * offset within the requested stream */
+  gint64 (*keyframe_offset) (GstBtDemux * demux, GstClockTime time);
+  GstClockTime (*keyframe_time) (GstBtDemux * demux, gint64 offset);
+
 
 } GstBtDemuxClass;
 
@@ -249,10 +404,4 @@ G_END_DECLS
 
 
 
-
-// Function declarations (if needed)
-gboolean init_piece_block_info_sd(guint32 num_pieces, guint32 blocks_per_piece_normal);
-void free_piece_block_info_sd(void);
-PieceBlockInfoSd* get_piece_block_info_sd();
-
 #endif
@@ -0,0 +1,340 @@
+/* Gst-Bt - BitTorrent related GStreamer elements
+ * Copyright (C) 2015 Jorge Luis Zapata
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "gst_bt_mp4_index.h"
+
+/* a moov larger than that is not worth holding in memory for trick modes */
+#define MAX_MOOV_SIZE (64 * 1024 * 1024)
+
+/* Look for the child box of the given type in data, return its payload and
+ * its size in payload_size, NULL if there is none */
+static const guint8 *
+gst_bt_mp4_find_box (const guint8 * data, gsize size, const gchar * type,
+    gsize * payload_size)
+{
+  while (size >= 8)
+  {
+    guint64 box_size = GST_READ_UINT32_BE (data);
+    gsize header = 8;
+
+    if (box_size == 1)
+    {
+      if (size < 16)
+        return NULL;
+      box_size = GST_READ_UINT64_BE (data + 8);
+      header = 16;
+    }
+    else if (box_size == 0)
+    {
+      box_size = size;
+    }
+
+    if (box_size < header || box_size > size)
+      return NULL;
+
+    if (memcmp (data + 4, type, 4) == 0)
+    {
+      *payload_size = box_size - header;
+      return data + header;
+    }
+
+    data += box_size;
+    size -= box_size;
+  }
+
+  return NULL;
+}
+
+/* the entry count of a full box whose entries are entry_size bytes after
+ * the version/flags and the count, 0 if the box is truncated */
+static guint32
+gst_bt_mp4_entries (const guint8 * box, gsize size, gsize skip, gsize entry_size)
+{
+  guint32 count;
+
+  if (!box || size < skip + 8)
+    return 0;
+
+  count = GST_READ_UINT32_BE (box + skip + 4);
+  if ((size - skip - 8) / entry_size < count)
+    return 0;
+
+  return count;
+}
+
+/* the sync samples of the stbl of a track, with the timescale of its mdhd */
+static GArray *
+gst_bt_mp4_parse_stbl (const guint8 * stbl, gsize stbl_size, guint32 timescale)
+{
+  const guint8 *stss, *stts, *stsc, *stsz, *stco, *co64;
+  gsize stss_size = 0, stts_size = 0, stsc_size = 0, stsz_size = 0;
+  gsize stco_size = 0, co64_size = 0;
+  guint32 n_sync, n_stts, n_stsc, n_samples, n_chunks, sample_size;
+  guint32 sync_i = 0, stts_i = 0, stts_left, stsc_i = 0, chunk, sample = 0;
+  guint64 dts = 0;
+  GArray *keyframes;
+
+  stss = gst_bt_mp4_find_box (stbl, stbl_size, "stss", &stss_size);
+  stts = gst_bt_mp4_find_box (stbl, stbl_size, "stts", &stts_size);
+  stsc = gst_bt_mp4_find_box (stbl, stbl_size, "stsc", &stsc_size);
+  stsz = gst_bt_mp4_find_box (stbl, stbl_size, "stsz", &stsz_size);
+  stco = gst_bt_mp4_find_box (stbl, stbl_size, "stco", &stco_size);
+  co64 = gst_bt_mp4_find_box (stbl, stbl_size, "co64", &co64_size);
+
+  if (!stts || !stsc || !stsz || (!stco && !co64) || stsz_size < 12)
+    return NULL;
+
+  /* no stss, every sample is a sync sample */
+  n_sync = gst_bt_mp4_entries (stss, stss_size, 0, 4);
+  n_stts = gst_bt_mp4_entries (stts, stts_size, 0, 8);
+  n_stsc = gst_bt_mp4_entries (stsc, stsc_size, 0, 12);
+  sample_size = GST_READ_UINT32_BE (stsz + 4);
+  n_samples = GST_READ_UINT32_BE (stsz + 8);
+  if (sample_size == 0 && (stsz_size - 12) / 4 < n_samples)
+    return NULL;
+  n_chunks = stco ? gst_bt_mp4_entries (stco, stco_size, 0, 4) :
+      gst_bt_mp4_entries (co64, co64_size, 0, 8);
+
+  if (n_stts == 0 || n_stsc == 0 || n_samples == 0 || n_chunks == 0 ||
+      (stss && n_sync == 0))
+    return NULL;
+
+  keyframes = g_array_sized_new (FALSE, FALSE, sizeof (GstBtKeyframe),
+      stss ? n_sync : n_samples);
+  stts_left = GST_READ_UINT32_BE (stts + 8);
+
+  for (chunk = 0; chunk < n_chunks && sample < n_samples; chunk++)
+  {
+    guint32 per_chunk, j;
+    gint64 offset;
+
+    /* stsc entries apply from their (1-based) first chunk on */
+    while (stsc_i + 1 < n_stsc &&
+        GST_READ_UINT32_BE (stsc + 8 + (stsc_i + 1) * 12) <= chunk + 1)
+      stsc_i++;
+    per_chunk = GST_READ_UINT32_BE (stsc + 8 + stsc_i * 12 + 4);
+
+    offset = stco ? GST_READ_UINT32_BE (stco + 8 + chunk * 4) :
+        (gint64) GST_READ_UINT64_BE (co64 + 8 + chunk * 8);
+
+    for (j = 0; j < per_chunk && sample < n_samples; j++, sample++)
+    {
+      guint32 size = sample_size ? sample_size :
+          GST_READ_UINT32_BE (stsz + 12 + sample * 4);
+
+      while (stss && sync_i < n_sync &&
+          GST_READ_UINT32_BE (stss + 8 + sync_i * 4) < sample + 1)
+        sync_i++;
+
+      if (size > 0 && (!stss || (sync_i < n_sync &&
+                  GST_READ_UINT32_BE (stss + 8 + sync_i * 4) == sample + 1)))
+      {
+        GstBtKeyframe kf;
+
+        kf.time = gst_util_uint64_scale (dts, GST_SECOND, timescale);
+        kf.offset = offset;
+        kf.size = size;
+        g_array_append_val (keyframes, kf);
+      }
+
+      offset += size;
+
+      /* next decode time, the last stts entry covers the remaining samples */
+      while (stts_left == 0 && stts_i + 1 < n_stts)
+      {
+        stts_i++;
+        stts_left = GST_READ_UINT32_BE (stts + 8 + stts_i * 8);
+      }
+      dts += GST_READ_UINT32_BE (stts + 8 + stts_i * 8 + 4);
+      if (stts_left)
+        stts_left--;
+    }
+  }
+
+  if (keyframes->len == 0)
+  {
+    g_array_free (keyframes, TRUE);
+    return NULL;
+  }
+
+  return keyframes;
+}
+
+/* the keyframes of the first video trak of the moov payload */
+static GArray *
+gst_bt_mp4_parse_moov (const guint8 * moov, gsize moov_size)
+{
+  while (moov_size >= 8)
+  {
+    const guint8 *trak, *mdia, *hdlr, *mdhd, *minf, *stbl;
+    gsize trak_size, mdia_size, hdlr_size, mdhd_size, minf_size, stbl_size;
+    guint32 timescale;
+
+    trak = gst_bt_mp4_find_box (moov, moov_size, "trak", &trak_size);
+    if (!trak)
+      return NULL;
+
+    /* continue after this trak */
+    moov_size -= trak + trak_size - moov;
+    moov = trak + trak_size;
+
+    mdia = gst_bt_mp4_find_box (trak, trak_size, "mdia", &mdia_size);
+    if (!mdia)
+      continue;
+    hdlr = gst_bt_mp4_find_box (mdia, mdia_size, "hdlr", &hdlr_size);
+    if (!hdlr || hdlr_size < 12 || memcmp (hdlr + 8, "vide", 4) != 0)
+      continue;
+
+    mdhd = gst_bt_mp4_find_box (mdia, mdia_size, "mdhd", &mdhd_size);
+    if (!mdhd || mdhd_size < 24)
+      continue;
+    /* version 1 has 64 bits creation and modification times */
+    if (mdhd[0] == 1)
+    {
+      if (mdhd_size < 24 + 8)
+        continue;
+      timescale = GST_READ_UINT32_BE (mdhd + 20);
+    }
+    else
+    {
+      timescale = GST_READ_UINT32_BE (mdhd + 12);
+    }
+    if (timescale == 0)
+      continue;
+
+    minf = gst_bt_mp4_find_box (mdia, mdia_size, "minf", &minf_size);
+    if (!minf)
+      continue;
+    stbl = gst_bt_mp4_find_box (minf, minf_size, "stbl", &stbl_size);
+    if (!stbl)
+      continue;
+
+    return gst_bt_mp4_parse_stbl (stbl, stbl_size, timescale);
+  }
+
+  return NULL;
+}
+
+/**
+ * gst_bt_mp4_keyframes_parse:
+ * @read: reads bytes of the file
+ * @user_data: data for @read
+ * @file_size: size of the file
+ *
+ * Walks the top level boxes of the file up to the moov and builds the keyframe
+ * index of its first video track. Only the box headers and the moov are read.
+ *
+ * Returns: a #GArray of #GstBtKeyframe in decode order, or %NULL if the moov
+ * is not readable yet or has no usable video track.
+ */
+GArray *
+gst_bt_mp4_keyframes_parse (GstBtMp4ReadFunc read, gpointer user_data,
+    gint64 file_size)
+{
+  gint64 offset = 0;
+
+  while (offset + 8 <= file_size)
+  {
+    guint8 header[16];
+    guint64 box_size;
+    gsize header_size = 8;
+
+    if (!read (user_data, offset, header, 8))
+      return NULL;
+
+    box_size = GST_READ_UINT32_BE (header);
+    if (box_size == 1)
+    {
+      if (offset + 16 > file_size || !read (user_data, offset + 8, header + 8, 8))
+        return NULL;
+      box_size = GST_READ_UINT64_BE (header + 8);
+      header_size = 16;
+    }
+    else if (box_size == 0)
+    {
+      box_size = file_size - offset;
+    }
+
+    if (box_size < header_size || (gint64) box_size > file_size - offset)
+      return NULL;
+
+    if (memcmp (header + 4, "moov", 4) == 0)
+    {
+      gsize moov_size = box_size - header_size;
+      guint8 *moov;
+      GArray *keyframes = NULL;
+
+      if (moov_size > MAX_MOOV_SIZE)
+        return NULL;
+
+      moov = (guint8 *) g_malloc (moov_size);
+      if (read (user_data, offset + header_size, moov, moov_size))
+      {
+        keyframes = gst_bt_mp4_parse_moov (moov, moov_size);
+      }
+      g_free (moov);
+
+      return keyframes;
+    }
+
+    offset += box_size;
+  }
+
+  return NULL;
+}
+
+/* index of the last keyframe at or before time, 0 if time is before the first */
+gint
+gst_bt_mp4_keyframes_find_time (GArray * keyframes, GstClockTime time)
+{
+  gint lo = 0, hi = (gint) keyframes->len - 1;
+
+  while (lo < hi)
+  {
+    gint mid = (lo + hi + 1) / 2;
+
+    if (g_array_index (keyframes, GstBtKeyframe, mid).time <= time)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+
+  return lo;
+}
+
+/* index of the last keyframe starting at or before offset, 0 if offset is
+ * before the first, the chunks are expected in file order as muxers write them */
+gint
+gst_bt_mp4_keyframes_find_offset (GArray * keyframes, gint64 offset)
+{
+  gint lo = 0, hi = (gint) keyframes->len - 1;
+
+  while (lo < hi)
+  {
+    gint mid = (lo + hi + 1) / 2;
+
+    if (g_array_index (keyframes, GstBtKeyframe, mid).offset <= offset)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+
+  return lo;
+}
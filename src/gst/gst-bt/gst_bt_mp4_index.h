@@ -0,0 +1,52 @@
+/* Gst-Bt - BitTorrent related GStreamer elements
+ * Copyright (C) 2015 Jorge Luis Zapata
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GST_BT_MP4_INDEX_H
+#define GST_BT_MP4_INDEX_H
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Keyframe index of an MP4/QuickTime file, for the trick modes: the sync
+ * samples of its first video track, parsed from the moov box, in decode order.
+ * offset is the position of the sample in the file, time its decode time.
+ * Composition offsets and edit lists are ignored, the demuxer downstream
+ * timestamps what it gets anyway, the index only has to tell where to read */
+
+typedef struct
+{
+  GstClockTime time;
+  gint64 offset;
+  guint32 size;
+} GstBtKeyframe;
+
+/* read size bytes at offset of the file into data, FALSE if they are not
+ * available (yet) */
+typedef gboolean (*GstBtMp4ReadFunc) (gpointer user_data, gint64 offset,
+    guint8 * data, gsize size);
+
+GArray *gst_bt_mp4_keyframes_parse (GstBtMp4ReadFunc read,
+    gpointer user_data, gint64 file_size);
+
+gint gst_bt_mp4_keyframes_find_time (GArray * keyframes, GstClockTime time);
+gint gst_bt_mp4_keyframes_find_offset (GArray * keyframes, gint64 offset);
+
+G_END_DECLS
+
+#endif
@@ -184,6 +184,14 @@ previous_chapter_action_cb (GSimpleAction *action,
 	TOTEM_PROFILE (totem_object_seek_previous (TOTEM_OBJECT (user_data)));
 }
 
+static void
+ab_loop_action_cb (GSimpleAction *action,
+		   GVariant      *parameter,
+		   gpointer       user_data)
+{
+	totem_object_ab_loop (TOTEM_OBJECT (user_data));
+}
+
 
 
 
@@ -215,6 +223,7 @@ static GActionEntry app_entries[] = {
 	{ "play", play_action_cb, NULL, NULL, NULL },
 	{ "next-chapter", next_chapter_action_cb, NULL, NULL, NULL },
 	{ "previous-chapter", previous_chapter_action_cb, NULL, NULL, NULL },
+	{ "ab-loop", ab_loop_action_cb, NULL, NULL, NULL },
 
 
 };
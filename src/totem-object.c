@@ -64,6 +64,9 @@
 #define OVERLAY_OPACITY 0.86
 
 #define TOTEM_SESSION_SAVE_TIMEOUT 10 /* seconds */
+#define TOTEM_POSITIONS_MAX 200 /* files remembered in positions.ini */
+#define TOTEM_RESUME_MIN_TIME 10000 /* ms, left earlier plays from the start */
+#define TOTEM_RESUME_END_MARGIN 30000 /* ms, left closer to the end counts as watched */
 
 #define TOTEM_NULL_STREAMING_FILE_IDX -1
 #define TOTEM_CLEAR_STREAMING_FILE_IDX -2
@@ -87,7 +90,7 @@ static void playlist_widget_setup (TotemObject *totem);
 static void totem_callback_connect (TotemObject *totem);
 static void totem_setup_window (TotemObject *totem);
 static void totem_got_torrent_videos_info (BaconVideoWidget* bvw ,TotemObject * totem);
-static void totem_got_piece_block_info (BaconVideoWidget* bvw ,PieceBlockInfoSd *sd, TotemObject * totem);
+static void totem_got_piece_block_info (BaconVideoWidget* bvw ,GstBtBlockState *block_state, TotemObject * totem);
 static void totem_got_finished_piece_info (BaconVideoWidget* bvw ,guint8 *byte_array, TotemObject * totem);
 static void totem_got_ppi_info (BaconVideoWidget *bvw, DownloadingBlocksSd *sd, TotemObject *totem);
 static void totem_got_piece_matrix (BaconVideoWidget* bvw ,guint8 *piece_matrix, TotemObject * totem);
@@ -113,6 +116,7 @@ G_MODULE_EXPORT void popup_menu_shown_cb                (GtkToggleButton *button
 /* Seekbar */
 G_MODULE_EXPORT gboolean seek_slider_pressed_cb         (GtkWidget *widget, GdkEventButton *event, TotemObject *totem);
 G_MODULE_EXPORT gboolean seek_slider_released_cb        (GtkWidget *widget, GdkEventButton *event, TotemObject *totem);
+G_MODULE_EXPORT void seek_slider_intent_cb              (GtkWidget *widget, gdouble position, TotemObject *totem);
 G_MODULE_EXPORT gboolean seek_slider_scroll_event_cb    (GtkWidget *widget, GdkEventScroll *event, gpointer user_data);
 
 /* Volume */
@@ -613,6 +617,8 @@ totem_object_init (TotemObject *totem)
 
 
 	totem->streaming_file_idx = TOTEM_NULL_STREAMING_FILE_IDX;
+	totem->resume_time = -1;
+	totem->loop_a = -1;
 
 	totem->settings = g_settings_new (TOTEM_GSETTINGS_SCHEMA);
 
@@ -835,33 +841,169 @@ totem_object_set_current_fileidx_and_play (TotemObject *totem)
 
 
 
-//NO NEED TO IT
-//save the torrent's streaming playing state. should localte at torrent-info-hash/player_state.xspf.xspf
-//we can store the currently playing file_index or stuffs  such as seeking to last time when open 
-// static gboolean
-// save_session_timeout_cb (Totem *totem)
-// {
-// 	totem_session_save (totem);
-// 	return TRUE;
-// }
+/*
+ * Where each file of a torrent was left, serialized in positions.ini: one group
+ * per "<info-hash>:<file-index>" with the "position" in ms, the byte "offset" in
+ * the file btdemux reads it from (its keyframe once the file is indexed), and when
+ * it was "saved" (unix time) to forget the oldest ones.
+ * On the next open btdemux prefetches the window at "offset" straight away,
+ * and we seek to "position" once the stream is seekable
+ **/
+static char *
+totem_object_position_group (TotemObject *totem, gint file_index)
+{
+	g_autofree char *info_hash = NULL;
 
-// static void
-// setup_save_timeout_cb (Totem    *totem,
-// 		       gboolean  enable)
-// {
-// 	if (enable && totem->save_timeout_id == 0) 
-// 	{
-// 		totem->save_timeout_id = g_timeout_add_seconds (TOTEM_SESSION_SAVE_TIMEOUT,
-// 								(GSourceFunc) save_session_timeout_cb,
-// 								totem);
-// 		g_source_set_name_by_id (totem->save_timeout_id, "[totem] save_session_timeout_cb");
-// 	} 
-// 	else if (totem->save_timeout_id > 0) 
-// 	{
-// 		g_source_remove (totem->save_timeout_id);
-// 		totem->save_timeout_id = 0;
-// 	}
-// }
+	if (totem->bvw == NULL || file_index < 0)
+		return NULL;
+
+	info_hash = bacon_video_widget_get_info_hash (totem->bvw);
+	if (info_hash == NULL)
+		return NULL;
+
+	return g_strdup_printf ("%s:%d", info_hash, file_index);
+}
+
+static GKeyFile *
+totem_object_load_positions (char **filename)
+{
+	GKeyFile *keyfile = g_key_file_new ();
+
+	*filename = g_build_filename (totem_dot_dir (), "positions.ini", NULL);
+	g_key_file_load_from_file (keyfile, *filename, G_KEY_FILE_NONE, NULL);
+
+	return keyfile;
+}
+
+/* keep positions.ini small, dropping the files saved longest ago */
+static void
+totem_object_prune_positions (GKeyFile *keyfile)
+{
+	g_auto(GStrv) groups = NULL;
+	gsize n_groups, i;
+
+	groups = g_key_file_get_groups (keyfile, &n_groups);
+	while (n_groups > TOTEM_POSITIONS_MAX)
+	{
+		gsize oldest = 0;
+
+		for (i = 1; i < n_groups; i++)
+		{
+			if (g_key_file_get_int64 (keyfile, groups[i], "saved", NULL) <
+			    g_key_file_get_int64 (keyfile, groups[oldest], "saved", NULL))
+				oldest = i;
+		}
+
+		g_key_file_remove_group (keyfile, groups[oldest], NULL);
+		g_free (groups[oldest]);
+		groups[oldest] = groups[n_groups - 1];
+		groups[n_groups - 1] = NULL;
+		n_groups--;
+	}
+}
+
+static void
+totem_object_save_position (TotemObject *totem)
+{
+	GKeyFile *keyfile;
+	g_autofree char *group = NULL;
+	g_autofree char *filename = NULL;
+	g_autofree char *contents = NULL;
+	gint64 position;
+
+	/* nothing played yet, or still on the way to the saved position */
+	if (totem->stream_length <= 0 || totem->resume_time >= 0)
+		return;
+
+	group = totem_object_position_group (totem, totem->streaming_file_idx);
+	if (group == NULL)
+		return;
+
+	position = bacon_video_widget_get_current_time (totem->bvw);
+	keyfile = totem_object_load_positions (&filename);
+
+	if (position < TOTEM_RESUME_MIN_TIME ||
+	    position > totem->stream_length - TOTEM_RESUME_END_MARGIN)
+	{
+		g_key_file_remove_group (keyfile, group, NULL);
+	}
+	else
+	{
+		g_key_file_set_int64 (keyfile, group, "position", position);
+		g_key_file_set_int64 (keyfile, group, "offset",
+				      bacon_video_widget_get_stream_offset (totem->bvw));
+		g_key_file_set_int64 (keyfile, group, "saved",
+				      g_get_real_time () / G_USEC_PER_SEC);
+		totem_object_prune_positions (keyfile);
+	}
+
+						printf ("(totem_object_save_position) %s at %" G_GINT64_FORMAT " ms\n", group, position);
+
+	contents = g_key_file_to_data (keyfile, NULL, NULL);
+	g_key_file_free (keyfile);
+	g_file_set_contents (filename, contents, -1, NULL);
+}
+
+/* called right after opening file_index: the stream is not even requested yet,
+ * btdemux maps the offset to its pieces as soon as it is */
+static void
+totem_object_restore_position (TotemObject *totem, gint file_index)
+{
+	GKeyFile *keyfile;
+	g_autofree char *group = NULL;
+	g_autofree char *filename = NULL;
+	gint64 position, offset;
+
+	totem->resume_time = -1;
+
+	group = totem_object_position_group (totem, file_index);
+	if (group == NULL)
+		return;
+
+	keyfile = totem_object_load_positions (&filename);
+	if (g_key_file_has_group (keyfile, group))
+	{
+		position = g_key_file_get_int64 (keyfile, group, "position", NULL);
+		offset = g_key_file_get_int64 (keyfile, group, "offset", NULL);
+
+		if (position > 0)
+		{
+						printf ("(totem_object_restore_position) %s left at %" G_GINT64_FORMAT " ms, offset %" G_GINT64_FORMAT "\n",
+							group, position, offset);
+
+			totem->resume_time = position;
+			if (offset > 0)
+				bacon_video_widget_set_prefetch_offset (totem->bvw, offset);
+		}
+	}
+	g_key_file_free (keyfile);
+}
+
+static gboolean
+save_session_timeout_cb (Totem *totem)
+{
+	if (totem->state == STATE_PLAYING)
+		totem_object_save_position (totem);
+	return TRUE;
+}
+
+static void
+setup_save_timeout_cb (Totem    *totem,
+		       gboolean  enable)
+{
+	if (enable && totem->save_timeout_id == 0) 
+	{
+		totem->save_timeout_id = g_timeout_add_seconds (TOTEM_SESSION_SAVE_TIMEOUT,
+								(GSourceFunc) save_session_timeout_cb,
+								totem);
+		g_source_set_name_by_id (totem->save_timeout_id, "[totem] save_session_timeout_cb");
+	} 
+	else if (totem->save_timeout_id > 0) 
+	{
+		g_source_remove (totem->save_timeout_id);
+		totem->save_timeout_id = 0;
+	}
+}
 
 
 
@@ -975,6 +1117,7 @@ totem_object_get_short_title (TotemObject *totem)
 
 
 //FORWARD DECLARATION
+static void totem_object_update_telemetry_level (TotemObject *totem);
 static void set_controls_visibility (TotemObject      *totem,
 				     gboolean          visible,
 				     gboolean          animate);
@@ -1019,13 +1162,8 @@ static void
 emit_file_opened (TotemObject *totem
 				,const char *fpath)
 {
-	// NO NEED
-	/*
-	* THIS is used for save playlist, playing state, all for resume, 
-	* so next time you open totem, it will resume playing the video you left last time
-	**/
-	// totem_session_save (totem);
-	// setup_save_timeout_cb (totem, TRUE);
+	/* keep the position of the file saved while it plays, for resume */
+	setup_save_timeout_cb (totem, TRUE);
 
 	//actually to tell totem-movie-properties Dialog fileidx has been switched, show its `movie proeprties`
 	//also to tell totem-open-directory plugin the full path of the video being played
@@ -1044,9 +1182,7 @@ emit_file_opened (TotemObject *totem
 static void
 emit_file_closed (TotemObject *totem)
 {
-	//NO NEED
-	// setup_save_timeout_cb (totem, FALSE);
-	// totem_session_save (totem);
+	setup_save_timeout_cb (totem, FALSE);
 	g_signal_emit (G_OBJECT (totem),
 		       totem_table_signals[FILEIDX_CLOSED],
 		       0);
@@ -1228,11 +1364,18 @@ totem_object_exit (TotemObject *totem)
 	if (display != NULL)
 		gdk_display_sync (display);
 
-	// setup_save_timeout_cb (totem, FALSE);
+	setup_save_timeout_cb (totem, FALSE);
 	// totem_session_cleanup (totem);
 
+	totem_object_save_position (totem);
 	totem_object_save_state (totem);
 
+	if (totem->preview_cancellable)
+	{
+		g_cancellable_cancel (totem->preview_cancellable);
+		g_clear_object (&totem->preview_cancellable);
+	}
+
 	g_clear_object (&totem->settings);
 
 	if (totem->win)
@@ -1516,6 +1659,12 @@ window_state_event_cb (GtkWidget           *window,
 
 	totem->maximised = !!(event->new_window_state & GDK_WINDOW_STATE_MAXIMIZED);
 
+	if (event->changed_mask & (GDK_WINDOW_STATE_ICONIFIED | GDK_WINDOW_STATE_WITHDRAWN)) {
+		totem->window_hidden = !!(event->new_window_state &
+					  (GDK_WINDOW_STATE_ICONIFIED | GDK_WINDOW_STATE_WITHDRAWN));
+		totem_object_update_telemetry_level (totem);
+	}
+
 	if ((event->changed_mask & GDK_WINDOW_STATE_FULLSCREEN) == 0)
 		return FALSE;
 
@@ -1584,13 +1733,13 @@ totem_object_set_fullscreen (TotemObject *totem, gboolean state)
 
 
 /************** Data transfer from btdemux **************/
-static void totem_got_piece_matrix (BaconVideoWidget* bvw ,guint8 *piece_matrix, TotemObject * totem)
+static void totem_got_piece_matrix (BaconVideoWidget* bvw ,GstBtBitset *piece_matrix, TotemObject * totem)
 {
 // printf ("third piece-matrix addr %p \n", piece_matrix);
 
-	//we here just read the piece_matrix and do nothing modification to it
-	bitfield_scale_update_piece_matrix_fallback (totem->seek, piece_matrix);
-	//no need to free the piece_matrix here, it is a dynamically allocated guint8* made in btdemux, and maintained by btdemux
+	//we here just read the changes of piece_matrix and do nothing modification to it
+	bitfield_scale_update_piece_matrix (totem->seek, piece_matrix);
+	//no need to free the piece_matrix here, bvw holds a reference during the emission
 }
 
 static void
@@ -1621,29 +1770,19 @@ totem_got_finished_piece_info (BaconVideoWidget* bvw ,guint8 *byte_array, TotemO
 
 
 static void
-totem_got_piece_block_info (BaconVideoWidget* bvw ,PieceBlockInfoSd *sd, TotemObject * totem)
+totem_got_piece_block_info (BaconVideoWidget* bvw ,GstBtBlockState *block_state, TotemObject * totem)
 {
 
-// printf ("third PieceBlockInfoSd addr %p \n", sd->info.finished_pieces);
-
 						printf ("(totem_got_piece_block_info) entering \n");
 
-    if (!sd) 
+    if (!block_state) 
 	{
         g_warning ("Received NULL shared data.");
         return;
     }
 
-	guint total_num_blocks = sd->info.total_num_blocks;
-	guint total_num_pieces = sd->info.total_num_pieces;
-	guint blocks_per_piece_normal = sd->info.blocks_per_piece_normal;
-	guint num_blocks_last_piece = sd->info.num_blocks_last_piece;
-	
-
-    bitfield_scale_set_piece_block_info (totem->seek, total_num_blocks, total_num_pieces,
-                                        blocks_per_piece_normal, num_blocks_last_piece,
-                                        sd->info.finished_pieces, 
-                                        sd->info.unfinished_pieces);
+	//the seek bar takes its own reference
+    bitfield_scale_set_piece_block_info (totem->seek, block_state);
 
 
 	// Remove the data (association) from the GObject to prevent double-free
@@ -1880,6 +2019,28 @@ set_controls_visibility (TotemObject      *totem,
 		schedule_hiding_popup (totem);
 	}
 	totem->reveal_controls = visible;
+	totem_object_update_telemetry_level (totem);
+}
+
+
+/* Nobody watching the window, or only the video but not the seek bar and time
+ * label in the toolbar, let bvw and btdemux stop or slow down their polling */
+static void
+totem_object_update_telemetry_level (TotemObject *totem)
+{
+	BvwTelemetryLevel level;
+
+	if (totem->bvw == NULL)
+		return;
+
+	if (totem->window_hidden)
+		level = BVW_TELEMETRY_MINIMAL;
+	else if (!totem->reveal_controls)
+		level = BVW_TELEMETRY_REDUCED;
+	else
+		level = BVW_TELEMETRY_FULL;
+
+	bacon_video_widget_set_telemetry_level (totem->bvw, level);
 }
 
 
@@ -1955,6 +2116,7 @@ totem_object_set_fileidx (TotemObject *totem, gint file_index)
 									printf("(totem_object_set_fileidx, file_idx=%d) Closing the current stream first \n", file_index);
 		//totem->pause_start maybe useless ,cuz we dont impl resume playing now
 		totem->pause_start = FALSE;
+		totem_object_save_position (totem);
 		bacon_video_widget_close (totem->bvw);
 		emit_file_closed (totem);
 		totem->has_played_emitted = FALSE;
@@ -2026,6 +2188,8 @@ totem_object_set_fileidx (TotemObject *totem, gint file_index)
 		g_application_unmark_busy (G_APPLICATION (totem));
 
 		totem->streaming_file_idx = file_index;
+		totem_object_restore_position (totem, file_index);
+		totem->loop_a = -1;
 
 		// Enable Play/Pause Button
 		action_set_sensitive ("play", TRUE);
@@ -2238,6 +2402,39 @@ totem_object_seek_time (TotemObject *totem, gint64 msec, gboolean accurate)
 	totem_seek_time_rel (totem, msec, FALSE, accurate);
 }
 
+/**
+ * totem_object_ab_loop:
+ * @totem: a #TotemObject
+ *
+ * Marks the start of an A-B loop at the current position, then its end,
+ * which starts playing it over and over. Called again while looping, it
+ * goes back to normal playback from where it is.
+ **/
+void
+totem_object_ab_loop (TotemObject *totem)
+{
+	gint64 _time;
+
+	if (bacon_video_widget_get_loop (totem->bvw, NULL, NULL)) {
+		bacon_video_widget_set_loop (totem->bvw, -1, -1);
+		totem->loop_a = -1;
+		return;
+	}
+
+	if (!totem->seekable)
+		return;
+
+	_time = bacon_video_widget_get_current_time (totem->bvw);
+	if (totem->loop_a < 0 || _time <= totem->loop_a) {
+		totem->loop_a = _time;
+				printf ("(totem_object_ab_loop) loop start at %" G_GINT64_FORMAT " ms\n", _time);
+		return;
+	}
+
+	bacon_video_widget_set_loop (totem->bvw, totem->loop_a, _time);
+	totem->loop_a = -1;
+}
+
 static void
 totem_object_set_zoom (TotemObject *totem,
 		       gboolean     zoom)
@@ -2550,21 +2747,14 @@ update_seekable (TotemObject *totem)
 	// }
 
 	//seeking to resume time point, usually happen open a video previously watched and saved resume data
-	// if (seekable != FALSE) 
-	// {
-	// 	gint64 starttime;
-	// 	starttime = 0;
-	// 	if (starttime != 0) 
-	// 	{
-	// 		bacon_video_widget_seek_time (totem->bvw,
-	// 					      starttime * 1000, FALSE, NULL);
-	// 		if (totem->pause_start) 
-	// 		{
-	// 			totem_object_pause (totem);
-	// 			totem->pause_start = FALSE;
-	// 		}
-	// 	}
-	// }
+	//its window has been prefetched since the open, see totem_object_restore_position()
+	if (seekable != FALSE && totem->resume_time > 0) 
+	{
+		gint64 starttime = totem->resume_time;
+
+		totem->resume_time = -1;
+		bacon_video_widget_seek_time (totem->bvw, starttime, FALSE, NULL);
+	}
 	
 
 	//// if (notify)
@@ -2833,6 +3023,52 @@ seek_slider_released_cb (GtkWidget *widget, GdkEventButton *event, TotemObject *
 
 
 
+static void
+seek_slider_preview_ready_cb (GObject *source_object, GAsyncResult *result, gpointer user_data)
+{
+	TotemObject *totem = user_data;
+	GdkPixbuf *pixbuf;
+	GError *error = NULL;
+
+	pixbuf = bacon_video_widget_get_preview_finish (totem->bvw, result, &error);
+	if (pixbuf == NULL)
+	{
+		if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			printf("(totem-object/seek_slider_preview_ready_cb) %s\n", error->message);
+		g_error_free (error);
+		return;
+	}
+
+	bitfield_scale_set_preview (BITFIELD_SCALE (totem->seek), pixbuf);
+	g_object_unref (pixbuf);
+}
+
+//the pointer rests on the seek bar (or left it, position is -1), fetch ahead where the user may seek
+//and show what is there, from the pieces we already have
+void
+seek_slider_intent_cb (GtkWidget *widget, gdouble position, TotemObject *totem)
+{
+	if (totem->preview_cancellable)
+	{
+		g_cancellable_cancel (totem->preview_cancellable);
+		g_clear_object (&totem->preview_cancellable);
+	}
+
+	if (position >= 0.0 && bacon_video_widget_can_direct_seek (totem->bvw) == FALSE)
+		return;
+
+	bacon_video_widget_set_seek_intent (totem->bvw, position);
+
+	if (position >= 0.0)
+	{
+		totem->preview_cancellable = g_cancellable_new ();
+		bacon_video_widget_get_preview_async (totem->bvw, position, totem->preview_cancellable,
+						      seek_slider_preview_ready_cb, totem);
+	}
+}
+
+
+
 
 gboolean
 seek_slider_scroll_event_cb (GtkWidget      *widget,
@@ -3169,6 +3405,10 @@ totem_object_handle_key_press (TotemObject *totem, GdkEventKey *event)
 	case GDK_KEY_question:
 		totem_object_show_keyboard_shortcuts (totem);
 		break;
+	case GDK_KEY_L:
+	case GDK_KEY_l:
+		totem_object_ab_loop (totem);
+		break;
 	case GDK_KEY_M:
 	case GDK_KEY_m:
 			totem_object_volume_toggle_mute (totem);
@@ -3581,6 +3821,16 @@ video_widget_create (TotemObject *totem)
 		totem_object_exit (totem);
 	}
 
+	/* let btdemux prefetch where the plain and Shift seek keys land, see totem_object_handle_seek() */
+	{
+		static const gint64 skip_offsets[] = {
+			SEEK_FORWARD_OFFSET * 1000, SEEK_BACKWARD_OFFSET * 1000,
+			SEEK_FORWARD_SHORT_OFFSET * 1000, SEEK_BACKWARD_SHORT_OFFSET * 1000,
+		};
+
+		bacon_video_widget_set_skip_offsets (totem->bvw, skip_offsets, G_N_ELEMENTS (skip_offsets));
+	}
+
 	gtk_drag_dest_set (GTK_WIDGET (totem->bvw), GTK_DEST_DEFAULT_ALL,
 			   target_table, G_N_ELEMENTS (target_table),
 			   GDK_ACTION_MOVE);
@@ -226,6 +226,15 @@ totem_preferences_dialog_constructed (GObject *object)
 	                              (GSettingsBindGetMapping) int_enum_get_mapping, (GSettingsBindSetMapping) int_enum_set_mapping,
 	                              g_type_class_ref (BVW_TYPE_AUDIO_OUTPUT_TYPE), (GDestroyNotify) g_type_class_unref);
 
+	/* Seek snapping to downloaded pieces, thru bvw's property "snap-tolerance" */
+	g_settings_bind (totem->settings, "seek-snap-tolerance", bvw, "snap-tolerance",
+	                 G_SETTINGS_BIND_DEFAULT | G_SETTINGS_BIND_NO_SENSITIVITY);
+
+	/* Background prefetch of the likely seek targets, thru bvw's properties "hotspot-count" and "hotspot-share" */
+	g_settings_bind (totem->settings, "hotspot-count", bvw, "hotspot-count",
+	                 G_SETTINGS_BIND_DEFAULT | G_SETTINGS_BIND_NO_SENSITIVITY);
+	g_settings_bind (totem->settings, "hotspot-share", bvw, "hotspot-share",
+	                 G_SETTINGS_BIND_DEFAULT | G_SETTINGS_BIND_NO_SENSITIVITY);
 
 
 	/* Disable keyboard shortcuts */
@@ -64,6 +64,7 @@ struct _TotemObject {
 	GtkAdjustment *seekadj;
 	gboolean seek_lock;/*a bool can also func as a lock*/
 	gboolean seekable;
+	GCancellable *preview_cancellable;/*thumbnail lookup of the seek bar position the pointer rests on*/
 
 	/* Volume */
 	GtkWidget *volume;
@@ -76,6 +77,7 @@ struct _TotemObject {
 	/* controls management */
 	ControlsVisibility controls_visibility;
 	gboolean reveal_controls;
+	gboolean window_hidden; /* minimized or withdrawn */
 	guint transition_timeout_id;
 	GHashTable *busy_popup_ht; /* key=reason string, value=gboolean */
 
@@ -87,6 +89,8 @@ struct _TotemObject {
 	/* session */
 	gboolean pause_start;
 	guint save_timeout_id;
+	gint64 resume_time; /* ms, where to seek once seekable, -1 for none */
+	gint64 loop_a; /* ms, start of the A-B loop being marked, -1 for none */
 
 	/* Window Configuration */
 	int window_w, window_h;
@@ -45,6 +45,7 @@ gboolean totem_object_can_seek_previous		(TotemObject *totem);
 void	totem_object_seek_previous		(TotemObject *totem);
 void	totem_object_seek_time			(TotemObject *totem, gint64 msec, gboolean accurate);
 void	totem_object_seek_relative		(TotemObject *totem, gint64 offset, gboolean accurate);
+void	totem_object_ab_loop			(TotemObject *totem);
 double	totem_object_get_volume			(TotemObject *totem);
 void	totem_object_set_volume			(TotemObject *totem, double volume);
 